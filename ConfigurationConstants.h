@@ -34,6 +34,113 @@
 #define MAWindowTitle				@"MacAlyzer"
 
 #define MADispatchFIFOSourceQueue	"com.joshuapiccari.MacAlyzer.FIFO"
+#define MAMaxRecordSize				(1 << 24)
+
+#define MAQueuePolicyKey			@"MAQueuePolicy"
+#define MAHelperQueueLength			65536
+#define MAHelperQueueBytes			(64 << 20)
+#define MAAppQueueLength			65536
+#define MAAppQueueBytes				(64 << 20)
+#define MADegradedSnaplen			128
+#define MAMaxBufferedPackets		65536
+
+#define MACaptureBufferSize			(32 << 20)
+#define MACaptureBatchLength		1024
+#define MAFrameInitialSize			(64 << 10)
+#define MAFrameFlushSize			(2 << 20)
+#define MATransportMaxDevices		1024
+#define MAHelperWriteBatch			64
+#define MACaptureFanoutMax			16
+#define MAFanoutWorkersKey			@"MAFanoutWorkers"
+#define MAFanoutMaxSkew				500000000ULL	/* ns */
+
+#define MAPcapngBufferSize			(1 << 20)
+
+#define MAWriteBehindKey			@"MAWriteBehind"
+#define MASpoolDirectoryName		@"Captures"
+#define MASpoolBufferSize			(4 << 20)
+#define MASpoolBuffers				8
+#define MASpoolSyncInterval			1
+#define MASpoolRotateMegabytesKey	@"MASpoolRotateMegabytes"
+#define MASpoolRotateSecondsKey		@"MASpoolRotateSeconds"
+#define MASpoolRotateFilesKey		@"MASpoolRotateFiles"
+#define MASpoolCompressKey			@"MASpoolCompress"
+#define MASpoolDefaultMegabytes		256
+#define MASpoolDefaultFiles			16
+
+#define MABlockStoreBlockSize		(512 << 10)
+#define MABlockStoreInFlight		16
+#define MABlockStoreExtension		".mabk"
+#define MABlockStoreQueueName		"com.joshuapiccari.MacAlyzer.blockstore"
+#define MAArchiveQueueName			"com.joshuapiccari.MacAlyzer.archive"
+
+#define MATriggerFilterKey			@"MATriggerFilter"
+#define MATriggerRstBurstKey		@"MATriggerRstBurst"
+#define MATriggerDropSpikeKey		@"MATriggerDropSpike"
+#define MATriggerWindowKey			@"MATriggerWindow"
+#define MATriggerPostWindowKey		@"MATriggerPostWindow"
+#define MATriggerDirectoryName		@"Triggers"
+#define MATriggerWindow				10		/* seconds */
+#define MATriggerPostWindow			5
+#define MATriggerRingBytes			(64 << 20)
+#define MATriggerRingPackets		(1 << 18)
+
+#define MARecordOnlyKey				@"MARecordOnly"
+#define MARecordSampleIntervalKey	@"MARecordSampleInterval"
+#define MARecordSampleInterval		100		/* ms */
+
+#define MASampleModeKey				@"MASampleMode"		/* count, random, reservoir, flow */
+#define MASampleRateKey				@"MASampleRate"
+#define MASampleReservoirKey		@"MASampleReservoir"
+#define MASampleWindowKey			@"MASampleWindow"
+#define MASampleRate				100		/* 1 in */
+#define MASampleReservoir			256		/* packets per window */
+#define MASampleWindow				1000	/* ms */
+
+#define MAFlowCutPacketsKey			@"MAFlowCutPackets"
+#define MAFlowCutBytesKey			@"MAFlowCutBytes"
+#define MAFlowCutDropKey			@"MAFlowCutDrop"	/* else keep headers */
+#define MAFlowCutTableSize			(1 << 18)	/* flows */
+#define MAFlowCutIdle				120		/* seconds */
+
+#define MADedupModeKey				@"MADedupMode"		/* drop, mark */
+#define MADedupWindowKey			@"MADedupWindow"
+#define MADedupWindow				50		/* ms */
+#define MADedupTableSize			(1 << 18)	/* hashes */
+
+#define MATopKCapacity				256		/* counters per summary */
+#define MATopKWindow				60		/* seconds */
+#define MATopKBuckets				12		/* per window */
+#define MATopKReportRows			10
+
+#define MACardinalitySources		1024	/* per source sketches */
+#define MACardinalityBucket			10		/* seconds */
+#define MACardinalityBuckets		30
+#define MACardinalityReportRows		10
+
+#define MABurstWindowKey			@"MABurstWindow"
+#define MABurstWindow				1000	/* µs, 100 to 1000 */
+#define MABurstLineRateKey			@"MABurstLineRate"
+#define MABurstLineRate				1000	/* Mbit/s */
+#define MABurstFractionKey			@"MABurstFraction"
+#define MABurstFraction				0.8		/* of the line rate */
+#define MABurstHistory				256		/* bursts kept */
+#define MABurstReportRows			10
+
+#define MATCPAnalysisTableSize		(1 << 16)	/* connections */
+#define MATCPAnalysisIdle			300		/* seconds */
+#define MATCPAnalysisReportRows		10
+
+#define MAMemoryBudgetKey			@"MAMemoryBudget"		/* megabytes */
+#define MAMemoryBudget				(256 << 20)
+#define MASpillArenaSize			(8 << 20)
+/* Address space for the spill mapping, there is much less of it in 32-bit. */
+#if __LP64__
+#define MASpillReserve				((size_t)1 << 38)
+#else
+#define MASpillReserve				((size_t)1 << 30)
+#endif
+#define MASpillQueueName			"com.joshuapiccari.MacAlyzer.spill"
 
 #define MAPCAPControllerKey			@"com.joshuapiccari.MacAlyzer.IPC.PCAPController"
 #define MAPCAPHelperKey				@"com.joshuapiccari.MacAlyzer.IPC.PCAPHelper"
@@ -46,6 +153,7 @@
 #define MAPCAPReadyNotificationKey	@"com.joshuapiccari.MacAlyzer.PCAPReadyNotification"
 #define MARecentCapNotificationKey	@"com.joshuapiccari.MacAlyzer.RecentCapNotification"
 #define MANewPacketNotificationKey	@"com.joshuapiccari.MacAlyzer.NewPacketCountNotification"
+#define MACaptureStatsNotificationKey	@"com.joshuapiccari.MacAlyzer.CaptureStatsNotification"
 
 #define MANewPacketCountKey			@"countNewPackets"
 
@@ -66,12 +174,35 @@
 #define	MAPacketViewMinWidth		100
 
 #define MACaptureUpdateInterval		1/2
+#define MACaptureStatsInterval		1.0
 #define MASaveFileUpdateInterval	1/32
 
 #define MACaptureWindowNibName		@"MACapture"
 
+#define MAStatisticsMenuTitle		@"Statistics"
+#define MAPipelineStatisticsTitle	@"Pipeline Latency"
+#define MACaptureStatisticsTitle	@"Capture Drops"
+#define MATrafficStatisticsTitle	@"Traffic Statistics"
+#define MAQueuePolicyMenuTitle		@"Overload Policy"
+#define MAStatisticsWindowWidth		860
+#define MAStatisticsWindowHeight	320
+#define MAStatisticsRefreshInterval	1.0
+#define MAIOGraphTitle				@"IO Graph"
+#define MAIOGraphMaxPoints			4096	/* buckets read per redraw */
+#define MAIOGraphMinSpan			10		/* ms, narrowest zoom */
+
 #define MADocumentTypePCAPDevice	@"PCAP Device"
 #define MADocumentTypePCAPSavefile	@"PCAP Savefile"
+#define MADocumentTypeMerged		@"Merged Capture"
+#define MADocumentTypePcapng		@"pcapng Savefile"
+#define MADocumentTypeBlockStore	@"MacAlyzer Block Store"
+
+#define MAMergeMaxPending			65536
+#define MAMergeMaxSkew				500000000ULL	/* ns */
+#define MAMergeSavefilesTitle		@"Merge Savefiles…"
+#define MAMergeDevicesTitle			@"Merge Active Devices"
+#define MASpoolWindowTitle			@"Open Capture Window…"
+#define MASpoolWindowMinutes		5
 
 #define MAShowSidebarText			@"Show Sidebar"
 #define MAHideSidebarText			@"Hide Sidebar"
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+#import <pcap/pcap.h>
+
+
+/*
+ * Seekable block compressed capture file.
+ *
+ * Packets are gathered into blocks of about MABlockStoreBlockSize, each
+ * a run of nanosecond pcap records compressed on its own, so any packet
+ * can be read back by inflating just the block it is in. Blocks are
+ * compressed on the global concurrent queue and written in order behind
+ * them, with at most MABlockStoreInFlight outstanding. An index of every
+ * block's offset, packet count and time range ends the file; without it
+ * (the writer never closed) the reader walks the block headers instead.
+ *
+ * MA_BLOCKSTORE_LIVE trades size for speed so a capture can be kept up
+ * with, MA_BLOCKSTORE_ARCHIVE the other way round. A block that doesn't
+ * shrink is stored as is.
+ */
+
+typedef enum
+{
+	MA_BLOCKSTORE_LIVE,
+	MA_BLOCKSTORE_ARCHIVE
+} ma_blockstore_mode_t;
+
+typedef struct
+{
+	off_t offset;
+	uint64_t firstPacket;
+	uint32_t packets;
+	uint32_t rawSize;
+	uint32_t storedSize;
+	uint32_t codec;
+	int64_t first;				/* nanoseconds */
+	int64_t last;
+} ma_blockstore_block_t;
+
+typedef struct ma_blockstore_writer ma_blockstore_writer_t;
+typedef struct ma_blockstore_reader ma_blockstore_reader_t;
+
+
+ma_blockstore_writer_t *ma_blockstore_writer_open(const char *path,
+												  ma_blockstore_mode_t mode,
+												  int linkType,
+												  uint32_t snapLen);
+BOOL ma_blockstore_writer_packet(ma_blockstore_writer_t *w,
+								 const struct pcap_pkthdr *hdr,
+								 const u_char *data);
+BOOL ma_blockstore_writer_close(ma_blockstore_writer_t *w);
+
+ma_blockstore_reader_t *ma_blockstore_reader_open(const char *path);
+void ma_blockstore_reader_close(ma_blockstore_reader_t *r);
+NSUInteger ma_blockstore_reader_count(ma_blockstore_reader_t *r);
+int ma_blockstore_reader_link_type(ma_blockstore_reader_t *r);
+uint32_t ma_blockstore_reader_snaplen(ma_blockstore_reader_t *r);
+NSUInteger ma_blockstore_reader_block_count(ma_blockstore_reader_t *r);
+const ma_blockstore_block_t *
+ma_blockstore_reader_block(ma_blockstore_reader_t *r, NSUInteger block);
+BOOL ma_blockstore_reader_packet(ma_blockstore_reader_t *r, NSUInteger index,
+								 struct pcap_pkthdr *hdr,
+								 const u_char **data);
+BOOL ma_blockstore_is_blockstore(const char *path);
+
+BOOL ma_blockstore_compress_savefile(const char *source, const char *path,
+									 ma_blockstore_mode_t mode);
@@ -0,0 +1,779 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import "MABlockStore.h"
+
+#import <fcntl.h>
+#import <libkern/OSByteOrder.h>
+#import <sys/stat.h>
+#import <unistd.h>
+#import <zlib.h>
+
+#import "ConfigurationConstants.h"
+#import "MAFileIO.h"
+#import "MARecord.h"
+
+
+/* Everything on disk is little endian. */
+#define MA_BLOCKSTORE_MAGIC			0x4B42414D	/* "MABK" */
+#define MA_BLOCKSTORE_BLOCK_MAGIC	0x4B4C424D	/* "MBLK" */
+#define MA_BLOCKSTORE_END_MAGIC		0x444E454D	/* "MEND" */
+#define MA_BLOCKSTORE_VERSION		1
+
+#define MA_BLOCKSTORE_STORED		0
+#define MA_BLOCKSTORE_DEFLATE		1
+
+#define MA_BLOCKSTORE_HEADER_SIZE	24	/* magic, version, link, snap, 0 */
+#define MA_BLOCKSTORE_BLOCK_SIZE	40	/* see ma_blockstore_put_block() */
+#define MA_BLOCKSTORE_INDEX_SIZE	48	/* block header and its offset */
+#define MA_BLOCKSTORE_TRAILER_SIZE	24	/* index offset, blocks, magic */
+#define MA_BLOCKSTORE_RECORD_SIZE	16	/* pcap record header */
+
+/* A block being filled, compressed or waiting to be written. */
+typedef struct
+{
+	u_char *raw;
+	size_t used;
+	size_t size;
+	uint32_t packets;
+	int64_t first;
+	int64_t last;
+	
+	u_char *stored;				/* NULL when stored as is */
+	size_t storedSize;
+	dispatch_semaphore_t done;
+} ma_blockstore_pending_t;
+
+struct ma_blockstore_writer
+{
+	int fd;
+	int level;
+	ma_blockstore_pending_t *fill;
+	dispatch_queue_t queue;		/* writes blocks in order */
+	dispatch_semaphore_t slots;	/* blocks in flight */
+	
+	/* Owned by queue. */
+	off_t offset;
+	ma_blockstore_block_t *index;
+	NSUInteger count;
+	NSUInteger capacity;
+	BOOL failed;
+};
+
+struct ma_blockstore_reader
+{
+	int fd;
+	int linkType;
+	uint32_t snapLen;
+	
+	ma_blockstore_block_t *blocks;
+	NSUInteger blockCount;
+	NSUInteger blockCapacity;
+	NSUInteger count;
+	
+	/* The block last inflated and where each of its records starts. */
+	NSInteger cached;
+	u_char *raw;
+	size_t rawSize;
+	u_char *stored;
+	size_t storedSize;
+	uint32_t *records;
+	NSUInteger recordCapacity;
+};
+
+
+#pragma mark - Encoding
+
+static inline void
+ma_blockstore_put32(u_char *p, uint32_t value)
+{
+	OSWriteLittleInt32(p, 0, value);
+}
+
+static inline void
+ma_blockstore_put64(u_char *p, uint64_t value)
+{
+	OSWriteLittleInt64(p, 0, value);
+}
+
+static inline uint32_t
+ma_blockstore_get32(const u_char *p)
+{
+	return OSReadLittleInt32(p, 0);
+}
+
+static inline uint64_t
+ma_blockstore_get64(const u_char *p)
+{
+	return OSReadLittleInt64(p, 0);
+}
+
+static void
+ma_blockstore_put_block(u_char *p, const ma_blockstore_block_t *block)
+{
+	ma_blockstore_put32(p, MA_BLOCKSTORE_BLOCK_MAGIC);
+	ma_blockstore_put32(p+4, block->codec);
+	ma_blockstore_put32(p+8, block->rawSize);
+	ma_blockstore_put32(p+12, block->storedSize);
+	ma_blockstore_put32(p+16, block->packets);
+	ma_blockstore_put32(p+20, 0);
+	ma_blockstore_put64(p+24, (uint64_t)block->first);
+	ma_blockstore_put64(p+32, (uint64_t)block->last);
+}
+
+static BOOL
+ma_blockstore_get_block(const u_char *p, ma_blockstore_block_t *block)
+{
+	if(ma_blockstore_get32(p) != MA_BLOCKSTORE_BLOCK_MAGIC)
+		return NO;
+	
+	block->codec = ma_blockstore_get32(p+4);
+	block->rawSize = ma_blockstore_get32(p+8);
+	block->storedSize = ma_blockstore_get32(p+12);
+	block->packets = ma_blockstore_get32(p+16);
+	block->first = (int64_t)ma_blockstore_get64(p+24);
+	block->last = (int64_t)ma_blockstore_get64(p+32);
+	
+	return (block->codec == MA_BLOCKSTORE_STORED ||
+			block->codec == MA_BLOCKSTORE_DEFLATE);
+}
+
+
+#pragma mark - Writer
+
+static void
+ma_blockstore_pending_free(ma_blockstore_pending_t *p)
+{
+	if(p->done)
+		dispatch_release(p->done);
+	free(p->stored);
+	free(p->raw);
+	free(p);
+}
+
+/* A new block to fill, waiting for one to be written if need be. */
+static ma_blockstore_pending_t *
+ma_blockstore_pending_new(ma_blockstore_writer_t *w, size_t size)
+{
+	ma_blockstore_pending_t *p;
+	
+	dispatch_semaphore_wait(w->slots, DISPATCH_TIME_FOREVER);
+	if(!(p = calloc(1, sizeof(*p))) || !(p->raw = malloc(size)))
+	{
+		free(p);
+		dispatch_semaphore_signal(w->slots);
+		return NULL;
+	}
+	p->size = size;
+	
+	return p;
+}
+
+/* Keep the deflated copy only if it is actually smaller. */
+static void
+ma_blockstore_deflate(ma_blockstore_pending_t *p, int level)
+{
+	uLongf size = compressBound(p->used);
+	
+	if(!(p->stored = malloc(size)))
+		return;
+	
+	if(compress2(p->stored, &size, p->raw, p->used, level) != Z_OK ||
+	   size >= p->used)
+	{
+		free(p->stored);
+		p->stored = NULL;
+		return;
+	}
+	
+	p->storedSize = size;
+}
+
+/* On the writer's queue, once the block is compressed. */
+static void
+ma_blockstore_write_block(ma_blockstore_writer_t *w,
+						  ma_blockstore_pending_t *p)
+{
+	u_char header[MA_BLOCKSTORE_BLOCK_SIZE];
+	ma_blockstore_block_t block;
+	
+	if(w->failed)
+		return;
+	
+	if(w->count == w->capacity)
+	{
+		NSUInteger capacity = (w->capacity ? w->capacity*2 : 256);
+		ma_blockstore_block_t *index;
+		
+		if(!(index = realloc(w->index, capacity*sizeof(*index))))
+		{
+			w->failed = YES;
+			return;
+		}
+		w->index = index;
+		w->capacity = capacity;
+	}
+	
+	block.offset = w->offset;
+	block.packets = p->packets;
+	block.rawSize = (uint32_t)p->used;
+	block.storedSize = (uint32_t)(p->stored ? p->storedSize : p->used);
+	block.codec = (p->stored ? MA_BLOCKSTORE_DEFLATE : MA_BLOCKSTORE_STORED);
+	block.first = p->first;
+	block.last = p->last;
+	ma_blockstore_put_block(header, &block);
+	
+	if(!ma_write_all(w->fd, header, sizeof(header)) ||
+	   !ma_write_all(w->fd, (p->stored ? p->stored : p->raw),
+					 block.storedSize))
+	{
+		NSLog(@"%s(): %s", __func__, strerror(errno));
+		w->failed = YES;
+		return;
+	}
+	
+	w->index[w->count++] = block;
+	w->offset += sizeof(header)+block.storedSize;
+}
+
+/* Compress the fill block on the worker pool and queue it for writing. */
+static void
+ma_blockstore_submit(ma_blockstore_writer_t *w)
+{
+	ma_blockstore_pending_t *p = w->fill;
+	int level = w->level;
+	
+	w->fill = NULL;
+	if(p == NULL)
+		return;
+	
+	if(p->packets == 0)
+	{
+		ma_blockstore_pending_free(p);
+		dispatch_semaphore_signal(w->slots);
+		return;
+	}
+	
+	p->done = dispatch_semaphore_create(0);
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+		ma_blockstore_deflate(p, level);
+		dispatch_semaphore_signal(p->done);
+	});
+	
+	dispatch_async(w->queue, ^{
+		dispatch_semaphore_wait(p->done, DISPATCH_TIME_FOREVER);
+		ma_blockstore_write_block(w, p);
+		ma_blockstore_pending_free(p);
+		dispatch_semaphore_signal(w->slots);
+	});
+}
+
+ma_blockstore_writer_t *
+ma_blockstore_writer_open(const char *path, ma_blockstore_mode_t mode,
+						  int linkType, uint32_t snapLen)
+{
+	u_char header[MA_BLOCKSTORE_HEADER_SIZE];
+	ma_blockstore_writer_t *w;
+	
+	if(!(w = calloc(1, sizeof(*w))))
+		return NULL;
+	
+	if((w->fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644)) == -1)
+	{
+		free(w);
+		return NULL;
+	}
+	ma_file_own(w->fd);
+	
+	ma_blockstore_put32(header, MA_BLOCKSTORE_MAGIC);
+	ma_blockstore_put32(header+4, MA_BLOCKSTORE_VERSION);
+	ma_blockstore_put32(header+8, (uint32_t)linkType);
+	ma_blockstore_put32(header+12, snapLen);
+	ma_blockstore_put64(header+16, 0);
+	if(!ma_write_all(w->fd, header, sizeof(header)))
+	{
+		close(w->fd);
+		free(w);
+		return NULL;
+	}
+	
+	w->offset = sizeof(header);
+	w->level = (mode == MA_BLOCKSTORE_ARCHIVE ?
+				Z_BEST_COMPRESSION : Z_BEST_SPEED);
+	w->queue = dispatch_queue_create(MABlockStoreQueueName, NULL);
+	w->slots = dispatch_semaphore_create(MABlockStoreInFlight);
+	
+	return w;
+}
+
+/*
+ * Append one packet, hdr carries nanoseconds. Blocks while
+ * MABlockStoreInFlight blocks are waiting on the disk.
+ */
+BOOL
+ma_blockstore_writer_packet(ma_blockstore_writer_t *w,
+							const struct pcap_pkthdr *hdr,
+							const u_char *data)
+{
+	size_t len = MA_BLOCKSTORE_RECORD_SIZE+hdr->caplen;
+	int64_t ts = ma_pkthdr_ns(hdr);
+	u_char *rec;
+	
+	if(w->fill && w->fill->used+len > w->fill->size)
+		ma_blockstore_submit(w);
+	
+	/* A packet bigger than a block gets a block of its own. */
+	if(w->fill == NULL &&
+	   !(w->fill = ma_blockstore_pending_new(w, MAX(len, MABlockStoreBlockSize))))
+		return NO;
+	
+	rec = w->fill->raw+w->fill->used;
+	ma_blockstore_put32(rec, (uint32_t)hdr->ts.tv_sec);
+	ma_blockstore_put32(rec+4, (uint32_t)hdr->ts.tv_usec);
+	ma_blockstore_put32(rec+8, hdr->caplen);
+	ma_blockstore_put32(rec+12, hdr->len);
+	memcpy(rec+MA_BLOCKSTORE_RECORD_SIZE, data, hdr->caplen);
+	w->fill->used += len;
+	
+	if(w->fill->packets++ == 0)
+		w->fill->first = ts;
+	w->fill->last = ts;
+	
+	return YES;
+}
+
+/* Write out the last block and the index. Returns NO if anything was lost. */
+BOOL
+ma_blockstore_writer_close(ma_blockstore_writer_t *w)
+{
+	u_char entry[MA_BLOCKSTORE_INDEX_SIZE];
+	u_char trailer[MA_BLOCKSTORE_TRAILER_SIZE];
+	off_t indexOffset;
+	NSUInteger i;
+	BOOL ok;
+	
+	if(w == NULL)
+		return NO;
+	
+	ma_blockstore_submit(w);
+	dispatch_sync(w->queue, ^{});
+	
+	/* Nothing is in flight any more, the queue's state is ours. */
+	ok = !w->failed;
+	indexOffset = w->offset;
+	for(i = 0; ok && i < w->count; i++)
+	{
+		ma_blockstore_put_block(entry, &w->index[i]);
+		ma_blockstore_put64(entry+MA_BLOCKSTORE_BLOCK_SIZE,
+							(uint64_t)w->index[i].offset);
+		ok = ma_write_all(w->fd, entry, sizeof(entry));
+	}
+	
+	ma_blockstore_put64(trailer, (uint64_t)indexOffset);
+	ma_blockstore_put64(trailer+8, w->count);
+	ma_blockstore_put32(trailer+16, MA_BLOCKSTORE_END_MAGIC);
+	ma_blockstore_put32(trailer+20, MA_BLOCKSTORE_VERSION);
+	if(ok)
+		ok = ma_write_all(w->fd, trailer, sizeof(trailer));
+	
+	if(close(w->fd) == -1)
+		ok = NO;
+	
+	dispatch_release(w->slots);
+	dispatch_release(w->queue);
+	free(w->index);
+	free(w);
+	
+	return ok;
+}
+
+
+#pragma mark - Reader
+
+static BOOL
+ma_blockstore_add_block(ma_blockstore_reader_t *r, ma_blockstore_block_t *block)
+{
+	if(r->blockCount == r->blockCapacity)
+	{
+		NSUInteger capacity = (r->blockCapacity ? r->blockCapacity*2 : 256);
+		ma_blockstore_block_t *blocks;
+		
+		if(!(blocks = realloc(r->blocks, capacity*sizeof(*blocks))))
+			return NO;
+		r->blocks = blocks;
+		r->blockCapacity = capacity;
+	}
+	
+	block->firstPacket = r->count;
+	r->blocks[r->blockCount++] = *block;
+	r->count += block->packets;
+	
+	return YES;
+}
+
+/* Take the index from the end of the file. NO if it isn't there. */
+static BOOL
+ma_blockstore_read_index(ma_blockstore_reader_t *r, off_t size)
+{
+	u_char trailer[MA_BLOCKSTORE_TRAILER_SIZE];
+	u_char *index;
+	off_t indexOffset;
+	uint64_t count;
+	uint64_t i;
+	
+	if(size < MA_BLOCKSTORE_HEADER_SIZE+MA_BLOCKSTORE_TRAILER_SIZE ||
+	   !ma_pread_all(r->fd, trailer, sizeof(trailer), size-sizeof(trailer)) ||
+	   ma_blockstore_get32(trailer+16) != MA_BLOCKSTORE_END_MAGIC)
+		return NO;
+	
+	/* A count the file can't hold would overflow the size check. */
+	indexOffset = (off_t)ma_blockstore_get64(trailer);
+	count = ma_blockstore_get64(trailer+8);
+	if(count > (uint64_t)(size-MA_BLOCKSTORE_HEADER_SIZE-sizeof(trailer))/
+	   MA_BLOCKSTORE_INDEX_SIZE ||
+	   indexOffset < MA_BLOCKSTORE_HEADER_SIZE ||
+	   indexOffset+count*MA_BLOCKSTORE_INDEX_SIZE+sizeof(trailer) != (uint64_t)size)
+		return NO;
+	
+	if(!(index = malloc(count ? count*MA_BLOCKSTORE_INDEX_SIZE : 1)))
+		return NO;
+	
+	if(!ma_pread_all(r->fd, index, count*MA_BLOCKSTORE_INDEX_SIZE,
+					 indexOffset))
+	{
+		free(index);
+		return NO;
+	}
+	
+	for(i = 0; i < count; i++)
+	{
+		const u_char *entry = index+i*MA_BLOCKSTORE_INDEX_SIZE;
+		ma_blockstore_block_t block;
+		
+		if(!ma_blockstore_get_block(entry, &block))
+			break;
+		
+		block.offset = (off_t)ma_blockstore_get64(entry+MA_BLOCKSTORE_BLOCK_SIZE);
+		if(block.offset+MA_BLOCKSTORE_BLOCK_SIZE+block.storedSize > indexOffset ||
+		   !ma_blockstore_add_block(r, &block))
+			break;
+	}
+	free(index);
+	
+	if(i < count)
+	{
+		r->blockCount = 0;
+		r->count = 0;
+		return NO;
+	}
+	
+	return YES;
+}
+
+/* No index, the writer never finished. Walk the blocks that made it. */
+static void
+ma_blockstore_scan(ma_blockstore_reader_t *r, off_t size)
+{
+	u_char header[MA_BLOCKSTORE_BLOCK_SIZE];
+	ma_blockstore_block_t block;
+	off_t offset = MA_BLOCKSTORE_HEADER_SIZE;
+	
+	while(offset+MA_BLOCKSTORE_BLOCK_SIZE <= size &&
+		  ma_pread_all(r->fd, header, sizeof(header), offset) &&
+		  ma_blockstore_get_block(header, &block))
+	{
+		block.offset = offset;
+		if(offset+MA_BLOCKSTORE_BLOCK_SIZE+block.storedSize > size ||
+		   !ma_blockstore_add_block(r, &block))
+			break;
+		
+		offset += MA_BLOCKSTORE_BLOCK_SIZE+block.storedSize;
+	}
+}
+
+ma_blockstore_reader_t *
+ma_blockstore_reader_open(const char *path)
+{
+	u_char header[MA_BLOCKSTORE_HEADER_SIZE];
+	ma_blockstore_reader_t *r;
+	struct stat st;
+	
+	if(!(r = calloc(1, sizeof(*r))))
+		return NULL;
+	
+	r->cached = -1;
+	if((r->fd = open(path, O_RDONLY)) == -1)
+	{
+		free(r);
+		return NULL;
+	}
+	
+	if(fstat(r->fd, &st) == -1 ||
+	   !ma_pread_all(r->fd, header, sizeof(header), 0) ||
+	   ma_blockstore_get32(header) != MA_BLOCKSTORE_MAGIC ||
+	   ma_blockstore_get32(header+4) != MA_BLOCKSTORE_VERSION)
+	{
+		ma_blockstore_reader_close(r);
+		return NULL;
+	}
+	
+	r->linkType = (int)ma_blockstore_get32(header+8);
+	r->snapLen = ma_blockstore_get32(header+12);
+	
+	if(!ma_blockstore_read_index(r, st.st_size))
+		ma_blockstore_scan(r, st.st_size);
+	
+	return r;
+}
+
+void
+ma_blockstore_reader_close(ma_blockstore_reader_t *r)
+{
+	if(r == NULL)
+		return;
+	
+	if(r->fd != -1)
+		close(r->fd);
+	free(r->records);
+	free(r->stored);
+	free(r->raw);
+	free(r->blocks);
+	free(r);
+}
+
+NSUInteger
+ma_blockstore_reader_count(ma_blockstore_reader_t *r)
+{
+	return r->count;
+}
+
+int
+ma_blockstore_reader_link_type(ma_blockstore_reader_t *r)
+{
+	return r->linkType;
+}
+
+uint32_t
+ma_blockstore_reader_snaplen(ma_blockstore_reader_t *r)
+{
+	return r->snapLen;
+}
+
+NSUInteger
+ma_blockstore_reader_block_count(ma_blockstore_reader_t *r)
+{
+	return r->blockCount;
+}
+
+const ma_blockstore_block_t *
+ma_blockstore_reader_block(ma_blockstore_reader_t *r, NSUInteger block)
+{
+	return (block < r->blockCount ? &r->blocks[block] : NULL);
+}
+
+static BOOL
+ma_blockstore_reserve(u_char **buf, size_t *size, size_t needed)
+{
+	u_char *p;
+	
+	if(needed <= *size)
+		return YES;
+	
+	if(!(p = realloc(*buf, needed)))
+		return NO;
+	*buf = p;
+	*size = needed;
+	
+	return YES;
+}
+
+/* Read and inflate a block and find where its records start. */
+static BOOL
+ma_blockstore_load(ma_blockstore_reader_t *r, NSUInteger index)
+{
+	const ma_blockstore_block_t *block = &r->blocks[index];
+	off_t offset = block->offset+MA_BLOCKSTORE_BLOCK_SIZE;
+	size_t pos = 0;
+	uint32_t i;
+	
+	if(r->cached == (NSInteger)index)
+		return YES;
+	r->cached = -1;
+	
+	if(!ma_blockstore_reserve(&r->raw, &r->rawSize, block->rawSize))
+		return NO;
+	
+	if(block->codec == MA_BLOCKSTORE_STORED)
+	{
+		if(block->storedSize != block->rawSize ||
+		   !ma_pread_all(r->fd, r->raw, block->rawSize, offset))
+			return NO;
+	}
+	else
+	{
+		uLongf size = block->rawSize;
+		
+		if(!ma_blockstore_reserve(&r->stored, &r->storedSize,
+								  block->storedSize) ||
+		   !ma_pread_all(r->fd, r->stored, block->storedSize, offset) ||
+		   uncompress(r->raw, &size, r->stored, block->storedSize) != Z_OK ||
+		   size != block->rawSize)
+			return NO;
+	}
+	
+	if(block->packets > r->recordCapacity)
+	{
+		uint32_t *records;
+		
+		if(!(records = realloc(r->records, block->packets*sizeof(*records))))
+			return NO;
+		r->records = records;
+		r->recordCapacity = block->packets;
+	}
+	
+	for(i = 0; i < block->packets; i++)
+	{
+		if(pos+MA_BLOCKSTORE_RECORD_SIZE > block->rawSize ||
+		   pos+MA_BLOCKSTORE_RECORD_SIZE+ma_blockstore_get32(r->raw+pos+8) >
+		   block->rawSize)
+			return NO;
+		
+		r->records[i] = (uint32_t)pos;
+		pos += MA_BLOCKSTORE_RECORD_SIZE+ma_blockstore_get32(r->raw+pos+8);
+	}
+	
+	r->cached = index;
+	return YES;
+}
+
+/*
+ * Packet at index, hdr in nanoseconds. data stays valid until the next
+ * call; reading in order inflates each block once.
+ */
+BOOL
+ma_blockstore_reader_packet(ma_blockstore_reader_t *r, NSUInteger index,
+							struct pcap_pkthdr *hdr, const u_char **data)
+{
+	NSUInteger low = 0;
+	NSUInteger high = r->blockCount;
+	const u_char *rec;
+	
+	if(index >= r->count)
+		return NO;
+	
+	/* Last block starting at or before index. */
+	while(high-low > 1)
+	{
+		NSUInteger mid = low+(high-low)/2;
+		
+		if(r->blocks[mid].firstPacket <= index)
+			low = mid;
+		else
+			high = mid;
+	}
+	
+	if(!ma_blockstore_load(r, low))
+		return NO;
+	
+	rec = r->raw+r->records[index-r->blocks[low].firstPacket];
+	hdr->ts.tv_sec = ma_blockstore_get32(rec);
+	hdr->ts.tv_usec = ma_blockstore_get32(rec+4);
+	hdr->caplen = ma_blockstore_get32(rec+8);
+	hdr->len = ma_blockstore_get32(rec+12);
+	*data = rec+MA_BLOCKSTORE_RECORD_SIZE;
+	
+	return YES;
+}
+
+BOOL
+ma_blockstore_is_blockstore(const char *path)
+{
+	u_char magic[4];
+	int fd;
+	BOOL isBlockStore;
+	
+	if((fd = open(path, O_RDONLY)) == -1)
+		return NO;
+	
+	isBlockStore = (ma_pread_all(fd, magic, sizeof(magic), 0) &&
+					ma_blockstore_get32(magic) == MA_BLOCKSTORE_MAGIC);
+	close(fd);
+	
+	return isBlockStore;
+}
+
+
+#pragma mark - Conversion
+
+/* Compress a pcap savefile into a new block store at path. */
+BOOL
+ma_blockstore_compress_savefile(const char *source, const char *path,
+								ma_blockstore_mode_t mode)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+	ma_blockstore_writer_t *w;
+	struct pcap_pkthdr *hdr;
+	const u_char *data;
+	pcap_t *session;
+	int result;
+	BOOL ok = YES;
+	
+	if(!(session = pcap_open_offline_with_tstamp_precision(source,
+							PCAP_TSTAMP_PRECISION_NANO, errbuf)))
+	{
+		NSLog(@"%s(): %s", __func__, errbuf);
+		return NO;
+	}
+	
+	if(!(w = ma_blockstore_writer_open(path, mode, pcap_datalink(session),
+									   (uint32_t)pcap_snapshot(session))))
+	{
+		pcap_close(session);
+		return NO;
+	}
+	
+	while(ok && (result = pcap_next_ex(session, &hdr, &data)) == 1)
+		ok = ma_blockstore_writer_packet(w, hdr, data);
+	
+	/* A savefile cut short still gets everything up to the cut. */
+	if(ok && result == -1)
+		NSLog(@"%s(): %s: %s", __func__, source, pcap_geterr(session));
+	
+	if(!ma_blockstore_writer_close(w))
+		ok = NO;
+	pcap_close(session);
+	
+	if(!ok)
+		unlink(path);
+	
+	return ok;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#import <Foundation/Foundation.h>
+#import <pcap/pcap.h>
+
+#import "MAFlow.h"
+
+
+/*
+ * Microbursts: stretches of packet time where the bytes seen in a short
+ * sliding window, 100 µs to 1 ms, are more than a fraction of what the
+ * line could carry in it.
+ *
+ * The window is MA_BURST_SLOTS slots of packet time, each holding the
+ * packets and wire bytes that arrived in it, so it slides a slot at a
+ * time in constant memory whatever the rate. A burst is detected when
+ * the window goes over the threshold and over once it is back under.
+ * It is reported from the first of the run of slots over the threshold
+ * on their own that set it off to the end of the last such slot, so
+ * its length is within a slot of the real one. While a burst lasts its
+ * flows are ranked by bytes with a small space-saving summary, an
+ * entry's bytes being overstated by at most its error.
+ *
+ * The last bursts are kept in a ring of fixed size, along with totals
+ * for the whole capture. Detectors fed different savefiles on different
+ * threads merge into one. It is safe to feed from several threads,
+ * packets are expected about in time order; older ones count in the
+ * newest slot.
+ */
+
+#define MA_BURST_SLOTS			16
+#define MA_BURST_FLOWS			8		/* flows attributed per burst */
+
+typedef struct
+{
+	u_char key[MA_FLOW_KEY_SIZE];
+	size_t keyLen;
+	uint64_t hash;
+	uint64_t bytes;
+	uint64_t error;				/* bytes may be overstated by this much */
+} ma_burst_flow_t;
+
+typedef struct
+{
+	int64_t start;				/* ns */
+	int64_t end;
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t peakBytes;			/* most in one window */
+	NSUInteger flowCount;
+	ma_burst_flow_t flows[MA_BURST_FLOWS];
+} ma_burst_interval_t;
+
+typedef struct ma_burst ma_burst_t;
+
+
+ma_burst_t *ma_burst_create(int64_t window, uint64_t lineRate, double fraction,
+							NSUInteger history);
+void ma_burst_destroy(ma_burst_t *b);
+BOOL ma_burst_packet(ma_burst_t *b, int linkType, const struct pcap_pkthdr *hdr,
+					 const u_char *data, uint32_t weight);
+void ma_burst_finish(ma_burst_t *b);
+BOOL ma_burst_merge(ma_burst_t *dst, ma_burst_t *src);
+
+NSUInteger ma_burst_recent(ma_burst_t *b, ma_burst_interval_t *bursts,
+						   NSUInteger n);
+NSString *ma_burst_report(ma_burst_t *b, NSUInteger rows);
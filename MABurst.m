@@ -0,0 +1,453 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#import "MABurst.h"
+
+#import <pthread.h>
+#import <time.h>
+
+#import "MARecord.h"
+
+
+struct ma_burst
+{
+	pthread_mutex_t lock;
+	int64_t window;				/* ns */
+	int64_t slotWidth;
+	uint64_t lineRate;			/* bits per second */
+	double fraction;
+	uint64_t threshold;			/* bytes in a window */
+	
+	/* The sliding window, slot epoch % MA_BURST_SLOTS. */
+	BOOL started;
+	int64_t epoch;				/* packet time / slot width of the newest */
+	uint64_t slotBytes[MA_BURST_SLOTS];
+	uint64_t slotPackets[MA_BURST_SLOTS];
+	uint64_t bytes;				/* in the whole window */
+	uint64_t packets;
+	
+	BOOL bursting;
+	ma_burst_interval_t current;
+	
+	ma_burst_interval_t *history;	/* ring, oldest at next once full */
+	NSUInteger historySize;
+	NSUInteger historyCount;
+	NSUInteger next;
+	
+	/* Whole capture */
+	uint64_t bursts;
+	int64_t burstTime;
+	uint64_t burstBytes;
+	int64_t longest;
+	uint64_t peakBytes;
+};
+
+
+ma_burst_t *
+ma_burst_create(int64_t window, uint64_t lineRate, double fraction,
+				NSUInteger history)
+{
+	ma_burst_t *b;
+	
+	if(window < MA_BURST_SLOTS || lineRate == 0 || fraction <= 0.0 ||
+	   history == 0)
+		return NULL;
+	
+	if(!(b = calloc(1, sizeof(*b))))
+		return NULL;
+	
+	if(!(b->history = calloc(history, sizeof(*b->history))))
+	{
+		free(b);
+		return NULL;
+	}
+	
+	pthread_mutex_init(&b->lock, NULL);
+	b->window = window;
+	b->slotWidth = window/MA_BURST_SLOTS;
+	b->lineRate = lineRate;
+	b->fraction = fraction;
+	b->threshold = (uint64_t)(fraction*lineRate/8*window/MA_NSEC_PER_SEC);
+	b->historySize = history;
+	
+	return b;
+}
+
+void
+ma_burst_destroy(ma_burst_t *b)
+{
+	if(b == NULL)
+		return;
+	
+	pthread_mutex_destroy(&b->lock);
+	free(b->history);
+	free(b);
+}
+
+#pragma mark - Detection
+
+/* end is when the window went back under, used if no slot was over alone. */
+static void
+ma_burst_close(ma_burst_t *b, int64_t end)
+{
+	ma_burst_interval_t *c = &b->current;
+	
+	if(c->end <= c->start)
+		c->end = end;
+	b->bursting = NO;
+	
+	b->bursts++;
+	b->burstTime += c->end-c->start;
+	b->burstBytes += c->bytes;
+	b->longest = MAX(b->longest, c->end-c->start);
+	b->peakBytes = MAX(b->peakBytes, c->peakBytes);
+	
+	b->history[b->next] = *c;
+	b->next = (b->next+1) % b->historySize;
+	b->historyCount = MIN(b->historyCount+1, b->historySize);
+}
+
+/*
+ * Slides the window up to slot epoch, a slot at a time while a burst
+ * may end in it. Once the window is empty it jumps the rest of the way.
+ */
+static void
+ma_burst_advance(ma_burst_t *b, int64_t epoch)
+{
+	NSUInteger i;
+	
+	while(b->epoch < epoch)
+	{
+		if(b->bytes == 0 && b->packets == 0 && !b->bursting)
+		{
+			b->epoch = epoch;
+			break;
+		}
+		
+		b->epoch++;
+		i = (NSUInteger)(b->epoch % MA_BURST_SLOTS);
+		b->bytes -= b->slotBytes[i];
+		b->packets -= b->slotPackets[i];
+		b->slotBytes[i] = 0;
+		b->slotPackets[i] = 0;
+		
+		if(b->bursting && b->bytes <= b->threshold)
+			ma_burst_close(b, b->epoch*b->slotWidth);
+	}
+}
+
+/*
+ * Opens a burst at the first slot of the latest run of slots over the
+ * threshold on their own, with the packets and bytes since. With the
+ * whole window over, at least one slot is.
+ */
+static void
+ma_burst_open(ma_burst_t *b)
+{
+	ma_burst_interval_t *c = &b->current;
+	uint64_t bytes = 0, packets = 0;
+	NSUInteger k, slot;
+	BOOL over = NO;
+	
+	memset(c, 0, sizeof(*c));
+	for(k = 0; k < MA_BURST_SLOTS && b->epoch >= (int64_t)k; k++)
+	{
+		slot = (NSUInteger)((b->epoch-(int64_t)k) % MA_BURST_SLOTS);
+		bytes += b->slotBytes[slot];
+		packets += b->slotPackets[slot];
+		
+		if(b->slotBytes[slot]*MA_BURST_SLOTS > b->threshold)
+		{
+			c->start = (b->epoch-(int64_t)k)*b->slotWidth;
+			c->bytes = bytes;
+			c->packets = packets;
+			over = YES;
+		}
+		else if(over)
+			break;
+	}
+	c->peakBytes = b->bytes;
+	b->bursting = YES;
+}
+
+/* Space saving over a handful of counters, a scan is all it needs. */
+static void
+ma_burst_attribute(ma_burst_interval_t *c, const ma_flow_t *flow,
+				   uint64_t bytes)
+{
+	ma_burst_flow_t *f, *least = NULL;
+	NSUInteger i;
+	
+	for(i = 0; i < c->flowCount; i++)
+	{
+		f = &c->flows[i];
+		if(f->hash == flow->hash && f->keyLen == flow->keyLen &&
+		   memcmp(f->key, flow->key, flow->keyLen) == 0)
+		{
+			f->bytes += bytes;
+			return;
+		}
+		
+		if(least == NULL || f->bytes < least->bytes)
+			least = f;
+	}
+	
+	if(c->flowCount < MA_BURST_FLOWS)
+	{
+		f = &c->flows[c->flowCount++];
+		f->error = 0;
+		f->bytes = bytes;
+	}
+	else
+	{
+		f = least;
+		f->error = f->bytes;
+		f->bytes += bytes;
+	}
+	
+	memcpy(f->key, flow->key, flow->keyLen);
+	f->keyLen = flow->keyLen;
+	f->hash = flow->hash;
+}
+
+BOOL
+ma_burst_packet(ma_burst_t *b, int linkType, const struct pcap_pkthdr *hdr,
+				const u_char *data, uint32_t weight)
+{
+	ma_burst_interval_t *c = &b->current;
+	ma_flow_t flow;
+	int64_t epoch = ma_pkthdr_ns(hdr)/b->slotWidth;
+	uint64_t bytes = (uint64_t)weight*hdr->len;
+	NSUInteger i;
+	
+	if(weight == 0)
+		return NO;
+	
+	pthread_mutex_lock(&b->lock);
+	if(!b->started)
+	{
+		b->epoch = epoch;
+		b->started = YES;
+	}
+	ma_burst_advance(b, epoch);
+	
+	i = (NSUInteger)(b->epoch % MA_BURST_SLOTS);
+	b->slotBytes[i] += bytes;
+	b->slotPackets[i] += weight;
+	b->bytes += bytes;
+	b->packets += weight;
+	
+	if(b->bursting)
+	{
+		c->packets += weight;
+		c->bytes += bytes;
+		c->peakBytes = MAX(c->peakBytes, b->bytes);
+	}
+	else if(b->bytes > b->threshold)
+		ma_burst_open(b);
+	
+	/* It lasts to the end of the last slot over the threshold alone. */
+	if(b->bursting && b->slotBytes[i]*MA_BURST_SLOTS > b->threshold)
+		c->end = (b->epoch+1)*b->slotWidth;
+	
+	/* Only packets in a burst are looked at any further. */
+	if(b->bursting && ma_flow_parse(linkType, hdr, data, &flow))
+		ma_burst_attribute(c, &flow, bytes);
+	pthread_mutex_unlock(&b->lock);
+	
+	return YES;
+}
+
+/* Closes a burst still going at the last packet, the end of a savefile. */
+void
+ma_burst_finish(ma_burst_t *b)
+{
+	pthread_mutex_lock(&b->lock);
+	if(b->bursting)
+		ma_burst_close(b, (b->epoch+1)*b->slotWidth);
+	pthread_mutex_unlock(&b->lock);
+}
+
+#pragma mark - Results
+
+static int
+ma_burst_compare_start(const void *a, const void *b)
+{
+	int64_t x = ((const ma_burst_interval_t *)a)->start;
+	int64_t y = ((const ma_burst_interval_t *)b)->start;
+	
+	return (x > y) - (x < y);
+}
+
+/*
+ * Adds the finished bursts of src, from another savefile or worker, to
+ * dst. The history keeps the latest of both by start time.
+ */
+BOOL
+ma_burst_merge(ma_burst_t *dst, ma_burst_t *src)
+{
+	ma_burst_interval_t *all = NULL;
+	NSUInteger count, keep, i;
+	
+	if(dst == src || dst->window != src->window ||
+	   dst->threshold != src->threshold)
+		return NO;
+	
+	pthread_mutex_lock(&src->lock);
+	pthread_mutex_lock(&dst->lock);
+	
+	count = dst->historyCount+src->historyCount;
+	if(src->historyCount && !(all = malloc(count*sizeof(*all))))
+	{
+		pthread_mutex_unlock(&dst->lock);
+		pthread_mutex_unlock(&src->lock);
+		return NO;
+	}
+	
+	if(src->historyCount)
+	{
+		memcpy(all, dst->history, dst->historyCount*sizeof(*all));
+		memcpy(all+dst->historyCount, src->history,
+			   src->historyCount*sizeof(*all));
+		qsort(all, count, sizeof(*all), ma_burst_compare_start);
+		
+		keep = MIN(count, dst->historySize);
+		for(i = 0; i < keep; i++)
+			dst->history[i] = all[count-keep+i];
+		dst->historyCount = keep;
+		dst->next = keep % dst->historySize;
+		free(all);
+	}
+	
+	dst->bursts += src->bursts;
+	dst->burstTime += src->burstTime;
+	dst->burstBytes += src->burstBytes;
+	dst->longest = MAX(dst->longest, src->longest);
+	dst->peakBytes = MAX(dst->peakBytes, src->peakBytes);
+	
+	pthread_mutex_unlock(&dst->lock);
+	pthread_mutex_unlock(&src->lock);
+	
+	return YES;
+}
+
+/*
+ * Copies up to n of the latest bursts, newest first, a burst still
+ * going included. Returns how many were copied.
+ */
+NSUInteger
+ma_burst_recent(ma_burst_t *b, ma_burst_interval_t *bursts, NSUInteger n)
+{
+	NSUInteger count = 0, i;
+	
+	pthread_mutex_lock(&b->lock);
+	if(n > 0 && b->bursting)
+	{
+		bursts[count] = b->current;
+		if(bursts[count].end <= bursts[count].start)
+			bursts[count].end = (b->epoch+1)*b->slotWidth;
+		count++;
+	}
+	
+	for(i = 0; count < n && i < b->historyCount; i++)
+		bursts[count++] = b->history[(b->next+b->historySize-1-i) %
+									 b->historySize];
+	pthread_mutex_unlock(&b->lock);
+	
+	return count;
+}
+
+static int
+ma_burst_compare_flows(const void *a, const void *b)
+{
+	uint64_t x = ((const ma_burst_flow_t *)a)->bytes;
+	uint64_t y = ((const ma_burst_flow_t *)b)->bytes;
+	
+	return (x < y) - (x > y);
+}
+
+NSString *
+ma_burst_report(ma_burst_t *b, NSUInteger rows)
+{
+	NSMutableString *report = [NSMutableString string];
+	ma_burst_interval_t *bursts;
+	ma_burst_interval_t *c;
+	ma_burst_flow_t *f;
+	double windowRate = (double)b->lineRate/8*b->window/MA_NSEC_PER_SEC;
+	char when[32];
+	time_t start;
+	struct tm tm;
+	NSUInteger n, i, j;
+	
+	pthread_mutex_lock(&b->lock);
+	[report appendFormat:@"window %.0f µs, over %.0f%% of %.0f Mbit/s "
+	 "(%llu bytes)\n",
+	 (double)b->window/1000, 100*b->fraction, (double)b->lineRate/1e6,
+	 b->threshold];
+	[report appendFormat:@"bursts %llu, %.3f ms in bursts, %llu bytes, "
+	 "longest %.3f ms, peak %.1f%% of line rate\n",
+	 b->bursts, (double)b->burstTime/MA_NSEC_PER_MSEC, b->burstBytes,
+	 (double)b->longest/MA_NSEC_PER_MSEC, 100*b->peakBytes/windowRate];
+	pthread_mutex_unlock(&b->lock);
+	
+	if(rows == 0 || !(bursts = malloc(rows*sizeof(*bursts))))
+		return report;
+	
+	/* Newest first, each followed by the flows that made it. */
+	n = ma_burst_recent(b, bursts, rows);
+	if(n)
+		[report appendFormat:@"\n%-16s %12s %10s %14s %8s\n", "start",
+		 "duration ms", "packets", "bytes", "peak %"];
+	for(i = 0; i < n; i++)
+	{
+		c = &bursts[i];
+		start = (time_t)(c->start/MA_NSEC_PER_SEC);
+		localtime_r(&start, &tm);
+		strftime(when, sizeof(when), "%H:%M:%S", &tm);
+		[report appendFormat:@"%s.%06lld  %12.3f %10llu %14llu %8.1f\n", when,
+		 (c->start % MA_NSEC_PER_SEC)/1000,
+		 (double)(c->end-c->start)/MA_NSEC_PER_MSEC, c->packets, c->bytes,
+		 100*c->peakBytes/windowRate];
+		
+		qsort(c->flows, c->flowCount, sizeof(*c->flows),
+			  ma_burst_compare_flows);
+		for(j = 0; j < c->flowCount; j++)
+		{
+			f = &c->flows[j];
+			[report appendFormat:@"    %-56s %14llu %7.1f%% ±%llu\n",
+			 [ma_flow_key_string(f->key, f->keyLen) UTF8String], f->bytes,
+			 (c->bytes ? 100.0*f->bytes/c->bytes : 0.0), f->error];
+		}
+	}
+	free(bursts);
+	
+	return report;
+}
@@ -32,14 +32,64 @@
 
 #import <Foundation/Foundation.h>
 #import <pcap/pcap.h>
+#import <pthread.h>
 
+#import "ConfigurationConstants.h"
+#import "MADedup.h"
+#import "MAFlowCut.h"
 #import "MAProtocols.h"
+#import "MARecord.h"
+#import "MASampler.h"
+#import "MASpool.h"
+#import "MATrigger.h"
+
+
+@class MACaptureStats;
+
+
+/* Counters updated from the capture thread and the mahelper writer. */
+typedef struct
+{
+	volatile int64_t enqueued;
+	volatile int64_t shed;
+	volatile int64_t degraded;
+	volatile int64_t transportDropped;
+	volatile int64_t triggered;
+	volatile int64_t recorded;
+	volatile int64_t recordDropped;
+	volatile int64_t sampledOut;
+	volatile int64_t flowCut;
+	volatile int64_t duplicates;
+} ma_device_counters_t;
+
+/*
+ * Packets from one capture buffer, framed together by the delegate and
+ * handed over once pcap_dispatch() returns (or sooner if the frame fills
+ * up).
+ */
+typedef struct
+{
+	NSUInteger count;
+	ma_frame_t frame;
+} ma_capture_batch_t;
+
+
+/*
+ * Every fanout worker numbers its own packets, the worker index rides in
+ * the low bits so the app can put them back into one order.
+ */
+#define MA_FANOUT_BITS				4
+#define MA_FANOUT_ID(seq, worker)	(((seq) << MA_FANOUT_BITS) | (worker))
+#define MA_FANOUT_WORKER(id)		((id) & ((1 << MA_FANOUT_BITS)-1))
+#define MA_FANOUT_SEQUENCE(id)		((id) >> MA_FANOUT_BITS)
 
 
 @interface MACaptureDevice : NSObject <MACaptureProtocol> {
 @private
-	NSUInteger _nextPacketId;
 	pcap_t *_captureSession;
+	pcap_t *_captureSessions[MACaptureFanoutMax];
+	pthread_t _captureThreads[MACaptureFanoutMax];
+	int _sessionCount;
 	char _captureErrorBuffer[PCAP_ERRBUF_SIZE];
 	
 	NSString *_deviceName;
@@ -53,8 +103,39 @@
 	int _dataLink;
 	int _maxPacketSize;
 	int _readDelay;
+	int _bufferSize;
+	BOOL _immediateMode;
+	int _fanoutWorkers;
+	
+	NSString *_triggerDirectory;
+	NSString *_triggerFilter;
+	int _triggerRstBurst;
+	int _triggerDropSpike;
+	int _triggerWindow;
+	int _triggerPostWindow;
+	volatile int64_t _triggerGeneration;
+	
+	NSString *_recordPath;
+	int _recordSampleInterval;
+	
+	ma_sample_mode_t _sampleMode;
+	int _sampleRate;
+	int _sampleReservoir;
+	int _sampleWindow;
+	
+	int _flowCutPackets;
+	int64_t _flowCutBytes;
+	BOOL _flowCutDrop;
+	
+	ma_dedup_mode_t _dedupMode;
+	int _dedupWindow;
 	
 	BOOL _isCapturing;
+	uint16_t _transportIndex;
+	BOOL _transportAnnounced;
+	
+	struct pcap_stat _pcapStats;
+	ma_device_counters_t _counters;
 	
 	id _delegate;
 }
@@ -72,8 +153,22 @@
 - (BOOL)isLoopBack;
 - (void)cloneAddress:(pcap_addr_t *)addr;
 
+- (pcap_t *)openSession:(NSString *)filter;
+- (ma_trigger_t *)newTriggerForWorker:(int)worker ofWorkers:(int)workers;
+- (ma_spool_t *)newRecorderForWorker:(int)worker ofWorkers:(int)workers;
+- (ma_sampler_t *)newSamplerForWorker:(int)worker ofWorkers:(int)workers;
+- (ma_flowcut_t *)newFlowCutForWorker:(int)worker ofWorkers:(int)workers;
+- (ma_dedup_t *)newDedupForWorker:(int)worker ofWorkers:(int)workers;
+- (void)updatePcapStats;
+
 - (void)sendPacket:(const u_char *)data
-		withHeader:(const struct pcap_pkthdr *)hdr;
+		withHeader:(const struct pcap_pkthdr *)hdr
+			withId:(NSUInteger)packetId
+			weight:(uint32_t)weight
+		   toBatch:(ma_capture_batch_t *)batch;
+- (void)flushBatch:(ma_capture_batch_t *)batch;
+
+- (MACaptureStats *)captureStats;
 
 
 @property (readonly) pcap_t *captureSession;
@@ -90,6 +185,35 @@
 @property (readonly) int dataLink;
 @property (readwrite) int maxPacketSize;
 @property (readwrite) int readDelay;
+@property (readwrite) int bufferSize;
+@property (readwrite) BOOL immediateMode;
+@property (readwrite) int fanoutWorkers;
+
+@property (readwrite, copy) NSString *triggerDirectory;
+@property (readwrite, copy) NSString *triggerFilter;
+@property (readwrite) int triggerRstBurst;
+@property (readwrite) int triggerDropSpike;
+@property (readwrite) int triggerWindow;
+@property (readwrite) int triggerPostWindow;
+
+@property (readwrite, copy) NSString *recordPath;
+@property (readwrite) int recordSampleInterval;
+
+@property (readwrite) ma_sample_mode_t sampleMode;
+@property (readwrite) int sampleRate;
+@property (readwrite) int sampleReservoir;
+@property (readwrite) int sampleWindow;
+
+@property (readwrite) int flowCutPackets;
+@property (readwrite) int64_t flowCutBytes;
+@property (readwrite) BOOL flowCutDrop;
+
+@property (readwrite) ma_dedup_mode_t dedupMode;
+@property (readwrite) int dedupWindow;
+
+@property (readonly) ma_device_counters_t *counters;
+@property (readwrite) uint16_t transportIndex;
+@property (readwrite) BOOL transportAnnounced;
 
 @property (readwrite, assign) id delegate;
 
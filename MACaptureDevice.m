@@ -33,20 +33,304 @@
 #import "MACaptureDevice.h"
 
 #import <arpa/inet.h>
+#import <libkern/OSAtomic.h>
+#import <mach/mach.h>
+#import <pthread.h>
 
+#import "MACaptureStats.h"
 #import "MADate.h"
 #import "MAProtocols.h"
 #import "MAPCAPHelper.h"
+#import "MARecord.h"
 #import "MAString.h"
 
 
+/* State for one capture worker, owned by its thread. */
+typedef struct
+{
+	MACaptureDevice *device;
+	pcap_t *session;
+	int worker;
+	int tstampScale;
+	NSUInteger nextSequence;
+	ma_trigger_t *trigger;
+	uint64_t triggered;
+	ma_spool_t *record;
+	int64_t nextSample;			/* nanoseconds */
+	int64_t sampleInterval;
+	int64_t recorded;			/* since the counters were last updated */
+	int64_t recordDropped;
+	ma_sampler_t *sampler;
+	uint64_t sampledOut;
+	ma_flowcut_t *flowCut;
+	uint64_t flowCutCount;
+	ma_dedup_t *dedup;
+	uint64_t duplicates;
+	int linkType;
+	ma_capture_batch_t batch;
+} ma_capture_context_t;
+
+
+/*
+ * Feed the trigger the session's drop counter and pass on how often it
+ * fired.
+ */
+static void
+ma_capture_check_trigger(ma_capture_context_t *ctx)
+{
+	ma_trigger_stats_t stats;
+	struct pcap_stat ps;
+	struct timeval now;
+	
+	/* A quiet link still closes the dump once the post window is over. */
+	gettimeofday(&now, NULL);
+	ma_trigger_tick(ctx->trigger, ma_timeval_ns(&now));
+	
+	if([ctx->device triggerDropSpike] > 0 && pcap_stats(ctx->session, &ps) == 0)
+		ma_trigger_drops(ctx->trigger, ps.ps_drop);
+	
+	ma_trigger_stats(ctx->trigger, &stats);
+	if(stats.fired != ctx->triggered)
+	{
+		OSAtomicAdd64((int64_t)(stats.fired-ctx->triggered),
+					  &[ctx->device counters]->triggered);
+		ctx->triggered = stats.fired;
+		NSLog(@"%@: capture triggered (%s)", [ctx->device deviceName],
+			  ma_trigger_reason_name(stats.lastReason));
+	}
+}
+
+/* A packet the sampler kept, on to the app with its weight. */
+static void
+ma_capture_send(void *obj, const struct pcap_pkthdr *hdr, const u_char *data,
+				NSUInteger packetId, uint32_t weight)
+{
+	ma_capture_context_t *ctx = obj;
+	
+	[ctx->device sendPacket:data
+				 withHeader:hdr
+					 withId:packetId
+					 weight:weight
+					toBatch:&ctx->batch];
+}
+
+/* Let a reservoir go at the end of its window and pass on the count. */
+static void
+ma_capture_check_sampler(ma_capture_context_t *ctx)
+{
+	struct timeval now;
+	uint64_t discarded;
+	
+	gettimeofday(&now, NULL);
+	ma_sampler_tick(ctx->sampler, ma_timeval_ns(&now), ma_capture_send, ctx);
+	
+	discarded = ma_sampler_discarded(ctx->sampler);
+	if(discarded != ctx->sampledOut)
+	{
+		OSAtomicAdd64((int64_t)(discarded-ctx->sampledOut),
+					  &[ctx->device counters]->sampledOut);
+		ctx->sampledOut = discarded;
+	}
+}
+
+/* Pass on how many packets per-flow truncation cut or dropped. */
+static void
+ma_capture_check_flowcut(ma_capture_context_t *ctx)
+{
+	ma_flowcut_stats_t stats;
+	uint64_t cut;
+	
+	ma_flowcut_stats(ctx->flowCut, &stats);
+	cut = stats.truncated+stats.dropped;
+	if(cut != ctx->flowCutCount)
+	{
+		OSAtomicAdd64((int64_t)(cut-ctx->flowCutCount),
+					  &[ctx->device counters]->flowCut);
+		ctx->flowCutCount = cut;
+	}
+}
+
+/* Pass on how many duplicates were dropped or marked. */
+static void
+ma_capture_check_dedup(ma_capture_context_t *ctx)
+{
+	uint64_t duplicates = ma_dedup_count(ctx->dedup);
+	
+	if(duplicates != ctx->duplicates)
+	{
+		OSAtomicAdd64((int64_t)(duplicates-ctx->duplicates),
+					  &[ctx->device counters]->duplicates);
+		ctx->duplicates = duplicates;
+	}
+}
+
 /*
  * Bounce our callback to an Objective-C method.
  */
 void
 ma_callback(u_char *obj, const struct pcap_pkthdr *hdr, const u_char *data)
 {
-	[(id)obj sendPacket:data withHeader:hdr];
+	ma_capture_context_t *ctx = (ma_capture_context_t *)obj;
+	struct pcap_pkthdr scaled;
+	bpf_u_int32 caplen;
+	BOOL duplicate = NO;
+	
+	/* The session couldn't do nanoseconds, scale microseconds up. */
+	if(ctx->tstampScale != 1)
+	{
+		scaled = *hdr;
+		scaled.ts.tv_usec *= ctx->tstampScale;
+		hdr = &scaled;
+	}
+	
+	/* A copy of a packet we just saw, from a SPAN port or second tap. */
+	if(ctx->dedup && ma_dedup_packet(ctx->dedup, ctx->linkType, hdr, data))
+	{
+		if([ctx->device dedupMode] == MA_DEDUP_DROP)
+			return;
+		duplicate = YES;
+	}
+	
+	/* Past its limit a flow keeps only headers, if anything. */
+	if(ctx->flowCut)
+	{
+		if(!ma_flowcut_packet(ctx->flowCut, hdr, data, &caplen))
+			return;
+		
+		if(caplen < hdr->caplen)
+		{
+			scaled = *hdr;
+			scaled.caplen = caplen;
+			hdr = &scaled;
+		}
+	}
+	
+	if(ctx->trigger)
+		ma_trigger_packet(ctx->trigger, hdr, data);
+	
+	/* Recording, the app only gets a packet now and then to show. */
+	if(ctx->record)
+	{
+		int64_t ts = ma_pkthdr_ns(hdr);
+		
+		if(ma_spool_packet(ctx->record, hdr, data))
+			ctx->recorded++;
+		else
+			ctx->recordDropped++;
+		
+		if(ts < ctx->nextSample)
+		{
+			ctx->nextSequence++;
+			return;
+		}
+		ctx->nextSample = ts+ctx->sampleInterval;
+	}
+	
+	/* Marked duplicates stand for no packets, sampling has nothing to do. */
+	if(duplicate)
+	{
+		ma_capture_send(ctx, hdr, data,
+						MA_FANOUT_ID(ctx->nextSequence++, ctx->worker), 0);
+		return;
+	}
+	
+	/* Sampling, a packet may go now, later or not at all. */
+	if(ctx->sampler)
+	{
+		ma_sampler_packet(ctx->sampler, hdr, data,
+						  MA_FANOUT_ID(ctx->nextSequence++, ctx->worker),
+						  ma_capture_send, ctx);
+		return;
+	}
+	
+	ma_capture_send(ctx, hdr, data,
+					MA_FANOUT_ID(ctx->nextSequence++, ctx->worker), 1);
+}
+
+/* Hand what was appended to the writer and pass on the counts. */
+static void
+ma_capture_commit_record(ma_capture_context_t *ctx)
+{
+	ma_device_counters_t *counters = [ctx->device counters];
+	
+	ma_spool_commit(ctx->record);
+	
+	if(ctx->recorded)
+		OSAtomicAdd64(ctx->recorded, &counters->recorded);
+	if(ctx->recordDropped)
+		OSAtomicAdd64(ctx->recordDropped, &counters->recordDropped);
+	ctx->recorded = 0;
+	ctx->recordDropped = 0;
+}
+
+/*
+ * Filter that gives worker its share of the traffic. Adding the two
+ * addresses is symmetric, so both directions between a pair of hosts land
+ * on the same worker, and every BPF implementation can add and mask.
+ * Anything that is not IP goes to worker 0.
+ */
+static NSString *
+ma_fanout_filter(int worker, int workers)
+{
+	return [NSString stringWithFormat:
+			@"(ip and ((ip[12:4] + ip[16:4]) & %d) = %d) or "
+			@"(ip6 and ((ip6[20:4] + ip6[36:4]) & %d) = %d)%@",
+			workers-1, worker, workers-1, worker,
+			(worker == 0 ? @" or not (ip or ip6)" : @"")];
+}
+
+/*
+ * Body of a capture worker thread. Reads one capture buffer at a time and
+ * passes everything it held to the delegate in one go. stopCapture breaks
+ * the loop and waits for us, then closes the session.
+ */
+static void *
+ma_capture_worker(void *arg)
+{
+	ma_capture_context_t *ctx = arg;
+	thread_affinity_policy_data_t affinity = { ctx->worker+1 };
+	int count;
+	
+	/* Distinct tags ask the scheduler to keep workers on separate cores. */
+	thread_policy_set(pthread_mach_thread_np(pthread_self()),
+					  THREAD_AFFINITY_POLICY, (thread_policy_t)&affinity,
+					  THREAD_AFFINITY_POLICY_COUNT);
+	
+	do
+	{
+		NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+		
+		count = pcap_dispatch(ctx->session, -1, ma_callback, (u_char *)ctx);
+		if(ctx->sampler)
+			ma_capture_check_sampler(ctx);
+		[ctx->device flushBatch:&ctx->batch];
+		
+		if(ctx->trigger)
+			ma_capture_check_trigger(ctx);
+		if(ctx->record)
+			ma_capture_commit_record(ctx);
+		if(ctx->flowCut)
+			ma_capture_check_flowcut(ctx);
+		if(ctx->dedup)
+			ma_capture_check_dedup(ctx);
+		
+		[pool drain];
+	} while(count >= 0);
+	
+	if(count == PCAP_ERROR)
+		NSLog(@"%s(): %s", __func__, pcap_geterr(ctx->session));
+	
+	if(ctx->record && !ma_spool_close(ctx->record))
+		NSLog(@"%s(): %@ recording is incomplete", __func__,
+			  [ctx->device deviceName]);
+	ma_trigger_destroy(ctx->trigger);
+	ma_sampler_destroy(ctx->sampler);
+	ma_flowcut_destroy(ctx->flowCut);
+	ma_dedup_destroy(ctx->dedup);
+	ma_frame_discard(&ctx->batch.frame);
+	free(ctx);
+	
+	return NULL;
 }
 
 @implementation MACaptureDevice
@@ -59,7 +343,15 @@ ma_callback(u_char *obj, const struct pcap_pkthdr *hdr, const u_char *data)
 	if(!(self = [super init]))
 		return nil;
 	
-	_nextPacketId = 1;
+	_bufferSize = MACaptureBufferSize;
+	_fanoutWorkers = 1;
+	_triggerWindow = MATriggerWindow;
+	_triggerPostWindow = MATriggerPostWindow;
+	_recordSampleInterval = MARecordSampleInterval;
+	_sampleRate = MASampleRate;
+	_sampleReservoir = MASampleReservoir;
+	_sampleWindow = MASampleWindow;
+	_dedupWindow = MADedupWindow;
 	
 	if(ifaceName)
 		_deviceName = [NSString stringWithUTF8String:ifaceName];
@@ -90,61 +382,371 @@ ma_callback(u_char *obj, const struct pcap_pkthdr *hdr, const u_char *data)
 	[_uuid release];
 	[_deviceName release];
 	[_deviceDescription release];
+	[_triggerDirectory release];
+	[_triggerFilter release];
+	[_recordPath release];
 	[super dealloc];
 }
 
 #pragma mark - PCAP methods
 
-- (BOOL)startCapture
+/*
+ * Create and activate one capture session on our interface, with filter
+ * applied if given.
+ */
+- (pcap_t *)openSession:(NSString *)filter
 {
-	if(_isCapturing)
-		return YES;
+	struct bpf_program program;
+	pcap_t *session;
+	int status;
 	
-	_isCapturing = YES;
-	_captureSession = pcap_create([self.deviceName UTF8String],
-								  _captureErrorBuffer);
-	if(!_captureSession)
+	if(!(session = pcap_create([self.deviceName UTF8String],
+							   _captureErrorBuffer)))
 	{
-		NSLog(@"%s(): %s", __func__, pcap_geterr(_captureSession));
-		pcap_close(_captureSession);
-		_isCapturing = NO;
-		return NO;
+		NSLog(@"%s(): %s", __func__, _captureErrorBuffer);
+		return NULL;
 	}
 	
 	/* Set Promiscious and monitor modes. */
-	pcap_set_promisc(_captureSession, (self.promiscuousMode ? 1 : 0));
-	pcap_set_rfmon(_captureSession, (self.monitorMode ? 1 : 0));
+	pcap_set_promisc(session, (self.promiscuousMode ? 1 : 0));
+	pcap_set_rfmon(session, (self.monitorMode ? 1 : 0));
 	
 	/* Set snapshot length and read delay. */
-	pcap_set_snaplen(_captureSession, self.maxPacketSize);
-	pcap_set_timeout(_captureSession, self.readDelay);
+	pcap_set_snaplen(session, self.maxPacketSize);
+	pcap_set_timeout(session, self.readDelay);
+	
+	/*
+	 * A large kernel buffer without immediate mode lets each read return
+	 * a whole buffer of packets; immediate mode trades that for latency.
+	 */
+	if(self.bufferSize > 0)
+		pcap_set_buffer_size(session, self.bufferSize);
+	pcap_set_immediate_mode(session, (self.immediateMode ? 1 : 0));
+	
+	/* Not every platform can, ma_callback scales if it didn't stick. */
+	pcap_set_tstamp_precision(session, PCAP_TSTAMP_PRECISION_NANO);
 	
 	/* Activate our capture device. */
-	pcap_activate(_captureSession);
+	if((status = pcap_activate(session)) < 0)
+	{
+		NSLog(@"%s(): %s", __func__, pcap_geterr(session));
+		pcap_close(session);
+		return NULL;
+	}
+	else if(status > 0)
+		NSLog(@"%s(): %s", __func__, pcap_geterr(session));
+	
+	if(filter)
+	{
+		if(pcap_compile(session, &program, [filter UTF8String], 1,
+						PCAP_NETMASK_UNKNOWN) == -1)
+		{
+			NSLog(@"%s(): %s", __func__, pcap_geterr(session));
+			pcap_close(session);
+			return NULL;
+		}
+		
+		status = pcap_setfilter(session, &program);
+		pcap_freecode(&program);
+		if(status == -1)
+		{
+			NSLog(@"%s(): %s", __func__, pcap_geterr(session));
+			pcap_close(session);
+			return NULL;
+		}
+	}
+	
+	return session;
+}
+
+- (BOOL)startCapture
+{
+	int workers;
+	int i;
+	
+	if(_isCapturing)
+		return YES;
+	
+	if(![_delegate respondsToSelector:
+		 @selector(processPacket:withData:withHeader:weight:toBatch:forDevice:)] ||
+	   ![_delegate respondsToSelector:@selector(flushBatch:forDevice:)])
+		return NO;
+	
+	memset(&_counters, 0, sizeof(_counters));
+	memset(&_pcapStats, 0, sizeof(_pcapStats));
+	
+	/*
+	 * With more than one worker each gets its own session on the interface
+	 * and a filter that keeps only its share of the flows.
+	 */
+	workers = self.fanoutWorkers;
+	for(i = 0; i < workers; i++)
+	{
+		NSString *filter = (workers > 1 ? ma_fanout_filter(i, workers) : nil);
+		
+		if(!(_captureSessions[i] = [self openSession:filter]))
+		{
+			while(i-- > 0)
+			{
+				pcap_close(_captureSessions[i]);
+				_captureSessions[i] = NULL;
+			}
+			return NO;
+		}
+	}
+	
+	_sessionCount = workers;
+	_captureSession = _captureSessions[0];
 	_dataLink = pcap_datalink(_captureSession);
+	_isCapturing = YES;
+	
+	/* The link type may have changed, tell the app again. */
+	_transportAnnounced = NO;
 	
-	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^{
-		pcap_loop(_captureSession, -1, ma_callback, (voidPtr)self);
-	});
+	/* Joinable, stopCapture waits for every worker before returning. */
+	for(i = 0; i < workers; i++)
+	{
+		ma_capture_context_t *ctx;
+		int error;
+		
+		if(!(ctx = malloc(sizeof(*ctx))))
+		{
+			NSLog(@"%s: Ran out of memory?", __func__);
+			pcap_close(_captureSessions[i]);
+			_captureSessions[i] = NULL;
+			continue;
+		}
+		
+		ctx->device = self;
+		ctx->session = _captureSessions[i];
+		ctx->worker = i;
+		ctx->tstampScale = (pcap_get_tstamp_precision(ctx->session) ==
+							PCAP_TSTAMP_PRECISION_NANO ? 1 : 1000);
+		ctx->nextSequence = 1;
+		ctx->trigger = [self newTriggerForWorker:i ofWorkers:workers];
+		ctx->triggered = 0;
+		ctx->record = [self newRecorderForWorker:i ofWorkers:workers];
+		ctx->nextSample = 0;
+		ctx->sampleInterval = (int64_t)_recordSampleInterval*MA_NSEC_PER_MSEC;
+		ctx->recorded = 0;
+		ctx->recordDropped = 0;
+		ctx->sampler = (ctx->record ? NULL :
+						[self newSamplerForWorker:i ofWorkers:workers]);
+		ctx->sampledOut = 0;
+		ctx->flowCut = [self newFlowCutForWorker:i ofWorkers:workers];
+		ctx->flowCutCount = 0;
+		ctx->dedup = [self newDedupForWorker:i ofWorkers:workers];
+		ctx->duplicates = 0;
+		ctx->linkType = pcap_datalink(ctx->session);
+		memset(&ctx->batch, 0, sizeof(ctx->batch));
+		
+		if((error = pthread_create(&_captureThreads[i], NULL,
+								   ma_capture_worker, ctx)))
+		{
+			NSLog(@"%s(): %s", __func__, strerror(error));
+			ma_spool_close(ctx->record);
+			ma_trigger_destroy(ctx->trigger);
+			ma_sampler_destroy(ctx->sampler);
+			ma_flowcut_destroy(ctx->flowCut);
+			ma_dedup_destroy(ctx->dedup);
+			pcap_close(ctx->session);
+			_captureSessions[i] = NULL;
+			free(ctx);
+		}
+	}
 	
 	return YES;
 }
 
+/*
+ * A pre-trigger ring for one worker, if trigger mode is on. The workers
+ * split the ring's memory and share a generation so they dump together.
+ */
+- (ma_trigger_t *)newTriggerForWorker:(int)worker ofWorkers:(int)workers
+{
+	ma_trigger_config_t config;
+	NSString *prefix;
+	ma_trigger_t *trigger;
+	
+	if(_triggerDirectory == nil ||
+	   ([_triggerFilter length] == 0 && _triggerRstBurst <= 0 &&
+		_triggerDropSpike <= 0))
+		return NULL;
+	
+	prefix = [_triggerDirectory stringByAppendingPathComponent:
+			  [NSString stringWithFormat:@"%@-w%d", self.deviceName, worker]];
+	
+	config.filter = [_triggerFilter UTF8String];
+	config.rstBurst = MAX(_triggerRstBurst, 0);
+	config.dropSpike = MAX(_triggerDropSpike, 0);
+	config.window = (int64_t)_triggerWindow*MA_NSEC_PER_SEC;
+	config.post = (int64_t)_triggerPostWindow*MA_NSEC_PER_SEC;
+	config.ringBytes = MATriggerRingBytes/workers;
+	config.ringPackets = MATriggerRingPackets/workers;
+	config.linkType = pcap_datalink(_captureSessions[worker]);
+	config.snapLen = self.maxPacketSize;
+	config.prefix = [prefix fileSystemRepresentation];
+	
+	if(!(trigger = ma_trigger_create(&config, &_triggerGeneration)))
+		NSLog(@"%s(): trigger mode unavailable on %@", __func__,
+			  self.deviceName);
+	
+	return trigger;
+}
+
+/*
+ * The file one worker records to in record-only mode, straight from the
+ * capture thread with write-behind buffers. Each worker has a file of its
+ * own, numbered when there is more than one.
+ */
+- (ma_spool_t *)newRecorderForWorker:(int)worker ofWorkers:(int)workers
+{
+	NSString *path = _recordPath;
+	ma_spool_t *record;
+	
+	if(path == nil)
+		return NULL;
+	
+	if(workers > 1)
+		path = [[[path stringByDeletingPathExtension] stringByAppendingFormat:
+				 @"-w%d", worker] stringByAppendingPathExtension:
+				[path pathExtension]];
+	
+	if(!(record = ma_spool_open([path fileSystemRepresentation],
+								pcap_datalink(_captureSessions[worker]),
+								self.maxPacketSize, NULL)))
+		NSLog(@"%s(): could not record %@ to %@", __func__, self.deviceName,
+			  path);
+	
+	return record;
+}
+
+/*
+ * A sampler for one worker, if sampling is on. Fanout keeps flows on one
+ * worker, so each samples its own share; reservoirs are split between
+ * them.
+ */
+- (ma_sampler_t *)newSamplerForWorker:(int)worker ofWorkers:(int)workers
+{
+	ma_sampler_config_t config;
+	ma_sampler_t *sampler;
+	
+	if(_sampleMode == MA_SAMPLE_NONE)
+		return NULL;
+	
+	config.mode = _sampleMode;
+	config.rate = (uint32_t)MAX(_sampleRate, 0);
+	config.reservoir = (NSUInteger)MAX(_sampleReservoir/workers, 1);
+	config.window = (int64_t)_sampleWindow*MA_NSEC_PER_MSEC;
+	config.linkType = pcap_datalink(_captureSessions[worker]);
+	config.snapLen = pcap_snapshot(_captureSessions[worker]);
+	
+	if(!(sampler = ma_sampler_create(&config)))
+		NSLog(@"%s(): could not sample %@ (%@)", __func__, self.deviceName,
+			  ma_sample_mode_name(_sampleMode));
+	
+	return sampler;
+}
+
+/*
+ * Per-flow truncation for one worker, if a limit is set. Fanout keeps a
+ * flow on one worker, so each tracks its own share of the table.
+ */
+- (ma_flowcut_t *)newFlowCutForWorker:(int)worker ofWorkers:(int)workers
+{
+	ma_flowcut_config_t config;
+	
+	if(_flowCutPackets <= 0 && _flowCutBytes <= 0)
+		return NULL;
+	
+	config.packets = (uint32_t)MAX(_flowCutPackets, 0);
+	config.bytes = (uint64_t)MAX(_flowCutBytes, 0);
+	config.headersOnly = !_flowCutDrop;
+	config.tableSize = MAFlowCutTableSize/workers;
+	config.idle = (int64_t)MAFlowCutIdle*MA_NSEC_PER_SEC;
+	config.linkType = pcap_datalink(_captureSessions[worker]);
+	
+	return ma_flowcut_create(&config);
+}
+
+/*
+ * Duplicate detection for one worker. The fanout filters send both
+ * copies of a packet to the same worker, so each keeps its own table.
+ */
+- (ma_dedup_t *)newDedupForWorker:(int)worker ofWorkers:(int)workers
+{
+	if(_dedupMode == MA_DEDUP_OFF)
+		return NULL;
+	
+	return ma_dedup_create(MADedupTableSize/workers,
+						   (int64_t)_dedupWindow*MA_NSEC_PER_MSEC);
+}
+
 - (void)stopCapture
 {
+	int i;
+	
 	if(!_isCapturing)
 		return;
 	else
 		_isCapturing = NO;
 	
-	if(!_captureSession)
-		return;
-
-	pcap_breakloop(_captureSession);
-	pcap_close(_captureSession);
+	/* Keep the final counters around after the sessions are gone. */
+	[self updatePcapStats];
+	
+	for(i = 0; i < _sessionCount; i++)
+		if(_captureSessions[i])
+			pcap_breakloop(_captureSessions[i]);
+	
+	/*
+	 * A worker uses its session, our counters and the delegate until it
+	 * returns; only then can the sessions go and a new capture start.
+	 */
+	for(i = 0; i < _sessionCount; i++)
+	{
+		if(!_captureSessions[i])
+			continue;
+		
+		pthread_join(_captureThreads[i], NULL);
+		pcap_close(_captureSessions[i]);
+		_captureSessions[i] = NULL;
+	}
+	
+	_sessionCount = 0;
 	_captureSession = NULL;
 }
 
+/*
+ * Each fanout session sees the whole interface, so received and interface
+ * drops are the same on all of them, but each drops only its own share.
+ */
+- (void)updatePcapStats
+{
+	struct pcap_stat total;
+	struct pcap_stat ps;
+	int i;
+	
+	memset(&total, 0, sizeof(total));
+	
+	for(i = 0; i < _sessionCount; i++)
+	{
+		if(!_captureSessions[i])
+			continue;
+		
+		if(pcap_stats(_captureSessions[i], &ps) == -1)
+		{
+			NSLog(@"%s(): %s", __func__, pcap_geterr(_captureSessions[i]));
+			return;
+		}
+		
+		total.ps_recv = MAX(total.ps_recv, ps.ps_recv);
+		total.ps_ifdrop = MAX(total.ps_ifdrop, ps.ps_ifdrop);
+		total.ps_drop += ps.ps_drop;
+	}
+	
+	_pcapStats = total;
+}
+
 - (BOOL)setFilter:(NSString *)expr
 {
 	return NO;
@@ -154,13 +756,63 @@ ma_callback(u_char *obj, const struct pcap_pkthdr *hdr, const u_char *data)
 
 - (void)sendPacket:(const u_char *)data
 		withHeader:(const struct pcap_pkthdr *)hdr
+			withId:(NSUInteger)packetId
+			weight:(uint32_t)weight
+		   toBatch:(ma_capture_batch_t *)batch
 {
-	if(![_delegate respondsToSelector:
-		 @selector(processPacket:withData:withHeader:forDevice:)])
+	/*
+	 * Ids in a frame count up from its first, a reservoir let go at the
+	 * end of its window holds ids older than a marked duplicate sent
+	 * straight away; such a packet starts a frame of its own.
+	 */
+	if(batch->count == MACaptureBatchLength ||
+	   batch->frame.used >= MAFrameFlushSize ||
+	   (batch->count > 0 && packetId < batch->frame.firstId))
+		[self flushBatch:batch];
+	
+	if(![_delegate processPacket:packetId withData:data withHeader:hdr
+						  weight:weight toBatch:batch forDevice:self])
+		OSAtomicIncrement64(&_counters.shed);
+}
+
+- (void)flushBatch:(ma_capture_batch_t *)batch
+{
+	NSUInteger pushed;
+	
+	if(batch->count == 0)
 		return;
 	
-	[_delegate processPacket:_nextPacketId++ withData:data
-				  withHeader:hdr forDevice:self];
+	pushed = [_delegate flushBatch:batch forDevice:self];
+	OSAtomicAdd64(pushed, &_counters.enqueued);
+	OSAtomicAdd64(batch->count-pushed, &_counters.shed);
+	batch->count = 0;
+}
+
+#pragma mark - Statistics
+
+- (MACaptureStats *)captureStats
+{
+	MACaptureStats *stats = [[MACaptureStats alloc]
+							 initWithDeviceName:self.deviceName];
+	
+	if(_isCapturing)
+		[self updatePcapStats];
+	
+	[stats setKernelReceived:_pcapStats.ps_recv];
+	[stats setKernelDropped:_pcapStats.ps_drop];
+	[stats setInterfaceDropped:_pcapStats.ps_ifdrop];
+	[stats setHelperEnqueued:_counters.enqueued];
+	[stats setHelperShed:_counters.shed];
+	[stats setHelperDegraded:_counters.degraded];
+	[stats setTransportDropped:_counters.transportDropped];
+	[stats setTriggersFired:_counters.triggered];
+	[stats setRecorded:_counters.recorded];
+	[stats setRecordDropped:_counters.recordDropped];
+	[stats setSampledOut:_counters.sampledOut];
+	[stats setFlowCut:_counters.flowCut];
+	[stats setDuplicates:_counters.duplicates];
+	
+	return [stats autorelease];
 }
 
 #pragma mark - Misc
@@ -302,11 +954,56 @@ ma_callback(u_char *obj, const struct pcap_pkthdr *hdr, const u_char *data)
 	return _readDelay;
 }
 
+- (void)setBufferSize:(int)size
+{
+	if(!_isCapturing)
+		_bufferSize = size;
+}
+
+- (int)bufferSize
+{
+	return _bufferSize;
+}
+
+- (void)setImmediateMode:(BOOL)mode
+{
+	if(!_isCapturing)
+		_immediateMode = mode;
+}
+
+- (BOOL)immediateMode
+{
+	return _immediateMode;
+}
+
+/* The fanout filters split flows by a mask, so round down to a power of 2. */
+- (void)setFanoutWorkers:(int)workers
+{
+	if(_isCapturing)
+		return;
+	
+	workers = MAX(1, MIN(workers, MACaptureFanoutMax));
+	while(workers & (workers-1))
+		workers &= workers-1;
+	
+	_fanoutWorkers = workers;
+}
+
+- (int)fanoutWorkers
+{
+	return _fanoutWorkers;
+}
+
 - (cap_device_t)deviceType
 {
 	return PCAP_DEVICE;
 }
 
+- (ma_device_counters_t *)counters
+{
+	return &_counters;
+}
+
 @synthesize captureSession		= _captureSession;
 
 @synthesize deviceAddress		= _deviceAddress;
@@ -318,6 +1015,28 @@ ma_callback(u_char *obj, const struct pcap_pkthdr *hdr, const u_char *data)
 @synthesize isCapturing			= _isCapturing;
 @synthesize dataLink			= _dataLink;
 
+@synthesize triggerDirectory	= _triggerDirectory;
+@synthesize triggerFilter		= _triggerFilter;
+@synthesize triggerRstBurst		= _triggerRstBurst;
+@synthesize triggerDropSpike	= _triggerDropSpike;
+@synthesize triggerWindow		= _triggerWindow;
+@synthesize triggerPostWindow	= _triggerPostWindow;
+
+@synthesize transportIndex		= _transportIndex;
+@synthesize transportAnnounced	= _transportAnnounced;
+
+@synthesize recordPath			= _recordPath;
+@synthesize recordSampleInterval	= _recordSampleInterval;
+@synthesize sampleMode			= _sampleMode;
+@synthesize sampleRate			= _sampleRate;
+@synthesize sampleReservoir		= _sampleReservoir;
+@synthesize sampleWindow		= _sampleWindow;
+@synthesize flowCutPackets		= _flowCutPackets;
+@synthesize flowCutBytes		= _flowCutBytes;
+@synthesize flowCutDrop			= _flowCutDrop;
+@synthesize dedupMode			= _dedupMode;
+@synthesize dedupWindow			= _dedupWindow;
+
 @synthesize delegate			= _delegate;
 
 @end
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+#import <pcap/pcap.h>
+
+
+/*
+ * Snapshot of the drop counters for one capture device. mahelper fills in
+ * everything up to the FIFO and sends the snapshot by copy, the app adds
+ * how many records it actually read back.
+ */
+@interface MACaptureStats : NSObject <NSCoding> {
+@private
+	NSString *_deviceName;
+	
+	uint64_t _kernelReceived;
+	uint64_t _kernelDropped;
+	uint64_t _interfaceDropped;
+	uint64_t _helperEnqueued;
+	uint64_t _helperShed;
+	uint64_t _helperDegraded;
+	uint64_t _transportDropped;
+	uint64_t _appIngested;
+	uint64_t _appShed;
+	uint64_t _appDegraded;
+	uint64_t _triggersFired;
+	uint64_t _recorded;
+	uint64_t _recordDropped;
+	uint64_t _sampledOut;
+	uint64_t _flowCut;
+	uint64_t _duplicates;
+}
+
+- (id)initWithDeviceName:(NSString *)name;
+
+- (uint64_t)totalDropped;
+- (uint64_t)totalDegraded;
+- (NSString *)summary;
+
+@property (readonly) NSString *deviceName;
+
+@property (readwrite) uint64_t kernelReceived;
+@property (readwrite) uint64_t kernelDropped;
+@property (readwrite) uint64_t interfaceDropped;
+@property (readwrite) uint64_t helperEnqueued;
+@property (readwrite) uint64_t helperShed;
+@property (readwrite) uint64_t helperDegraded;
+@property (readwrite) uint64_t transportDropped;
+@property (readwrite) uint64_t appIngested;
+@property (readwrite) uint64_t appShed;
+@property (readwrite) uint64_t appDegraded;
+@property (readwrite) uint64_t triggersFired;
+@property (readwrite) uint64_t recorded;
+@property (readwrite) uint64_t recordDropped;
+@property (readwrite) uint64_t sampledOut;
+@property (readwrite) uint64_t flowCut;
+@property (readwrite) uint64_t duplicates;
+
+@end
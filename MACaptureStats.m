@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import "MACaptureStats.h"
+
+
+@implementation MACaptureStats
+
+- (id)initWithDeviceName:(NSString *)name
+{
+	if(!(self = [super init]))
+		return nil;
+	
+	_deviceName = [name copy];
+	
+	return self;
+}
+
+- (void)dealloc
+{
+	[_deviceName release];
+	[super dealloc];
+}
+
+#pragma mark - NSCoding
+
+- (id)initWithCoder:(NSCoder *)decoder
+{
+	if(!(self = [super init]))
+		return nil;
+	
+	_deviceName = [[decoder decodeObject] retain];
+	[decoder decodeValueOfObjCType:@encode(uint64_t) at:&_kernelReceived];
+	[decoder decodeValueOfObjCType:@encode(uint64_t) at:&_kernelDropped];
+	[decoder decodeValueOfObjCType:@encode(uint64_t) at:&_interfaceDropped];
+	[decoder decodeValueOfObjCType:@encode(uint64_t) at:&_helperEnqueued];
+	[decoder decodeValueOfObjCType:@encode(uint64_t) at:&_helperShed];
+	[decoder decodeValueOfObjCType:@encode(uint64_t) at:&_helperDegraded];
+	[decoder decodeValueOfObjCType:@encode(uint64_t) at:&_transportDropped];
+	[decoder decodeValueOfObjCType:@encode(uint64_t) at:&_appIngested];
+	[decoder decodeValueOfObjCType:@encode(uint64_t) at:&_appShed];
+	[decoder decodeValueOfObjCType:@encode(uint64_t) at:&_appDegraded];
+	[decoder decodeValueOfObjCType:@encode(uint64_t) at:&_triggersFired];
+	[decoder decodeValueOfObjCType:@encode(uint64_t) at:&_recorded];
+	[decoder decodeValueOfObjCType:@encode(uint64_t) at:&_recordDropped];
+	[decoder decodeValueOfObjCType:@encode(uint64_t) at:&_sampledOut];
+	[decoder decodeValueOfObjCType:@encode(uint64_t) at:&_flowCut];
+	[decoder decodeValueOfObjCType:@encode(uint64_t) at:&_duplicates];
+	
+	return self;
+}
+
+- (void)encodeWithCoder:(NSCoder *)encoder
+{
+	[encoder encodeObject:_deviceName];
+	[encoder encodeValueOfObjCType:@encode(uint64_t) at:&_kernelReceived];
+	[encoder encodeValueOfObjCType:@encode(uint64_t) at:&_kernelDropped];
+	[encoder encodeValueOfObjCType:@encode(uint64_t) at:&_interfaceDropped];
+	[encoder encodeValueOfObjCType:@encode(uint64_t) at:&_helperEnqueued];
+	[encoder encodeValueOfObjCType:@encode(uint64_t) at:&_helperShed];
+	[encoder encodeValueOfObjCType:@encode(uint64_t) at:&_helperDegraded];
+	[encoder encodeValueOfObjCType:@encode(uint64_t) at:&_transportDropped];
+	[encoder encodeValueOfObjCType:@encode(uint64_t) at:&_appIngested];
+	[encoder encodeValueOfObjCType:@encode(uint64_t) at:&_appShed];
+	[encoder encodeValueOfObjCType:@encode(uint64_t) at:&_appDegraded];
+	[encoder encodeValueOfObjCType:@encode(uint64_t) at:&_triggersFired];
+	[encoder encodeValueOfObjCType:@encode(uint64_t) at:&_recorded];
+	[encoder encodeValueOfObjCType:@encode(uint64_t) at:&_recordDropped];
+	[encoder encodeValueOfObjCType:@encode(uint64_t) at:&_sampledOut];
+	[encoder encodeValueOfObjCType:@encode(uint64_t) at:&_flowCut];
+	[encoder encodeValueOfObjCType:@encode(uint64_t) at:&_duplicates];
+}
+
+/* Always send a copy over the helper connection, never a proxy. */
+- (id)replacementObjectForPortCoder:(NSPortCoder *)encoder
+{
+	return self;
+}
+
+#pragma mark - Misc
+
+- (uint64_t)totalDropped
+{
+	return _kernelDropped+_interfaceDropped+_helperShed+_transportDropped+
+		_appShed+_recordDropped;
+}
+
+- (uint64_t)totalDegraded
+{
+	return _helperDegraded+_appDegraded;
+}
+
+- (NSString *)summary
+{
+	NSString *dropped;
+	
+	if([self totalDropped] == 0)
+		dropped = @"no drops";
+	else
+		dropped = [NSString stringWithFormat:
+				   @"%llu dropped (kernel %llu, interface %llu, shed %llu, "
+				   @"transport %llu, disk %llu)", [self totalDropped],
+				   _kernelDropped, _interfaceDropped, _helperShed+_appShed,
+				   _transportDropped, _recordDropped];
+	
+	/* Sampled out or cut on purpose, not a drop. */
+	if(_sampledOut > 0)
+		dropped = [NSString stringWithFormat:@"%@, %llu sampled out", dropped,
+				   _sampledOut];
+	if(_flowCut > 0)
+		dropped = [NSString stringWithFormat:@"%@, %llu past flow limit",
+				   dropped, _flowCut];
+	if(_duplicates > 0)
+		dropped = [NSString stringWithFormat:@"%@, %llu duplicates", dropped,
+				   _duplicates];
+	
+	if([self totalDegraded] == 0)
+		return dropped;
+	
+	return [NSString stringWithFormat:@"%@, %llu truncated", dropped,
+			[self totalDegraded]];
+}
+
+- (NSString *)description
+{
+	return [NSString stringWithFormat:
+			@"%@: received %llu, kernel dropped %llu, interface dropped %llu, "
+			@"enqueued %llu, helper shed %llu, helper truncated %llu, "
+			@"transport dropped %llu, ingested %llu, app shed %llu, "
+			@"app truncated %llu, triggers %llu, recorded %llu, "
+			@"disk dropped %llu, sampled out %llu, flow cut %llu, "
+			@"duplicates %llu",
+			_deviceName, _kernelReceived, _kernelDropped, _interfaceDropped,
+			_helperEnqueued, _helperShed, _helperDegraded, _transportDropped,
+			_appIngested, _appShed, _appDegraded, _triggersFired, _recorded,
+			_recordDropped, _sampledOut, _flowCut, _duplicates];
+}
+
+#pragma mark - Accessors
+
+@synthesize deviceName			= _deviceName;
+
+@synthesize kernelReceived		= _kernelReceived;
+@synthesize kernelDropped		= _kernelDropped;
+@synthesize interfaceDropped	= _interfaceDropped;
+@synthesize helperEnqueued		= _helperEnqueued;
+@synthesize helperShed			= _helperShed;
+@synthesize helperDegraded		= _helperDegraded;
+@synthesize transportDropped	= _transportDropped;
+@synthesize appIngested			= _appIngested;
+@synthesize appShed				= _appShed;
+@synthesize appDegraded			= _appDegraded;
+@synthesize triggersFired		= _triggersFired;
+@synthesize recorded			= _recorded;
+@synthesize recordDropped		= _recordDropped;
+@synthesize sampledOut			= _sampledOut;
+@synthesize flowCut				= _flowCut;
+@synthesize duplicates			= _duplicates;
+
+@end
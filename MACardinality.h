@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#import <Foundation/Foundation.h>
+#import <pcap/pcap.h>
+
+
+/*
+ * Distinct counts in fixed memory, for spotting scans and fan-out.
+ *
+ * Counts are HyperLogLog sketches: 2^p one byte registers, each holding
+ * the longest run of leading zeros seen in the hashes that select it.
+ * The estimate is within about 1.04/sqrt(2^p) and two sketches of the
+ * same size merge by taking the larger of each register, so sketches
+ * from different workers, files or time buckets can be combined without
+ * counting anything twice.
+ *
+ * ma_cardinality_t counts distinct hosts, flows and TCP/UDP destination
+ * ports over the whole capture and for each bucket of packet time, and
+ * distinct destinations and destination ports for each source address.
+ * Sources are kept in a fixed size table; when it is full the source
+ * seen least recently in the probed slots makes way for a new one. It
+ * is safe to feed from several threads.
+ */
+
+typedef enum
+{
+	MA_CARD_HOSTS,				/* source and destination addresses */
+	MA_CARD_FLOWS,
+	MA_CARD_PORTS,				/* protocol and destination port */
+	MA_CARD_KINDS
+} ma_card_kind_t;
+
+typedef struct ma_cardinality ma_cardinality_t;
+
+
+ma_cardinality_t *ma_cardinality_create(NSUInteger sources, int64_t bucketWidth,
+										NSUInteger buckets);
+void ma_cardinality_destroy(ma_cardinality_t *c);
+BOOL ma_cardinality_packet(ma_cardinality_t *c, int linkType,
+						   const struct pcap_pkthdr *hdr, const u_char *data);
+BOOL ma_cardinality_merge(ma_cardinality_t *dst, ma_cardinality_t *src);
+
+double ma_cardinality_estimate(ma_cardinality_t *c, ma_card_kind_t kind);
+double ma_cardinality_window(ma_cardinality_t *c, ma_card_kind_t kind,
+							 NSUInteger buckets);
+NSString *ma_cardinality_report(ma_cardinality_t *c, NSUInteger rows);
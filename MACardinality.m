@@ -0,0 +1,514 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#import "MACardinality.h"
+
+#import <arpa/inet.h>
+#import <math.h>
+#import <netinet/in.h>
+#import <pthread.h>
+#import <time.h>
+
+#import "MAFlow.h"
+#import "MARecord.h"
+
+
+#define MA_CARD_PRECISION			14		/* whole capture, 16k registers */
+#define MA_CARD_BUCKET_PRECISION	10
+#define MA_CARD_SOURCE_PRECISION	8
+#define MA_CARD_PROBES				8
+
+#define MA_HLL_SIZE(p)				((size_t)1 << (p))
+
+typedef struct
+{
+	int64_t epoch;				/* packet time / bucket width, -1 unused */
+	uint8_t registers[MA_CARD_KINDS][MA_HLL_SIZE(MA_CARD_BUCKET_PRECISION)];
+} ma_card_bucket_t;
+
+typedef struct
+{
+	u_char addr[16];
+	size_t addrLen;				/* 0 for a free slot */
+	uint64_t hash;
+	int64_t lastSeen;			/* ns */
+	uint8_t destinations[MA_HLL_SIZE(MA_CARD_SOURCE_PRECISION)];
+	uint8_t ports[MA_HLL_SIZE(MA_CARD_SOURCE_PRECISION)];
+} ma_card_source_t;
+
+struct ma_cardinality
+{
+	pthread_mutex_t lock;
+	uint8_t registers[MA_CARD_KINDS][MA_HLL_SIZE(MA_CARD_PRECISION)];
+	int64_t bucketWidth;		/* ns */
+	int64_t newest;				/* epoch */
+	NSUInteger bucketCount;
+	ma_card_bucket_t *buckets;
+	NSUInteger sourceMask;
+	ma_card_source_t *sources;
+	uint64_t evicted;			/* sources pushed out of the table */
+};
+
+
+#pragma mark - HyperLogLog
+
+/* The top p bits pick the register, the rest give the rank. */
+static void
+ma_hll_add(uint8_t *registers, int p, uint64_t hash)
+{
+	uint64_t rest = (hash << p) | ((uint64_t)1 << (p-1));
+	uint8_t rank = (uint8_t)(__builtin_clzll(rest)+1);
+	size_t i = (size_t)(hash >> (64-p));
+	
+	if(registers[i] < rank)
+		registers[i] = rank;
+}
+
+static void
+ma_hll_merge(uint8_t *dst, const uint8_t *src, int p)
+{
+	size_t i;
+	
+	for(i = 0; i < MA_HLL_SIZE(p); i++)
+		if(dst[i] < src[i])
+			dst[i] = src[i];
+}
+
+static double
+ma_hll_estimate(const uint8_t *registers, int p)
+{
+	double m = (double)MA_HLL_SIZE(p);
+	double sum = 0, estimate, alpha;
+	size_t i, zeros = 0;
+	
+	for(i = 0; i < MA_HLL_SIZE(p); i++)
+	{
+		sum += ldexp(1.0, -registers[i]);
+		if(registers[i] == 0)
+			zeros++;
+	}
+	
+	if(p == 4)
+		alpha = 0.673;
+	else if(p == 5)
+		alpha = 0.697;
+	else if(p == 6)
+		alpha = 0.709;
+	else
+		alpha = 0.7213/(1+1.079/m);
+	
+	/* Small counts are better served by linear counting. */
+	estimate = alpha*m*m/sum;
+	if(estimate <= 2.5*m && zeros > 0)
+		estimate = m*log(m/(double)zeros);
+	
+	return estimate;
+}
+
+#pragma mark - Tracking
+
+ma_cardinality_t *
+ma_cardinality_create(NSUInteger sources, int64_t bucketWidth,
+					  NSUInteger buckets)
+{
+	ma_cardinality_t *c;
+	NSUInteger i;
+	
+	if(bucketWidth <= 0 || buckets == 0 || sources < MA_CARD_PROBES ||
+	   (sources & (sources-1)))
+		return NULL;
+	
+	if(!(c = calloc(1, sizeof(*c))))
+		return NULL;
+	
+	pthread_mutex_init(&c->lock, NULL);
+	c->bucketWidth = bucketWidth;
+	c->newest = -1;
+	c->bucketCount = buckets;
+	c->sourceMask = sources-1;
+	
+	if(!(c->buckets = calloc(buckets, sizeof(*c->buckets))) ||
+	   !(c->sources = calloc(sources, sizeof(*c->sources))))
+	{
+		NSLog(@"%s(): no memory for %lu buckets and %lu sources", __func__,
+			  (unsigned long)buckets, (unsigned long)sources);
+		ma_cardinality_destroy(c);
+		return NULL;
+	}
+	
+	for(i = 0; i < buckets; i++)
+		c->buckets[i].epoch = -1;
+	
+	return c;
+}
+
+void
+ma_cardinality_destroy(ma_cardinality_t *c)
+{
+	if(c == NULL)
+		return;
+	
+	free(c->buckets);
+	free(c->sources);
+	pthread_mutex_destroy(&c->lock);
+	free(c);
+}
+
+static ma_card_bucket_t *
+ma_cardinality_bucket(ma_cardinality_t *c, int64_t epoch)
+{
+	ma_card_bucket_t *b;
+	
+	if(epoch > c->newest)
+		c->newest = epoch;
+	if(epoch <= c->newest-(int64_t)c->bucketCount)
+		return NULL;
+	
+	b = &c->buckets[epoch % (int64_t)c->bucketCount];
+	if(b->epoch != epoch)
+	{
+		memset(b->registers, 0, sizeof(b->registers));
+		b->epoch = epoch;
+	}
+	
+	return b;
+}
+
+/*
+ * The table entry for a source, taking over the stalest probed slot if
+ * it isn't there. lastSeen of a new entry is left for the caller.
+ */
+static ma_card_source_t *
+ma_cardinality_source(ma_cardinality_t *c, const u_char *addr, size_t addrLen,
+					  uint64_t hash)
+{
+	ma_card_source_t *s, *victim = NULL;
+	NSUInteger i;
+	
+	for(i = 0; i < MA_CARD_PROBES; i++)
+	{
+		s = &c->sources[(hash+i) & c->sourceMask];
+		
+		if(s->addrLen == addrLen && s->hash == hash &&
+		   memcmp(s->addr, addr, addrLen) == 0)
+			return s;
+		
+		if(victim == NULL || (victim->addrLen &&
+							  (s->addrLen == 0 || s->lastSeen < victim->lastSeen)))
+			victim = s;
+	}
+	
+	if(victim->addrLen)
+		c->evicted++;
+	
+	memset(victim, 0, sizeof(*victim));
+	memcpy(victim->addr, addr, addrLen);
+	victim->addrLen = addrLen;
+	victim->hash = hash;
+	
+	return victim;
+}
+
+/* Counts an IP packet, anything else is ignored. */
+BOOL
+ma_cardinality_packet(ma_cardinality_t *c, int linkType,
+					  const struct pcap_pkthdr *hdr, const u_char *data)
+{
+	ma_card_bucket_t *b;
+	ma_card_source_t *s;
+	ma_flow_t flow;
+	u_char port[3];
+	uint64_t src, dst, service = 0, conn;
+	int64_t ts = ma_pkthdr_ns(hdr);
+	BOOL hasPort;
+	
+	if(!ma_flow_parse(linkType, hdr, data, &flow))
+		return NO;
+	
+	src = ma_flow_hash(ma_flow_src(&flow), flow.addrLen);
+	dst = ma_flow_hash(ma_flow_dst(&flow), flow.addrLen);
+	conn = ma_flow_hash(flow.key, flow.keyLen);
+	
+	port[0] = flow.ipProto;
+	memcpy(port+1, ma_flow_dst(&flow)+flow.addrLen, 2);
+	if((hasPort = (port[1] || port[2])))
+		service = ma_flow_hash(port, sizeof(port));
+	
+	pthread_mutex_lock(&c->lock);
+	ma_hll_add(c->registers[MA_CARD_HOSTS], MA_CARD_PRECISION, src);
+	ma_hll_add(c->registers[MA_CARD_HOSTS], MA_CARD_PRECISION, dst);
+	ma_hll_add(c->registers[MA_CARD_FLOWS], MA_CARD_PRECISION, conn);
+	if(hasPort)
+		ma_hll_add(c->registers[MA_CARD_PORTS], MA_CARD_PRECISION, service);
+	
+	if((b = ma_cardinality_bucket(c, MAX(ts, 0)/c->bucketWidth)))
+	{
+		ma_hll_add(b->registers[MA_CARD_HOSTS], MA_CARD_BUCKET_PRECISION, src);
+		ma_hll_add(b->registers[MA_CARD_HOSTS], MA_CARD_BUCKET_PRECISION, dst);
+		ma_hll_add(b->registers[MA_CARD_FLOWS], MA_CARD_BUCKET_PRECISION, conn);
+		if(hasPort)
+			ma_hll_add(b->registers[MA_CARD_PORTS], MA_CARD_BUCKET_PRECISION,
+					   service);
+	}
+	
+	s = ma_cardinality_source(c, ma_flow_src(&flow), flow.addrLen, src);
+	s->lastSeen = MAX(s->lastSeen, ts);
+	ma_hll_add(s->destinations, MA_CARD_SOURCE_PRECISION, dst);
+	if(hasPort)
+		ma_hll_add(s->ports, MA_CARD_SOURCE_PRECISION, service);
+	pthread_mutex_unlock(&c->lock);
+	
+	return YES;
+}
+
+/*
+ * Folds src into dst, they must have been created alike. Buckets src
+ * has for times dst has already moved past are left out of dst's
+ * buckets, they still count in the whole capture.
+ */
+BOOL
+ma_cardinality_merge(ma_cardinality_t *dst, ma_cardinality_t *src)
+{
+	ma_card_bucket_t *from, *to;
+	ma_card_source_t *s, *into;
+	NSUInteger i;
+	int k;
+	
+	if(dst == src || dst->bucketWidth != src->bucketWidth ||
+	   dst->bucketCount != src->bucketCount ||
+	   dst->sourceMask != src->sourceMask)
+		return NO;
+	
+	pthread_mutex_lock(&src->lock);
+	pthread_mutex_lock(&dst->lock);
+	
+	for(k = 0; k < MA_CARD_KINDS; k++)
+		ma_hll_merge(dst->registers[k], src->registers[k], MA_CARD_PRECISION);
+	
+	for(i = 0; i < src->bucketCount; i++)
+	{
+		from = &src->buckets[i];
+		if(from->epoch < 0 || !(to = ma_cardinality_bucket(dst, from->epoch)))
+			continue;
+		
+		for(k = 0; k < MA_CARD_KINDS; k++)
+			ma_hll_merge(to->registers[k], from->registers[k],
+						 MA_CARD_BUCKET_PRECISION);
+	}
+	
+	for(i = 0; i <= src->sourceMask; i++)
+	{
+		s = &src->sources[i];
+		if(s->addrLen == 0)
+			continue;
+		
+		into = ma_cardinality_source(dst, s->addr, s->addrLen, s->hash);
+		into->lastSeen = MAX(into->lastSeen, s->lastSeen);
+		ma_hll_merge(into->destinations, s->destinations,
+					 MA_CARD_SOURCE_PRECISION);
+		ma_hll_merge(into->ports, s->ports, MA_CARD_SOURCE_PRECISION);
+	}
+	dst->evicted += src->evicted;
+	
+	pthread_mutex_unlock(&dst->lock);
+	pthread_mutex_unlock(&src->lock);
+	
+	return YES;
+}
+
+#pragma mark - Queries
+
+double
+ma_cardinality_estimate(ma_cardinality_t *c, ma_card_kind_t kind)
+{
+	double estimate;
+	
+	pthread_mutex_lock(&c->lock);
+	estimate = ma_hll_estimate(c->registers[kind], MA_CARD_PRECISION);
+	pthread_mutex_unlock(&c->lock);
+	
+	return estimate;
+}
+
+/* Distinct over the newest buckets, up to the packet time last seen. */
+double
+ma_cardinality_window(ma_cardinality_t *c, ma_card_kind_t kind,
+					  NSUInteger buckets)
+{
+	uint8_t registers[MA_HLL_SIZE(MA_CARD_BUCKET_PRECISION)] = {0};
+	NSUInteger i;
+	
+	buckets = MIN(buckets, c->bucketCount);
+	
+	pthread_mutex_lock(&c->lock);
+	for(i = 0; i < c->bucketCount; i++)
+	{
+		if(c->buckets[i].epoch >= 0 &&
+		   c->buckets[i].epoch > c->newest-(int64_t)buckets)
+			ma_hll_merge(registers, c->buckets[i].registers[kind],
+						 MA_CARD_BUCKET_PRECISION);
+	}
+	pthread_mutex_unlock(&c->lock);
+	
+	return ma_hll_estimate(registers, MA_CARD_BUCKET_PRECISION);
+}
+
+typedef struct
+{
+	ma_card_source_t *source;
+	double destinations;
+	double ports;
+} ma_card_rank_t;
+
+static int
+ma_card_compare_destinations(const void *a, const void *b)
+{
+	double da = ((const ma_card_rank_t *)a)->destinations;
+	double db = ((const ma_card_rank_t *)b)->destinations;
+	
+	return (da < db) - (da > db);
+}
+
+static int
+ma_card_compare_ports(const void *a, const void *b)
+{
+	double pa = ((const ma_card_rank_t *)a)->ports;
+	double pb = ((const ma_card_rank_t *)b)->ports;
+	
+	return (pa < pb) - (pa > pb);
+}
+
+static void
+ma_cardinality_report_sources(NSMutableString *report, ma_card_rank_t *ranks,
+							  NSUInteger n, NSUInteger rows, BOOL byPorts)
+{
+	char addr[INET6_ADDRSTRLEN];
+	ma_card_source_t *s;
+	NSUInteger i;
+	
+	qsort(ranks, n, sizeof(*ranks),
+		  (byPorts ? ma_card_compare_ports : ma_card_compare_destinations));
+	
+	[report appendFormat:@"\n%-40s %14s %14s\n",
+	 (byPorts ? "sources by destination ports" : "sources by destinations"),
+	 "destinations", "ports"];
+	for(i = 0; i < n && i < rows; i++)
+	{
+		s = ranks[i].source;
+		if(!inet_ntop((s->addrLen == 4 ? AF_INET : AF_INET6), s->addr, addr,
+					  sizeof(addr)))
+			continue;
+		
+		[report appendFormat:@"%-40s %14.0f %14.0f\n", addr,
+		 ranks[i].destinations, ranks[i].ports];
+	}
+}
+
+NSString *
+ma_cardinality_report(ma_cardinality_t *c, NSUInteger rows)
+{
+	static const char *kinds[MA_CARD_KINDS] = {
+		[MA_CARD_HOSTS]		= "hosts",
+		[MA_CARD_FLOWS]		= "flows",
+		[MA_CARD_PORTS]		= "ports"
+	};
+	NSMutableString *report = [NSMutableString string];
+	double width = (double)c->bucketWidth/MA_NSEC_PER_SEC;
+	ma_card_rank_t *ranks;
+	ma_card_bucket_t *b;
+	char when[32];
+	time_t start;
+	struct tm tm;
+	NSUInteger i, n = 0;
+	int64_t epoch;
+	int k;
+	
+	[report appendFormat:@"%-12s %14s %14s %14s\n", "distinct", "capture",
+	 [[NSString stringWithFormat:@"last %.0f s", width*c->bucketCount]
+	  UTF8String],
+	 [[NSString stringWithFormat:@"last %.0f s", width] UTF8String]];
+	for(k = 0; k < MA_CARD_KINDS; k++)
+	{
+		[report appendFormat:@"%-12s %14.0f %14.0f %14.0f\n", kinds[k],
+		 ma_cardinality_estimate(c, k),
+		 ma_cardinality_window(c, k, c->bucketCount),
+		 ma_cardinality_window(c, k, 1)];
+	}
+	
+	pthread_mutex_lock(&c->lock);
+	
+	/* Newest bucket first. */
+	[report appendFormat:@"\n%-12s %14s %14s %14s\n", "bucket", kinds[0],
+	 kinds[1], kinds[2]];
+	for(epoch = c->newest; epoch >= 0 &&
+		epoch > c->newest-(int64_t)c->bucketCount; epoch--)
+	{
+		b = &c->buckets[epoch % (int64_t)c->bucketCount];
+		if(b->epoch != epoch)
+			continue;
+		
+		start = (time_t)(epoch*c->bucketWidth/MA_NSEC_PER_SEC);
+		localtime_r(&start, &tm);
+		strftime(when, sizeof(when), "%H:%M:%S", &tm);
+		[report appendFormat:@"%-12s %14.0f %14.0f %14.0f\n", when,
+		 ma_hll_estimate(b->registers[MA_CARD_HOSTS], MA_CARD_BUCKET_PRECISION),
+		 ma_hll_estimate(b->registers[MA_CARD_FLOWS], MA_CARD_BUCKET_PRECISION),
+		 ma_hll_estimate(b->registers[MA_CARD_PORTS], MA_CARD_BUCKET_PRECISION)];
+	}
+	
+	if((ranks = malloc((c->sourceMask+1)*sizeof(*ranks))))
+	{
+		for(i = 0; i <= c->sourceMask; i++)
+		{
+			if(c->sources[i].addrLen == 0)
+				continue;
+			
+			ranks[n].source = &c->sources[i];
+			ranks[n].destinations =
+				ma_hll_estimate(c->sources[i].destinations,
+								MA_CARD_SOURCE_PRECISION);
+			ranks[n].ports = ma_hll_estimate(c->sources[i].ports,
+											 MA_CARD_SOURCE_PRECISION);
+			n++;
+		}
+		
+		ma_cardinality_report_sources(report, ranks, n, rows, NO);
+		ma_cardinality_report_sources(report, ranks, n, rows, YES);
+		free(ranks);
+	}
+	
+	if(c->evicted)
+		[report appendFormat:@"\n%llu sources pushed out of the table\n",
+		 c->evicted];
+	pthread_mutex_unlock(&c->lock);
+	
+	return report;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+#import <pcap/pcap.h>
+
+
+/*
+ * Duplicate packet detection, for SPAN ports and overlapping taps that
+ * deliver the same frame more than once.
+ *
+ * A packet is hashed from its network header on, with the IPv4 TTL and
+ * header checksum or the IPv6 hop limit zeroed so copies taken either
+ * side of a router still match; the link header is left out since VLAN
+ * tags and MAC addresses differ between copies. Only the first
+ * MA_DEDUP_HASH_BYTES are hashed, along with the wire length. Anything
+ * that isn't IP is hashed whole.
+ *
+ * Hashes are kept in a fixed size open addressing table, each stamped
+ * with the time bucket (a quarter of the window) it was seen in, so
+ * entries older than the window are simply overwritten.
+ */
+
+#define MA_DEDUP_HASH_BYTES		128
+
+typedef enum
+{
+	MA_DEDUP_OFF,
+	MA_DEDUP_DROP,
+	MA_DEDUP_MARK				/* keep it, with a sample weight of 0 */
+} ma_dedup_mode_t;
+
+typedef struct ma_dedup ma_dedup_t;
+
+
+ma_dedup_t *ma_dedup_create(NSUInteger tableSize, int64_t window);
+void ma_dedup_destroy(ma_dedup_t *d);
+BOOL ma_dedup_packet(ma_dedup_t *d, int linkType, const struct pcap_pkthdr *hdr,
+					 const u_char *data);
+uint64_t ma_dedup_count(ma_dedup_t *d);
+
+ma_dedup_mode_t ma_dedup_mode_from_string(NSString *name);
+NSString *ma_dedup_mode_name(ma_dedup_mode_t mode);
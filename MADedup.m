@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import "MADedup.h"
+
+#import "MAFlow.h"
+#import "MARecord.h"
+
+
+#define MA_DEDUP_BUCKETS		4		/* per window */
+#define MA_DEDUP_PROBES			8
+
+typedef struct
+{
+	uint64_t hash;				/* 0 for a free slot */
+	int64_t bucket;
+} ma_dedup_entry_t;
+
+struct ma_dedup
+{
+	int64_t bucketWidth;		/* ns */
+	NSUInteger mask;
+	ma_dedup_entry_t *table;
+	uint64_t duplicates;
+};
+
+
+ma_dedup_t *
+ma_dedup_create(NSUInteger tableSize, int64_t window)
+{
+	ma_dedup_t *d;
+	
+	if(window <= 0 || tableSize < MA_DEDUP_PROBES ||
+	   (tableSize & (tableSize-1)))
+		return NULL;
+	
+	if(!(d = calloc(1, sizeof(*d))))
+		return NULL;
+	
+	d->bucketWidth = MAX(window/MA_DEDUP_BUCKETS, 1);
+	d->mask = tableSize-1;
+	
+	if(!(d->table = calloc(tableSize, sizeof(*d->table))))
+	{
+		NSLog(@"%s(): no memory for %lu hashes", __func__,
+			  (unsigned long)tableSize);
+		free(d);
+		return NULL;
+	}
+	
+	return d;
+}
+
+void
+ma_dedup_destroy(ma_dedup_t *d)
+{
+	if(d == NULL)
+		return;
+	
+	free(d->table);
+	free(d);
+}
+
+/* MurmurHash64A */
+static uint64_t
+ma_dedup_murmur(const u_char *p, size_t len, uint64_t seed)
+{
+	const uint64_t m = 0xC6A4A7935BD1E995ULL;
+	const u_char *end = p+(len & ~(size_t)7);
+	uint64_t h = seed ^ (len*m);
+	uint64_t k;
+	
+	for(; p != end; p += 8)
+	{
+		memcpy(&k, p, sizeof(k));
+		k *= m;
+		k ^= k >> 47;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
+	
+	switch(len & 7)
+	{
+		case 7: h ^= (uint64_t)p[6] << 48;
+		case 6: h ^= (uint64_t)p[5] << 40;
+		case 5: h ^= (uint64_t)p[4] << 32;
+		case 4: h ^= (uint64_t)p[3] << 24;
+		case 3: h ^= (uint64_t)p[2] << 16;
+		case 2: h ^= (uint64_t)p[1] << 8;
+		case 1: h ^= (uint64_t)p[0];
+			h *= m;
+	}
+	
+	h ^= h >> 47;
+	h *= m;
+	h ^= h >> 47;
+	
+	return h;
+}
+
+static uint64_t
+ma_dedup_hash(int linkType, const struct pcap_pkthdr *hdr, const u_char *data)
+{
+	u_char buf[MA_DEDUP_HASH_BYTES];
+	uint16_t proto;
+	size_t len;
+	int off;
+	
+	if((off = ma_flow_network(linkType, data, hdr->caplen, &proto)) < 0 ||
+	   (proto != 0x0800 && proto != 0x86DD))
+		return ma_dedup_murmur(data, MIN(hdr->caplen, MA_DEDUP_HASH_BYTES),
+							   hdr->len);
+	
+	len = MIN(hdr->caplen-off, MA_DEDUP_HASH_BYTES);
+	memcpy(buf, data+off, len);
+	
+	if(proto == 0x0800 && len >= 12)
+	{
+		buf[8] = 0;
+		buf[10] = 0;
+		buf[11] = 0;
+	}
+	else if(proto == 0x86DD && len >= 8)
+		buf[7] = 0;
+	
+	return ma_dedup_murmur(buf, len, hdr->len-off);
+}
+
+/*
+ * YES if the same packet was seen within the window, otherwise it is
+ * remembered. Packets are expected in roughly time order; a copy that
+ * arrives a little earlier than the original still matches.
+ */
+BOOL
+ma_dedup_packet(ma_dedup_t *d, int linkType, const struct pcap_pkthdr *hdr,
+				const u_char *data)
+{
+	uint64_t hash = ma_dedup_hash(linkType, hdr, data);
+	int64_t bucket = ma_pkthdr_ns(hdr)/d->bucketWidth;
+	ma_dedup_entry_t *spare = NULL;
+	ma_dedup_entry_t *oldest = NULL;
+	ma_dedup_entry_t *e;
+	NSUInteger i;
+	
+	/* Zero marks a free slot. */
+	if(hash == 0)
+		hash = 1;
+	
+	for(i = 0; i < MA_DEDUP_PROBES; i++)
+	{
+		int64_t age;
+		
+		e = &d->table[(hash+i) & d->mask];
+		age = bucket-e->bucket;
+		
+		/* Free, or too old to count. */
+		if(e->hash == 0 || age > MA_DEDUP_BUCKETS || age < -MA_DEDUP_BUCKETS)
+		{
+			if(spare == NULL)
+				spare = e;
+			continue;
+		}
+		
+		if(e->hash == hash)
+		{
+			d->duplicates++;
+			return YES;
+		}
+		
+		if(oldest == NULL || e->bucket < oldest->bucket)
+			oldest = e;
+	}
+	
+	if(spare == NULL)
+		spare = oldest;
+	spare->hash = hash;
+	spare->bucket = bucket;
+	
+	return NO;
+}
+
+uint64_t
+ma_dedup_count(ma_dedup_t *d)
+{
+	return d->duplicates;
+}
+
+ma_dedup_mode_t
+ma_dedup_mode_from_string(NSString *name)
+{
+	if([name isEqualToString:@"drop"])
+		return MA_DEDUP_DROP;
+	else if([name isEqualToString:@"mark"])
+		return MA_DEDUP_MARK;
+	
+	return MA_DEDUP_OFF;
+}
+
+NSString *
+ma_dedup_mode_name(ma_dedup_mode_t mode)
+{
+	switch(mode)
+	{
+		case MA_DEDUP_DROP:
+			return @"drop";
+		case MA_DEDUP_MARK:
+			return @"mark";
+		default:
+			return @"off";
+	}
+}
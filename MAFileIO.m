@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import "MAFileIO.h"
+
+#import <errno.h>
+#import <unistd.h>
+
+
+static BOOL ownerSet;
+static uid_t ownerUID;
+static gid_t ownerGID;
+
+
+BOOL
+ma_write_all(int fd, const void *buf, size_t size)
+{
+	const u_char *p = buf;
+	ssize_t written;
+	
+	while(size > 0)
+	{
+		if((written = write(fd, p, size)) == -1)
+		{
+			if(errno == EINTR)
+				continue;
+			return NO;
+		}
+		
+		p += written;
+		size -= written;
+	}
+	
+	return YES;
+}
+
+BOOL
+ma_pread_all(int fd, void *buf, size_t size, off_t offset)
+{
+	u_char *p = buf;
+	ssize_t got;
+	
+	while(size > 0)
+	{
+		if((got = pread(fd, p, size, offset)) <= 0)
+		{
+			if(got == -1 && errno == EINTR)
+				continue;
+			return NO;
+		}
+		
+		p += got;
+		size -= got;
+		offset += got;
+	}
+	
+	return YES;
+}
+
+void
+ma_file_set_owner(uid_t uid, gid_t gid)
+{
+	ownerUID = uid;
+	ownerGID = gid;
+	ownerSet = YES;
+}
+
+/* Hand a file we just created to the owner, if one was set. */
+void
+ma_file_own(int fd)
+{
+	if(ownerSet && fchown(fd, ownerUID, ownerGID) == -1)
+		NSLog(@"%s(): %s", __func__, strerror(errno));
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+#import <pcap/pcap.h>
+
+
+/*
+ * The flow a captured packet belongs to. The key is the IP protocol then
+ * the address and port of either end, lower end first, so both
+ * directions of a connection have the same key and hash. Ports are zero
+ * for protocols without them and for IPv4 fragments, the later ones
+ * don't carry them.
+ */
+
+#define MA_FLOW_KEY_SIZE		(1+2*(16+2))
+
+/* TCP flags */
+#define MA_TCP_FIN				0x01
+#define MA_TCP_SYN				0x02
+#define MA_TCP_RST				0x04
+#define MA_TCP_ACK				0x10
+
+typedef struct
+{
+	u_char key[MA_FLOW_KEY_SIZE];
+	size_t keyLen;
+	uint64_t hash;
+	u_char ipProto;
+	u_char tcpFlags;			/* 0 unless TCP */
+	size_t headerLen;			/* link, network and transport headers */
+	size_t addrLen;				/* 4 or 16 */
+	BOOL reversed;				/* the source is the higher end of the key */
+} ma_flow_t;
+
+/* Address of one end of the key, its port follows. */
+#define ma_flow_end(f, i)		((f)->key+1+(i)*((f)->addrLen+2))
+#define ma_flow_src(f)			ma_flow_end(f, (f)->reversed)
+#define ma_flow_dst(f)			ma_flow_end(f, !(f)->reversed)
+
+
+int ma_flow_network(int linkType, const u_char *data, bpf_u_int32 caplen,
+					uint16_t *proto);
+BOOL ma_flow_parse(int linkType, const struct pcap_pkthdr *hdr,
+				   const u_char *data, ma_flow_t *flow);
+NSString *ma_flow_key_string(const u_char *key, size_t keyLen);
+uint64_t ma_flow_hash(const u_char *key, size_t keyLen);
@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import "MAFlow.h"
+
+#import <arpa/inet.h>
+#import <netinet/in.h>
+
+
+/*
+ * Offset of the network header for the link types we capture on, -1 if
+ * there isn't one we know. proto is set to the ethertype.
+ */
+int
+ma_flow_network(int linkType, const u_char *data, bpf_u_int32 caplen,
+				uint16_t *proto)
+{
+	uint32_t family;
+	
+	switch(linkType)
+	{
+		case DLT_EN10MB:
+			if(caplen < 14)
+				return -1;
+			*proto = (uint16_t)(data[12] << 8 | data[13]);
+			
+			/* One VLAN tag. */
+			if(*proto == 0x8100)
+			{
+				if(caplen < 18)
+					return -1;
+				*proto = (uint16_t)(data[16] << 8 | data[17]);
+				return 18;
+			}
+			return 14;
+			
+		case DLT_NULL:
+		case DLT_LOOP:
+			if(caplen < 4)
+				return -1;
+			memcpy(&family, data, sizeof(family));
+			if(linkType == DLT_LOOP)
+				family = ntohl(family);
+			
+			if(family == AF_INET)
+				*proto = 0x0800;
+			else if(family == AF_INET6)
+				*proto = 0x86DD;
+			else
+				return -1;
+			return 4;
+			
+		case DLT_RAW:
+			if(caplen < 1)
+				return -1;
+			*proto = ((data[0] >> 4) == 6 ? 0x86DD : 0x0800);
+			return 0;
+			
+		default:
+			return -1;
+	}
+}
+
+/*
+ * Find the flow of an IP packet. NO if it isn't IP or its headers are
+ * cut short.
+ */
+BOOL
+ma_flow_parse(int linkType, const struct pcap_pkthdr *hdr, const u_char *data,
+			  ma_flow_t *flow)
+{
+	const u_char *ip;
+	const u_char *ends[2];
+	u_char ports[2][2] = {{0, 0}, {0, 0}};
+	size_t addrLen, ipLen, l4;
+	uint16_t proto;
+	int off, lo;
+	size_t n = 0;
+	
+	if((off = ma_flow_network(linkType, data, hdr->caplen, &proto)) < 0)
+		return NO;
+	ip = data+off;
+	
+	if(proto == 0x0800)
+	{
+		if(hdr->caplen < (size_t)off+20 || (ip[0] >> 4) != 4)
+			return NO;
+		flow->ipProto = ip[9];
+		ends[0] = ip+12;
+		ends[1] = ip+16;
+		addrLen = 4;
+		ipLen = (size_t)(ip[0] & 0x0F)*4;
+		l4 = ipLen;
+		
+		/* More fragments or a fragment offset. */
+		if((ip[6] & 0x3F) || ip[7])
+			l4 = 0;
+	}
+	else if(proto == 0x86DD)
+	{
+		if(hdr->caplen < (size_t)off+40 || (ip[0] >> 4) != 6)
+			return NO;
+		flow->ipProto = ip[6];
+		ends[0] = ip+8;
+		ends[1] = ip+24;
+		addrLen = 16;
+		ipLen = 40;
+		l4 = ipLen;
+	}
+	else
+		return NO;
+	
+	flow->tcpFlags = 0;
+	flow->headerLen = off+ipLen;
+	
+	if(l4 && (flow->ipProto == IPPROTO_TCP || flow->ipProto == IPPROTO_UDP) &&
+	   hdr->caplen >= off+l4+4)
+	{
+		memcpy(ports[0], ip+l4, 2);
+		memcpy(ports[1], ip+l4+2, 2);
+		
+		if(flow->ipProto == IPPROTO_UDP)
+			flow->headerLen = off+l4+8;
+		else if(hdr->caplen >= off+l4+14)
+		{
+			flow->tcpFlags = ip[l4+13];
+			flow->headerLen = off+l4+(size_t)(ip[l4+12] >> 4)*4;
+		}
+	}
+	
+	/* Lower end first, so both directions build the same key. */
+	lo = memcmp(ends[0], ends[1], addrLen);
+	if(lo == 0)
+		lo = memcmp(ports[0], ports[1], 2);
+	lo = (lo > 0 ? 1 : 0);
+	flow->addrLen = addrLen;
+	flow->reversed = lo;
+	
+	flow->key[n++] = flow->ipProto;
+	memcpy(flow->key+n, ends[lo], addrLen);
+	n += addrLen;
+	memcpy(flow->key+n, ports[lo], 2);
+	n += 2;
+	memcpy(flow->key+n, ends[!lo], addrLen);
+	n += addrLen;
+	memcpy(flow->key+n, ports[!lo], 2);
+	n += 2;
+	flow->keyLen = n;
+	
+	flow->hash = ma_flow_hash(flow->key, n);
+	
+	return YES;
+}
+
+/*
+ * FNV-1a, then the MurmurHash3 finalizer so every bit is good: hash
+ * tables use the low ones, HyperLogLog all of them.
+ */
+uint64_t
+ma_flow_hash(const u_char *key, size_t keyLen)
+{
+	uint64_t hash = 0xCBF29CE484222325ULL;
+	size_t i;
+	
+	for(i = 0; i < keyLen; i++)
+		hash = (hash ^ key[i])*0x100000001B3ULL;
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDULL;
+	hash ^= hash >> 33;
+	hash *= 0xC4CEB9FE1A85EC53ULL;
+	hash ^= hash >> 33;
+	
+	return hash;
+}
+
+/* "tcp 10.0.0.1:80 <-> 10.0.0.2:51000", from a key built above. */
+NSString *
+ma_flow_key_string(const u_char *key, size_t keyLen)
+{
+	char a[INET6_ADDRSTRLEN], b[INET6_ADDRSTRLEN];
+	char proto[8];
+	size_t addrLen = (keyLen-1)/2-2;
+	const u_char *ends[2] = {key+1, key+1+addrLen+2};
+	int family = (addrLen == 4 ? AF_INET : AF_INET6);
+	
+	if((addrLen != 4 && addrLen != 16) ||
+	   !inet_ntop(family, ends[0], a, sizeof(a)) ||
+	   !inet_ntop(family, ends[1], b, sizeof(b)))
+		return @"<Unknown>";
+	
+	if(key[0] == IPPROTO_TCP)
+		strlcpy(proto, "tcp", sizeof(proto));
+	else if(key[0] == IPPROTO_UDP)
+		strlcpy(proto, "udp", sizeof(proto));
+	else
+		return [NSString stringWithFormat:@"ip/%u %s <-> %s",
+				(unsigned)key[0], a, b];
+	
+	return [NSString stringWithFormat:
+			(family == AF_INET ? @"%s %s:%u <-> %s:%u" :
+			 @"%s [%s]:%u <-> [%s]:%u"), proto,
+			a, (unsigned)(ends[0][addrLen] << 8 | ends[0][addrLen+1]),
+			b, (unsigned)(ends[1][addrLen] << 8 | ends[1][addrLen+1])];
+}
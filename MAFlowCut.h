@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+#import <pcap/pcap.h>
+
+
+/*
+ * Per-flow truncation for one capture session. The first packets
+ * packets or bytes bytes of wire data of each flow, whichever limit comes
+ * first, are kept whole; after that only the headers are kept, or
+ * nothing. TCP SYN, FIN and RST segments are always kept whole and a SYN
+ * without ACK starts the flow over. Anything that isn't IP passes
+ * untouched.
+ *
+ * Flows live in a fixed size open addressing table, allocated up front,
+ * keyed by the flow hash alone. A flow is forgotten after idle
+ * nanoseconds without packets, or evicted when its neighbourhood in the
+ * table is full; either way it starts over if it comes back.
+ */
+
+typedef struct
+{
+	uint32_t packets;			/* 0 for no packet limit */
+	uint64_t bytes;				/* 0 for no byte limit */
+	BOOL headersOnly;			/* else drop past the limit */
+	NSUInteger tableSize;		/* flows, a power of 2 */
+	int64_t idle;				/* ns */
+	int linkType;
+} ma_flowcut_config_t;
+
+typedef struct
+{
+	uint64_t truncated;
+	uint64_t dropped;
+	uint64_t evicted;
+} ma_flowcut_stats_t;
+
+typedef struct ma_flowcut ma_flowcut_t;
+
+
+ma_flowcut_t *ma_flowcut_create(const ma_flowcut_config_t *config);
+void ma_flowcut_destroy(ma_flowcut_t *c);
+BOOL ma_flowcut_packet(ma_flowcut_t *c, const struct pcap_pkthdr *hdr,
+					   const u_char *data, bpf_u_int32 *caplen);
+void ma_flowcut_stats(ma_flowcut_t *c, ma_flowcut_stats_t *stats);
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import "MAFlowCut.h"
+
+#import "MAFlow.h"
+#import "MARecord.h"
+
+
+/* Slots looked at for a flow before the stalest one is evicted. */
+#define MA_FLOWCUT_PROBES		8
+
+typedef struct
+{
+	uint64_t hash;				/* 0 for a free slot */
+	uint64_t bytes;
+	uint32_t packets;
+	uint32_t lastSeen;			/* seconds */
+} ma_flowcut_entry_t;
+
+struct ma_flowcut
+{
+	ma_flowcut_config_t config;
+	uint32_t idle;				/* seconds */
+	NSUInteger mask;
+	ma_flowcut_entry_t *table;
+	ma_flowcut_stats_t stats;
+};
+
+
+ma_flowcut_t *
+ma_flowcut_create(const ma_flowcut_config_t *config)
+{
+	ma_flowcut_t *c;
+	
+	if((config->packets == 0 && config->bytes == 0) ||
+	   config->tableSize < MA_FLOWCUT_PROBES ||
+	   (config->tableSize & (config->tableSize-1)))
+		return NULL;
+	
+	if(!(c = calloc(1, sizeof(*c))))
+		return NULL;
+	
+	c->config = *config;
+	c->idle = (uint32_t)MAX(config->idle/MA_NSEC_PER_SEC, 1);
+	c->mask = config->tableSize-1;
+	
+	if(!(c->table = calloc(config->tableSize, sizeof(*c->table))))
+	{
+		NSLog(@"%s(): no memory for %lu flows", __func__,
+			  (unsigned long)config->tableSize);
+		free(c);
+		return NULL;
+	}
+	
+	return c;
+}
+
+void
+ma_flowcut_destroy(ma_flowcut_t *c)
+{
+	if(c == NULL)
+		return;
+	
+	free(c->table);
+	free(c);
+}
+
+/*
+ * The flow's slot, taking a free or idle one or evicting the stalest
+ * around it if the flow is new.
+ */
+static ma_flowcut_entry_t *
+ma_flowcut_lookup(ma_flowcut_t *c, uint64_t hash, uint32_t now)
+{
+	ma_flowcut_entry_t *e;
+	ma_flowcut_entry_t *spare = NULL;
+	ma_flowcut_entry_t *stalest = NULL;
+	NSUInteger i;
+	
+	for(i = 0; i < MA_FLOWCUT_PROBES; i++)
+	{
+		e = &c->table[(hash+i) & c->mask];
+		
+		if(e->hash == hash)
+			return e;
+		
+		if(e->hash == 0 || (now > e->lastSeen && now-e->lastSeen > c->idle))
+		{
+			if(spare == NULL)
+				spare = e;
+		}
+		else if(stalest == NULL || e->lastSeen < stalest->lastSeen)
+			stalest = e;
+	}
+	
+	if(spare == NULL)
+	{
+		spare = stalest;
+		c->stats.evicted++;
+	}
+	
+	spare->hash = hash;
+	spare->bytes = 0;
+	spare->packets = 0;
+	
+	return spare;
+}
+
+/*
+ * Decide on one packet. Returns NO to drop it, otherwise caplen is set
+ * to how much of it to keep.
+ */
+BOOL
+ma_flowcut_packet(ma_flowcut_t *c, const struct pcap_pkthdr *hdr,
+				  const u_char *data, bpf_u_int32 *caplen)
+{
+	ma_flowcut_entry_t *e;
+	ma_flow_t flow;
+	uint64_t before;
+	uint32_t now = (uint32_t)hdr->ts.tv_sec;
+	BOOL over;
+	
+	*caplen = hdr->caplen;
+	
+	if(!ma_flow_parse(c->config.linkType, hdr, data, &flow))
+		return YES;
+	
+	/* Zero marks a free slot. */
+	e = ma_flowcut_lookup(c, (flow.hash ? flow.hash : 1), now);
+	
+	if((flow.tcpFlags & (MA_TCP_SYN|MA_TCP_ACK)) == MA_TCP_SYN)
+	{
+		e->bytes = 0;
+		e->packets = 0;
+	}
+	
+	before = e->bytes;
+	e->bytes += hdr->len;
+	e->packets++;
+	e->lastSeen = now;
+	
+	if(flow.tcpFlags & (MA_TCP_SYN|MA_TCP_FIN|MA_TCP_RST))
+		return YES;
+	
+	over = ((c->config.packets && e->packets > c->config.packets) ||
+			(c->config.bytes && before >= c->config.bytes));
+	if(!over)
+		return YES;
+	
+	if(!c->config.headersOnly)
+	{
+		c->stats.dropped++;
+		return NO;
+	}
+	
+	if(flow.headerLen < hdr->caplen)
+	{
+		*caplen = (bpf_u_int32)flow.headerLen;
+		c->stats.truncated++;
+	}
+	
+	return YES;
+}
+
+void
+ma_flowcut_stats(ma_flowcut_t *c, ma_flowcut_stats_t *stats)
+{
+	*stats = c->stats;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+
+
+/*
+ * Log-linear (HDR style) histogram of 64-bit values.
+ *
+ * Values below 2^MA_HISTOGRAM_SUB_BITS are counted exactly, larger values
+ * fall into one of 2^MA_HISTOGRAM_SUB_BITS linear sub-buckets of their
+ * power of two, which bounds the relative error of any reported value to
+ * roughly 1/2^MA_HISTOGRAM_SUB_BITS. Recording is lock-free and safe to
+ * call from any thread.
+ */
+
+#define MA_HISTOGRAM_SUB_BITS	4
+#define MA_HISTOGRAM_SUB_COUNT	(1 << MA_HISTOGRAM_SUB_BITS)
+#define MA_HISTOGRAM_BUCKETS	((64-MA_HISTOGRAM_SUB_BITS+1)*MA_HISTOGRAM_SUB_COUNT)
+
+typedef struct
+{
+	volatile int64_t counts[MA_HISTOGRAM_BUCKETS];
+	volatile int64_t total;
+	volatile int64_t sum;
+	volatile int64_t min;
+	volatile int64_t max;
+} ma_histogram_t;
+
+
+void ma_histogram_init(ma_histogram_t *h);
+void ma_histogram_record(ma_histogram_t *h, uint64_t value);
+void ma_histogram_merge(ma_histogram_t *dst, const ma_histogram_t *src);
+
+uint64_t ma_histogram_count(const ma_histogram_t *h);
+uint64_t ma_histogram_mean(const ma_histogram_t *h);
+uint64_t ma_histogram_percentile(const ma_histogram_t *h, double percentile);
+
+NSUInteger ma_histogram_bucket(uint64_t value);
+uint64_t ma_histogram_bucket_low(NSUInteger bucket);
+uint64_t ma_histogram_bucket_high(NSUInteger bucket);
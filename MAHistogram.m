@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import "MAHistogram.h"
+
+#import <libkern/OSAtomic.h>
+
+
+void
+ma_histogram_init(ma_histogram_t *h)
+{
+	memset((void *)h, 0, sizeof(*h));
+	h->min = INT64_MAX;
+}
+
+/*
+ * Map a value to its bucket. The first MA_HISTOGRAM_SUB_COUNT buckets hold
+ * exact values, after that each power of two is split linearly.
+ */
+NSUInteger
+ma_histogram_bucket(uint64_t value)
+{
+	NSUInteger magnitude;
+	
+	if(value < MA_HISTOGRAM_SUB_COUNT)
+		return (NSUInteger)value;
+	
+	magnitude = 63-__builtin_clzll(value);
+	return ((magnitude-MA_HISTOGRAM_SUB_BITS+1) << MA_HISTOGRAM_SUB_BITS)+
+		((value >> (magnitude-MA_HISTOGRAM_SUB_BITS)) &
+		 (MA_HISTOGRAM_SUB_COUNT-1));
+}
+
+uint64_t
+ma_histogram_bucket_low(NSUInteger bucket)
+{
+	NSUInteger shift;
+	
+	if(bucket < MA_HISTOGRAM_SUB_COUNT)
+		return bucket;
+	
+	shift = (bucket >> MA_HISTOGRAM_SUB_BITS)-1;
+	return (uint64_t)(MA_HISTOGRAM_SUB_COUNT+
+					  (bucket & (MA_HISTOGRAM_SUB_COUNT-1))) << shift;
+}
+
+uint64_t
+ma_histogram_bucket_high(NSUInteger bucket)
+{
+	if(bucket < MA_HISTOGRAM_SUB_COUNT)
+		return bucket;
+	
+	return ma_histogram_bucket_low(bucket)+
+		((uint64_t)1 << ((bucket >> MA_HISTOGRAM_SUB_BITS)-1))-1;
+}
+
+void
+ma_histogram_record(ma_histogram_t *h, uint64_t value)
+{
+	int64_t cur;
+	int64_t v = (value > INT64_MAX) ? INT64_MAX : (int64_t)value;
+	
+	OSAtomicIncrement64(&h->counts[ma_histogram_bucket(value)]);
+	OSAtomicIncrement64(&h->total);
+	OSAtomicAdd64(v, &h->sum);
+	
+	while(v < (cur = h->min))
+	{
+		if(OSAtomicCompareAndSwap64(cur, v, &h->min))
+			break;
+	}
+	while(v > (cur = h->max))
+	{
+		if(OSAtomicCompareAndSwap64(cur, v, &h->max))
+			break;
+	}
+}
+
+/*
+ * Fold src into dst. Histograms are plain counters so merging is exact,
+ * which lets per-thread or per-device histograms be combined cheaply.
+ */
+void
+ma_histogram_merge(ma_histogram_t *dst, const ma_histogram_t *src)
+{
+	NSUInteger i;
+	int64_t cur;
+	
+	if(src->total == 0)
+		return;
+	
+	for(i = 0; i < MA_HISTOGRAM_BUCKETS; i++)
+	{
+		if(src->counts[i])
+			OSAtomicAdd64(src->counts[i], &dst->counts[i]);
+	}
+	OSAtomicAdd64(src->total, &dst->total);
+	OSAtomicAdd64(src->sum, &dst->sum);
+	
+	while(src->min < (cur = dst->min))
+	{
+		if(OSAtomicCompareAndSwap64(cur, src->min, &dst->min))
+			break;
+	}
+	while(src->max > (cur = dst->max))
+	{
+		if(OSAtomicCompareAndSwap64(cur, src->max, &dst->max))
+			break;
+	}
+}
+
+uint64_t
+ma_histogram_count(const ma_histogram_t *h)
+{
+	return (uint64_t)h->total;
+}
+
+uint64_t
+ma_histogram_mean(const ma_histogram_t *h)
+{
+	if(h->total == 0)
+		return 0;
+	
+	return (uint64_t)(h->sum/h->total);
+}
+
+/*
+ * Value at the given percentile (0-100). Returns the upper edge of the
+ * bucket, clamped to the largest value actually recorded.
+ */
+uint64_t
+ma_histogram_percentile(const ma_histogram_t *h, double percentile)
+{
+	NSUInteger i;
+	int64_t seen = 0;
+	int64_t wanted;
+	uint64_t value;
+	
+	if(h->total == 0)
+		return 0;
+	
+	if(percentile >= 100.0)
+		return (uint64_t)h->max;
+	
+	wanted = (int64_t)((percentile/100.0)*h->total+0.5);
+	if(wanted < 1)
+		wanted = 1;
+	
+	for(i = 0; i < MA_HISTOGRAM_BUCKETS; i++)
+	{
+		seen += h->counts[i];
+		if(seen >= wanted)
+		{
+			value = ma_histogram_bucket_high(i);
+			return (value > (uint64_t)h->max) ? (uint64_t)h->max : value;
+		}
+	}
+	
+	return (uint64_t)h->max;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#import <Foundation/Foundation.h>
+#import <pcap/pcap.h>
+
+
+/*
+ * Throughput over time, kept as a pyramid of fixed width buckets so a
+ * graph can be drawn at any zoom by reading about one bucket per point.
+ *
+ * Every packet is added to its bucket at each level, from 1 ms up to
+ * 1 min, with its packets, wire bytes and bytes per protocol, scaled by
+ * its sample weight. A query picks the finest level that covers the
+ * range in no more buckets than it has points.
+ *
+ * Buckets are grouped in pages of MA_IOGRAPH_PAGE_BUCKETS. Only a few
+ * pages per level are kept in memory, least recently used ones are
+ * written to a file in directory, from a queue of their own so adding a
+ * packet never waits on the disk, and read back when they are touched
+ * again. The 1 ms and 10 ms levels only keep the recent past, so the
+ * file grows with the coarser levels alone; older ranges are drawn from
+ * those. ma_iograph_write() saves the pyramid with an index of its pages,
+ * to keep next to the capture.
+ *
+ * Buckets start at the minute of the first packet, anything older than
+ * that is only counted as early. A packet so far ahead that a level would
+ * need over a million pages past the oldest it keeps is only counted as
+ * far. It is safe to use from several threads.
+ */
+
+#define MA_IOGRAPH_LEVELS			5
+#define MA_IOGRAPH_PAGE_BUCKETS		1024
+
+typedef enum
+{
+	MA_IOGRAPH_TCP,
+	MA_IOGRAPH_UDP,
+	MA_IOGRAPH_ICMP,			/* and ICMPv6 */
+	MA_IOGRAPH_OTHER,			/* other IP protocols and non-IP */
+	MA_IOGRAPH_PROTOS
+} ma_iograph_proto_t;
+
+typedef struct
+{
+	uint64_t packets;
+	uint64_t bytes;
+	uint64_t protoBytes[MA_IOGRAPH_PROTOS];
+} ma_iograph_bucket_t;
+
+typedef struct ma_iograph ma_iograph_t;
+
+
+ma_iograph_t *ma_iograph_create(const char *directory);
+void ma_iograph_destroy(ma_iograph_t *g);
+void ma_iograph_packet(ma_iograph_t *g, int linkType,
+					   const struct pcap_pkthdr *hdr, const u_char *data,
+					   uint32_t weight);
+BOOL ma_iograph_range(ma_iograph_t *g, int64_t *first, int64_t *last);
+NSUInteger ma_iograph_query(ma_iograph_t *g, int64_t start, int64_t end,
+							NSUInteger points, ma_iograph_bucket_t *buckets,
+							int64_t *bucketStart, int64_t *width);
+BOOL ma_iograph_write(ma_iograph_t *g, const char *path);
+
+int64_t ma_iograph_width(NSUInteger level);
@@ -0,0 +1,698 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#import "MAIOGraph.h"
+
+#import <libkern/OSByteOrder.h>
+#import <netinet/in.h>
+#import <pthread.h>
+#import <sys/param.h>
+#import <unistd.h>
+
+#import "MAFlow.h"
+#import "MARecord.h"
+
+
+#define MA_IOGRAPH_MAGIC			0x4F49414D	/* "MAIO" */
+#define MA_IOGRAPH_END_MAGIC		0x444E4549	/* "IEND" */
+#define MA_IOGRAPH_VERSION			2
+#define MA_IOGRAPH_HEADER_SIZE		32	/* magic, version, levels, page, origin */
+#define MA_IOGRAPH_TRAILER_SIZE		32	/* index offset, first, last, magic */
+#define MA_IOGRAPH_RESIDENT			4	/* pages per level in memory */
+#define MA_IOGRAPH_MAX_PAGES		(1 << 20)	/* per level, past its floor */
+#define MA_IOGRAPH_FIELDS			(sizeof(ma_iograph_bucket_t)/sizeof(uint64_t))
+#define MA_IOGRAPH_PAGE_SIZE		(MA_IOGRAPH_PAGE_BUCKETS*sizeof(ma_iograph_bucket_t))
+
+static const int64_t ma_iograph_widths[MA_IOGRAPH_LEVELS] = {
+	MA_NSEC_PER_MSEC,
+	10*MA_NSEC_PER_MSEC,
+	100*MA_NSEC_PER_MSEC,
+	MA_NSEC_PER_SEC,
+	60*MA_NSEC_PER_SEC
+};
+
+/*
+ * How far back from the newest packet a level is kept, 0 for the whole
+ * capture. A dense hour at 1 ms is some 170 MB, the fine levels only
+ * cover the recent past and older ranges are drawn from coarser ones.
+ */
+static const int64_t ma_iograph_retain[MA_IOGRAPH_LEVELS] = {
+	10*60*MA_NSEC_PER_SEC,
+	60*60*MA_NSEC_PER_SEC,
+	0,
+	0,
+	0
+};
+
+typedef struct
+{
+	int64_t page;				/* -1 for a free slot */
+	uint64_t used;				/* clock of the last touch */
+	BOOL dirty;
+	ma_iograph_bucket_t buckets[MA_IOGRAPH_PAGE_BUCKETS];
+} ma_iograph_page_t;
+
+typedef struct
+{
+	off_t *offsets;				/* in the file from floor on, 0 if unwritten */
+	NSUInteger pageCount;
+	int64_t floor;				/* pages before this one were given up */
+	int64_t newest;
+	ma_iograph_page_t resident[MA_IOGRAPH_RESIDENT];
+} ma_iograph_level_t;
+
+struct ma_iograph
+{
+	pthread_mutex_t lock;
+	int fd;
+	off_t length;
+	dispatch_queue_t io;		/* page writes, in order */
+	off_t *spare;				/* offsets of given up pages, for reuse */
+	NSUInteger spareCount;
+	NSUInteger spareCapacity;
+	volatile BOOL failed;		/* a page could not be written */
+	BOOL started;
+	int64_t origin;				/* ns, on a minute */
+	int64_t first;
+	int64_t last;
+	uint64_t early;
+	uint64_t far;
+	uint64_t clock;
+	ma_iograph_level_t levels[MA_IOGRAPH_LEVELS];
+};
+
+
+int64_t
+ma_iograph_width(NSUInteger level)
+{
+	return ma_iograph_widths[MIN(level, MA_IOGRAPH_LEVELS-1)];
+}
+
+#pragma mark - Pages
+
+/* A page's offset in the file, NULL if the level has no entry for it. */
+static off_t *
+ma_iograph_offset(ma_iograph_level_t *l, int64_t page)
+{
+	if(page < l->floor || page-l->floor >= (int64_t)l->pageCount)
+		return NULL;
+	
+	return &l->offsets[page-l->floor];
+}
+
+/* Pages are little endian on disk, swapped in place around the I/O. */
+static void
+ma_iograph_swap(ma_iograph_bucket_t *buckets, NSUInteger count)
+{
+#if __BIG_ENDIAN__
+	uint64_t *field = (uint64_t *)buckets;
+	size_t i;
+	
+	for(i = 0; i < count*MA_IOGRAPH_FIELDS; i++)
+		field[i] = OSSwapInt64(field[i]);
+#else
+	(void)buckets;
+	(void)count;
+#endif
+}
+
+/*
+ * Hand a dirty page to the io queue. It is written from a copy, so the
+ * caller never waits for the disk; the offset is settled here, under the
+ * lock, and reused from a given up page when there is one.
+ */
+static BOOL
+ma_iograph_flush(ma_iograph_t *g, ma_iograph_level_t *l, ma_iograph_page_t *p)
+{
+	ma_iograph_bucket_t *copy;
+	off_t *entry = ma_iograph_offset(l, p->page);
+	off_t offset;
+	int fd = g->fd;
+	
+	if(!p->dirty)
+		return YES;
+	
+	if(entry == NULL || !(copy = malloc(MA_IOGRAPH_PAGE_SIZE)))
+		return NO;
+	
+	if(*entry == 0)
+	{
+		if(g->spareCount > 0)
+			*entry = g->spare[--g->spareCount];
+		else
+		{
+			*entry = g->length;
+			g->length += MA_IOGRAPH_PAGE_SIZE;
+		}
+	}
+	offset = *entry;
+	
+	memcpy(copy, p->buckets, MA_IOGRAPH_PAGE_SIZE);
+	ma_iograph_swap(copy, MA_IOGRAPH_PAGE_BUCKETS);
+	p->dirty = NO;
+	
+	dispatch_async(g->io, ^{
+		if(pwrite(fd, copy, MA_IOGRAPH_PAGE_SIZE, offset) !=
+		   (ssize_t)MA_IOGRAPH_PAGE_SIZE && !g->failed)
+		{
+			NSLog(@"ma_iograph_flush(): %s", strerror(errno));
+			g->failed = YES;
+		}
+		free(copy);
+	});
+	
+	return YES;
+}
+
+/*
+ * Read count buckets from index of a page that was written out, once the
+ * writes queued ahead of us have landed.
+ */
+static BOOL
+ma_iograph_read(ma_iograph_t *g, off_t offset, NSUInteger index,
+				NSUInteger count, ma_iograph_bucket_t *buckets)
+{
+	size_t size = count*sizeof(*buckets);
+	
+	dispatch_sync(g->io, ^{});
+	if(pread(g->fd, buckets, size, offset+index*sizeof(*buckets)) !=
+	   (ssize_t)size)
+		return NO;
+	ma_iograph_swap(buckets, count);
+	
+	return YES;
+}
+
+/*
+ * A new newest page for the level: pages that fell out of what the level
+ * keeps are given up, their room in the file goes to later pages, and
+ * the offsets move down to start at the new floor.
+ */
+static void
+ma_iograph_expire(ma_iograph_t *g, NSUInteger level, int64_t newest)
+{
+	ma_iograph_level_t *l = &g->levels[level];
+	int64_t pages, floor;
+	NSUInteger i, shift;
+	
+	l->newest = newest;
+	if(ma_iograph_retain[level] == 0)
+		return;
+	
+	pages = ma_iograph_retain[level]/
+		(ma_iograph_widths[level]*MA_IOGRAPH_PAGE_BUCKETS)+1;
+	if((floor = newest-pages+1) <= l->floor)
+		return;
+	
+	shift = (NSUInteger)MIN(floor-l->floor, (int64_t)l->pageCount);
+	for(i = 0; i < shift; i++)
+	{
+		if(l->offsets[i] == 0)
+			continue;
+		
+		if(g->spareCount == g->spareCapacity)
+		{
+			NSUInteger capacity = MAX(g->spareCapacity*2, 64);
+			off_t *spare = realloc(g->spare, capacity*sizeof(*spare));
+			
+			/* Out of memory, the room is lost but nothing else. */
+			if(spare == NULL)
+				continue;
+			g->spare = spare;
+			g->spareCapacity = capacity;
+		}
+		g->spare[g->spareCount++] = l->offsets[i];
+	}
+	memmove(l->offsets, l->offsets+shift,
+			(l->pageCount-shift)*sizeof(*l->offsets));
+	l->pageCount -= shift;
+	
+	for(i = 0; i < MA_IOGRAPH_RESIDENT; i++)
+	{
+		if(l->resident[i].page >= 0 && l->resident[i].page < floor)
+		{
+			l->resident[i].page = -1;
+			l->resident[i].dirty = NO;
+		}
+	}
+	
+	l->floor = floor;
+}
+
+/* The resident copy of a page, NULL if it isn't in memory. */
+static ma_iograph_page_t *
+ma_iograph_resident(ma_iograph_level_t *l, int64_t page)
+{
+	NSUInteger i;
+	
+	for(i = 0; i < MA_IOGRAPH_RESIDENT; i++)
+		if(l->resident[i].page == page)
+			return &l->resident[i];
+	
+	return NULL;
+}
+
+/*
+ * Page number page of a level for adding to, read back or made as needed.
+ * NULL if the level has already given the page up, or on failure. Only
+ * a packet older than the resident pages makes us read from the file.
+ */
+static ma_iograph_page_t *
+ma_iograph_page(ma_iograph_t *g, NSUInteger level, int64_t page)
+{
+	ma_iograph_level_t *l = &g->levels[level];
+	ma_iograph_page_t *p, *victim = NULL;
+	NSUInteger i;
+	
+	if((p = ma_iograph_resident(l, page)))
+	{
+		p->used = ++g->clock;
+		return p;
+	}
+	
+	if(page < l->floor || page-l->floor >= MA_IOGRAPH_MAX_PAGES)
+		return NULL;
+	
+	if(page > l->newest)
+	{
+		ma_iograph_expire(g, level, page);
+		if(page < l->floor)
+			return NULL;
+	}
+	
+	if(page-l->floor >= (int64_t)l->pageCount)
+	{
+		NSUInteger count = MIN(MAX(l->pageCount*2,
+								   (NSUInteger)(page-l->floor)+1),
+							   (NSUInteger)MA_IOGRAPH_MAX_PAGES);
+		off_t *offsets;
+		
+		if(!(offsets = realloc(l->offsets, count*sizeof(*offsets))))
+			return NULL;
+		
+		memset(offsets+l->pageCount, 0,
+			   (count-l->pageCount)*sizeof(*offsets));
+		l->offsets = offsets;
+		l->pageCount = count;
+	}
+	
+	for(i = 0; i < MA_IOGRAPH_RESIDENT; i++)
+	{
+		p = &l->resident[i];
+		if(victim == NULL || (victim->page >= 0 &&
+							  (p->page < 0 || p->used < victim->used)))
+			victim = p;
+	}
+	
+	if(victim->page >= 0 && !ma_iograph_flush(g, l, victim))
+		return NULL;
+	
+	if(*ma_iograph_offset(l, page))
+	{
+		if(!ma_iograph_read(g, *ma_iograph_offset(l, page), 0,
+							MA_IOGRAPH_PAGE_BUCKETS, victim->buckets))
+		{
+			victim->page = -1;
+			return NULL;
+		}
+	}
+	else
+		memset(victim->buckets, 0, sizeof(victim->buckets));
+	
+	victim->page = page;
+	victim->used = ++g->clock;
+	victim->dirty = NO;
+	
+	return victim;
+}
+
+#pragma mark - Recording
+
+ma_iograph_t *
+ma_iograph_create(const char *directory)
+{
+	char path[MAXPATHLEN];
+	ma_iograph_t *g;
+	NSUInteger i, j;
+	
+	if(!(g = calloc(1, sizeof(*g))))
+		return NULL;
+	
+	snprintf(path, sizeof(path), "%s/MacAlyzer-iograph.XXXXXX", directory);
+	if((g->fd = mkstemp(path)) == -1)
+	{
+		NSLog(@"%s(): %s", __func__, strerror(errno));
+		free(g);
+		return NULL;
+	}
+	unlink(path);
+	
+	pthread_mutex_init(&g->lock, NULL);
+	g->io = dispatch_queue_create("MacAlyzer.iograph", NULL);
+	g->length = MA_IOGRAPH_HEADER_SIZE;
+	
+	for(i = 0; i < MA_IOGRAPH_LEVELS; i++)
+		for(j = 0; j < MA_IOGRAPH_RESIDENT; j++)
+			g->levels[i].resident[j].page = -1;
+	
+	return g;
+}
+
+void
+ma_iograph_destroy(ma_iograph_t *g)
+{
+	NSUInteger i;
+	
+	if(g == NULL)
+		return;
+	
+	/* Queued writes hold the descriptor. */
+	dispatch_sync(g->io, ^{});
+	dispatch_release(g->io);
+	
+	for(i = 0; i < MA_IOGRAPH_LEVELS; i++)
+		free(g->levels[i].offsets);
+	free(g->spare);
+	close(g->fd);
+	pthread_mutex_destroy(&g->lock);
+	free(g);
+}
+
+static ma_iograph_proto_t
+ma_iograph_proto(int linkType, const struct pcap_pkthdr *hdr,
+				 const u_char *data)
+{
+	ma_flow_t flow;
+	
+	if(!ma_flow_parse(linkType, hdr, data, &flow))
+		return MA_IOGRAPH_OTHER;
+	
+	switch(flow.ipProto)
+	{
+		case IPPROTO_TCP:
+			return MA_IOGRAPH_TCP;
+			
+		case IPPROTO_UDP:
+			return MA_IOGRAPH_UDP;
+			
+		case IPPROTO_ICMP:
+		case IPPROTO_ICMPV6:
+			return MA_IOGRAPH_ICMP;
+			
+		default:
+			return MA_IOGRAPH_OTHER;
+	}
+}
+
+void
+ma_iograph_packet(ma_iograph_t *g, int linkType, const struct pcap_pkthdr *hdr,
+				  const u_char *data, uint32_t weight)
+{
+	ma_iograph_proto_t proto;
+	ma_iograph_bucket_t *b;
+	ma_iograph_page_t *p;
+	int64_t ts = ma_pkthdr_ns(hdr);
+	int64_t index;
+	uint64_t bytes = (uint64_t)weight*hdr->len;
+	NSUInteger level;
+	
+	if(weight == 0)
+		return;
+	
+	proto = ma_iograph_proto(linkType, hdr, data);
+	
+	pthread_mutex_lock(&g->lock);
+	if(!g->started)
+	{
+		g->origin = ts-ts % ma_iograph_widths[MA_IOGRAPH_LEVELS-1];
+		g->first = g->last = ts;
+		g->started = YES;
+	}
+	
+	if(ts < g->origin)
+	{
+		g->early += weight;
+		pthread_mutex_unlock(&g->lock);
+		return;
+	}
+	
+	/*
+	 * A timestamp far in the future, most likely a bad one, would have
+	 * the fine levels give up everything they keep and the others index
+	 * pages without end. Count it and leave the graph alone.
+	 */
+	for(level = 0; level < MA_IOGRAPH_LEVELS; level++)
+	{
+		index = (ts-g->origin)/ma_iograph_widths[level];
+		if(index/MA_IOGRAPH_PAGE_BUCKETS-g->levels[level].floor >=
+		   MA_IOGRAPH_MAX_PAGES)
+		{
+			g->far += weight;
+			pthread_mutex_unlock(&g->lock);
+			return;
+		}
+	}
+	
+	g->first = MIN(g->first, ts);
+	g->last = MAX(g->last, ts);
+	
+	for(level = 0; level < MA_IOGRAPH_LEVELS; level++)
+	{
+		index = (ts-g->origin)/ma_iograph_widths[level];
+		if(!(p = ma_iograph_page(g, level, index/MA_IOGRAPH_PAGE_BUCKETS)))
+			continue;
+		
+		b = &p->buckets[index % MA_IOGRAPH_PAGE_BUCKETS];
+		b->packets += weight;
+		b->bytes += bytes;
+		b->protoBytes[proto] += bytes;
+		p->dirty = YES;
+	}
+	pthread_mutex_unlock(&g->lock);
+}
+
+#pragma mark - Queries
+
+/* Time of the first and last packet counted, NO before the first. */
+BOOL
+ma_iograph_range(ma_iograph_t *g, int64_t *first, int64_t *last)
+{
+	BOOL started;
+	
+	pthread_mutex_lock(&g->lock);
+	*first = g->first;
+	*last = g->last;
+	started = g->started;
+	pthread_mutex_unlock(&g->lock);
+	
+	return started;
+}
+
+/*
+ * Fills buckets with the finest level that still keeps start and covers
+ * start to end in no more than points buckets, or the first points
+ * buckets of the coarsest level if none does. bucketStart is set to the
+ * time of the first bucket and width to the level's. Returns the number
+ * of buckets filled.
+ *
+ * Pages that aren't resident are read straight into buckets, a query
+ * never pushes the pages being recorded to out of memory.
+ */
+NSUInteger
+ma_iograph_query(ma_iograph_t *g, int64_t start, int64_t end,
+				 NSUInteger points, ma_iograph_bucket_t *buckets,
+				 int64_t *bucketStart, int64_t *width)
+{
+	ma_iograph_level_t *l;
+	ma_iograph_page_t *p;
+	off_t *offset;
+	int64_t first, last, index, page;
+	NSUInteger level, n, i, run;
+	
+	if(points == 0 || end < start)
+		return 0;
+	
+	pthread_mutex_lock(&g->lock);
+	if(!g->started)
+	{
+		pthread_mutex_unlock(&g->lock);
+		return 0;
+	}
+	
+	start = MAX(start, g->origin);
+	end = MAX(end, start);
+	
+	for(level = 0; level < MA_IOGRAPH_LEVELS-1; level++)
+	{
+		first = (start-g->origin)/ma_iograph_widths[level];
+		if(first/MA_IOGRAPH_PAGE_BUCKETS >= g->levels[level].floor &&
+		   (end-g->origin)/ma_iograph_widths[level]-first < (int64_t)points)
+			break;
+	}
+	
+	l = &g->levels[level];
+	*width = ma_iograph_widths[level];
+	first = (start-g->origin)/(*width);
+	last = (end-g->origin)/(*width);
+	n = (NSUInteger)MIN(last-first+1, (int64_t)points);
+	*bucketStart = g->origin+first*(*width);
+	
+	/* A page at a time, pages never written are all zeroes. */
+	memset(buckets, 0, n*sizeof(*buckets));
+	for(i = 0; i < n; i += run)
+	{
+		index = first+(int64_t)i;
+		page = index/MA_IOGRAPH_PAGE_BUCKETS;
+		run = MIN(n-i, (NSUInteger)(MA_IOGRAPH_PAGE_BUCKETS-
+									index % MA_IOGRAPH_PAGE_BUCKETS));
+		
+		if((p = ma_iograph_resident(l, page)))
+			memcpy(&buckets[i], &p->buckets[index % MA_IOGRAPH_PAGE_BUCKETS],
+				   run*sizeof(*buckets));
+		else if((offset = ma_iograph_offset(l, page)) && *offset &&
+				!ma_iograph_read(g, *offset,
+								 (NSUInteger)(index % MA_IOGRAPH_PAGE_BUCKETS),
+								 run, &buckets[i]))
+			memset(&buckets[i], 0, run*sizeof(*buckets));
+	}
+	pthread_mutex_unlock(&g->lock);
+	
+	return n;
+}
+
+#pragma mark - Saving
+
+/*
+ * Saves the pyramid: the header, every page still kept, then an index of
+ * page offsets for each level (its bucket width, first page kept, page
+ * count and one offset per page from the first, 0 for none) and a
+ * trailer pointing at the index.
+ * Pages are copied level by level, without the room given up pages left
+ * in our own file.
+ */
+BOOL
+ma_iograph_write(ma_iograph_t *g, const char *path)
+{
+	u_char header[MA_IOGRAPH_HEADER_SIZE] = {0};
+	u_char trailer[MA_IOGRAPH_TRAILER_SIZE] = {0};
+	ma_iograph_bucket_t *buffer;
+	off_t *written[MA_IOGRAPH_LEVELS] = {NULL};
+	off_t pos = MA_IOGRAPH_HEADER_SIZE;
+	NSUInteger level, i;
+	BOOL ok = YES;
+	FILE *fp;
+	
+	if(!(buffer = malloc(MA_IOGRAPH_PAGE_SIZE)))
+		return NO;
+	
+	if(!(fp = fopen(path, "w")))
+	{
+		NSLog(@"%s(): %s: %s", __func__, path, strerror(errno));
+		free(buffer);
+		return NO;
+	}
+	
+	pthread_mutex_lock(&g->lock);
+	for(level = 0; level < MA_IOGRAPH_LEVELS; level++)
+		for(i = 0; i < MA_IOGRAPH_RESIDENT; i++)
+			if(g->levels[level].resident[i].page >= 0)
+				ok &= ma_iograph_flush(g, &g->levels[level],
+									   &g->levels[level].resident[i]);
+	
+	dispatch_sync(g->io, ^{});
+	
+	OSWriteLittleInt32(header, 0, MA_IOGRAPH_MAGIC);
+	OSWriteLittleInt32(header, 4, MA_IOGRAPH_VERSION);
+	OSWriteLittleInt32(header, 8, MA_IOGRAPH_LEVELS);
+	OSWriteLittleInt32(header, 12, MA_IOGRAPH_PAGE_BUCKETS);
+	OSWriteLittleInt64(header, 16, g->origin);
+	ok &= (fwrite(header, sizeof(header), 1, fp) == 1);
+	
+	for(level = 0; ok && level < MA_IOGRAPH_LEVELS; level++)
+	{
+		ma_iograph_level_t *l = &g->levels[level];
+		
+		if(l->pageCount == 0)
+			continue;
+		if(!(written[level] = calloc(l->pageCount, sizeof(off_t))))
+		{
+			ok = NO;
+			break;
+		}
+		
+		for(i = 0; ok && i < l->pageCount; i++)
+		{
+			if(l->offsets[i] == 0)
+				continue;
+			
+			/* Still little endian, straight from our file. */
+			ok = (pread(g->fd, buffer, MA_IOGRAPH_PAGE_SIZE, l->offsets[i]) ==
+				  (ssize_t)MA_IOGRAPH_PAGE_SIZE &&
+				  fwrite(buffer, MA_IOGRAPH_PAGE_SIZE, 1, fp) == 1);
+			written[level][i] = pos;
+			pos += MA_IOGRAPH_PAGE_SIZE;
+		}
+	}
+	
+	for(level = 0; ok && level < MA_IOGRAPH_LEVELS; level++)
+	{
+		ma_iograph_level_t *l = &g->levels[level];
+		u_char entry[8];
+		
+		OSWriteLittleInt64(entry, 0, ma_iograph_widths[level]);
+		ok &= (fwrite(entry, sizeof(entry), 1, fp) == 1);
+		OSWriteLittleInt64(entry, 0, l->floor);
+		ok &= (fwrite(entry, sizeof(entry), 1, fp) == 1);
+		OSWriteLittleInt64(entry, 0, l->pageCount);
+		ok &= (fwrite(entry, sizeof(entry), 1, fp) == 1);
+		
+		for(i = 0; ok && i < l->pageCount; i++)
+		{
+			OSWriteLittleInt64(entry, 0, written[level][i]);
+			ok &= (fwrite(entry, sizeof(entry), 1, fp) == 1);
+		}
+	}
+	
+	OSWriteLittleInt64(trailer, 0, pos);
+	OSWriteLittleInt64(trailer, 8, g->first);
+	OSWriteLittleInt64(trailer, 16, g->last);
+	OSWriteLittleInt32(trailer, 24, MA_IOGRAPH_END_MAGIC);
+	ok &= (fwrite(trailer, sizeof(trailer), 1, fp) == 1);
+	ok &= !g->failed;
+	pthread_mutex_unlock(&g->lock);
+	
+	for(level = 0; level < MA_IOGRAPH_LEVELS; level++)
+		free(written[level]);
+	ok &= (fclose(fp) == 0);
+	free(buffer);
+	
+	return ok;
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+
+
+/*
+ * Streaming k-way merge of sources that each deliver items in timestamp
+ * order. Items wait in a min-heap until the watermark passes them; the
+ * watermark is the oldest latest-timestamp over every source that has not
+ * finished. For live sources a maximum skew can be given as well, then
+ * the watermark never trails the newest timestamp seen by more than that,
+ * so a quiet source only holds the others back for so long.
+ *
+ * Memory is bounded by maxPending items. Pushing with wait blocks a source
+ * that has more than its share in the heap until the others catch up,
+ * which is what savefile readers want; without wait the oldest item is
+ * emitted early instead. Items that arrive behind what has already been
+ * emitted are passed straight through and counted as late.
+ *
+ * The emit callback runs on the pushing thread with the merge locked, it
+ * must not call back into the merge. A consumer that goes away cancels
+ * the merge, waits for its sources to return and hands what is left to
+ * ma_merge_destroy() to be thrown away.
+ */
+typedef void (*ma_merge_emit_t)(void *ctx, void *item);
+
+typedef struct
+{
+	uint64_t pushed;
+	uint64_t emitted;
+	uint64_t late;
+	uint64_t forced;
+	NSUInteger pending;
+} ma_merge_stats_t;
+
+typedef struct ma_merge ma_merge_t;
+
+
+ma_merge_t *ma_merge_create(NSUInteger sources, NSUInteger maxPending,
+							uint64_t maxSkew, ma_merge_emit_t emit, void *ctx);
+void ma_merge_destroy(ma_merge_t *m, ma_merge_emit_t discard);
+
+BOOL ma_merge_push(ma_merge_t *m, NSUInteger source, uint64_t timestamp,
+				   void *item, BOOL wait);
+void ma_merge_finish(ma_merge_t *m, NSUInteger source);
+void ma_merge_cancel(ma_merge_t *m);
+void ma_merge_advance(ma_merge_t *m, uint64_t now);
+void ma_merge_flush(ma_merge_t *m);
+
+void ma_merge_stats(ma_merge_t *m, ma_merge_stats_t *stats);
@@ -0,0 +1,405 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import "MAMerge.h"
+
+#import <pthread.h>
+
+
+typedef struct
+{
+	uint64_t timestamp;
+	uint64_t order;
+	NSUInteger source;
+	void *item;
+} ma_merge_entry_t;
+
+typedef struct
+{
+	uint64_t latest;
+	NSUInteger pending;
+	BOOL started;
+	BOOL finished;
+} ma_merge_source_t;
+
+struct ma_merge
+{
+	pthread_mutex_t lock;
+	pthread_cond_t drained;
+	
+	ma_merge_entry_t *heap;
+	NSUInteger count;
+	NSUInteger maxPending;
+	uint64_t nextOrder;
+	
+	ma_merge_source_t *sources;
+	NSUInteger sourceCount;
+	uint64_t maxSkew;
+	uint64_t newest;
+	uint64_t emittedUpTo;
+	
+	ma_merge_emit_t emit;
+	void *ctx;
+	
+	uint64_t pushed;
+	uint64_t emitted;
+	uint64_t late;
+	uint64_t forced;
+	BOOL cancelled;
+};
+
+
+#pragma mark - Heap
+
+static inline BOOL
+ma_merge_before(const ma_merge_entry_t *a, const ma_merge_entry_t *b)
+{
+	if(a->timestamp != b->timestamp)
+		return (a->timestamp < b->timestamp);
+	
+	return (a->order < b->order);
+}
+
+static void
+ma_merge_sift_up(ma_merge_t *m, NSUInteger i)
+{
+	ma_merge_entry_t entry = m->heap[i];
+	
+	while(i > 0)
+	{
+		NSUInteger parent = (i-1)/2;
+		
+		if(!ma_merge_before(&entry, &m->heap[parent]))
+			break;
+		
+		m->heap[i] = m->heap[parent];
+		i = parent;
+	}
+	
+	m->heap[i] = entry;
+}
+
+static void
+ma_merge_sift_down(ma_merge_t *m, NSUInteger i)
+{
+	ma_merge_entry_t entry = m->heap[i];
+	
+	for(;;)
+	{
+		NSUInteger child = 2*i+1;
+		
+		if(child >= m->count)
+			break;
+		if(child+1 < m->count && ma_merge_before(&m->heap[child+1],
+												 &m->heap[child]))
+			child++;
+		if(!ma_merge_before(&m->heap[child], &entry))
+			break;
+		
+		m->heap[i] = m->heap[child];
+		i = child;
+	}
+	
+	m->heap[i] = entry;
+}
+
+/* Remove the oldest entry and hand its item to the emit callback. */
+static void
+ma_merge_pop(ma_merge_t *m)
+{
+	ma_merge_entry_t top = m->heap[0];
+	
+	m->heap[0] = m->heap[--m->count];
+	if(m->count > 0)
+		ma_merge_sift_down(m, 0);
+	
+	m->sources[top.source].pending--;
+	if(top.timestamp > m->emittedUpTo)
+		m->emittedUpTo = top.timestamp;
+	m->emitted++;
+	
+	m->emit(m->ctx, top.item);
+}
+
+#pragma mark - Watermark
+
+static uint64_t
+ma_merge_watermark(ma_merge_t *m)
+{
+	uint64_t watermark = UINT64_MAX;
+	NSUInteger i;
+	
+	for(i = 0; i < m->sourceCount; i++)
+	{
+		ma_merge_source_t *src = &m->sources[i];
+		
+		if(src->finished)
+			continue;
+		if(!src->started)
+		{
+			watermark = 0;
+			break;
+		}
+		if(src->latest < watermark)
+			watermark = src->latest;
+	}
+	
+	if(m->maxSkew && m->newest > m->maxSkew &&
+	   watermark < m->newest-m->maxSkew)
+		watermark = m->newest-m->maxSkew;
+	
+	return watermark;
+}
+
+/* Emit everything the watermark has passed, then wake blocked pushers. */
+static void
+ma_merge_release(ma_merge_t *m, uint64_t watermark)
+{
+	BOOL emitted = NO;
+	
+	if(m->cancelled)
+		return;
+	
+	while(m->count > 0 && m->heap[0].timestamp <= watermark)
+	{
+		ma_merge_pop(m);
+		emitted = YES;
+	}
+	
+	if(emitted)
+		pthread_cond_broadcast(&m->drained);
+}
+
+#pragma mark - Create/Destroy
+
+ma_merge_t *
+ma_merge_create(NSUInteger sources, NSUInteger maxPending, uint64_t maxSkew,
+				ma_merge_emit_t emit, void *ctx)
+{
+	ma_merge_t *m;
+	
+	if(sources == 0 || maxPending < sources || !emit ||
+	   !(m = calloc(1, sizeof(*m))))
+		return NULL;
+	
+	if(!(m->heap = calloc(maxPending, sizeof(*m->heap))) ||
+	   !(m->sources = calloc(sources, sizeof(*m->sources))))
+	{
+		free(m->heap);
+		free(m);
+		return NULL;
+	}
+	
+	pthread_mutex_init(&m->lock, NULL);
+	pthread_cond_init(&m->drained, NULL);
+	m->maxPending = maxPending;
+	m->sourceCount = sources;
+	m->maxSkew = maxSkew;
+	m->emit = emit;
+	m->ctx = ctx;
+	
+	return m;
+}
+
+/*
+ * Frees the merge, items still pending go to discard (if given) rather
+ * than being emitted. Nobody may be pushing at this point, cancel the
+ * merge and wait for the sources to stop first.
+ */
+void
+ma_merge_destroy(ma_merge_t *m, ma_merge_emit_t discard)
+{
+	NSUInteger i;
+	
+	if(m == NULL)
+		return;
+	
+	for(i = 0; i < m->count; i++)
+		if(discard)
+			discard(m->ctx, m->heap[i].item);
+	
+	pthread_cond_destroy(&m->drained);
+	pthread_mutex_destroy(&m->lock);
+	free(m->sources);
+	free(m->heap);
+	free(m);
+}
+
+#pragma mark - Push
+
+/*
+ * Add item from source. Returns NO if source is out of range, has already
+ * finished or the merge was cancelled, in which case the caller keeps the
+ * item.
+ */
+BOOL
+ma_merge_push(ma_merge_t *m, NSUInteger source, uint64_t timestamp,
+			  void *item, BOOL wait)
+{
+	ma_merge_source_t *src;
+	ma_merge_entry_t *entry;
+	NSUInteger share;
+	
+	if(source >= m->sourceCount)
+		return NO;
+	
+	pthread_mutex_lock(&m->lock);
+	
+	src = &m->sources[source];
+	if(src->finished || m->cancelled)
+	{
+		pthread_mutex_unlock(&m->lock);
+		return NO;
+	}
+	
+	/* Let the other sources catch up before taking any more from this one. */
+	share = m->maxPending/m->sourceCount;
+	while(wait && src->pending >= share && !src->finished)
+		pthread_cond_wait(&m->drained, &m->lock);
+	
+	if(m->cancelled)
+	{
+		pthread_mutex_unlock(&m->lock);
+		return NO;
+	}
+	
+	m->pushed++;
+	
+	if(timestamp > src->latest || !src->started)
+		src->latest = timestamp;
+	src->started = YES;
+	if(timestamp > m->newest)
+		m->newest = timestamp;
+	
+	/* Too late to put in order, pass it straight on. */
+	if(m->emitted > 0 && timestamp < m->emittedUpTo)
+	{
+		m->late++;
+		m->emitted++;
+		m->emit(m->ctx, item);
+		ma_merge_release(m, ma_merge_watermark(m));
+		pthread_mutex_unlock(&m->lock);
+		return YES;
+	}
+	
+	/* Out of room, the oldest goes out early. */
+	if(m->count == m->maxPending)
+	{
+		m->forced++;
+		ma_merge_pop(m);
+	}
+	
+	entry = &m->heap[m->count];
+	entry->timestamp = timestamp;
+	entry->order = m->nextOrder++;
+	entry->source = source;
+	entry->item = item;
+	ma_merge_sift_up(m, m->count++);
+	src->pending++;
+	
+	ma_merge_release(m, ma_merge_watermark(m));
+	
+	pthread_mutex_unlock(&m->lock);
+	
+	return YES;
+}
+
+/* The source has no more items, stop holding the others back for it. */
+void
+ma_merge_finish(ma_merge_t *m, NSUInteger source)
+{
+	if(source >= m->sourceCount)
+		return;
+	
+	pthread_mutex_lock(&m->lock);
+	m->sources[source].finished = YES;
+	ma_merge_release(m, ma_merge_watermark(m));
+	pthread_cond_broadcast(&m->drained);
+	pthread_mutex_unlock(&m->lock);
+}
+
+/*
+ * Stop the merge for good: nothing more is emitted, pushers blocked on
+ * their share are woken and every push from now on is refused. Whatever
+ * is pending stays put until ma_merge_destroy().
+ */
+void
+ma_merge_cancel(ma_merge_t *m)
+{
+	NSUInteger i;
+	
+	pthread_mutex_lock(&m->lock);
+	m->cancelled = YES;
+	for(i = 0; i < m->sourceCount; i++)
+		m->sources[i].finished = YES;
+	pthread_cond_broadcast(&m->drained);
+	pthread_mutex_unlock(&m->lock);
+}
+
+/*
+ * For live sources: nothing older than now less the maximum skew can still
+ * arrive in order, so let it go even if a source has gone quiet.
+ */
+void
+ma_merge_advance(ma_merge_t *m, uint64_t now)
+{
+	uint64_t watermark;
+	
+	pthread_mutex_lock(&m->lock);
+	
+	watermark = ma_merge_watermark(m);
+	if(m->maxSkew && now > m->maxSkew && watermark < now-m->maxSkew)
+		watermark = now-m->maxSkew;
+	ma_merge_release(m, watermark);
+	
+	pthread_mutex_unlock(&m->lock);
+}
+
+void
+ma_merge_flush(ma_merge_t *m)
+{
+	pthread_mutex_lock(&m->lock);
+	ma_merge_release(m, UINT64_MAX);
+	pthread_mutex_unlock(&m->lock);
+}
+
+void
+ma_merge_stats(ma_merge_t *m, ma_merge_stats_t *stats)
+{
+	pthread_mutex_lock(&m->lock);
+	stats->pushed = m->pushed;
+	stats->emitted = m->emitted;
+	stats->late = m->late;
+	stats->forced = m->forced;
+	stats->pending = m->count;
+	pthread_mutex_unlock(&m->lock);
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+#import <pcap/pcap.h>
+
+
+/*
+ * Native pcapng reader and writer.
+ *
+ * The writer emits one Section Header Block, an Interface Description
+ * Block per interface added, Enhanced Packet Blocks and Interface
+ * Statistics Blocks. Interfaces are declared with if_tsresol 9, packet
+ * headers are taken at nanosecond precision (see ma_pkthdr_ns()). Blocks
+ * are collected in a large buffer and written out in one go.
+ *
+ * The reader indexes every packet block by file offset when it is
+ * opened, so packets can be fetched in any order afterwards. Sections
+ * of either byte order are supported; timestamps are converted to
+ * nanoseconds whatever the interface's resolution.
+ */
+
+#define MA_PCAPNG_SHB				0x0A0D0D0A
+#define MA_PCAPNG_IDB				0x00000001
+#define MA_PCAPNG_PB				0x00000002
+#define MA_PCAPNG_SPB				0x00000003
+#define MA_PCAPNG_ISB				0x00000005
+#define MA_PCAPNG_EPB				0x00000006
+#define MA_PCAPNG_BYTE_ORDER_MAGIC	0x1A2B3C4D
+
+typedef struct
+{
+	uint64_t received;			/* isb_ifrecv */
+	uint64_t interfaceDropped;	/* isb_ifdrop */
+	uint64_t kernelDropped;		/* isb_osdrop */
+	uint64_t delivered;			/* isb_usrdeliv */
+} ma_pcapng_stats_t;
+
+typedef struct
+{
+	int linkType;
+	uint32_t snapLen;
+	uint64_t unitsPerSecond;
+	int64_t offset;				/* if_tsoffset, seconds */
+	char name[64];
+	char description[128];
+} ma_pcapng_interface_t;
+
+typedef struct
+{
+	struct pcap_pkthdr hdr;
+	const u_char *data;
+	NSUInteger interface;
+} ma_pcapng_packet_t;
+
+typedef struct ma_pcapng_writer ma_pcapng_writer_t;
+typedef struct ma_pcapng_reader ma_pcapng_reader_t;
+
+
+ma_pcapng_writer_t *ma_pcapng_writer_open(const char *path,
+										  const char *application);
+NSInteger ma_pcapng_writer_add_interface(ma_pcapng_writer_t *w, int linkType,
+										 uint32_t snapLen, const char *name,
+										 const char *description);
+BOOL ma_pcapng_writer_packet(ma_pcapng_writer_t *w, NSUInteger interface,
+							 const struct pcap_pkthdr *hdr,
+							 const u_char *data);
+BOOL ma_pcapng_writer_stats(ma_pcapng_writer_t *w, NSUInteger interface,
+							int64_t timestamp, const ma_pcapng_stats_t *stats);
+BOOL ma_pcapng_writer_flush(ma_pcapng_writer_t *w);
+BOOL ma_pcapng_writer_close(ma_pcapng_writer_t *w);
+
+ma_pcapng_reader_t *ma_pcapng_reader_open(const char *path);
+void ma_pcapng_reader_close(ma_pcapng_reader_t *r);
+NSUInteger ma_pcapng_reader_count(ma_pcapng_reader_t *r);
+NSUInteger ma_pcapng_reader_interface_count(ma_pcapng_reader_t *r);
+const ma_pcapng_interface_t *ma_pcapng_reader_interface(ma_pcapng_reader_t *r,
+														 NSUInteger interface);
+BOOL ma_pcapng_reader_packet(ma_pcapng_reader_t *r, NSUInteger index,
+							 ma_pcapng_packet_t *packet);
+BOOL ma_pcapng_is_pcapng(const char *path);
@@ -0,0 +1,671 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import "MAPcapng.h"
+
+#import <fcntl.h>
+#import <libkern/OSByteOrder.h>
+#import <unistd.h>
+
+#import "ConfigurationConstants.h"
+#import "MAFileIO.h"
+#import "MARecord.h"
+
+
+#define MA_PAD4(n)		(((n)+3) & ~3)
+
+/* Option codes used here. */
+#define OPT_ENDOFOPT		0
+#define OPT_SHB_USERAPPL	4
+#define OPT_IF_NAME			2
+#define OPT_IF_DESCRIPTION	3
+#define OPT_IF_TSRESOL		9
+#define OPT_IF_TSOFFSET		14
+#define OPT_ISB_IFRECV		4
+#define OPT_ISB_IFDROP		5
+#define OPT_ISB_OSDROP		7
+#define OPT_ISB_USRDELIV	8
+
+struct ma_pcapng_writer
+{
+	int fd;
+	u_char *buffer;
+	size_t used;
+	size_t size;
+	NSUInteger interfaces;
+	BOOL failed;
+};
+
+typedef struct
+{
+	off_t offset;
+	uint32_t length;
+	uint32_t interface;
+} ma_pcapng_index_t;
+
+struct ma_pcapng_reader
+{
+	int fd;
+	
+	ma_pcapng_index_t *index;
+	NSUInteger count;
+	NSUInteger capacity;
+	
+	ma_pcapng_interface_t *interfaces;
+	NSUInteger interfaceCount;
+	NSUInteger interfaceCapacity;
+	
+	u_char *block;
+	size_t blockSize;
+};
+
+
+#pragma mark - Writer
+
+BOOL
+ma_pcapng_writer_flush(ma_pcapng_writer_t *w)
+{
+	if(w->used > 0 && !w->failed)
+		w->failed = !ma_write_all(w->fd, w->buffer, w->used);
+	w->used = 0;
+	
+	return !w->failed;
+}
+
+/*
+ * Room for a block of len bytes at the end of the buffer, flushing first
+ * if needed. Blocks bigger than the whole buffer get a buffer of their own.
+ */
+static u_char *
+ma_pcapng_reserve(ma_pcapng_writer_t *w, size_t len)
+{
+	u_char *p;
+	
+	if(w->used+len > w->size && !ma_pcapng_writer_flush(w))
+		return NULL;
+	
+	if(len > w->size)
+	{
+		if(!(p = realloc(w->buffer, len)))
+			return NULL;
+		w->buffer = p;
+		w->size = len;
+	}
+	
+	p = w->buffer+w->used;
+	w->used += len;
+	memset(p, 0, len);
+	
+	return p;
+}
+
+static u_char *
+ma_pcapng_put_option(u_char *p, uint16_t code, const void *value, uint16_t len)
+{
+	memcpy(p, &code, sizeof(code));
+	memcpy(p+2, &len, sizeof(len));
+	if(len > 0)
+		memcpy(p+4, value, len);
+	
+	return p+4+MA_PAD4(len);
+}
+
+static size_t
+ma_pcapng_option_size(size_t len)
+{
+	return 4+MA_PAD4(len);
+}
+
+/* Fill in a block's type and both copies of its length. */
+static void
+ma_pcapng_close_block(u_char *block, uint32_t type, uint32_t len)
+{
+	memcpy(block, &type, sizeof(type));
+	memcpy(block+4, &len, sizeof(len));
+	memcpy(block+len-4, &len, sizeof(len));
+}
+
+ma_pcapng_writer_t *
+ma_pcapng_writer_open(const char *path, const char *application)
+{
+	ma_pcapng_writer_t *w;
+	size_t appLen = (application ? MIN(strlen(application), 0xffff) : 0);
+	uint32_t len;
+	uint32_t magic = MA_PCAPNG_BYTE_ORDER_MAGIC;
+	uint16_t major = 1;
+	uint16_t minor = 0;
+	int64_t sectionLength = -1;
+	u_char *block;
+	u_char *p;
+	
+	if(!(w = calloc(1, sizeof(*w))))
+		return NULL;
+	
+	if(!(w->buffer = malloc(MAPcapngBufferSize)))
+	{
+		free(w);
+		return NULL;
+	}
+	w->size = MAPcapngBufferSize;
+	
+	if((w->fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644)) == -1)
+	{
+		free(w->buffer);
+		free(w);
+		return NULL;
+	}
+	
+	len = 28+(appLen ? ma_pcapng_option_size(appLen) : 0)+4;
+	if(!(block = ma_pcapng_reserve(w, len)))
+	{
+		close(w->fd);
+		free(w->buffer);
+		free(w);
+		return NULL;
+	}
+	p = block+8;
+	memcpy(p, &magic, 4);
+	memcpy(p+4, &major, 2);
+	memcpy(p+6, &minor, 2);
+	memcpy(p+8, &sectionLength, 8);
+	p += 16;
+	if(appLen)
+		p = ma_pcapng_put_option(p, OPT_SHB_USERAPPL, application,
+								 (uint16_t)appLen);
+	ma_pcapng_put_option(p, OPT_ENDOFOPT, NULL, 0);
+	ma_pcapng_close_block(block, MA_PCAPNG_SHB, len);
+	
+	return w;
+}
+
+/* Returns the new interface's id, or -1. */
+NSInteger
+ma_pcapng_writer_add_interface(ma_pcapng_writer_t *w, int linkType,
+							   uint32_t snapLen, const char *name,
+							   const char *description)
+{
+	size_t nameLen = (name ? MIN(strlen(name), 0xffff) : 0);
+	size_t descLen = (description ? MIN(strlen(description), 0xffff) : 0);
+	uint16_t dlt = (uint16_t)linkType;
+	u_char tsresol = 9;
+	uint32_t len;
+	u_char *block;
+	u_char *p;
+	
+	len = 16+ma_pcapng_option_size(1)+4+4;
+	if(nameLen)
+		len += ma_pcapng_option_size(nameLen);
+	if(descLen)
+		len += ma_pcapng_option_size(descLen);
+	
+	if(!(block = ma_pcapng_reserve(w, len)))
+		return -1;
+	
+	p = block+8;
+	memcpy(p, &dlt, 2);
+	memcpy(p+4, &snapLen, 4);
+	p += 8;
+	if(nameLen)
+		p = ma_pcapng_put_option(p, OPT_IF_NAME, name, (uint16_t)nameLen);
+	if(descLen)
+		p = ma_pcapng_put_option(p, OPT_IF_DESCRIPTION, description,
+								 (uint16_t)descLen);
+	p = ma_pcapng_put_option(p, OPT_IF_TSRESOL, &tsresol, 1);
+	ma_pcapng_put_option(p, OPT_ENDOFOPT, NULL, 0);
+	ma_pcapng_close_block(block, MA_PCAPNG_IDB, len);
+	
+	return w->interfaces++;
+}
+
+BOOL
+ma_pcapng_writer_packet(ma_pcapng_writer_t *w, NSUInteger interface,
+						const struct pcap_pkthdr *hdr, const u_char *data)
+{
+	uint64_t ts = (uint64_t)ma_pkthdr_ns(hdr);
+	uint32_t words[5];
+	uint32_t len;
+	u_char *block;
+	
+	if(interface >= w->interfaces)
+		return NO;
+	
+	len = 28+MA_PAD4(hdr->caplen)+4;
+	if(!(block = ma_pcapng_reserve(w, len)))
+		return NO;
+	
+	words[0] = (uint32_t)interface;
+	words[1] = (uint32_t)(ts >> 32);
+	words[2] = (uint32_t)ts;
+	words[3] = hdr->caplen;
+	words[4] = hdr->len;
+	memcpy(block+8, words, sizeof(words));
+	memcpy(block+28, data, hdr->caplen);
+	ma_pcapng_close_block(block, MA_PCAPNG_EPB, len);
+	
+	return !w->failed;
+}
+
+BOOL
+ma_pcapng_writer_stats(ma_pcapng_writer_t *w, NSUInteger interface,
+					   int64_t timestamp, const ma_pcapng_stats_t *stats)
+{
+	uint32_t words[3];
+	uint32_t len;
+	u_char *block;
+	u_char *p;
+	
+	if(interface >= w->interfaces)
+		return NO;
+	
+	len = 20+4*ma_pcapng_option_size(8)+4+4;
+	if(!(block = ma_pcapng_reserve(w, len)))
+		return NO;
+	
+	words[0] = (uint32_t)interface;
+	words[1] = (uint32_t)((uint64_t)timestamp >> 32);
+	words[2] = (uint32_t)timestamp;
+	memcpy(block+8, words, sizeof(words));
+	
+	p = block+20;
+	p = ma_pcapng_put_option(p, OPT_ISB_IFRECV, &stats->received, 8);
+	p = ma_pcapng_put_option(p, OPT_ISB_IFDROP, &stats->interfaceDropped, 8);
+	p = ma_pcapng_put_option(p, OPT_ISB_OSDROP, &stats->kernelDropped, 8);
+	p = ma_pcapng_put_option(p, OPT_ISB_USRDELIV, &stats->delivered, 8);
+	ma_pcapng_put_option(p, OPT_ENDOFOPT, NULL, 0);
+	ma_pcapng_close_block(block, MA_PCAPNG_ISB, len);
+	
+	return !w->failed;
+}
+
+/* Flush and close. Returns NO if anything failed to reach the file. */
+BOOL
+ma_pcapng_writer_close(ma_pcapng_writer_t *w)
+{
+	BOOL ok;
+	
+	if(w == NULL)
+		return NO;
+	
+	ok = ma_pcapng_writer_flush(w);
+	if(close(w->fd) == -1)
+		ok = NO;
+	
+	free(w->buffer);
+	free(w);
+	
+	return ok;
+}
+
+#pragma mark - Reader
+
+static inline uint16_t
+ma_pcapng_16(const u_char *p, BOOL swap)
+{
+	uint16_t v;
+	
+	memcpy(&v, p, sizeof(v));
+	return (swap ? OSSwapInt16(v) : v);
+}
+
+static inline uint32_t
+ma_pcapng_32(const u_char *p, BOOL swap)
+{
+	uint32_t v;
+	
+	memcpy(&v, p, sizeof(v));
+	return (swap ? OSSwapInt32(v) : v);
+}
+
+static inline uint64_t
+ma_pcapng_64(const u_char *p, BOOL swap)
+{
+	uint64_t v;
+	
+	memcpy(&v, p, sizeof(v));
+	return (swap ? OSSwapInt64(v) : v);
+}
+
+/* Read a whole block into the reader's scratch buffer. */
+static u_char *
+ma_pcapng_read_block(ma_pcapng_reader_t *r, off_t offset, uint32_t len)
+{
+	if(len > r->blockSize)
+	{
+		u_char *p;
+		
+		if(!(p = realloc(r->block, len)))
+			return NULL;
+		r->block = p;
+		r->blockSize = len;
+	}
+	
+	if(!ma_pread_all(r->fd, r->block, len, offset))
+		return NULL;
+	
+	return r->block;
+}
+
+static BOOL
+ma_pcapng_add_index(ma_pcapng_reader_t *r, off_t offset, uint32_t len,
+					uint32_t interface)
+{
+	if(r->count == r->capacity)
+	{
+		NSUInteger capacity = (r->capacity ? r->capacity*2 : 1024);
+		ma_pcapng_index_t *index;
+		
+		if(!(index = realloc(r->index, capacity*sizeof(*index))))
+			return NO;
+		r->index = index;
+		r->capacity = capacity;
+	}
+	
+	r->index[r->count].offset = offset;
+	r->index[r->count].length = len;
+	r->index[r->count].interface = interface;
+	r->count++;
+	
+	return YES;
+}
+
+static BOOL
+ma_pcapng_parse_interface(ma_pcapng_reader_t *r, const u_char *block,
+						  uint32_t len, BOOL swap)
+{
+	ma_pcapng_interface_t *iface;
+	const u_char *p = block+16;
+	const u_char *end = block+len-4;
+	
+	if(r->interfaceCount == r->interfaceCapacity)
+	{
+		NSUInteger capacity = (r->interfaceCapacity ? r->interfaceCapacity*2 : 8);
+		ma_pcapng_interface_t *interfaces;
+		
+		if(!(interfaces = realloc(r->interfaces, capacity*sizeof(*interfaces))))
+			return NO;
+		r->interfaces = interfaces;
+		r->interfaceCapacity = capacity;
+	}
+	
+	iface = &r->interfaces[r->interfaceCount++];
+	memset(iface, 0, sizeof(*iface));
+	iface->linkType = ma_pcapng_16(block+8, swap);
+	iface->snapLen = ma_pcapng_32(block+12, swap);
+	iface->unitsPerSecond = 1000000;
+	
+	while(p+4 <= end)
+	{
+		uint16_t code = ma_pcapng_16(p, swap);
+		uint16_t optLen = ma_pcapng_16(p+2, swap);
+		const u_char *value = p+4;
+		
+		if(code == OPT_ENDOFOPT || value+optLen > end)
+			break;
+		
+		switch(code)
+		{
+			case OPT_IF_NAME:
+				memcpy(iface->name, value, MIN(optLen, sizeof(iface->name)-1));
+				break;
+			
+			case OPT_IF_DESCRIPTION:
+				memcpy(iface->description, value,
+					   MIN(optLen, sizeof(iface->description)-1));
+				break;
+			
+			case OPT_IF_TSRESOL:
+				if(optLen >= 1)
+				{
+					u_char exp = value[0] & 0x7f;
+					uint64_t units = 1;
+					
+					/* High bit set means a power of two, else of ten. */
+					while(exp-- > 0 && units < UINT64_MAX/10)
+						units *= ((value[0] & 0x80) ? 2 : 10);
+					iface->unitsPerSecond = units;
+				}
+				break;
+			
+			case OPT_IF_TSOFFSET:
+				if(optLen >= 8)
+					iface->offset = (int64_t)ma_pcapng_64(value, swap);
+				break;
+		}
+		
+		p = value+MA_PAD4(optLen);
+	}
+	
+	return YES;
+}
+
+/*
+ * Open path and index every packet block in it. A truncated last block
+ * ends the index rather than failing the whole file.
+ */
+ma_pcapng_reader_t *
+ma_pcapng_reader_open(const char *path)
+{
+	ma_pcapng_reader_t *r;
+	NSUInteger sectionBase = 0;
+	BOOL swap = NO;
+	BOOL inSection = NO;
+	off_t offset = 0;
+	BOOL scanning = YES;
+	u_char head[12];
+	
+	if(!(r = calloc(1, sizeof(*r))))
+		return NULL;
+	
+	if((r->fd = open(path, O_RDONLY)) == -1)
+	{
+		free(r);
+		return NULL;
+	}
+	
+	while(scanning && ma_pread_all(r->fd, head, sizeof(head), offset))
+	{
+		uint32_t type = ma_pcapng_32(head, NO);
+		uint32_t len;
+		u_char *block;
+		
+		/* The section header decides the byte order of what follows. */
+		if(type == MA_PCAPNG_SHB)
+		{
+			uint32_t magic = ma_pcapng_32(head+8, NO);
+			
+			if(magic == MA_PCAPNG_BYTE_ORDER_MAGIC)
+				swap = NO;
+			else if(magic == OSSwapInt32(MA_PCAPNG_BYTE_ORDER_MAGIC))
+				swap = YES;
+			else
+				break;
+			
+			inSection = YES;
+			sectionBase = r->interfaceCount;
+		}
+		else if(!inSection)
+			break;
+		
+		type = ma_pcapng_32(head, swap);
+		len = ma_pcapng_32(head+4, swap);
+		if(len < 12 || len % 4 || len > MAMaxRecordSize)
+			break;
+		
+		switch(type)
+		{
+			case MA_PCAPNG_IDB:
+				if(!(block = ma_pcapng_read_block(r, offset, len)) ||
+				   len < 20 || !ma_pcapng_parse_interface(r, block, len, swap))
+					scanning = NO;
+				break;
+			
+			case MA_PCAPNG_EPB:
+				if(!ma_pcapng_add_index(r, offset, len, (uint32_t)sectionBase+
+										ma_pcapng_32(head+8, swap)))
+					scanning = NO;
+				break;
+			
+			case MA_PCAPNG_SPB:
+				if(!ma_pcapng_add_index(r, offset, len, (uint32_t)sectionBase))
+					scanning = NO;
+				break;
+		}
+		
+		offset += len;
+	}
+	
+	if(r->count == 0 && r->interfaceCount == 0)
+	{
+		ma_pcapng_reader_close(r);
+		return NULL;
+	}
+	
+	return r;
+}
+
+void
+ma_pcapng_reader_close(ma_pcapng_reader_t *r)
+{
+	if(r == NULL)
+		return;
+	
+	close(r->fd);
+	free(r->index);
+	free(r->interfaces);
+	free(r->block);
+	free(r);
+}
+
+NSUInteger
+ma_pcapng_reader_count(ma_pcapng_reader_t *r)
+{
+	return r->count;
+}
+
+NSUInteger
+ma_pcapng_reader_interface_count(ma_pcapng_reader_t *r)
+{
+	return r->interfaceCount;
+}
+
+const ma_pcapng_interface_t *
+ma_pcapng_reader_interface(ma_pcapng_reader_t *r, NSUInteger interface)
+{
+	if(interface >= r->interfaceCount)
+		return NULL;
+	
+	return &r->interfaces[interface];
+}
+
+/*
+ * Fetch packet number index. The data pointer stays valid until the next
+ * call on this reader.
+ */
+BOOL
+ma_pcapng_reader_packet(ma_pcapng_reader_t *r, NSUInteger index,
+						ma_pcapng_packet_t *packet)
+{
+	ma_pcapng_index_t *entry;
+	const ma_pcapng_interface_t *iface;
+	u_char *block;
+	uint32_t magic;
+	uint64_t ts;
+	uint64_t secs;
+	BOOL swap;
+	
+	if(index >= r->count)
+		return NO;
+	
+	entry = &r->index[index];
+	if(entry->interface >= r->interfaceCount ||
+	   !(block = ma_pcapng_read_block(r, entry->offset, entry->length)))
+		return NO;
+	
+	/* The trailing length tells us the byte order of this block. */
+	magic = ma_pcapng_32(block+entry->length-4, NO);
+	swap = (magic != entry->length);
+	iface = &r->interfaces[entry->interface];
+	packet->interface = entry->interface;
+	
+	if(ma_pcapng_32(block, swap) == MA_PCAPNG_EPB)
+	{
+		if(entry->length < 32)
+			return NO;
+		
+		ts = ((uint64_t)ma_pcapng_32(block+12, swap) << 32) |
+			ma_pcapng_32(block+16, swap);
+		packet->hdr.caplen = ma_pcapng_32(block+20, swap);
+		packet->hdr.len = ma_pcapng_32(block+24, swap);
+		packet->data = block+28;
+	}
+	else
+	{
+		if(entry->length < 16)
+			return NO;
+		
+		ts = 0;
+		packet->hdr.len = ma_pcapng_32(block+8, swap);
+		packet->hdr.caplen = MIN(packet->hdr.len, entry->length-16);
+		if(iface->snapLen)
+			packet->hdr.caplen = MIN(packet->hdr.caplen, iface->snapLen);
+		packet->data = block+12;
+	}
+	
+	if(packet->data+packet->hdr.caplen > block+entry->length-4)
+		return NO;
+	
+	/* Down to seconds and nanoseconds, see ma_pkthdr_ns(). */
+	secs = ts/iface->unitsPerSecond;
+	packet->hdr.ts.tv_sec = (time_t)(secs+iface->offset);
+	packet->hdr.ts.tv_usec = (suseconds_t)((ts%iface->unitsPerSecond)*
+										   MA_NSEC_PER_SEC/iface->unitsPerSecond);
+	
+	return YES;
+}
+
+/* Sniff the first block type. */
+BOOL
+ma_pcapng_is_pcapng(const char *path)
+{
+	uint32_t type = 0;
+	int fd;
+	BOOL isPcapng;
+	
+	if((fd = open(path, O_RDONLY)) == -1)
+		return NO;
+	
+	isPcapng = (ma_pread_all(fd, &type, sizeof(type), 0) &&
+				type == MA_PCAPNG_SHB);
+	close(fd);
+	
+	return isPcapng;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+#import <pcap/pcap.h>
+
+#import "MAHistogram.h"
+
+
+/*
+ * Stages a live packet passes through on its way from libpcap to the
+ * packet list. Each stage is timed from the boundary before it to the
+ * boundary after it:
+ *
+ *	MA_STAGE_CAPTURE	kernel timestamp -> mahelper callback
+ *	MA_STAGE_ENCODE		mahelper callback -> record encoded
+ *	MA_STAGE_FIFO		record encoded -> record read by the app
+ *	MA_STAGE_DISPATCH	record read -> decode block starts
+ *	MA_STAGE_PACKET		MAPacket creation
+ *	MA_STAGE_MAIN_QUEUE	MAPacket created -> main queue
+ *	MA_STAGE_BUFFER		main queue -> drained out of the document buffer
+ *	MA_STAGE_DRAIN		one updatePacketsWithSortDescriptors: pass
+ *	MA_STAGE_TOTAL		mahelper callback -> drained
+ */
+typedef enum
+{
+	MA_STAGE_CAPTURE,
+	MA_STAGE_ENCODE,
+	MA_STAGE_FIFO,
+	MA_STAGE_DISPATCH,
+	MA_STAGE_PACKET,
+	MA_STAGE_MAIN_QUEUE,
+	MA_STAGE_BUFFER,
+	MA_STAGE_DRAIN,
+	MA_STAGE_TOTAL,
+	MA_STAGE_COUNT
+} ma_stage_t;
+
+typedef struct
+{
+	ma_histogram_t latency;			/* nanoseconds */
+	volatile int64_t packets;
+	volatile int64_t bytes;
+	volatile int64_t drops;
+} ma_stage_stats_t;
+
+typedef struct
+{
+	uint64_t started;				/* ma_pipeline_now() at init/reset */
+	ma_stage_stats_t stages[MA_STAGE_COUNT];
+	volatile int64_t ingested;		/* records read back, survives resets */
+	volatile int64_t shed;			/* shed by the app queues, ditto */
+	volatile int64_t degraded;		/* truncated by the app queues, ditto */
+} ma_pipeline_t;
+
+
+const char *ma_stage_name(ma_stage_t stage);
+
+uint64_t ma_pipeline_now(void);
+uint64_t ma_pipeline_ns(uint64_t ticks);
+uint64_t ma_pipeline_capture_latency(const struct pcap_pkthdr *hdr,
+									 uint64_t stamp);
+
+void ma_pipeline_init(ma_pipeline_t *p);
+void ma_pipeline_reset(ma_pipeline_t *p);
+void ma_pipeline_ingest(ma_pipeline_t *p);
+void ma_pipeline_shed(ma_pipeline_t *p, ma_stage_t stage, NSUInteger packets);
+void ma_pipeline_degrade(ma_pipeline_t *p, NSUInteger packets);
+void ma_pipeline_record(ma_pipeline_t *p, ma_stage_t stage, uint64_t start,
+						uint64_t end, NSUInteger packets, NSUInteger bytes);
+void ma_pipeline_record_ns(ma_pipeline_t *p, ma_stage_t stage, uint64_t ns,
+						   NSUInteger packets, NSUInteger bytes);
+void ma_pipeline_drop(ma_pipeline_t *p, ma_stage_t stage, NSUInteger packets);
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import "MAPipeline.h"
+
+#import <libkern/OSAtomic.h>
+#import <mach/mach_time.h>
+#import <sys/time.h>
+
+#import "MARecord.h"
+
+
+static const char *ma_stage_names[MA_STAGE_COUNT] = {
+	"capture",
+	"encode",
+	"fifo",
+	"dispatch",
+	"packet",
+	"main-queue",
+	"buffer",
+	"drain",
+	"total"
+};
+
+static mach_timebase_info_data_t ma_timebase;
+
+
+const char *
+ma_stage_name(ma_stage_t stage)
+{
+	if(stage >= MA_STAGE_COUNT)
+		return "unknown";
+	
+	return ma_stage_names[stage];
+}
+
+/*
+ * Stage boundaries are stamped with mach_absolute_time(), which is cheap
+ * and shared between mahelper and the app, so stamps taken in the helper
+ * can be compared against stamps taken after the FIFO.
+ */
+uint64_t
+ma_pipeline_now(void)
+{
+	return mach_absolute_time();
+}
+
+uint64_t
+ma_pipeline_ns(uint64_t ticks)
+{
+	if(ma_timebase.denom == 0)
+		mach_timebase_info(&ma_timebase);
+	
+	return ticks*ma_timebase.numer/ma_timebase.denom;
+}
+
+/*
+ * Time between the kernel timestamp in hdr and the mahelper callback that
+ * was stamped at stamp. The kernel uses wall clock time, so the stamp is
+ * converted by walking back from the current wall clock.
+ */
+uint64_t
+ma_pipeline_capture_latency(const struct pcap_pkthdr *hdr, uint64_t stamp)
+{
+	struct timeval now;
+	uint64_t wall;
+	uint64_t captured;
+	uint64_t elapsed;
+	
+	gettimeofday(&now, NULL);
+	elapsed = ma_pipeline_ns(ma_pipeline_now()-stamp);
+	wall = (uint64_t)now.tv_sec*NSEC_PER_SEC+(uint64_t)now.tv_usec*NSEC_PER_USEC;
+	captured = ma_pkthdr_ns(hdr);
+	
+	if(wall < elapsed || wall-elapsed < captured)
+		return 0;
+	
+	return wall-elapsed-captured;
+}
+
+void
+ma_pipeline_init(ma_pipeline_t *p)
+{
+	NSUInteger i;
+	
+	memset(p, 0, sizeof(*p));
+	for(i = 0; i < MA_STAGE_COUNT; i++)
+		ma_histogram_init(&p->stages[i].latency);
+	
+	p->started = ma_pipeline_now();
+}
+
+/*
+ * Clear the stage statistics. The ingested, shed and degraded counts feed
+ * the capture drop counters, which are cumulative, so they are left alone.
+ */
+void
+ma_pipeline_reset(ma_pipeline_t *p)
+{
+	int64_t ingested = p->ingested;
+	int64_t shed = p->shed;
+	int64_t degraded = p->degraded;
+	
+	ma_pipeline_init(p);
+	p->ingested = ingested;
+	p->shed = shed;
+	p->degraded = degraded;
+}
+
+void
+ma_pipeline_ingest(ma_pipeline_t *p)
+{
+	if(p != NULL)
+		OSAtomicIncrement64(&p->ingested);
+}
+
+/*
+ * A packet was shed by a bounded queue in front of stage.
+ */
+void
+ma_pipeline_shed(ma_pipeline_t *p, ma_stage_t stage, NSUInteger packets)
+{
+	if(p == NULL)
+		return;
+	
+	ma_pipeline_drop(p, stage, packets);
+	OSAtomicAdd64(packets, &p->shed);
+}
+
+void
+ma_pipeline_degrade(ma_pipeline_t *p, NSUInteger packets)
+{
+	if(p != NULL)
+		OSAtomicAdd64(packets, &p->degraded);
+}
+
+void
+ma_pipeline_record(ma_pipeline_t *p, ma_stage_t stage, uint64_t start,
+				   uint64_t end, NSUInteger packets, NSUInteger bytes)
+{
+	if(start == 0 || end < start)
+		return;
+	
+	ma_pipeline_record_ns(p, stage, ma_pipeline_ns(end-start), packets, bytes);
+}
+
+void
+ma_pipeline_record_ns(ma_pipeline_t *p, ma_stage_t stage, uint64_t ns,
+					  NSUInteger packets, NSUInteger bytes)
+{
+	ma_stage_stats_t *s;
+	
+	if(p == NULL || stage >= MA_STAGE_COUNT)
+		return;
+	
+	s = &p->stages[stage];
+	ma_histogram_record(&s->latency, ns);
+	OSAtomicAdd64(packets, &s->packets);
+	OSAtomicAdd64(bytes, &s->bytes);
+}
+
+void
+ma_pipeline_drop(ma_pipeline_t *p, ma_stage_t stage, NSUInteger packets)
+{
+	if(p == NULL || stage >= MA_STAGE_COUNT)
+		return;
+	
+	OSAtomicAdd64(packets, &p->stages[stage].drops);
+}
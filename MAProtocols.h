@@ -40,7 +40,8 @@
 typedef enum
 {
 	PCAP_SAVEFILE,
-	PCAP_DEVICE
+	PCAP_DEVICE,
+	PCAP_MERGED
 } cap_device_t;
 
 @protocol MACaptureProtocol <NSObject>
@@ -94,6 +95,8 @@ typedef enum
 - (void)stopRunLoop;
 
 - (NSDictionary *)deviceList;
+- (bycopy NSDictionary *)captureStats;
+- (oneway void)setQueuePolicy:(NSString *)policy;
 
 @end
 
@@ -104,3 +107,11 @@ typedef enum
 - (void)processPacket:(NSData *)data;
 
 @end
+
+
+/* Protocol used by objects shown in a statistics window. */
+@protocol MAStatisticsReporting <NSObject>
+
+- (NSString *)statisticsReport;
+
+@end
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+
+
+/*
+ * Bounded FIFO of opaque items used between pipeline stages. The queue is
+ * limited both in items and in bytes; what happens when a new item does
+ * not fit is decided by the policy:
+ *
+ *	MA_QUEUE_DROP_NEWEST	the new item is refused
+ *	MA_QUEUE_DROP_OLDEST	items at the head are shed to make room
+ *	MA_QUEUE_DEGRADE		producers truncate items to their headers once
+ *							the queue is half full, newest dropped when full
+ *
+ * Shed items are handed to the shed callback given at creation, outside
+ * the queue lock and on the pushing thread; refused items stay with the
+ * caller.
+ */
+typedef enum
+{
+	MA_QUEUE_DROP_NEWEST,
+	MA_QUEUE_DROP_OLDEST,
+	MA_QUEUE_DEGRADE,
+	MA_QUEUE_POLICY_COUNT
+} ma_queue_policy_t;
+
+typedef struct
+{
+	uint64_t enqueued;
+	uint64_t refused;
+	uint64_t shed;
+	uint64_t degraded;
+	NSUInteger count;
+	size_t bytes;
+} ma_queue_stats_t;
+
+typedef void (*ma_queue_shed_t)(void *item);
+
+/* Items shed per lock hold, a push that has to shed more relocks. */
+#define MA_QUEUE_SHED_BATCH	64
+
+typedef struct ma_queue ma_queue_t;
+
+
+ma_queue_t *ma_queue_create(NSUInteger capacity, size_t maxBytes,
+							ma_queue_policy_t policy, ma_queue_shed_t shed);
+void ma_queue_destroy(ma_queue_t *q);
+
+void ma_queue_set_policy(ma_queue_t *q, ma_queue_policy_t policy);
+ma_queue_policy_t ma_queue_policy(ma_queue_t *q);
+ma_queue_policy_t ma_queue_policy_from_string(NSString *name);
+NSString *ma_queue_policy_name(ma_queue_policy_t policy);
+
+BOOL ma_queue_should_degrade(ma_queue_t *q);
+void ma_queue_count_degraded(ma_queue_t *q);
+
+BOOL ma_queue_push(ma_queue_t *q, void *item, size_t size);
+NSUInteger ma_queue_push_batch(ma_queue_t *q, void **items, const size_t *sizes,
+							   NSUInteger count);
+void *ma_queue_pop(ma_queue_t *q, BOOL wait);
+NSUInteger ma_queue_pop_batch(ma_queue_t *q, void **items, size_t *sizes,
+							  NSUInteger max, BOOL wait);
+void ma_queue_close(ma_queue_t *q);
+
+void ma_queue_stats(ma_queue_t *q, ma_queue_stats_t *stats);
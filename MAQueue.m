@@ -0,0 +1,409 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import "MAQueue.h"
+
+#import <pthread.h>
+
+
+typedef struct
+{
+	void *item;
+	size_t size;
+} ma_queue_slot_t;
+
+struct ma_queue
+{
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	
+	ma_queue_slot_t *slots;
+	NSUInteger capacity;
+	NSUInteger head;
+	NSUInteger count;
+	size_t bytes;
+	size_t maxBytes;
+	
+	ma_queue_policy_t policy;
+	ma_queue_shed_t shed;
+	BOOL closed;
+	
+	uint64_t enqueued;
+	uint64_t refused;
+	uint64_t shedCount;
+	uint64_t degraded;
+};
+
+
+ma_queue_t *
+ma_queue_create(NSUInteger capacity, size_t maxBytes,
+				ma_queue_policy_t policy, ma_queue_shed_t shed)
+{
+	ma_queue_t *q;
+	
+	if(capacity == 0 || !(q = calloc(1, sizeof(*q))))
+		return NULL;
+	
+	if(!(q->slots = calloc(capacity, sizeof(*q->slots))))
+	{
+		free(q);
+		return NULL;
+	}
+	
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->ready, NULL);
+	q->capacity = capacity;
+	q->maxBytes = maxBytes;
+	q->policy = policy;
+	q->shed = shed;
+	
+	return q;
+}
+
+/*
+ * Free the queue, anything still queued is passed to the shed callback
+ * without being counted.
+ */
+void
+ma_queue_destroy(ma_queue_t *q)
+{
+	NSUInteger i;
+	
+	if(q == NULL)
+		return;
+	
+	for(i = 0; i < q->count; i++)
+	{
+		void *item = q->slots[(q->head+i) % q->capacity].item;
+		if(q->shed)
+			q->shed(item);
+	}
+	
+	pthread_cond_destroy(&q->ready);
+	pthread_mutex_destroy(&q->lock);
+	free(q->slots);
+	free(q);
+}
+
+#pragma mark - Policy
+
+void
+ma_queue_set_policy(ma_queue_t *q, ma_queue_policy_t policy)
+{
+	pthread_mutex_lock(&q->lock);
+	q->policy = policy;
+	pthread_mutex_unlock(&q->lock);
+}
+
+ma_queue_policy_t
+ma_queue_policy(ma_queue_t *q)
+{
+	return q->policy;
+}
+
+ma_queue_policy_t
+ma_queue_policy_from_string(NSString *name)
+{
+	if([name isEqualToString:@"drop-oldest"])
+		return MA_QUEUE_DROP_OLDEST;
+	else if([name isEqualToString:@"degrade"])
+		return MA_QUEUE_DEGRADE;
+	
+	return MA_QUEUE_DROP_NEWEST;
+}
+
+NSString *
+ma_queue_policy_name(ma_queue_policy_t policy)
+{
+	switch(policy)
+	{
+		case MA_QUEUE_DROP_OLDEST:
+			return @"drop-oldest";
+		case MA_QUEUE_DEGRADE:
+			return @"degrade";
+		default:
+			return @"drop-newest";
+	}
+}
+
+/*
+ * Producers ask this before building an item. It is advisory, so the
+ * unlocked read of count/bytes is fine.
+ */
+BOOL
+ma_queue_should_degrade(ma_queue_t *q)
+{
+	if(q->policy != MA_QUEUE_DEGRADE)
+		return NO;
+	
+	return (q->count*2 >= q->capacity ||
+			(q->maxBytes && q->bytes*2 >= q->maxBytes));
+}
+
+void
+ma_queue_count_degraded(ma_queue_t *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->degraded++;
+	pthread_mutex_unlock(&q->lock);
+}
+
+#pragma mark - Push/Pop
+
+/*
+ * Items shed by one push are collected here and handed to the shed
+ * callback once the lock is dropped, the callback may take locks or
+ * message objects of its own.
+ */
+typedef struct
+{
+	void *items[MA_QUEUE_SHED_BATCH];
+	NSUInteger count;
+} ma_queue_shed_list_t;
+
+typedef enum
+{
+	MA_QUEUE_APPENDED,
+	MA_QUEUE_REFUSED,
+	MA_QUEUE_AGAIN			/* shed list is full, flush it and retry */
+} ma_queue_append_t;
+
+static void
+ma_queue_flush_shed(ma_queue_t *q, ma_queue_shed_list_t *list)
+{
+	NSUInteger i;
+	
+	if(q->shed)
+		for(i = 0; i < list->count; i++)
+			q->shed(list->items[i]);
+	list->count = 0;
+}
+
+/*
+ * Append one item with the lock held, making room first under
+ * MA_QUEUE_DROP_OLDEST.
+ */
+static ma_queue_append_t
+ma_queue_append(ma_queue_t *q, void *item, size_t size,
+				ma_queue_shed_list_t *list)
+{
+	if(q->closed)
+	{
+		q->refused++;
+		return MA_QUEUE_REFUSED;
+	}
+	
+	if(q->policy == MA_QUEUE_DROP_OLDEST)
+	{
+		while(q->count > 0 && (q->count == q->capacity ||
+			  (q->maxBytes && q->bytes+size > q->maxBytes)))
+		{
+			ma_queue_slot_t *slot = &q->slots[q->head];
+			
+			if(list->count == MA_QUEUE_SHED_BATCH)
+				return MA_QUEUE_AGAIN;
+			
+			q->head = (q->head+1) % q->capacity;
+			q->count--;
+			q->bytes -= slot->size;
+			q->shedCount++;
+			list->items[list->count++] = slot->item;
+		}
+	}
+	
+	if(q->count == q->capacity ||
+	   (q->maxBytes && q->count > 0 && q->bytes+size > q->maxBytes))
+	{
+		q->refused++;
+		return MA_QUEUE_REFUSED;
+	}
+	
+	q->slots[(q->head+q->count) % q->capacity].item = item;
+	q->slots[(q->head+q->count) % q->capacity].size = size;
+	q->count++;
+	q->bytes += size;
+	q->enqueued++;
+	
+	return MA_QUEUE_APPENDED;
+}
+
+/*
+ * Append item. Returns NO if the item was refused, in which case the
+ * caller still owns it.
+ */
+BOOL
+ma_queue_push(ma_queue_t *q, void *item, size_t size)
+{
+	ma_queue_shed_list_t list;
+	ma_queue_append_t result;
+	
+	list.count = 0;
+	do
+	{
+		pthread_mutex_lock(&q->lock);
+		if((result = ma_queue_append(q, item, size, &list)) ==
+		   MA_QUEUE_APPENDED)
+			pthread_cond_signal(&q->ready);
+		pthread_mutex_unlock(&q->lock);
+		
+		ma_queue_flush_shed(q, &list);
+	} while(result == MA_QUEUE_AGAIN);
+	
+	return (result == MA_QUEUE_APPENDED);
+}
+
+/*
+ * Append count items under as few locks and wakeups as possible. Stops at
+ * the first refusal and returns how many were taken; the caller still owns
+ * the rest.
+ */
+NSUInteger
+ma_queue_push_batch(ma_queue_t *q, void **items, const size_t *sizes,
+					NSUInteger count)
+{
+	ma_queue_shed_list_t list;
+	ma_queue_append_t result = MA_QUEUE_APPENDED;
+	NSUInteger pushed = 0;
+	
+	list.count = 0;
+	while(pushed < count && result != MA_QUEUE_REFUSED)
+	{
+		NSUInteger before = pushed;
+		
+		pthread_mutex_lock(&q->lock);
+		
+		while(pushed < count &&
+			  (result = ma_queue_append(q, items[pushed], sizes[pushed],
+										&list)) == MA_QUEUE_APPENDED)
+			pushed++;
+		
+		/*
+		 * Everything left over counts as refused, just as single pushes
+		 * would.
+		 */
+		if(result == MA_QUEUE_REFUSED && pushed < count)
+			q->refused += count-pushed-1;
+		
+		if(pushed > before)
+			pthread_cond_signal(&q->ready);
+		pthread_mutex_unlock(&q->lock);
+		
+		ma_queue_flush_shed(q, &list);
+	}
+	
+	return pushed;
+}
+
+/*
+ * Remove the oldest item. With wait, blocks until an item arrives or the
+ * queue is closed; returns NULL when there is nothing to hand out.
+ */
+void *
+ma_queue_pop(ma_queue_t *q, BOOL wait)
+{
+	ma_queue_slot_t *slot;
+	void *item = NULL;
+	
+	pthread_mutex_lock(&q->lock);
+	
+	while(wait && q->count == 0 && !q->closed)
+		pthread_cond_wait(&q->ready, &q->lock);
+	
+	if(q->count > 0)
+	{
+		slot = &q->slots[q->head];
+		item = slot->item;
+		q->head = (q->head+1) % q->capacity;
+		q->count--;
+		q->bytes -= slot->size;
+	}
+	
+	pthread_mutex_unlock(&q->lock);
+	
+	return item;
+}
+
+/*
+ * Remove up to max of the oldest items into items. With wait, blocks until
+ * at least one arrives or the queue is closed. Returns the number removed.
+ */
+NSUInteger
+ma_queue_pop_batch(ma_queue_t *q, void **items, size_t *sizes, NSUInteger max,
+				   BOOL wait)
+{
+	NSUInteger popped = 0;
+	
+	pthread_mutex_lock(&q->lock);
+	
+	while(wait && q->count == 0 && !q->closed)
+		pthread_cond_wait(&q->ready, &q->lock);
+	
+	while(popped < max && q->count > 0)
+	{
+		ma_queue_slot_t *slot = &q->slots[q->head];
+		
+		items[popped] = slot->item;
+		if(sizes)
+			sizes[popped] = slot->size;
+		popped++;
+		
+		q->head = (q->head+1) % q->capacity;
+		q->count--;
+		q->bytes -= slot->size;
+	}
+	
+	pthread_mutex_unlock(&q->lock);
+	
+	return popped;
+}
+
+void
+ma_queue_close(ma_queue_t *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->closed = YES;
+	pthread_cond_broadcast(&q->ready);
+	pthread_mutex_unlock(&q->lock);
+}
+
+void
+ma_queue_stats(ma_queue_t *q, ma_queue_stats_t *stats)
+{
+	pthread_mutex_lock(&q->lock);
+	stats->enqueued = q->enqueued;
+	stats->refused = q->refused;
+	stats->shed = q->shedCount;
+	stats->degraded = q->degraded;
+	stats->count = q->count;
+	stats->bytes = q->bytes;
+	pthread_mutex_unlock(&q->lock);
+}
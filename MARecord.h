@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+#import <pcap/pcap.h>
+#import <sys/time.h>
+
+
+/*
+ * Packet headers inside MacAlyzer carry nanosecond timestamps the way
+ * libpcap does for PCAP_TSTAMP_PRECISION_NANO: ts.tv_usec holds
+ * nanoseconds. Sessions and savefiles are opened at that precision, or
+ * scaled up when the platform can't do it.
+ *
+ * The nanosecond and immediate mode calls came with libpcap 1.5, which
+ * OS X first shipped in 10.10; that is the deployment target.
+ */
+#if !defined(PCAP_TSTAMP_PRECISION_NANO)
+#error "libpcap 1.5 or later is required"
+#endif
+
+#define MA_NSEC_PER_SEC		1000000000LL
+#define MA_NSEC_PER_MSEC	1000000LL
+
+static inline int64_t
+ma_pkthdr_ns(const struct pcap_pkthdr *hdr)
+{
+	return (int64_t)hdr->ts.tv_sec*MA_NSEC_PER_SEC + hdr->ts.tv_usec;
+}
+
+/* A time from gettimeofday(), which does carry microseconds. */
+static inline int64_t
+ma_timeval_ns(const struct timeval *tv)
+{
+	return (int64_t)tv->tv_sec*MA_NSEC_PER_SEC + (int64_t)tv->tv_usec*1000;
+}
+
+
+/*
+ * Frames passed from mahelper to the application over the FIFO, version
+ * 3. Everything is little endian and fixed width, so a recorded stream
+ * can be replayed anywhere. Every frame starts with
+ *
+ *	uint32_t	MA_FRAME_MAGIC
+ *	uint16_t	MA_FRAME_VERSION
+ *	uint16_t	frame type
+ *	uint32_t	length of the body that follows
+ *
+ * A device frame gives a capture device its 16 bit index for the rest of
+ * the stream, it is sent each time the device starts capturing:
+ *
+ *	uint16_t	device index
+ *	uint16_t	0
+ *	int32_t		link type
+ *	char[]		device name (not NUL terminated)
+ *
+ * A packets frame carries one capture batch from one device:
+ *
+ *	uint16_t	device index
+ *	uint16_t	0
+ *	uint32_t	packet count
+ *	uint64_t	first packet id
+ *	uint64_t	mahelper callback stamp of the first packet
+ *	uint64_t	frame encoded stamp (ma_pipeline_now())
+ *
+ * followed by, for each packet,
+ *
+ *	uint32_t	caplen
+ *	uint32_t	len
+ *	uint64_t	timestamp, nanoseconds
+ *	uint32_t	packet id less the first packet id
+ *	uint32_t	callback stamp less the first packet's stamp
+ *	uint32_t	sample weight, the packets this one stands for
+ *	u_char[caplen]	packet data
+ *
+ * Version 2 records had no weight and were 24 bytes. Frames of any other
+ * version are refused rather than misread.
+ */
+
+#define MA_FRAME_MAGIC			0x3246414D	/* "MAF2" */
+#define MA_FRAME_VERSION		3
+#define MA_FRAME_HEADER_SIZE	12
+#define MA_FRAME_DEVICE_SIZE	8
+#define MA_FRAME_PACKETS_SIZE	32
+#define MA_FRAME_RECORD_SIZE	28
+
+typedef enum
+{
+	MA_FRAME_DEVICE = 1,
+	MA_FRAME_PACKETS = 2
+} ma_frame_type_t;
+
+/* A packets frame being built. */
+typedef struct
+{
+	u_char *buf;
+	size_t used;
+	size_t size;
+	uint32_t count;
+	NSUInteger firstId;
+	uint64_t capturedAt;
+} ma_frame_t;
+
+typedef struct
+{
+	uint16_t index;
+	int dataLink;
+	const char *name;
+	size_t nameLen;
+} ma_frame_device_t;
+
+/* A decoded packets frame, records are read off it in order. */
+typedef struct
+{
+	uint16_t device;
+	uint32_t count;
+	NSUInteger firstId;
+	uint64_t capturedAt;
+	uint64_t enqueuedAt;
+	const u_char *records;
+	size_t length;
+	size_t offset;				/* of the next record */
+} ma_frame_packets_t;
+
+typedef struct
+{
+	NSUInteger packetId;
+	uint64_t capturedAt;
+	uint32_t weight;
+	struct pcap_pkthdr hdr;
+	const u_char *data;
+} ma_record_t;
+
+
+size_t ma_frame_device_size(size_t nameLen);
+size_t ma_frame_encode_device(u_char *buf, size_t size, uint16_t index,
+							  int dataLink, const char *name, size_t nameLen);
+BOOL ma_frame_add_packet(ma_frame_t *f, uint16_t device, NSUInteger packetId,
+						 uint64_t capturedAt, uint32_t weight,
+						 const struct pcap_pkthdr *hdr, const u_char *data);
+u_char *ma_frame_finish(ma_frame_t *f, size_t *length);
+void ma_frame_discard(ma_frame_t *f);
+
+BOOL ma_frame_header(const u_char *buf, ma_frame_type_t *type,
+					 uint32_t *length);
+BOOL ma_frame_decode_device(const u_char *body, size_t len,
+							ma_frame_device_t *device);
+BOOL ma_frame_decode_packets(const u_char *body, size_t len,
+							 ma_frame_packets_t *packets);
+BOOL ma_frame_next_record(ma_frame_packets_t *packets, ma_record_t *rec);
+size_t ma_frame_truncate(u_char *body, size_t len, bpf_u_int32 snaplen,
+						 NSUInteger *truncated);
@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import "MARecord.h"
+
+#import <libkern/OSByteOrder.h>
+
+#import "ConfigurationConstants.h"
+#import "MAPipeline.h"
+
+
+static void
+ma_frame_put_header(u_char *p, ma_frame_type_t type, uint32_t length)
+{
+	OSWriteLittleInt32(p, 0, MA_FRAME_MAGIC);
+	OSWriteLittleInt16(p, 4, MA_FRAME_VERSION);
+	OSWriteLittleInt16(p, 6, type);
+	OSWriteLittleInt32(p, 8, length);
+}
+
+#pragma mark - Encoding
+
+size_t
+ma_frame_device_size(size_t nameLen)
+{
+	return MA_FRAME_HEADER_SIZE+MA_FRAME_DEVICE_SIZE+nameLen;
+}
+
+/* Returns the number of bytes used or 0 if the buffer is too small. */
+size_t
+ma_frame_encode_device(u_char *buf, size_t size, uint16_t index,
+					   int dataLink, const char *name, size_t nameLen)
+{
+	size_t total = ma_frame_device_size(nameLen);
+	u_char *body = buf+MA_FRAME_HEADER_SIZE;
+	
+	if(size < total)
+		return 0;
+	
+	ma_frame_put_header(buf, MA_FRAME_DEVICE, (uint32_t)(total-MA_FRAME_HEADER_SIZE));
+	OSWriteLittleInt16(body, 0, index);
+	OSWriteLittleInt16(body, 2, 0);
+	OSWriteLittleInt32(body, 4, (uint32_t)dataLink);
+	memcpy(body+MA_FRAME_DEVICE_SIZE, name, nameLen);
+	
+	return total;
+}
+
+/*
+ * Append a packet to the frame, growing it as needed; the headers are
+ * filled in by ma_frame_finish(). Returns NO if out of memory or the
+ * packet is too far from the first one to be expressed.
+ */
+BOOL
+ma_frame_add_packet(ma_frame_t *f, uint16_t device, NSUInteger packetId,
+					uint64_t capturedAt, uint32_t weight,
+					const struct pcap_pkthdr *hdr, const u_char *data)
+{
+	size_t len = MA_FRAME_RECORD_SIZE+hdr->caplen;
+	u_char *rec;
+	
+	if(f->count == 0)
+	{
+		f->used = MA_FRAME_HEADER_SIZE+MA_FRAME_PACKETS_SIZE;
+		f->firstId = packetId;
+		f->capturedAt = capturedAt;
+	}
+	
+	if(packetId-f->firstId > UINT32_MAX || capturedAt < f->capturedAt ||
+	   capturedAt-f->capturedAt > UINT32_MAX)
+		return NO;
+	
+	if(f->used+len > f->size)
+	{
+		size_t size = MAX(f->size, MAFrameInitialSize);
+		u_char *buf;
+		
+		while(size < f->used+len)
+			size *= 2;
+		
+		if(!(buf = realloc(f->buf, size)))
+			return NO;
+		f->buf = buf;
+		f->size = size;
+	}
+	
+	/* The device index goes in now, the rest of the header later. */
+	OSWriteLittleInt16(f->buf, MA_FRAME_HEADER_SIZE, device);
+	
+	rec = f->buf+f->used;
+	OSWriteLittleInt32(rec, 0, hdr->caplen);
+	OSWriteLittleInt32(rec, 4, hdr->len);
+	OSWriteLittleInt64(rec, 8, (uint64_t)ma_pkthdr_ns(hdr));
+	OSWriteLittleInt32(rec, 16, (uint32_t)(packetId-f->firstId));
+	OSWriteLittleInt32(rec, 20, (uint32_t)(capturedAt-f->capturedAt));
+	OSWriteLittleInt32(rec, 24, weight);
+	memcpy(rec+MA_FRAME_RECORD_SIZE, data, hdr->caplen);
+	
+	f->used += len;
+	f->count++;
+	
+	return YES;
+}
+
+/*
+ * Fill in the headers, stamping the frame as encoded, and hand over the
+ * buffer; the caller frees it. f is ready for the next frame. NULL if
+ * there were no packets.
+ */
+u_char *
+ma_frame_finish(ma_frame_t *f, size_t *length)
+{
+	u_char *buf = f->buf;
+	u_char *body;
+	
+	if(f->count == 0)
+		return NULL;
+	
+	body = buf+MA_FRAME_HEADER_SIZE;
+	ma_frame_put_header(buf, MA_FRAME_PACKETS,
+						(uint32_t)(f->used-MA_FRAME_HEADER_SIZE));
+	OSWriteLittleInt16(body, 2, 0);
+	OSWriteLittleInt32(body, 4, f->count);
+	OSWriteLittleInt64(body, 8, (uint64_t)f->firstId);
+	OSWriteLittleInt64(body, 16, f->capturedAt);
+	OSWriteLittleInt64(body, 24, ma_pipeline_now());
+	*length = f->used;
+	
+	f->buf = NULL;
+	f->used = 0;
+	f->size = 0;
+	f->count = 0;
+	
+	return buf;
+}
+
+void
+ma_frame_discard(ma_frame_t *f)
+{
+	free(f->buf);
+	memset(f, 0, sizeof(*f));
+}
+
+#pragma mark - Decoding
+
+/* Check a frame header and pull out its type and body length. */
+BOOL
+ma_frame_header(const u_char *buf, ma_frame_type_t *type, uint32_t *length)
+{
+	if(OSReadLittleInt32(buf, 0) != MA_FRAME_MAGIC ||
+	   OSReadLittleInt16(buf, 4) != MA_FRAME_VERSION)
+		return NO;
+	
+	*type = OSReadLittleInt16(buf, 6);
+	*length = OSReadLittleInt32(buf, 8);
+	
+	return YES;
+}
+
+/* The returned name references body, nothing is copied. */
+BOOL
+ma_frame_decode_device(const u_char *body, size_t len,
+					   ma_frame_device_t *device)
+{
+	if(len < MA_FRAME_DEVICE_SIZE)
+		return NO;
+	
+	device->index = OSReadLittleInt16(body, 0);
+	device->dataLink = (int)OSReadLittleInt32(body, 4);
+	device->name = (const char *)body+MA_FRAME_DEVICE_SIZE;
+	device->nameLen = len-MA_FRAME_DEVICE_SIZE;
+	
+	return YES;
+}
+
+BOOL
+ma_frame_decode_packets(const u_char *body, size_t len,
+						ma_frame_packets_t *packets)
+{
+	if(len < MA_FRAME_PACKETS_SIZE)
+		return NO;
+	
+	packets->device = OSReadLittleInt16(body, 0);
+	packets->count = OSReadLittleInt32(body, 4);
+	packets->firstId = (NSUInteger)OSReadLittleInt64(body, 8);
+	packets->capturedAt = OSReadLittleInt64(body, 16);
+	packets->enqueuedAt = OSReadLittleInt64(body, 24);
+	packets->records = body+MA_FRAME_PACKETS_SIZE;
+	packets->length = len-MA_FRAME_PACKETS_SIZE;
+	packets->offset = 0;
+	
+	return YES;
+}
+
+/*
+ * The next record of a packets frame. rec->data references the frame.
+ * Returns NO at the end or if the frame is cut short.
+ */
+BOOL
+ma_frame_next_record(ma_frame_packets_t *packets, ma_record_t *rec)
+{
+	const u_char *p = packets->records+packets->offset;
+	size_t left = packets->length-packets->offset;
+	int64_t ts;
+	
+	if(left < MA_FRAME_RECORD_SIZE)
+		return NO;
+	
+	rec->hdr.caplen = OSReadLittleInt32(p, 0);
+	rec->hdr.len = OSReadLittleInt32(p, 4);
+	if(left-MA_FRAME_RECORD_SIZE < rec->hdr.caplen)
+		return NO;
+	
+	ts = (int64_t)OSReadLittleInt64(p, 8);
+	rec->hdr.ts.tv_sec = (time_t)(ts/MA_NSEC_PER_SEC);
+	rec->hdr.ts.tv_usec = (suseconds_t)(ts%MA_NSEC_PER_SEC);
+	rec->packetId = packets->firstId+OSReadLittleInt32(p, 16);
+	rec->capturedAt = packets->capturedAt+OSReadLittleInt32(p, 20);
+	rec->weight = OSReadLittleInt32(p, 24);
+	rec->data = p+MA_FRAME_RECORD_SIZE;
+	
+	packets->offset += MA_FRAME_RECORD_SIZE+rec->hdr.caplen;
+	
+	return YES;
+}
+
+/*
+ * Cut the packet data of every record in a packets frame body down to
+ * snaplen bytes in place, keeping the original wire lengths. Returns the
+ * new body length, truncated is set to how many records were cut.
+ */
+size_t
+ma_frame_truncate(u_char *body, size_t len, bpf_u_int32 snaplen,
+				  NSUInteger *truncated)
+{
+	size_t in = MA_FRAME_PACKETS_SIZE;
+	size_t out = MA_FRAME_PACKETS_SIZE;
+	
+	*truncated = 0;
+	if(len < MA_FRAME_PACKETS_SIZE)
+		return len;
+	
+	while(len-in >= MA_FRAME_RECORD_SIZE)
+	{
+		uint32_t caplen = OSReadLittleInt32(body, in);
+		uint32_t keep = MIN(caplen, snaplen);
+		
+		if(len-in-MA_FRAME_RECORD_SIZE < caplen)
+			break;
+		
+		if(keep < caplen)
+		{
+			OSWriteLittleInt32(body, in, keep);
+			(*truncated)++;
+		}
+		
+		memmove(body+out, body+in, MA_FRAME_RECORD_SIZE+keep);
+		in += MA_FRAME_RECORD_SIZE+caplen;
+		out += MA_FRAME_RECORD_SIZE+keep;
+	}
+	
+	return out;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+#import <pcap/pcap.h>
+
+
+/*
+ * Packet sampling for one capture session, applied before packets are
+ * framed for the app.
+ *
+ *	count		every rate'th packet
+ *	random		each packet with probability 1/rate
+ *	reservoir	a uniform sample of reservoir packets out of every window
+ *			nanoseconds, handed on in time order when the window ends
+ *	flow		the packets of one in rate flows, chosen by a hash of the
+ *			addresses, protocol and ports that is the same both ways;
+ *			it isn't seeded, so every capture picks the same flows
+ *
+ * Every packet handed on carries a weight, the number of packets it
+ * stands for, so counts and byte totals can be scaled back up. Within a
+ * reservoir window the weights add up to exactly the packets seen.
+ */
+
+typedef enum
+{
+	MA_SAMPLE_NONE,
+	MA_SAMPLE_COUNT,
+	MA_SAMPLE_RANDOM,
+	MA_SAMPLE_RESERVOIR,
+	MA_SAMPLE_FLOW
+} ma_sample_mode_t;
+
+typedef struct
+{
+	ma_sample_mode_t mode;
+	uint32_t rate;				/* 1 in rate, not for reservoir */
+	NSUInteger reservoir;		/* packets kept per window */
+	int64_t window;				/* ns */
+	int linkType;				/* to find the flow in a packet */
+	uint32_t snapLen;
+} ma_sampler_config_t;
+
+typedef struct ma_sampler ma_sampler_t;
+
+/* Called for each packet the sampler keeps. */
+typedef void (*ma_sample_fn)(void *ctx, const struct pcap_pkthdr *hdr,
+							 const u_char *data, NSUInteger packetId,
+							 uint32_t weight);
+
+
+ma_sampler_t *ma_sampler_create(const ma_sampler_config_t *config);
+void ma_sampler_destroy(ma_sampler_t *s);
+void ma_sampler_packet(ma_sampler_t *s, const struct pcap_pkthdr *hdr,
+					   const u_char *data, NSUInteger packetId,
+					   ma_sample_fn fn, void *ctx);
+void ma_sampler_tick(ma_sampler_t *s, int64_t now, ma_sample_fn fn, void *ctx);
+uint64_t ma_sampler_discarded(ma_sampler_t *s);
+
+ma_sample_mode_t ma_sample_mode_from_string(NSString *name);
+NSString *ma_sample_mode_name(ma_sample_mode_t mode);
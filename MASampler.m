@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import "MASampler.h"
+
+#import "MAFlow.h"
+#import "MARecord.h"
+
+
+typedef struct
+{
+	struct pcap_pkthdr hdr;
+	size_t offset;
+	NSUInteger packetId;
+} ma_sample_slot_t;
+
+struct ma_sampler
+{
+	ma_sampler_config_t config;
+	uint64_t random;
+	uint64_t seen;
+	uint64_t discarded;
+	
+	/* Reservoir mode */
+	u_char *arena;
+	ma_sample_slot_t *slots;
+	NSUInteger kept;
+	uint64_t windowSeen;
+	int64_t windowEnd;
+};
+
+
+/* xorshift64*, plenty for picking packets. */
+static inline uint64_t
+ma_sampler_random(ma_sampler_t *s)
+{
+	s->random ^= s->random >> 12;
+	s->random ^= s->random << 25;
+	s->random ^= s->random >> 27;
+	
+	return s->random*0x2545F4914F6CDD1DULL;
+}
+
+ma_sampler_t *
+ma_sampler_create(const ma_sampler_config_t *config)
+{
+	ma_sampler_t *s;
+	
+	if(config->mode == MA_SAMPLE_NONE)
+		return NULL;
+	
+	if(config->mode == MA_SAMPLE_RESERVOIR ?
+	   (config->reservoir == 0 || config->window <= 0) : config->rate < 2)
+		return NULL;
+	
+	if(!(s = calloc(1, sizeof(*s))))
+		return NULL;
+	
+	s->config = *config;
+	s->random = ((uint64_t)arc4random() << 32 | arc4random()) | 1;
+	
+	if(config->mode == MA_SAMPLE_RESERVOIR)
+	{
+		s->arena = malloc(config->reservoir*config->snapLen);
+		s->slots = calloc(config->reservoir, sizeof(*s->slots));
+		if(!s->arena || !s->slots)
+		{
+			NSLog(@"%s(): no memory for a %lu packet reservoir", __func__,
+				  (unsigned long)config->reservoir);
+			ma_sampler_destroy(s);
+			return NULL;
+		}
+	}
+	
+	return s;
+}
+
+void
+ma_sampler_destroy(ma_sampler_t *s)
+{
+	if(s == NULL)
+		return;
+	
+	free(s->arena);
+	free(s->slots);
+	free(s);
+}
+
+#pragma mark - Reservoir
+
+static int
+ma_sampler_slot_compare(const void *a, const void *b)
+{
+	int64_t ta = ma_pkthdr_ns(&((const ma_sample_slot_t *)a)->hdr);
+	int64_t tb = ma_pkthdr_ns(&((const ma_sample_slot_t *)b)->hdr);
+	
+	return (ta < tb ? -1 : (ta > tb ? 1 : 0));
+}
+
+/*
+ * Hand on what the window kept, oldest first. The weights split the
+ * window's packets as evenly as they can.
+ */
+static void
+ma_sampler_end_window(ma_sampler_t *s, ma_sample_fn fn, void *ctx)
+{
+	uint32_t weight;
+	NSUInteger extra;
+	NSUInteger i;
+	
+	if(s->kept > 0)
+	{
+		weight = (uint32_t)(s->windowSeen/s->kept);
+		extra = (NSUInteger)(s->windowSeen%s->kept);
+		
+		qsort(s->slots, s->kept, sizeof(*s->slots), ma_sampler_slot_compare);
+		for(i = 0; i < s->kept; i++)
+		{
+			ma_sample_slot_t *slot = &s->slots[i];
+			
+			fn(ctx, &slot->hdr, s->arena+slot->offset, slot->packetId,
+			   weight+(i < extra ? 1 : 0));
+		}
+		s->discarded += s->windowSeen-s->kept;
+	}
+	
+	s->kept = 0;
+	s->windowSeen = 0;
+}
+
+/* Algorithm R: the n'th packet of the window replaces a slot with k/n odds. */
+static void
+ma_sampler_reservoir(ma_sampler_t *s, const struct pcap_pkthdr *hdr,
+					 const u_char *data, NSUInteger packetId)
+{
+	ma_sample_slot_t *slot;
+	uint64_t pick;
+	
+	s->windowSeen++;
+	
+	if(s->kept < s->config.reservoir)
+		slot = &s->slots[s->kept++];
+	else if((pick = ma_sampler_random(s)%s->windowSeen) < s->config.reservoir)
+		slot = &s->slots[pick];
+	else
+		return;
+	
+	/* Slots move when sorted, so each one's place is tied to its index. */
+	slot->hdr = *hdr;
+	slot->hdr.caplen = MIN(hdr->caplen, s->config.snapLen);
+	slot->offset = (slot-s->slots)*s->config.snapLen;
+	slot->packetId = packetId;
+	memcpy(s->arena+slot->offset, data, slot->hdr.caplen);
+}
+
+#pragma mark - Sampling
+
+void
+ma_sampler_packet(ma_sampler_t *s, const struct pcap_pkthdr *hdr,
+				  const u_char *data, NSUInteger packetId,
+				  ma_sample_fn fn, void *ctx)
+{
+	uint32_t rate = s->config.rate;
+	ma_flow_t flow;
+	BOOL keep;
+	
+	s->seen++;
+	
+	switch(s->config.mode)
+	{
+		case MA_SAMPLE_COUNT:
+			keep = ((s->seen-1)%rate == 0);
+			break;
+			
+		case MA_SAMPLE_RANDOM:
+			keep = (ma_sampler_random(s)%rate == 0);
+			break;
+			
+		case MA_SAMPLE_FLOW:
+			/* Anything that isn't IP is counted through instead. */
+			if(ma_flow_parse(s->config.linkType, hdr, data, &flow))
+				keep = (flow.hash%rate == 0);
+			else
+				keep = ((s->seen-1)%rate == 0);
+			break;
+			
+		case MA_SAMPLE_RESERVOIR:
+			ma_sampler_tick(s, ma_pkthdr_ns(hdr), fn, ctx);
+			ma_sampler_reservoir(s, hdr, data, packetId);
+			return;
+			
+		default:
+			keep = YES;
+			rate = 1;
+			break;
+	}
+	
+	if(keep)
+		fn(ctx, hdr, data, packetId, rate);
+	else
+		s->discarded++;
+}
+
+/*
+ * Let the sampler know the time, now in nanoseconds since the epoch. A
+ * reservoir whose window has passed is handed on even if no packet has
+ * arrived to close it.
+ */
+void
+ma_sampler_tick(ma_sampler_t *s, int64_t now, ma_sample_fn fn, void *ctx)
+{
+	int64_t window = s->config.window;
+	
+	if(s->config.mode != MA_SAMPLE_RESERVOIR)
+		return;
+	
+	if(s->windowEnd == 0)
+		s->windowEnd = now-now%window+window;
+	
+	if(now < s->windowEnd)
+		return;
+	
+	ma_sampler_end_window(s, fn, ctx);
+	s->windowEnd = now-now%window+window;
+}
+
+uint64_t
+ma_sampler_discarded(ma_sampler_t *s)
+{
+	return s->discarded;
+}
+
+ma_sample_mode_t
+ma_sample_mode_from_string(NSString *name)
+{
+	if([name isEqualToString:@"count"])
+		return MA_SAMPLE_COUNT;
+	else if([name isEqualToString:@"random"])
+		return MA_SAMPLE_RANDOM;
+	else if([name isEqualToString:@"reservoir"])
+		return MA_SAMPLE_RESERVOIR;
+	else if([name isEqualToString:@"flow"])
+		return MA_SAMPLE_FLOW;
+	
+	return MA_SAMPLE_NONE;
+}
+
+NSString *
+ma_sample_mode_name(ma_sample_mode_t mode)
+{
+	switch(mode)
+	{
+		case MA_SAMPLE_COUNT:
+			return @"count";
+		case MA_SAMPLE_RANDOM:
+			return @"random";
+		case MA_SAMPLE_RESERVOIR:
+			return @"reservoir";
+		case MA_SAMPLE_FLOW:
+			return @"flow";
+		default:
+			return @"none";
+	}
+}
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+#import <pcap/pcap.h>
+
+
+/*
+ * Write-behind capture file.
+ *
+ * Packets are appended to large page aligned buffers by a single
+ * producer; full buffers are handed to a writer thread which writes them
+ * out and fsyncs the file every MASpoolSyncInterval. The producer never
+ * waits on the disk, if every buffer is still queued for writing the
+ * packet is counted as dropped instead.
+ * ma_spool_open_with_room() takes the size of a burst known up front,
+ * such as a trigger's ring, and has enough buffers to hold all of it.
+ *
+ * The file is a plain nanosecond pcap savefile. With a rotation set the
+ * capture is split over numbered files, a new one started once the
+ * current one reaches maxBytes or spans maxDuration, and only the last
+ * maxFiles kept. An index of which file holds which time range is kept
+ * in memory and next to the files, as <name>.index. With compress set
+ * each finished file is turned into a block store (see MABlockStore.h)
+ * in the background and the savefile removed. ma_spool_discard() closes
+ * the spool and removes all of it.
+ */
+
+/* What a packet takes in the file besides its data. */
+#define MA_SPOOL_RECORD_SIZE	16
+/* The pcap header at the start of each file. */
+#define MA_SPOOL_HEADER_SIZE	24
+
+typedef struct
+{
+	uint64_t packets;		/* appended */
+	uint64_t dropped;		/* no buffer free */
+	uint64_t written;		/* bytes on disk */
+	uint64_t syncs;
+	uint64_t rotations;
+} ma_spool_stats_t;
+
+typedef struct
+{
+	uint64_t maxBytes;		/* 0 for no limit */
+	int64_t maxDuration;	/* nanoseconds, 0 for no limit */
+	NSUInteger maxFiles;	/* 0 to keep every file */
+	BOOL compress;			/* finished files to block stores */
+} ma_spool_rotation_t;
+
+typedef struct
+{
+	uint32_t sequence;
+	int64_t first;			/* nanoseconds */
+	int64_t last;
+	uint64_t packets;
+	uint64_t bytes;
+} ma_spool_file_t;
+
+typedef struct ma_spool ma_spool_t;
+
+
+ma_spool_t *ma_spool_open(const char *path, int linkType, uint32_t snapLen,
+						  const ma_spool_rotation_t *rotation);
+ma_spool_t *ma_spool_open_with_room(const char *path, int linkType,
+									uint32_t snapLen,
+									const ma_spool_rotation_t *rotation,
+									size_t room);
+BOOL ma_spool_packet(ma_spool_t *s, const struct pcap_pkthdr *hdr,
+					 const u_char *data);
+void ma_spool_commit(ma_spool_t *s);
+BOOL ma_spool_sync(ma_spool_t *s);
+BOOL ma_spool_close(ma_spool_t *s);
+void ma_spool_discard(ma_spool_t *s);
+void ma_spool_stats(ma_spool_t *s, ma_spool_stats_t *stats);
+BOOL ma_spool_rotates(ma_spool_t *s);
+BOOL ma_spool_complete(ma_spool_t *s);
+NSUInteger ma_spool_file_count(ma_spool_t *s);
+BOOL ma_spool_file(ma_spool_t *s, NSUInteger index, ma_spool_file_t *file);
+uint64_t ma_spool_synced_bytes(ma_spool_t *s, uint32_t sequence);
+void ma_spool_file_path(ma_spool_t *s, uint32_t sequence, char *path,
+						size_t size);
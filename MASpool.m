@@ -0,0 +1,906 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import "MASpool.h"
+
+#import <fcntl.h>
+#import <libkern/OSAtomic.h>
+#import <stdio.h>
+#import <pthread.h>
+#import <sys/param.h>
+#import <sys/time.h>
+#import <unistd.h>
+
+#import "ConfigurationConstants.h"
+#import "MABlockStore.h"
+#import "MAFileIO.h"
+#import "MARecord.h"
+
+
+#define MA_PCAP_NSEC_MAGIC	0xa1b23c4d
+
+typedef struct
+{
+	uint32_t sec;
+	uint32_t nsec;
+	uint32_t caplen;
+	uint32_t len;
+} ma_spool_record_t;
+
+struct ma_spool
+{
+	int fd;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;		/* writer waits for buffers */
+	pthread_cond_t done;		/* producer waits for the writer */
+	
+	u_char **buffers;
+	size_t *used;
+	NSUInteger bufferCount;
+	NSUInteger fill;			/* owned by the producer */
+	NSUInteger head;			/* next one for the writer */
+	NSUInteger pending;			/* full buffers queued */
+	
+	int linkType;
+	uint32_t snapLen;
+	char base[MAXPATHLEN];		/* path less its extension */
+	char extension[16];
+	
+	ma_spool_rotation_t rotation;
+	BOOL rotating;
+	BOOL *rotateAfter;
+	ma_spool_file_t *finished;
+	ma_spool_file_t current;	/* owned by the producer */
+	ma_spool_file_t *files;		/* finished and still on disk */
+	NSUInteger fileCount;
+	NSUInteger fileCapacity;
+	
+	uint32_t writing;			/* the writer's file, under the lock */
+	uint64_t fileWritten;
+	uint64_t synced;			/* of it, as of the last fsync */
+	
+	struct timeval handedAt;
+	BOOL syncRequested;
+	BOOL dirty;
+	BOOL closing;
+	BOOL failed;
+	
+	ma_spool_stats_t stats;		/* the writer's counters, under the lock */
+	volatile int64_t appended;	/* the producer's, without it */
+	volatile int64_t dropped;
+};
+
+
+/* Sequence 0 is the file of a spool that doesn't rotate. */
+static void
+ma_spool_savefile_path(ma_spool_t *s, uint32_t sequence, char *path,
+					   size_t size)
+{
+	if(sequence == 0)
+		snprintf(path, size, "%s%s", s->base, s->extension);
+	else
+		snprintf(path, size, "%s_%05u%s", s->base, sequence, s->extension);
+}
+
+static void
+ma_spool_archive_path(ma_spool_t *s, uint32_t sequence, char *path,
+					  size_t size)
+{
+	snprintf(path, size, "%s_%05u%s", s->base, sequence,
+			 MABlockStoreExtension);
+}
+
+/*
+ * Compressing and removing files goes through one queue, so a file is
+ * never removed while it is still being compressed.
+ */
+static dispatch_queue_t
+ma_spool_archive_queue(void)
+{
+	static dispatch_queue_t queue;
+	static dispatch_once_t once;
+	
+	dispatch_once(&once, ^{
+		queue = dispatch_queue_create(MAArchiveQueueName, NULL);
+	});
+	
+	return queue;
+}
+
+/* Compress a finished file into its block store, then drop the savefile. */
+static void
+ma_spool_archive(ma_spool_t *s, uint32_t sequence)
+{
+	char path[MAXPATHLEN];
+	char *source;
+	char *archive;
+	
+	ma_spool_savefile_path(s, sequence, path, sizeof(path));
+	source = strdup(path);
+	ma_spool_archive_path(s, sequence, path, sizeof(path));
+	archive = strdup(path);
+	if(source == NULL || archive == NULL)
+	{
+		free(source);
+		free(archive);
+		return;
+	}
+	
+	dispatch_async(ma_spool_archive_queue(), ^{
+		char temp[MAXPATHLEN];
+		
+		/* Only ever show the finished store under its real name. */
+		snprintf(temp, sizeof(temp), "%s.tmp", archive);
+		if(ma_blockstore_compress_savefile(source, temp, MA_BLOCKSTORE_LIVE) &&
+		   rename(temp, archive) == 0)
+			unlink(source);
+		else
+			unlink(temp);
+		
+		free(source);
+		free(archive);
+	});
+}
+
+static void
+ma_spool_remove(ma_spool_t *s, uint32_t sequence)
+{
+	char path[MAXPATHLEN];
+	char *source;
+	char *archive;
+	
+	ma_spool_savefile_path(s, sequence, path, sizeof(path));
+	if(!s->rotation.compress)
+	{
+		unlink(path);
+		return;
+	}
+	
+	source = strdup(path);
+	ma_spool_archive_path(s, sequence, path, sizeof(path));
+	archive = strdup(path);
+	
+	dispatch_async(ma_spool_archive_queue(), ^{
+		if(source)
+			unlink(source);
+		if(archive)
+			unlink(archive);
+		free(source);
+		free(archive);
+	});
+}
+
+static int
+ma_spool_create(ma_spool_t *s, uint32_t sequence)
+{
+	char path[MAXPATHLEN];
+	int fd;
+	
+	ma_spool_savefile_path(s, sequence, path, sizeof(path));
+	if((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644)) == -1)
+		return -1;
+	ma_file_own(fd);
+	
+#ifdef F_NOCACHE
+	/* We won't read it back soon, keep it out of the buffer cache. */
+	fcntl(fd, F_NOCACHE, 1);
+#endif
+	
+	return fd;
+}
+
+/* Rewrite <name>.index from a copy of the file list. */
+static void
+ma_spool_write_index(ma_spool_t *s, const ma_spool_file_t *files,
+					 NSUInteger count)
+{
+	char path[MAXPATHLEN];
+	char temp[MAXPATHLEN];
+	NSUInteger i;
+	FILE *fp;
+	
+	snprintf(path, sizeof(path), "%s.index", s->base);
+	snprintf(temp, sizeof(temp), "%s.index.tmp", s->base);
+	if(!(fp = fopen(temp, "w")))
+		return;
+	ma_file_own(fileno(fp));
+	
+	for(i = 0; i < count; i++)
+		fprintf(fp, "%u\t%lld\t%lld\t%llu\t%llu\n", files[i].sequence,
+				(long long)files[i].first, (long long)files[i].last,
+				(unsigned long long)files[i].packets,
+				(unsigned long long)files[i].bytes);
+	
+	if(fclose(fp) == 0)
+		rename(temp, path);
+}
+
+/*
+ * The buffer just written finished a file: close it, start the next,
+ * drop the oldest ones past maxFiles and update the index. Called with
+ * the lock held, which is dropped around the file system work.
+ */
+static void
+ma_spool_rotate_file(ma_spool_t *s, const ma_spool_file_t *finished)
+{
+	ma_spool_file_t *files;
+	NSUInteger count;
+	BOOL closed;
+	int fd;
+	
+	pthread_mutex_unlock(&s->lock);
+	/* Close even if the sync failed, the file is finished either way. */
+	closed = NO;
+	if(s->fd != -1)
+	{
+		closed = (fsync(s->fd) == 0);
+		if(close(s->fd) == -1)
+			closed = NO;
+	}
+	fd = ma_spool_create(s, finished->sequence+1);
+	pthread_mutex_lock(&s->lock);
+	
+	if(!closed || fd == -1)
+		s->failed = YES;
+	s->fd = fd;
+	s->dirty = NO;
+	s->writing = finished->sequence+1;
+	s->fileWritten = 0;
+	s->synced = 0;
+	s->stats.rotations++;
+	
+	if(closed && s->rotation.compress)
+		ma_spool_archive(s, finished->sequence);
+	
+	if(s->fileCount == s->fileCapacity)
+	{
+		NSUInteger capacity = (s->fileCapacity ? s->fileCapacity*2 : 16);
+		
+		if((files = realloc(s->files, capacity*sizeof(*files))))
+		{
+			s->files = files;
+			s->fileCapacity = capacity;
+		}
+	}
+	if(s->fileCount < s->fileCapacity)
+		s->files[s->fileCount++] = *finished;
+	
+	/* The file being written counts towards maxFiles too. */
+	while(s->rotation.maxFiles && s->fileCount > 0 &&
+		  s->fileCount >= s->rotation.maxFiles)
+	{
+		uint32_t sequence = s->files[0].sequence;
+		
+		memmove(s->files, s->files+1, (--s->fileCount)*sizeof(*s->files));
+		
+		pthread_mutex_unlock(&s->lock);
+		ma_spool_remove(s, sequence);
+		pthread_mutex_lock(&s->lock);
+	}
+	
+	count = s->fileCount;
+	if(!(files = malloc((count ? count : 1)*sizeof(*files))))
+		return;
+	memcpy(files, s->files, count*sizeof(*files));
+	
+	pthread_mutex_unlock(&s->lock);
+	ma_spool_write_index(s, files, count);
+	free(files);
+	pthread_mutex_lock(&s->lock);
+}
+
+static void *
+ma_spool_writer(void *arg)
+{
+	ma_spool_t *s = arg;
+	struct timeval lastSync;
+	
+	gettimeofday(&lastSync, NULL);
+	pthread_mutex_lock(&s->lock);
+	for(;;)
+	{
+		struct timeval now;
+		struct timespec deadline;
+		BOOL elapsed;
+		BOOL syncing;
+		
+		while(s->pending == 0 && !s->closing && !s->syncRequested)
+		{
+			deadline.tv_sec = lastSync.tv_sec+MASpoolSyncInterval;
+			deadline.tv_nsec = lastSync.tv_usec*1000;
+			if(pthread_cond_timedwait(&s->ready, &s->lock,
+									  &deadline) == ETIMEDOUT)
+				break;
+		}
+		
+		/* Only what is queued now is covered by this sync. */
+		syncing = s->syncRequested;
+		
+		/* The producer doesn't touch queued buffers, write without the lock. */
+		while(s->pending > 0)
+		{
+			NSUInteger i = s->head;
+			BOOL ok;
+			
+			pthread_mutex_unlock(&s->lock);
+			ok = (s->fd != -1 &&
+				  ma_write_all(s->fd, s->buffers[i], s->used[i]));
+			pthread_mutex_lock(&s->lock);
+			
+			if(ok)
+			{
+				s->stats.written += s->used[i];
+				s->fileWritten += s->used[i];
+			}
+			else
+				s->failed = YES;
+			s->dirty = YES;
+			
+			if(s->rotateAfter[i])
+			{
+				s->rotateAfter[i] = NO;
+				ma_spool_rotate_file(s, &s->finished[i]);
+			}
+			
+			s->head = (i+1) % s->bufferCount;
+			s->pending--;
+			pthread_cond_broadcast(&s->done);
+		}
+		
+		gettimeofday(&now, NULL);
+		elapsed = (now.tv_sec-lastSync.tv_sec >= MASpoolSyncInterval);
+		if(s->dirty && (syncing || s->closing || elapsed))
+		{
+			int rc;
+			
+			s->dirty = NO;
+			pthread_mutex_unlock(&s->lock);
+			rc = (s->fd == -1 ? -1 : fsync(s->fd));
+			pthread_mutex_lock(&s->lock);
+			
+			if(rc == -1)
+				s->failed = YES;
+			else
+				s->synced = s->fileWritten;
+			s->stats.syncs++;
+			lastSync = now;
+		}
+		else if(elapsed)
+			lastSync = now;
+		
+		if(syncing)
+		{
+			s->syncRequested = NO;
+			pthread_cond_broadcast(&s->done);
+		}
+		
+		if(s->closing && s->pending == 0)
+			break;
+	}
+	pthread_mutex_unlock(&s->lock);
+	
+	return NULL;
+}
+
+/* Queue the fill buffer for writing. Called with the lock held. */
+static void
+ma_spool_hand_over(ma_spool_t *s)
+{
+	s->pending++;
+	s->fill = (s->fill+1) % s->bufferCount;
+	s->used[s->fill] = 0;
+	gettimeofday(&s->handedAt, NULL);
+	pthread_cond_signal(&s->ready);
+}
+
+/*
+ * Copy len bytes in, handing buffers over as they fill. The caller has
+ * checked there is room for all of it.
+ */
+static void
+ma_spool_append(ma_spool_t *s, const void *data, size_t len)
+{
+	const u_char *p = data;
+	
+	while(len > 0)
+	{
+		size_t room = MASpoolBufferSize-s->used[s->fill];
+		size_t n = MIN(room, len);
+		
+		memcpy(s->buffers[s->fill]+s->used[s->fill], p, n);
+		s->used[s->fill] += n;
+		p += n;
+		len -= n;
+		
+		if(s->used[s->fill] == MASpoolBufferSize)
+		{
+			pthread_mutex_lock(&s->lock);
+			ma_spool_hand_over(s);
+			pthread_mutex_unlock(&s->lock);
+		}
+	}
+}
+
+static void
+ma_spool_free(ma_spool_t *s)
+{
+	NSUInteger i;
+	
+	if(s->buffers)
+		for(i = 0; i < s->bufferCount; i++)
+			free(s->buffers[i]);
+	free(s->buffers);
+	free(s->used);
+	free(s->rotateAfter);
+	free(s->finished);
+	free(s->files);
+	free(s);
+}
+
+/* Start a file with the pcap global header. */
+static void
+ma_spool_header(ma_spool_t *s)
+{
+	uint32_t header[6];
+	
+	header[0] = MA_PCAP_NSEC_MAGIC;
+	header[1] = 2 | (4 << 16);		/* version 2.4 */
+	header[2] = 0;					/* thiszone */
+	header[3] = 0;					/* sigfigs */
+	header[4] = s->snapLen;
+	header[5] = (uint32_t)s->linkType;
+	ma_spool_append(s, header, sizeof(header));
+	s->current.bytes = sizeof(header);
+}
+
+/*
+ * Finish the current file with whatever is in the fill buffer and
+ * start the next one. NO if there is no buffer to hand over.
+ */
+static BOOL
+ma_spool_rotate(ma_spool_t *s)
+{
+	uint32_t sequence = s->current.sequence;
+	
+	pthread_mutex_lock(&s->lock);
+	if(s->pending == s->bufferCount-1)
+	{
+		pthread_mutex_unlock(&s->lock);
+		return NO;
+	}
+	
+	s->finished[s->fill] = s->current;
+	s->rotateAfter[s->fill] = YES;
+	ma_spool_hand_over(s);
+	pthread_mutex_unlock(&s->lock);
+	
+	memset(&s->current, 0, sizeof(s->current));
+	s->current.sequence = sequence+1;
+	ma_spool_header(s);
+	
+	return YES;
+}
+
+/*
+ * Open path for writing, or with a rotation the first of the numbered
+ * files named after it.
+ */
+ma_spool_t *
+ma_spool_open(const char *path, int linkType, uint32_t snapLen,
+			  const ma_spool_rotation_t *rotation)
+{
+	return ma_spool_open_with_room(path, linkType, snapLen, rotation, 0);
+}
+
+/*
+ * As ma_spool_open(), with enough buffers to take room bytes of packets
+ * and their records at once, before the writer has written any of it.
+ */
+ma_spool_t *
+ma_spool_open_with_room(const char *path, int linkType, uint32_t snapLen,
+						const ma_spool_rotation_t *rotation, size_t room)
+{
+	ma_spool_t *s;
+	const char *dot;
+	NSUInteger i;
+	
+	if(!(s = calloc(1, sizeof(*s))))
+		return NULL;
+	
+	/* One more for the buffer being filled, one for a partly used one. */
+	s->bufferCount = MAX((NSUInteger)MASpoolBuffers,
+						 room/MASpoolBufferSize+2);
+	if(!(s->buffers = calloc(s->bufferCount, sizeof(*s->buffers))) ||
+	   !(s->used = calloc(s->bufferCount, sizeof(*s->used))) ||
+	   !(s->rotateAfter = calloc(s->bufferCount, sizeof(*s->rotateAfter))) ||
+	   !(s->finished = calloc(s->bufferCount, sizeof(*s->finished))))
+	{
+		ma_spool_free(s);
+		return NULL;
+	}
+	
+	/* Page aligned, so the kernel can take them without copying. */
+	for(i = 0; i < s->bufferCount; i++)
+	{
+		if(posix_memalign((void **)&s->buffers[i], getpagesize(),
+						  MASpoolBufferSize))
+		{
+			s->buffers[i] = NULL;
+			ma_spool_free(s);
+			return NULL;
+		}
+	}
+	
+	s->linkType = linkType;
+	s->snapLen = snapLen;
+	s->rotating = (rotation && (rotation->maxBytes || rotation->maxDuration));
+	if(s->rotating)
+		s->rotation = *rotation;
+	
+	strlcpy(s->base, path, sizeof(s->base));
+	if((dot = strrchr(path, '.')) && !strchr(dot, '/'))
+	{
+		s->base[dot-path] = '\0';
+		strlcpy(s->extension, dot, sizeof(s->extension));
+	}
+	
+	s->current.sequence = (s->rotating ? 1 : 0);
+	s->writing = s->current.sequence;
+	if((s->fd = ma_spool_create(s, s->current.sequence)) == -1)
+	{
+		ma_spool_free(s);
+		return NULL;
+	}
+	
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->ready, NULL);
+	pthread_cond_init(&s->done, NULL);
+	gettimeofday(&s->handedAt, NULL);
+	ma_spool_header(s);
+	
+	if(pthread_create(&s->thread, NULL, ma_spool_writer, s))
+	{
+		close(s->fd);
+		pthread_cond_destroy(&s->done);
+		pthread_cond_destroy(&s->ready);
+		pthread_mutex_destroy(&s->lock);
+		ma_spool_free(s);
+		return NULL;
+	}
+	
+	return s;
+}
+
+/*
+ * Append one packet, hdr carries nanoseconds. Returns NO when the writer
+ * has fallen too far behind and the packet was dropped.
+ */
+BOOL
+ma_spool_packet(ma_spool_t *s, const struct pcap_pkthdr *hdr,
+				const u_char *data)
+{
+	ma_spool_record_t rec;
+	size_t len = sizeof(rec)+hdr->caplen;
+	int64_t ts = ma_pkthdr_ns(hdr);
+	
+	if(s->rotating && s->current.packets > 0 &&
+	   ((s->rotation.maxBytes &&
+		 s->current.bytes+len > s->rotation.maxBytes) ||
+		(s->rotation.maxDuration &&
+		 ts-s->current.first >= s->rotation.maxDuration)) &&
+	   !ma_spool_rotate(s))
+	{
+		OSAtomicIncrement64(&s->dropped);
+		return NO;
+	}
+	
+	/*
+	 * A record that ends exactly at the end of the fill buffer hands it
+	 * over, which needs a free buffer to fill next: at most bufferCount-1
+	 * are ever pending, the last byte of room is never used.
+	 */
+	if(len >= MASpoolBufferSize-s->used[s->fill])
+	{
+		size_t room;
+		
+		pthread_mutex_lock(&s->lock);
+		room = (s->bufferCount-1-s->pending)*MASpoolBufferSize+
+			MASpoolBufferSize-s->used[s->fill];
+		pthread_mutex_unlock(&s->lock);
+		
+		if(len >= room)
+		{
+			OSAtomicIncrement64(&s->dropped);
+			return NO;
+		}
+	}
+	
+	rec.sec = (uint32_t)hdr->ts.tv_sec;
+	rec.nsec = (uint32_t)hdr->ts.tv_usec;
+	rec.caplen = hdr->caplen;
+	rec.len = hdr->len;
+	ma_spool_append(s, &rec, sizeof(rec));
+	ma_spool_append(s, data, hdr->caplen);
+	OSAtomicIncrement64(&s->appended);
+	
+	if(s->current.packets++ == 0)
+		s->current.first = ts;
+	s->current.last = ts;
+	s->current.bytes += len;
+	
+	return YES;
+}
+
+/*
+ * Hand over a partly filled buffer if it has sat for a sync interval, so
+ * a quiet capture still reaches the disk. Call after each batch.
+ */
+void
+ma_spool_commit(ma_spool_t *s)
+{
+	struct timeval now;
+	
+	if(s->used[s->fill] == 0)
+		return;
+	
+	gettimeofday(&now, NULL);
+	if(now.tv_sec-s->handedAt.tv_sec < MASpoolSyncInterval)
+		return;
+	
+	pthread_mutex_lock(&s->lock);
+	if(s->pending < s->bufferCount-1)
+		ma_spool_hand_over(s);
+	pthread_mutex_unlock(&s->lock);
+}
+
+/* Write out and fsync everything appended so far. */
+BOOL
+ma_spool_sync(ma_spool_t *s)
+{
+	BOOL ok;
+	
+	pthread_mutex_lock(&s->lock);
+	if(s->used[s->fill] > 0)
+	{
+		while(s->pending == s->bufferCount-1)
+			pthread_cond_wait(&s->done, &s->lock);
+		ma_spool_hand_over(s);
+	}
+	
+	s->syncRequested = YES;
+	pthread_cond_signal(&s->ready);
+	while(s->pending > 0 || s->syncRequested)
+		pthread_cond_wait(&s->done, &s->lock);
+	ok = !s->failed;
+	pthread_mutex_unlock(&s->lock);
+	
+	return ok;
+}
+
+/* Write out what is left, stop the writer and close the file. */
+static BOOL
+ma_spool_stop(ma_spool_t *s)
+{
+	BOOL ok;
+	
+	pthread_mutex_lock(&s->lock);
+	if(s->used[s->fill] > 0)
+	{
+		while(s->pending == s->bufferCount-1)
+			pthread_cond_wait(&s->done, &s->lock);
+		ma_spool_hand_over(s);
+	}
+	s->closing = YES;
+	pthread_cond_signal(&s->ready);
+	pthread_mutex_unlock(&s->lock);
+	
+	pthread_join(s->thread, NULL);
+	ok = !s->failed;
+	if(s->fd == -1 || close(s->fd) == -1)
+		ok = NO;
+	
+	pthread_cond_destroy(&s->done);
+	pthread_cond_destroy(&s->ready);
+	pthread_mutex_destroy(&s->lock);
+	
+	return ok;
+}
+
+/* Write out what is left and close. Returns NO if anything was lost. */
+BOOL
+ma_spool_close(ma_spool_t *s)
+{
+	BOOL ok;
+	
+	if(s == NULL)
+		return NO;
+	
+	ok = ma_spool_stop(s);
+	
+	/* The index gets the last file too, now it is complete. */
+	if(s->rotating && s->current.packets > 0)
+	{
+		ma_spool_file_t *files;
+		
+		if((files = malloc((s->fileCount+1)*sizeof(*files))))
+		{
+			memcpy(files, s->files, s->fileCount*sizeof(*files));
+			files[s->fileCount] = s->current;
+			ma_spool_write_index(s, files, s->fileCount+1);
+			free(files);
+		}
+		
+		if(ok && s->rotation.compress)
+			ma_spool_archive(s, s->current.sequence);
+	}
+	
+	ma_spool_free(s);
+	
+	return ok;
+}
+
+/*
+ * Stop writing and remove every file of the spool, its index and any
+ * block stores, for a capture nobody kept.
+ */
+void
+ma_spool_discard(ma_spool_t *s)
+{
+	char path[MAXPATHLEN];
+	NSUInteger i;
+	
+	if(s == NULL)
+		return;
+	
+	ma_spool_stop(s);
+	
+	for(i = 0; i < s->fileCount; i++)
+		ma_spool_remove(s, s->files[i].sequence);
+	ma_spool_remove(s, s->current.sequence);
+	
+	snprintf(path, sizeof(path), "%s.index", s->base);
+	unlink(path);
+	
+	ma_spool_free(s);
+}
+
+void
+ma_spool_stats(ma_spool_t *s, ma_spool_stats_t *stats)
+{
+	pthread_mutex_lock(&s->lock);
+	*stats = s->stats;
+	pthread_mutex_unlock(&s->lock);
+	stats->packets = (uint64_t)OSAtomicAdd64(0, &s->appended);
+	stats->dropped = (uint64_t)OSAtomicAdd64(0, &s->dropped);
+}
+
+BOOL
+ma_spool_rotates(ma_spool_t *s)
+{
+	return s->rotating;
+}
+
+/*
+ * Whether every packet appended is still in a savefile: none dropped,
+ * no file removed past maxFiles and none compressed.
+ */
+BOOL
+ma_spool_complete(ma_spool_t *s)
+{
+	BOOL complete;
+	
+	if(OSAtomicAdd64(0, &s->dropped) > 0)
+		return NO;
+	if(!s->rotating)
+		return YES;
+	
+	pthread_mutex_lock(&s->lock);
+	complete = (!s->rotation.compress &&
+				(s->fileCount == 0 || s->files[0].sequence == 1));
+	pthread_mutex_unlock(&s->lock);
+	
+	return complete;
+}
+
+/*
+ * Files still on disk, oldest first; the last one is the file being
+ * written. Only call from the thread that appends packets.
+ */
+NSUInteger
+ma_spool_file_count(ma_spool_t *s)
+{
+	NSUInteger count;
+	
+	pthread_mutex_lock(&s->lock);
+	count = s->fileCount+1;
+	pthread_mutex_unlock(&s->lock);
+	
+	return count;
+}
+
+BOOL
+ma_spool_file(ma_spool_t *s, NSUInteger index, ma_spool_file_t *file)
+{
+	BOOL found = YES;
+	
+	pthread_mutex_lock(&s->lock);
+	if(index < s->fileCount)
+		*file = s->files[index];
+	else if(index == s->fileCount)
+		*file = s->current;
+	else
+		found = NO;
+	pthread_mutex_unlock(&s->lock);
+	
+	return found;
+}
+
+/*
+ * How much of a file is known to be on disk: all of a finished one, of
+ * the one being written what the last sync covered. 0 for a file that
+ * is gone.
+ */
+uint64_t
+ma_spool_synced_bytes(ma_spool_t *s, uint32_t sequence)
+{
+	uint64_t bytes = 0;
+	NSUInteger i;
+	
+	pthread_mutex_lock(&s->lock);
+	if(sequence == s->writing)
+		bytes = s->synced;
+	else
+		for(i = 0; i < s->fileCount; i++)
+			if(s->files[i].sequence == sequence)
+				bytes = s->files[i].bytes;
+	pthread_mutex_unlock(&s->lock);
+	
+	return bytes;
+}
+
+/*
+ * Where a file is now: its block store once it has been compressed,
+ * the savefile until then.
+ */
+void
+ma_spool_file_path(ma_spool_t *s, uint32_t sequence, char *path, size_t size)
+{
+	if(sequence != 0 && s->rotation.compress)
+	{
+		ma_spool_archive_path(s, sequence, path, size);
+		if(access(path, F_OK) == 0)
+			return;
+	}
+	
+	ma_spool_savefile_path(s, sequence, path, size);
+}
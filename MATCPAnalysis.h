@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#import <Foundation/Foundation.h>
+#import <pcap/pcap.h>
+
+
+/*
+ * TCP expert analysis, one segment at a time as they arrive.
+ *
+ * Each connection keeps, for either direction, the next sequence number
+ * expected, the last acknowledgement and window advertised, the window
+ * scale from its SYN and the run of duplicate ACKs, enough to tag a
+ * segment with what went wrong:
+ *
+ *	retransmission		data sent before, more than
+ *						MA_TCPA_REORDER_TIME after the data past it
+ *	fast retransmission	a retransmission of what the other side has
+ *						sent at least two duplicate ACKs for
+ *	out of order		data sent before but within MA_TCPA_REORDER_TIME
+ *						of the data past it, most likely reordered
+ *	lost segment		starts past the next sequence number, what is
+ *						in between was not captured
+ *	duplicate ACK		a bare ACK repeating the last one and its window
+ *						while data is outstanding
+ *	zero window			advertises no room at all
+ *	window full			fills the window the other side advertised
+ *
+ * Tags are a bitfield of ma_tcpa_tag_t, small enough to keep with every
+ * packet. Each connection counts its tags as well, and the whole capture.
+ *
+ * Connections live in a fixed size open addressing table allocated up
+ * front, as for per-flow truncation; a SYN without ACK starts one over.
+ * It is safe to feed from several threads, segments of a connection are
+ * expected in the order they were captured.
+ */
+
+typedef enum
+{
+	MA_TCPA_RETRANSMISSION,
+	MA_TCPA_FAST_RETRANSMISSION,
+	MA_TCPA_OUT_OF_ORDER,
+	MA_TCPA_LOST_SEGMENT,
+	MA_TCPA_DUP_ACK,
+	MA_TCPA_ZERO_WINDOW,
+	MA_TCPA_WINDOW_FULL,
+	MA_TCPA_KINDS
+} ma_tcpa_kind_t;
+
+typedef uint16_t ma_tcpa_tags_t;
+
+#define MA_TCPA_TAG(kind)			((ma_tcpa_tags_t)(1 << (kind)))
+#define MA_TCPA_REORDER_TIME		3000000LL	/* ns */
+
+typedef struct ma_tcpa ma_tcpa_t;
+
+
+ma_tcpa_t *ma_tcpa_create(NSUInteger tableSize, int64_t idle);
+void ma_tcpa_destroy(ma_tcpa_t *a);
+ma_tcpa_tags_t ma_tcpa_packet(ma_tcpa_t *a, int linkType,
+							  const struct pcap_pkthdr *hdr,
+							  const u_char *data);
+void ma_tcpa_totals(ma_tcpa_t *a, uint64_t totals[MA_TCPA_KINDS]);
+
+const char *ma_tcpa_kind_name(ma_tcpa_kind_t kind);
+NSString *ma_tcpa_tags_string(ma_tcpa_tags_t tags);
+NSString *ma_tcpa_report(ma_tcpa_t *a, NSUInteger rows);
@@ -0,0 +1,511 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#import "MATCPAnalysis.h"
+
+#import <libkern/OSByteOrder.h>
+#import <netinet/in.h>
+#import <pthread.h>
+
+#import "MAFlow.h"
+#import "MARecord.h"
+
+
+/* Slots looked at for a connection before the stalest one is evicted. */
+#define MA_TCPA_PROBES			8
+
+#define MA_TCPA_FIN				0x01
+#define MA_TCPA_SYN				0x02
+#define MA_TCPA_RST				0x04
+#define MA_TCPA_ACK				0x10
+
+#define MA_TCPA_OPT_END			0
+#define MA_TCPA_OPT_NOP			1
+#define MA_TCPA_OPT_WSCALE		3
+#define MA_TCPA_MAX_WSCALE		14
+
+/* Sequence space comparisons, modulo 2^32. */
+#define MA_SEQ_LT(a, b)			((int32_t)((a)-(b)) < 0)
+#define MA_SEQ_GT(a, b)			((int32_t)((a)-(b)) > 0)
+
+typedef struct
+{
+	uint32_t nextSeq;			/* past the highest data sent */
+	uint32_t lastAck;
+	uint32_t window;			/* scaled */
+	int64_t advancedAt;			/* ns, nextSeq last moved */
+	uint16_t dupAcks;			/* in a row */
+	uint8_t scale;
+	BOOL scaleOffered;			/* in our SYN */
+	BOOL sent;					/* nextSeq is set */
+	BOOL acked;					/* lastAck and window are */
+} ma_tcpa_side_t;
+
+typedef struct
+{
+	uint64_t hash;				/* 0 for a free slot */
+	u_char key[MA_FLOW_KEY_SIZE];
+	uint8_t keyLen;
+	uint32_t lastSeen;			/* seconds */
+	ma_tcpa_side_t sides[2];	/* lower end of the key first */
+	uint64_t packets;
+	uint32_t counts[MA_TCPA_KINDS];
+} ma_tcpa_flow_t;
+
+/* What analysis needs of one segment. */
+typedef struct
+{
+	uint32_t seq;
+	uint32_t ack;
+	uint16_t window;
+	uint8_t flags;
+	int8_t scale;				/* -1 without the option */
+	size_t payload;
+} ma_tcpa_segment_t;
+
+struct ma_tcpa
+{
+	pthread_mutex_t lock;
+	uint32_t idle;				/* seconds */
+	NSUInteger mask;
+	ma_tcpa_flow_t *table;
+	uint64_t packets;
+	uint64_t evicted;
+	uint64_t totals[MA_TCPA_KINDS];
+};
+
+
+ma_tcpa_t *
+ma_tcpa_create(NSUInteger tableSize, int64_t idle)
+{
+	ma_tcpa_t *a;
+	
+	if(tableSize < MA_TCPA_PROBES || (tableSize & (tableSize-1)))
+		return NULL;
+	
+	if(!(a = calloc(1, sizeof(*a))))
+		return NULL;
+	
+	a->idle = (uint32_t)MAX(idle/MA_NSEC_PER_SEC, 1);
+	a->mask = tableSize-1;
+	
+	if(!(a->table = calloc(tableSize, sizeof(*a->table))))
+	{
+		NSLog(@"%s(): no memory for %lu connections", __func__,
+			  (unsigned long)tableSize);
+		free(a);
+		return NULL;
+	}
+	pthread_mutex_init(&a->lock, NULL);
+	
+	return a;
+}
+
+void
+ma_tcpa_destroy(ma_tcpa_t *a)
+{
+	if(a == NULL)
+		return;
+	
+	pthread_mutex_destroy(&a->lock);
+	free(a->table);
+	free(a);
+}
+
+#pragma mark - Analysis
+
+/*
+ * The connection's slot, taking a free or idle one or evicting the
+ * stalest around it if the connection is new.
+ */
+static ma_tcpa_flow_t *
+ma_tcpa_lookup(ma_tcpa_t *a, const ma_flow_t *flow, uint32_t now)
+{
+	ma_tcpa_flow_t *e;
+	ma_tcpa_flow_t *spare = NULL;
+	ma_tcpa_flow_t *stalest = NULL;
+	uint64_t hash = (flow->hash ? flow->hash : 1);
+	NSUInteger i;
+	
+	for(i = 0; i < MA_TCPA_PROBES; i++)
+	{
+		e = &a->table[(hash+i) & a->mask];
+		
+		if(e->hash == hash)
+			return e;
+		
+		if(e->hash == 0 || (now > e->lastSeen && now-e->lastSeen > a->idle))
+		{
+			if(spare == NULL)
+				spare = e;
+		}
+		else if(stalest == NULL || e->lastSeen < stalest->lastSeen)
+			stalest = e;
+	}
+	
+	if(spare == NULL)
+	{
+		spare = stalest;
+		a->evicted++;
+	}
+	
+	memset(spare, 0, sizeof(*spare));
+	spare->hash = hash;
+	memcpy(spare->key, flow->key, flow->keyLen);
+	spare->keyLen = (uint8_t)flow->keyLen;
+	
+	return spare;
+}
+
+/*
+ * The TCP header and payload length of a segment ma_flow_parse() found.
+ * NO for fragments and segments captured too short to analyse.
+ */
+static BOOL
+ma_tcpa_segment(int linkType, const struct pcap_pkthdr *hdr,
+				const u_char *data, ma_tcpa_segment_t *seg)
+{
+	const u_char *ip, *tcp, *opt, *end;
+	size_t ipLen, tcpLen, total;
+	uint16_t proto;
+	int off;
+	
+	if((off = ma_flow_network(linkType, data, hdr->caplen, &proto)) < 0)
+		return NO;
+	ip = data+off;
+	
+	if(proto == 0x0800)
+	{
+		if((ip[6] & 0x3F) || ip[7])
+			return NO;
+		ipLen = (size_t)(ip[0] & 0x0F)*4;
+		total = (size_t)(ip[2] << 8 | ip[3]);
+	}
+	else
+	{
+		ipLen = 40;
+		total = ipLen+(size_t)(ip[4] << 8 | ip[5]);
+	}
+	
+	if(hdr->caplen < (size_t)off+ipLen+20)
+		return NO;
+	tcp = ip+ipLen;
+	tcpLen = (size_t)(tcp[12] >> 4)*4;
+	
+	/* Segmentation offload leaves the IP length at zero. */
+	if(total == 0 || total == ipLen)
+		total = hdr->len-(size_t)off;
+	
+	seg->seq = OSReadBigInt32(tcp, 4);
+	seg->ack = OSReadBigInt32(tcp, 8);
+	seg->flags = tcp[13];
+	seg->window = OSReadBigInt16(tcp, 14);
+	seg->payload = (total > ipLen+tcpLen ? total-ipLen-tcpLen : 0);
+	seg->scale = -1;
+	
+	/* Window scale is only offered on a SYN. */
+	if(!(seg->flags & MA_TCPA_SYN))
+		return YES;
+	
+	opt = tcp+20;
+	end = tcp+MIN(tcpLen, hdr->caplen-(size_t)off-ipLen);
+	while(opt < end && *opt != MA_TCPA_OPT_END)
+	{
+		if(*opt == MA_TCPA_OPT_NOP)
+		{
+			opt++;
+			continue;
+		}
+		if(opt+1 >= end || opt[1] < 2 || opt+opt[1] > end)
+			break;
+		
+		if(opt[0] == MA_TCPA_OPT_WSCALE && opt[1] == 3)
+			seg->scale = (int8_t)MIN(opt[2], MA_TCPA_MAX_WSCALE);
+		opt += opt[1];
+	}
+	
+	return YES;
+}
+
+/* Data, SYN or FIN: where it falls against what this side sent before. */
+static ma_tcpa_tags_t
+ma_tcpa_sequence(ma_tcpa_side_t *s, const ma_tcpa_side_t *r,
+				 const ma_tcpa_segment_t *seg, uint32_t length, int64_t ts)
+{
+	ma_tcpa_tags_t tags = 0;
+	uint32_t end = seg->seq+length;
+	
+	if(s->sent)
+	{
+		if(MA_SEQ_GT(seg->seq, s->nextSeq))
+			tags |= MA_TCPA_TAG(MA_TCPA_LOST_SEGMENT);
+		else if(seg->payload <= 1 && seg->seq == s->nextSeq-1 &&
+				!(seg->flags & (MA_TCPA_SYN|MA_TCPA_FIN)))
+			return tags;		/* a keep-alive */
+		else if(MA_SEQ_LT(seg->seq, s->nextSeq))
+		{
+			if(r->acked && r->dupAcks >= 2 && seg->seq == r->lastAck)
+				tags |= MA_TCPA_TAG(MA_TCPA_FAST_RETRANSMISSION);
+			else if(ts-s->advancedAt < MA_TCPA_REORDER_TIME)
+				tags |= MA_TCPA_TAG(MA_TCPA_OUT_OF_ORDER);
+			else
+				tags |= MA_TCPA_TAG(MA_TCPA_RETRANSMISSION);
+		}
+	}
+	
+	/* Up to the right edge of what the receiver said it could take. */
+	if(seg->payload && r->acked && !(seg->flags & MA_TCPA_SYN) &&
+	   end == r->lastAck+r->window)
+		tags |= MA_TCPA_TAG(MA_TCPA_WINDOW_FULL);
+	
+	if(!s->sent || MA_SEQ_GT(end, s->nextSeq))
+	{
+		s->nextSeq = end;
+		s->advancedAt = ts;
+		s->sent = YES;
+	}
+	
+	return tags;
+}
+
+/* Tags one segment, 0 if it isn't TCP or there is nothing to say. */
+ma_tcpa_tags_t
+ma_tcpa_packet(ma_tcpa_t *a, int linkType, const struct pcap_pkthdr *hdr,
+			   const u_char *data)
+{
+	ma_tcpa_segment_t seg;
+	ma_tcpa_flow_t *e;
+	ma_tcpa_side_t *s, *r;
+	ma_tcpa_tags_t tags = 0;
+	ma_flow_t flow;
+	int64_t ts = ma_pkthdr_ns(hdr);
+	uint32_t window, length;
+	int kind;
+	
+	if(!ma_flow_parse(linkType, hdr, data, &flow) ||
+	   flow.ipProto != IPPROTO_TCP ||
+	   !ma_tcpa_segment(linkType, hdr, data, &seg))
+		return 0;
+	
+	pthread_mutex_lock(&a->lock);
+	e = ma_tcpa_lookup(a, &flow, (uint32_t)hdr->ts.tv_sec);
+	e->lastSeen = (uint32_t)hdr->ts.tv_sec;
+	
+	/* A new connection on the same ports. */
+	if((seg.flags & (MA_TCPA_SYN|MA_TCPA_ACK)) == MA_TCPA_SYN &&
+	   e->sides[flow.reversed].sent &&
+	   seg.seq != e->sides[flow.reversed].nextSeq-1)
+	{
+		memset(e->sides, 0, sizeof(e->sides));
+		memset(e->counts, 0, sizeof(e->counts));
+		e->packets = 0;
+	}
+	
+	s = &e->sides[flow.reversed];
+	r = &e->sides[!flow.reversed];
+	e->packets++;
+	a->packets++;
+	
+	if(seg.flags & MA_TCPA_SYN)
+	{
+		s->scaleOffered = (seg.scale >= 0);
+		s->scale = (uint8_t)MAX(seg.scale, 0);
+	}
+	
+	/* Windows in a SYN are never scaled. */
+	window = seg.window;
+	if(!(seg.flags & MA_TCPA_SYN) && s->scaleOffered && r->scaleOffered)
+		window <<= s->scale;
+	
+	if(window == 0 && !(seg.flags & (MA_TCPA_SYN|MA_TCPA_FIN|MA_TCPA_RST)))
+		tags |= MA_TCPA_TAG(MA_TCPA_ZERO_WINDOW);
+	
+	length = (uint32_t)seg.payload+((seg.flags & MA_TCPA_SYN) ? 1 : 0)+
+		((seg.flags & MA_TCPA_FIN) ? 1 : 0);
+	if(length && !(seg.flags & MA_TCPA_RST))
+		tags |= ma_tcpa_sequence(s, r, &seg, length, ts);
+	
+	if((seg.flags & MA_TCPA_ACK) && !(seg.flags & MA_TCPA_RST))
+	{
+		if(s->acked && length == 0 && seg.ack == s->lastAck &&
+		   window == s->window && r->sent && MA_SEQ_GT(r->nextSeq, seg.ack))
+		{
+			s->dupAcks++;
+			tags |= MA_TCPA_TAG(MA_TCPA_DUP_ACK);
+		}
+		else if(seg.ack != s->lastAck)
+			s->dupAcks = 0;
+		
+		s->lastAck = seg.ack;
+		s->window = window;
+		s->acked = YES;
+	}
+	
+	for(kind = 0; tags && kind < MA_TCPA_KINDS; kind++)
+	{
+		if(tags & MA_TCPA_TAG(kind))
+		{
+			e->counts[kind]++;
+			a->totals[kind]++;
+		}
+	}
+	pthread_mutex_unlock(&a->lock);
+	
+	return tags;
+}
+
+void
+ma_tcpa_totals(ma_tcpa_t *a, uint64_t totals[MA_TCPA_KINDS])
+{
+	pthread_mutex_lock(&a->lock);
+	memcpy(totals, a->totals, sizeof(a->totals));
+	pthread_mutex_unlock(&a->lock);
+}
+
+#pragma mark - Reports
+
+const char *
+ma_tcpa_kind_name(ma_tcpa_kind_t kind)
+{
+	static const char *names[MA_TCPA_KINDS] = {
+		[MA_TCPA_RETRANSMISSION]		= "Retransmission",
+		[MA_TCPA_FAST_RETRANSMISSION]	= "Fast Retransmission",
+		[MA_TCPA_OUT_OF_ORDER]			= "Out-Of-Order",
+		[MA_TCPA_LOST_SEGMENT]			= "Previous Segment Lost",
+		[MA_TCPA_DUP_ACK]				= "Dup ACK",
+		[MA_TCPA_ZERO_WINDOW]			= "Zero Window",
+		[MA_TCPA_WINDOW_FULL]			= "Window Full"
+	};
+	
+	return (kind < MA_TCPA_KINDS ? names[kind] : "Unknown");
+}
+
+/* "Dup ACK, Zero Window", nil without tags. */
+NSString *
+ma_tcpa_tags_string(ma_tcpa_tags_t tags)
+{
+	NSMutableString *str = nil;
+	int kind;
+	
+	for(kind = 0; kind < MA_TCPA_KINDS; kind++)
+	{
+		if(!(tags & MA_TCPA_TAG(kind)))
+			continue;
+		
+		if(str == nil)
+			str = [NSMutableString stringWithUTF8String:ma_tcpa_kind_name(kind)];
+		else
+			[str appendFormat:@", %s", ma_tcpa_kind_name(kind)];
+	}
+	
+	return str;
+}
+
+static uint64_t
+ma_tcpa_problems(const ma_tcpa_flow_t *e)
+{
+	uint64_t sum = 0;
+	int kind;
+	
+	for(kind = 0; kind < MA_TCPA_KINDS; kind++)
+		sum += e->counts[kind];
+	
+	return sum;
+}
+
+static int
+ma_tcpa_compare(const void *a, const void *b)
+{
+	uint64_t x = ma_tcpa_problems(*(ma_tcpa_flow_t * const *)a);
+	uint64_t y = ma_tcpa_problems(*(ma_tcpa_flow_t * const *)b);
+	
+	return (x < y) - (x > y);
+}
+
+NSString *
+ma_tcpa_report(ma_tcpa_t *a, NSUInteger rows)
+{
+	static const char *columns[MA_TCPA_KINDS] = {
+		[MA_TCPA_RETRANSMISSION]		= "retrans",
+		[MA_TCPA_FAST_RETRANSMISSION]	= "fast",
+		[MA_TCPA_OUT_OF_ORDER]			= "ooo",
+		[MA_TCPA_LOST_SEGMENT]			= "lost",
+		[MA_TCPA_DUP_ACK]				= "dupack",
+		[MA_TCPA_ZERO_WINDOW]			= "zerowin",
+		[MA_TCPA_WINDOW_FULL]			= "full"
+	};
+	NSMutableString *report = [NSMutableString string];
+	ma_tcpa_flow_t **worst;
+	ma_tcpa_flow_t *e;
+	NSUInteger n = 0, i;
+	int kind;
+	
+	pthread_mutex_lock(&a->lock);
+	[report appendFormat:@"segments %llu, connections evicted %llu\n\n",
+	 a->packets, a->evicted];
+	for(kind = 0; kind < MA_TCPA_KINDS; kind++)
+		[report appendFormat:@"%-24s %14llu %7.3f%%\n", ma_tcpa_kind_name(kind),
+		 a->totals[kind],
+		 (a->packets ? 100.0*a->totals[kind]/a->packets : 0.0)];
+	
+	/* The connections with the most tagged segments. */
+	if(rows && (worst = malloc((a->mask+1)*sizeof(*worst))))
+	{
+		for(i = 0; i <= a->mask; i++)
+		{
+			e = &a->table[i];
+			if(e->hash && ma_tcpa_problems(e))
+				worst[n++] = e;
+		}
+		qsort(worst, n, sizeof(*worst), ma_tcpa_compare);
+		
+		if(n)
+		{
+			[report appendFormat:@"\n%-56s %10s", "connections", "segments"];
+			for(kind = 0; kind < MA_TCPA_KINDS; kind++)
+				[report appendFormat:@" %8s", columns[kind]];
+			[report appendString:@"\n"];
+		}
+		for(i = 0; i < n && i < rows; i++)
+		{
+			e = worst[i];
+			[report appendFormat:@"%-56s %10llu",
+			 [ma_flow_key_string(e->key, e->keyLen) UTF8String], e->packets];
+			for(kind = 0; kind < MA_TCPA_KINDS; kind++)
+				[report appendFormat:@" %8u", e->counts[kind]];
+			[report appendString:@"\n"];
+		}
+		free(worst);
+	}
+	pthread_mutex_unlock(&a->lock);
+	
+	return report;
+}
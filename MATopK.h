@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#import <Foundation/Foundation.h>
+#import <pcap/pcap.h>
+
+
+/*
+ * Heavy hitters in fixed memory.
+ *
+ * ma_topk_t is a space-saving summary (Metwally et al.): capacity
+ * counters, a lazily kept min-heap of them, and a hash table from key to
+ * counter. A key without a counter takes over the smallest one and
+ * inherits its count as its error, so a count is never understated and
+ * is overstated by at most error, itself no more than total/capacity.
+ * Two summaries merge by adding counts, a key missing from a full
+ * summary being charged that summary's smallest count, then keeping the
+ * largest capacity counters; the bounds still hold for the union of the
+ * two streams, so summaries from different threads, files or time
+ * windows can be combined.
+ *
+ * ma_talkers_t keeps one summary per kind and metric for each of a
+ * number of time buckets, covering a sliding window of packet time. As
+ * a bucket is reused its summaries are folded into a running total for
+ * the whole capture. It is safe to feed from several threads.
+ */
+
+#define MA_TOPK_KEY_SIZE		32		/* two IPv6 addresses */
+
+typedef enum
+{
+	MA_TOPK_SOURCES,
+	MA_TOPK_DESTINATIONS,
+	MA_TOPK_CONVERSATIONS,		/* address pairs, either direction */
+	MA_TOPK_PORTS,				/* TCP and UDP, the lower port of the two */
+	MA_TOPK_KINDS
+} ma_topk_kind_t;
+
+typedef enum
+{
+	MA_TOPK_PACKETS,
+	MA_TOPK_BYTES,				/* on the wire */
+	MA_TOPK_METRICS
+} ma_topk_metric_t;
+
+typedef struct
+{
+	u_char key[MA_TOPK_KEY_SIZE];
+	size_t keyLen;
+	uint64_t hash;
+	uint64_t count;
+	uint64_t error;				/* count may be overstated by this much */
+} ma_topk_entry_t;
+
+typedef struct ma_topk ma_topk_t;
+typedef struct ma_talkers ma_talkers_t;
+
+
+ma_topk_t *ma_topk_create(NSUInteger capacity);
+void ma_topk_destroy(ma_topk_t *t);
+void ma_topk_clear(ma_topk_t *t);
+void ma_topk_add(ma_topk_t *t, const u_char *key, size_t keyLen,
+				 uint64_t weight);
+BOOL ma_topk_merge(ma_topk_t *dst, ma_topk_t *src);
+NSUInteger ma_topk_top(const ma_topk_t *t, ma_topk_entry_t *top, NSUInteger n);
+uint64_t ma_topk_total(const ma_topk_t *t);
+
+ma_talkers_t *ma_talkers_create(NSUInteger capacity, int64_t window,
+								NSUInteger buckets);
+void ma_talkers_destroy(ma_talkers_t *tk);
+BOOL ma_talkers_packet(ma_talkers_t *tk, int linkType,
+					   const struct pcap_pkthdr *hdr, const u_char *data,
+					   uint32_t weight);
+ma_topk_t *ma_talkers_query(ma_talkers_t *tk, ma_topk_kind_t kind,
+							ma_topk_metric_t metric, BOOL windowed);
+NSString *ma_talkers_report(ma_talkers_t *tk, NSUInteger rows);
+
+NSString *ma_topk_key_string(ma_topk_kind_t kind, const ma_topk_entry_t *entry);
@@ -0,0 +1,698 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#import "MATopK.h"
+
+#import <arpa/inet.h>
+#import <netinet/in.h>
+#import <pthread.h>
+
+#import "MAFlow.h"
+#import "MARecord.h"
+
+
+#define MA_TOPK_EMPTY			UINT32_MAX
+
+/*
+ * Heap counts are what the entry's count was when it was last sifted, so
+ * an update costs nothing; the heap is only put right at the root, when
+ * a counter is wanted for a new key.
+ */
+typedef struct
+{
+	uint64_t count;
+	uint32_t entry;
+} ma_topk_heap_t;
+
+struct ma_topk
+{
+	NSUInteger capacity;
+	NSUInteger used;
+	uint64_t total;
+	ma_topk_entry_t *entries;
+	ma_topk_heap_t *heap;		/* smallest count first */
+	uint32_t *slots;			/* key hash to entry index */
+	NSUInteger mask;
+};
+
+typedef struct
+{
+	int64_t epoch;				/* packet time / bucket width, -1 unused */
+	ma_topk_t *summaries[MA_TOPK_KINDS][MA_TOPK_METRICS];
+} ma_talkers_bucket_t;
+
+struct ma_talkers
+{
+	pthread_mutex_t lock;
+	int64_t bucketWidth;		/* ns */
+	int64_t newest;				/* epoch */
+	NSUInteger bucketCount;
+	ma_talkers_bucket_t *buckets;
+	ma_talkers_bucket_t expired;	/* folded in as buckets are reused */
+};
+
+
+#pragma mark - Space-saving summary
+
+static void
+ma_topk_swap(ma_topk_t *t, NSUInteger a, NSUInteger b)
+{
+	ma_topk_heap_t temp = t->heap[a];
+	
+	t->heap[a] = t->heap[b];
+	t->heap[b] = temp;
+}
+
+static void
+ma_topk_sift_up(ma_topk_t *t, NSUInteger i)
+{
+	while(i > 0 && t->heap[(i-1)/2].count > t->heap[i].count)
+	{
+		ma_topk_swap(t, i, (i-1)/2);
+		i = (i-1)/2;
+	}
+}
+
+static void
+ma_topk_sift_down(ma_topk_t *t, NSUInteger i)
+{
+	NSUInteger child;
+	
+	while((child = 2*i+1) < t->used)
+	{
+		if(child+1 < t->used &&
+		   t->heap[child+1].count < t->heap[child].count)
+			child++;
+		if(t->heap[i].count <= t->heap[child].count)
+			break;
+		ma_topk_swap(t, i, child);
+		i = child;
+	}
+}
+
+static NSUInteger
+ma_topk_slot(const ma_topk_t *t, const u_char *key, size_t keyLen,
+			 uint64_t hash)
+{
+	NSUInteger slot = (NSUInteger)hash & t->mask;
+	const ma_topk_entry_t *e;
+	
+	for(; t->slots[slot] != MA_TOPK_EMPTY; slot = (slot+1) & t->mask)
+	{
+		e = &t->entries[t->slots[slot]];
+		if(e->hash == hash && e->keyLen == keyLen &&
+		   memcmp(e->key, key, keyLen) == 0)
+			break;
+	}
+	
+	return slot;
+}
+
+/* Linear probing, so later entries are shifted back over the hole. */
+static void
+ma_topk_unlink(ma_topk_t *t, NSUInteger slot)
+{
+	NSUInteger next = slot, home;
+	
+	for(;;)
+	{
+		next = (next+1) & t->mask;
+		if(t->slots[next] == MA_TOPK_EMPTY)
+			break;
+		
+		home = (NSUInteger)t->entries[t->slots[next]].hash & t->mask;
+		if((slot <= next) ? (slot < home && home <= next)
+						  : (slot < home || home <= next))
+			continue;
+		
+		t->slots[slot] = t->slots[next];
+		slot = next;
+	}
+	t->slots[slot] = MA_TOPK_EMPTY;
+}
+
+/* The key must not be in the summary yet, and there must be room. */
+static void
+ma_topk_insert(ma_topk_t *t, const ma_topk_entry_t *entry)
+{
+	uint32_t i = (uint32_t)t->used++;
+	
+	t->entries[i] = *entry;
+	t->slots[ma_topk_slot(t, entry->key, entry->keyLen, entry->hash)] = i;
+	t->heap[i].count = entry->count;
+	t->heap[i].entry = i;
+	ma_topk_sift_up(t, i);
+}
+
+/*
+ * The entry with the smallest count. Heap counts are never more than the
+ * real ones, so once the root's is current nothing can be smaller.
+ */
+static uint32_t
+ma_topk_min(ma_topk_t *t)
+{
+	ma_topk_heap_t *root = &t->heap[0];
+	
+	while(root->count != t->entries[root->entry].count)
+	{
+		root->count = t->entries[root->entry].count;
+		ma_topk_sift_down(t, 0);
+	}
+	
+	return root->entry;
+}
+
+
+ma_topk_t *
+ma_topk_create(NSUInteger capacity)
+{
+	ma_topk_t *t;
+	NSUInteger slots = 1;
+	
+	if(capacity == 0 || capacity >= MA_TOPK_EMPTY/2)
+		return NULL;
+	
+	/* At most half full keeps the probes short. */
+	while(slots < 2*capacity)
+		slots <<= 1;
+	
+	if(!(t = calloc(1, sizeof(*t))))
+		return NULL;
+	
+	t->capacity = capacity;
+	t->mask = slots-1;
+	t->entries = malloc(capacity*sizeof(*t->entries));
+	t->heap = malloc(capacity*sizeof(*t->heap));
+	t->slots = malloc(slots*sizeof(*t->slots));
+	
+	if(!t->entries || !t->heap || !t->slots)
+	{
+		NSLog(@"%s(): no memory for %lu counters", __func__,
+			  (unsigned long)capacity);
+		ma_topk_destroy(t);
+		return NULL;
+	}
+	
+	ma_topk_clear(t);
+	return t;
+}
+
+void
+ma_topk_destroy(ma_topk_t *t)
+{
+	if(t == NULL)
+		return;
+	
+	free(t->entries);
+	free(t->heap);
+	free(t->slots);
+	free(t);
+}
+
+void
+ma_topk_clear(ma_topk_t *t)
+{
+	t->used = 0;
+	t->total = 0;
+	memset(t->slots, 0xFF, (t->mask+1)*sizeof(*t->slots));
+}
+
+void
+ma_topk_add(ma_topk_t *t, const u_char *key, size_t keyLen, uint64_t weight)
+{
+	ma_topk_entry_t entry;
+	ma_topk_entry_t *e;
+	NSUInteger slot;
+	uint32_t i;
+	
+	if(weight == 0 || keyLen > MA_TOPK_KEY_SIZE)
+		return;
+	
+	t->total += weight;
+	entry.hash = ma_flow_hash(key, keyLen);
+	slot = ma_topk_slot(t, key, keyLen, entry.hash);
+	
+	if(t->slots[slot] != MA_TOPK_EMPTY)
+	{
+		t->entries[t->slots[slot]].count += weight;
+		return;
+	}
+	
+	memcpy(entry.key, key, keyLen);
+	entry.keyLen = keyLen;
+	
+	if(t->used < t->capacity)
+	{
+		entry.count = weight;
+		entry.error = 0;
+		ma_topk_insert(t, &entry);
+		return;
+	}
+	
+	/* Take over the smallest counter. */
+	i = ma_topk_min(t);
+	e = &t->entries[i];
+	ma_topk_unlink(t, ma_topk_slot(t, e->key, e->keyLen, e->hash));
+	
+	entry.error = e->count;
+	entry.count = e->count+weight;
+	*e = entry;
+	t->slots[ma_topk_slot(t, key, keyLen, entry.hash)] = i;
+	t->heap[0].count = entry.count;
+	ma_topk_sift_down(t, 0);
+}
+
+static int
+ma_topk_compare(const void *a, const void *b)
+{
+	uint64_t ca = ((const ma_topk_entry_t *)a)->count;
+	uint64_t cb = ((const ma_topk_entry_t *)b)->count;
+	
+	return (ca < cb) - (ca > cb);
+}
+
+BOOL
+ma_topk_merge(ma_topk_t *dst, ma_topk_t *src)
+{
+	ma_topk_entry_t *all;
+	uint64_t dstMin, srcMin;
+	NSUInteger n = 0, i, slot;
+	
+	if(src->used == 0)
+		return YES;
+	
+	if(!(all = malloc((dst->used+src->used)*sizeof(*all))))
+		return NO;
+	
+	/* A key a full summary doesn't have may still have had its minimum. */
+	dstMin = (dst->used == dst->capacity ?
+			  dst->entries[ma_topk_min(dst)].count : 0);
+	srcMin = (src->used == src->capacity ?
+			  src->entries[ma_topk_min(src)].count : 0);
+	
+	for(i = 0; i < dst->used; i++)
+	{
+		all[n] = dst->entries[i];
+		slot = ma_topk_slot(src, all[n].key, all[n].keyLen, all[n].hash);
+		
+		if(src->slots[slot] != MA_TOPK_EMPTY)
+		{
+			all[n].count += src->entries[src->slots[slot]].count;
+			all[n].error += src->entries[src->slots[slot]].error;
+		}
+		else
+		{
+			all[n].count += srcMin;
+			all[n].error += srcMin;
+		}
+		n++;
+	}
+	
+	for(i = 0; i < src->used; i++)
+	{
+		const ma_topk_entry_t *e = &src->entries[i];
+		
+		slot = ma_topk_slot(dst, e->key, e->keyLen, e->hash);
+		if(dst->slots[slot] != MA_TOPK_EMPTY)
+			continue;
+		
+		all[n] = *e;
+		all[n].count += dstMin;
+		all[n].error += dstMin;
+		n++;
+	}
+	
+	qsort(all, n, sizeof(*all), ma_topk_compare);
+	
+	dst->total += src->total;
+	dst->used = 0;
+	memset(dst->slots, 0xFF, (dst->mask+1)*sizeof(*dst->slots));
+	for(i = 0; i < n && i < dst->capacity; i++)
+		ma_topk_insert(dst, &all[i]);
+	
+	free(all);
+	return YES;
+}
+
+/* The n largest counters, largest first. */
+NSUInteger
+ma_topk_top(const ma_topk_t *t, ma_topk_entry_t *top, NSUInteger n)
+{
+	ma_topk_entry_t *all;
+	
+	if(!(all = malloc(MAX(t->used, 1)*sizeof(*all))))
+		return 0;
+	
+	memcpy(all, t->entries, t->used*sizeof(*all));
+	qsort(all, t->used, sizeof(*all), ma_topk_compare);
+	
+	n = MIN(n, t->used);
+	memcpy(top, all, n*sizeof(*top));
+	free(all);
+	
+	return n;
+}
+
+uint64_t
+ma_topk_total(const ma_topk_t *t)
+{
+	return t->total;
+}
+
+#pragma mark - Sliding window
+
+static void
+ma_talkers_free_summaries(ma_topk_t *summaries[MA_TOPK_KINDS][MA_TOPK_METRICS])
+{
+	int k, m;
+	
+	for(k = 0; k < MA_TOPK_KINDS; k++)
+		for(m = 0; m < MA_TOPK_METRICS; m++)
+			ma_topk_destroy(summaries[k][m]);
+}
+
+static BOOL
+ma_talkers_new_summaries(ma_topk_t *summaries[MA_TOPK_KINDS][MA_TOPK_METRICS],
+						 NSUInteger capacity)
+{
+	int k, m;
+	
+	for(k = 0; k < MA_TOPK_KINDS; k++)
+		for(m = 0; m < MA_TOPK_METRICS; m++)
+			if(!(summaries[k][m] = ma_topk_create(capacity)))
+				return NO;
+	
+	return YES;
+}
+
+ma_talkers_t *
+ma_talkers_create(NSUInteger capacity, int64_t window, NSUInteger buckets)
+{
+	ma_talkers_t *tk;
+	NSUInteger i;
+	
+	if(window <= 0 || buckets == 0)
+		return NULL;
+	
+	if(!(tk = calloc(1, sizeof(*tk))))
+		return NULL;
+	
+	pthread_mutex_init(&tk->lock, NULL);
+	tk->bucketWidth = MAX(window/(int64_t)buckets, 1);
+	tk->newest = -1;
+	tk->bucketCount = buckets;
+	
+	if(!(tk->buckets = calloc(buckets, sizeof(*tk->buckets))) ||
+	   !ma_talkers_new_summaries(tk->expired.summaries, capacity))
+	{
+		ma_talkers_destroy(tk);
+		return NULL;
+	}
+	
+	for(i = 0; i < buckets; i++)
+	{
+		tk->buckets[i].epoch = -1;
+		if(!ma_talkers_new_summaries(tk->buckets[i].summaries, capacity))
+		{
+			ma_talkers_destroy(tk);
+			return NULL;
+		}
+	}
+	
+	return tk;
+}
+
+void
+ma_talkers_destroy(ma_talkers_t *tk)
+{
+	NSUInteger i;
+	
+	if(tk == NULL)
+		return;
+	
+	for(i = 0; tk->buckets && i < tk->bucketCount; i++)
+		ma_talkers_free_summaries(tk->buckets[i].summaries);
+	free(tk->buckets);
+	ma_talkers_free_summaries(tk->expired.summaries);
+	pthread_mutex_destroy(&tk->lock);
+	free(tk);
+}
+
+/* The bucket for a packet at epoch, or the running total if it's too old. */
+static ma_talkers_bucket_t *
+ma_talkers_bucket(ma_talkers_t *tk, int64_t epoch)
+{
+	ma_talkers_bucket_t *b;
+	int k, m;
+	
+	if(epoch > tk->newest)
+		tk->newest = epoch;
+	if(epoch <= tk->newest-(int64_t)tk->bucketCount)
+		return &tk->expired;
+	
+	b = &tk->buckets[epoch % (int64_t)tk->bucketCount];
+	if(b->epoch != epoch)
+	{
+		for(k = 0; k < MA_TOPK_KINDS; k++)
+		{
+			for(m = 0; m < MA_TOPK_METRICS; m++)
+			{
+				if(b->epoch >= 0 &&
+				   !ma_topk_merge(tk->expired.summaries[k][m],
+									  b->summaries[k][m]))
+					NSLog(@"%s(): could not keep an expired bucket", __func__);
+				ma_topk_clear(b->summaries[k][m]);
+			}
+		}
+		b->epoch = epoch;
+	}
+	
+	return b;
+}
+
+/*
+ * Counts an IP packet, weight times, against its source, destination,
+ * address pair and port. Anything else is ignored.
+ */
+BOOL
+ma_talkers_packet(ma_talkers_t *tk, int linkType, const struct pcap_pkthdr *hdr,
+				  const u_char *data, uint32_t weight)
+{
+	ma_talkers_bucket_t *b;
+	ma_flow_t flow;
+	u_char pair[MA_TOPK_KEY_SIZE];
+	u_char port[3];
+	uint16_t ports[2];
+	const uint64_t counts[MA_TOPK_METRICS] = {
+		[MA_TOPK_PACKETS]	= weight,
+		[MA_TOPK_BYTES]		= (uint64_t)weight*hdr->len
+	};
+	int64_t ts = ma_pkthdr_ns(hdr);
+	int m;
+	
+	if(weight == 0 || !ma_flow_parse(linkType, hdr, data, &flow))
+		return NO;
+	
+	/* The key already has the lower end first. */
+	memcpy(pair, ma_flow_end(&flow, 0), flow.addrLen);
+	memcpy(pair+flow.addrLen, ma_flow_end(&flow, 1), flow.addrLen);
+	
+	ports[0] = (uint16_t)(ma_flow_end(&flow, 0)[flow.addrLen] << 8 |
+						  ma_flow_end(&flow, 0)[flow.addrLen+1]);
+	ports[1] = (uint16_t)(ma_flow_end(&flow, 1)[flow.addrLen] << 8 |
+						  ma_flow_end(&flow, 1)[flow.addrLen+1]);
+	ports[0] = (ports[0] && (ports[0] < ports[1] || !ports[1]) ?
+				ports[0] : ports[1]);
+	port[0] = flow.ipProto;
+	port[1] = (u_char)(ports[0] >> 8);
+	port[2] = (u_char)ports[0];
+	
+	pthread_mutex_lock(&tk->lock);
+	b = ma_talkers_bucket(tk, MAX(ts, 0)/tk->bucketWidth);
+	
+	for(m = 0; m < MA_TOPK_METRICS; m++)
+	{
+		ma_topk_add(b->summaries[MA_TOPK_SOURCES][m], ma_flow_src(&flow),
+					flow.addrLen, counts[m]);
+		ma_topk_add(b->summaries[MA_TOPK_DESTINATIONS][m], ma_flow_dst(&flow),
+					flow.addrLen, counts[m]);
+		ma_topk_add(b->summaries[MA_TOPK_CONVERSATIONS][m], pair,
+					2*flow.addrLen, counts[m]);
+		if(ports[0])
+			ma_topk_add(b->summaries[MA_TOPK_PORTS][m], port, sizeof(port),
+						counts[m]);
+	}
+	pthread_mutex_unlock(&tk->lock);
+	
+	return YES;
+}
+
+/*
+ * A new summary of the window ending at the newest packet, or of the whole
+ * capture. The caller destroys it.
+ */
+ma_topk_t *
+ma_talkers_query(ma_talkers_t *tk, ma_topk_kind_t kind,
+				 ma_topk_metric_t metric, BOOL windowed)
+{
+	ma_topk_t *t;
+	NSUInteger i;
+	BOOL merged = YES;
+	
+	if(!(t = ma_topk_create(tk->expired.summaries[kind][metric]->capacity)))
+		return NULL;
+	
+	pthread_mutex_lock(&tk->lock);
+	if(!windowed)
+		merged = ma_topk_merge(t, tk->expired.summaries[kind][metric]);
+	
+	/*
+	 * A bucket that fell out of the window is only folded into the
+	 * running total once it is reused, until then the whole capture
+	 * still has to take it from the bucket itself.
+	 */
+	for(i = 0; merged && i < tk->bucketCount; i++)
+	{
+		if(tk->buckets[i].epoch >= 0 &&
+		   (!windowed ||
+			tk->buckets[i].epoch > tk->newest-(int64_t)tk->bucketCount))
+			merged = ma_topk_merge(t, tk->buckets[i].summaries[kind][metric]);
+	}
+	pthread_mutex_unlock(&tk->lock);
+	
+	if(!merged)
+	{
+		ma_topk_destroy(t);
+		return NULL;
+	}
+	
+	return t;
+}
+
+#pragma mark - Report
+
+NSString *
+ma_topk_key_string(ma_topk_kind_t kind, const ma_topk_entry_t *entry)
+{
+	char a[INET6_ADDRSTRLEN], b[INET6_ADDRSTRLEN];
+	size_t addrLen = entry->keyLen;
+	int family;
+	
+	if(kind == MA_TOPK_PORTS)
+	{
+		return [NSString stringWithFormat:@"%s/%u",
+				(entry->key[0] == IPPROTO_TCP ? "tcp" : "udp"),
+				(unsigned)(entry->key[1] << 8 | entry->key[2])];
+	}
+	
+	if(kind == MA_TOPK_CONVERSATIONS)
+		addrLen /= 2;
+	family = (addrLen == 4 ? AF_INET : AF_INET6);
+	
+	if(!inet_ntop(family, entry->key, a, sizeof(a)))
+		return @"<Unknown>";
+	if(kind != MA_TOPK_CONVERSATIONS)
+		return [NSString stringWithUTF8String:a];
+	
+	if(!inet_ntop(family, entry->key+addrLen, b, sizeof(b)))
+		return @"<Unknown>";
+	return [NSString stringWithFormat:@"%s <-> %s", a, b];
+}
+
+static void
+ma_talkers_report_table(NSMutableString *report, ma_talkers_t *tk,
+						ma_topk_kind_t kind, ma_topk_metric_t metric,
+						BOOL windowed, NSUInteger rows)
+{
+	static const char *kinds[MA_TOPK_KINDS] = {
+		[MA_TOPK_SOURCES]		= "sources",
+		[MA_TOPK_DESTINATIONS]	= "destinations",
+		[MA_TOPK_CONVERSATIONS]	= "conversations",
+		[MA_TOPK_PORTS]			= "ports"
+	};
+	static const char *metrics[MA_TOPK_METRICS] = {
+		[MA_TOPK_PACKETS]		= "packets",
+		[MA_TOPK_BYTES]			= "bytes"
+	};
+	ma_topk_entry_t *top;
+	ma_topk_t *t;
+	NSUInteger n, i;
+	uint64_t total;
+	
+	if(!(t = ma_talkers_query(tk, kind, metric, windowed)))
+		return;
+	if(!(top = malloc(MAX(rows, 1)*sizeof(*top))))
+	{
+		ma_topk_destroy(t);
+		return;
+	}
+	
+	n = ma_topk_top(t, top, rows);
+	total = ma_topk_total(t);
+	
+	[report appendFormat:@"\n%-48s %14s %8s %14s\n",
+	 [[NSString stringWithFormat:@"top %s by %s", kinds[kind],
+	   metrics[metric]] UTF8String], metrics[metric], "share", "error"];
+	for(i = 0; i < n; i++)
+	{
+		[report appendFormat:@"%-48s %14llu %7.1f%% %14llu\n",
+		 [ma_topk_key_string(kind, &top[i]) UTF8String], top[i].count,
+		 (total ? 100.0*top[i].count/total : 0.0), top[i].error];
+	}
+	
+	free(top);
+	ma_topk_destroy(t);
+}
+
+NSString *
+ma_talkers_report(ma_talkers_t *tk, NSUInteger rows)
+{
+	NSMutableString *report = [NSMutableString string];
+	ma_topk_kind_t kind;
+	ma_topk_metric_t metric;
+	int pass;
+	
+	for(pass = 0; pass < 2; pass++)
+	{
+		if(pass == 0)
+			[report appendFormat:@"last %.0f seconds\n",
+			 (double)tk->bucketWidth*tk->bucketCount/MA_NSEC_PER_SEC];
+		else
+			[report appendString:@"\n\nwhole capture\n"];
+		
+		for(kind = 0; kind < MA_TOPK_KINDS; kind++)
+			for(metric = 0; metric < MA_TOPK_METRICS; metric++)
+				ma_talkers_report_table(report, tk, kind, metric, pass == 0,
+										rows);
+	}
+	
+	return report;
+}
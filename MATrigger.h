@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+#import <pcap/pcap.h>
+
+
+/*
+ * Pre-trigger ring for one capture session.
+ *
+ * Every packet is kept in a ring bounded by age (window), bytes and
+ * packet count. When a trigger fires the ring's contents are written out
+ * followed by the packets of the next post nanoseconds, then it re-arms.
+ * The ring and the trigger state are allocated up front, nothing is
+ * allocated per packet; only opening a dump file allocates.
+ *
+ * Triggers are a BPF expression matched against each packet, a burst of
+ * rstBurst TCP resets within a second and a jump of dropSpike kernel
+ * drops within a second. Several rings (one per fanout worker) can share
+ * a generation counter so that when one fires they all dump.
+ */
+
+typedef enum
+{
+	MA_TRIGGER_NONE,
+	MA_TRIGGER_FILTER,
+	MA_TRIGGER_RST_BURST,
+	MA_TRIGGER_DROP_SPIKE,
+	MA_TRIGGER_SHARED
+} ma_trigger_reason_t;
+
+typedef struct
+{
+	const char *filter;			/* NULL for none */
+	NSUInteger rstBurst;		/* 0 for none */
+	uint64_t dropSpike;			/* 0 for none */
+	int64_t window;				/* ns kept before the trigger */
+	int64_t post;				/* ns written after it */
+	size_t ringBytes;
+	NSUInteger ringPackets;
+	int linkType;
+	uint32_t snapLen;
+	const char *prefix;			/* dumps go to <prefix>-<time>.pcap */
+} ma_trigger_config_t;
+
+typedef struct
+{
+	uint64_t fired;
+	uint64_t dumped;			/* packets written */
+	uint64_t lost;				/* not written, dump writer too slow */
+	ma_trigger_reason_t lastReason;
+} ma_trigger_stats_t;
+
+typedef struct ma_trigger ma_trigger_t;
+
+
+ma_trigger_t *ma_trigger_create(const ma_trigger_config_t *config,
+								volatile int64_t *generation);
+void ma_trigger_destroy(ma_trigger_t *t);
+void ma_trigger_packet(ma_trigger_t *t, const struct pcap_pkthdr *hdr,
+					   const u_char *data);
+void ma_trigger_tick(ma_trigger_t *t, int64_t now);
+void ma_trigger_drops(ma_trigger_t *t, uint64_t drops);
+void ma_trigger_stats(ma_trigger_t *t, ma_trigger_stats_t *stats);
+const char *ma_trigger_reason_name(ma_trigger_reason_t reason);
@@ -0,0 +1,402 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import "MATrigger.h"
+
+#import <libkern/OSAtomic.h>
+#import <sys/param.h>
+#import <sys/time.h>
+#import <time.h>
+
+#import "ConfigurationConstants.h"
+#import "MARecord.h"
+#import "MASpool.h"
+
+
+/* IPv4 via tcpflags, IPv6 only without extension headers. */
+#define MA_TRIGGER_RST_FILTER	"tcp[tcpflags] & tcp-rst != 0 or " \
+								"(ip6 and ip6[6] = 6 and ip6[53] & 4 != 0)"
+
+typedef struct
+{
+	struct pcap_pkthdr hdr;
+	size_t offset;
+} ma_trigger_slot_t;
+
+struct ma_trigger
+{
+	ma_trigger_config_t config;
+	char prefix[MAXPATHLEN];
+	volatile int64_t *generation;
+	int64_t seen;
+	
+	u_char *arena;
+	size_t head;				/* where the next packet goes */
+	ma_trigger_slot_t *slots;
+	NSUInteger first;
+	NSUInteger count;
+	
+	struct bpf_program filter;
+	BOOL hasFilter;
+	struct bpf_program rst;
+	BOOL hasRst;
+	int64_t *rstTimes;			/* the last rstBurst resets */
+	NSUInteger rstNext;
+	
+	uint64_t lastDrops;
+	time_t lastDropCheck;
+	
+	ma_spool_t *dump;
+	int64_t postUntil;
+	
+	ma_trigger_stats_t stats;
+};
+
+
+static BOOL
+ma_trigger_compile(ma_trigger_t *t, const char *expr,
+				   struct bpf_program *program)
+{
+	pcap_t *dead;
+	BOOL ok;
+	
+	if(!(dead = pcap_open_dead(t->config.linkType, t->config.snapLen)))
+		return NO;
+	
+	ok = (pcap_compile(dead, program, expr, 1, PCAP_NETMASK_UNKNOWN) == 0);
+	if(!ok)
+		NSLog(@"%s(): %s", __func__, pcap_geterr(dead));
+	pcap_close(dead);
+	
+	return ok;
+}
+
+/*
+ * generation is shared by the rings that should dump together, NULL if
+ * this one stands alone.
+ */
+ma_trigger_t *
+ma_trigger_create(const ma_trigger_config_t *config,
+				  volatile int64_t *generation)
+{
+	ma_trigger_t *t;
+	
+	if(config->ringBytes == 0 || config->ringPackets == 0)
+		return NULL;
+	
+	if(!(t = calloc(1, sizeof(*t))))
+		return NULL;
+	
+	t->config = *config;
+	t->generation = generation;
+	t->seen = (generation ? *generation : 0);
+	strlcpy(t->prefix, (config->prefix ? config->prefix : "trigger"),
+			sizeof(t->prefix));
+	t->config.prefix = t->prefix;
+	t->config.filter = NULL;
+	
+	if(!(t->arena = malloc(config->ringBytes)) ||
+	   !(t->slots = calloc(config->ringPackets, sizeof(*t->slots))) ||
+	   (config->rstBurst &&
+		!(t->rstTimes = calloc(config->rstBurst, sizeof(*t->rstTimes)))))
+	{
+		ma_trigger_destroy(t);
+		return NULL;
+	}
+	
+	if(config->filter && *config->filter)
+	{
+		if(!(t->hasFilter = ma_trigger_compile(t, config->filter, &t->filter)))
+		{
+			ma_trigger_destroy(t);
+			return NULL;
+		}
+	}
+	
+	if(config->rstBurst)
+		t->hasRst = ma_trigger_compile(t, MA_TRIGGER_RST_FILTER, &t->rst);
+	
+	return t;
+}
+
+void
+ma_trigger_destroy(ma_trigger_t *t)
+{
+	if(t == NULL)
+		return;
+	
+	if(t->dump && !ma_spool_close(t->dump))
+		NSLog(@"%s(): trigger dump incomplete", __func__);
+	if(t->hasFilter)
+		pcap_freecode(&t->filter);
+	if(t->hasRst)
+		pcap_freecode(&t->rst);
+	
+	free(t->rstTimes);
+	free(t->slots);
+	free(t->arena);
+	free(t);
+}
+
+#pragma mark - Ring
+
+static inline void
+ma_trigger_evict(ma_trigger_t *t)
+{
+	t->first = (t->first+1) % t->config.ringPackets;
+	if(--t->count == 0)
+		t->head = 0;
+}
+
+static void
+ma_trigger_store(ma_trigger_t *t, const struct pcap_pkthdr *hdr,
+				 const u_char *data, int64_t ts)
+{
+	size_t len = hdr->caplen;
+	size_t offset;
+	ma_trigger_slot_t *slot;
+	
+	if(len > t->config.ringBytes)
+		return;
+	
+	while(t->count > 0 &&
+		  ts-ma_pkthdr_ns(&t->slots[t->first].hdr) > t->config.window)
+		ma_trigger_evict(t);
+	if(t->count == t->config.ringPackets)
+		ma_trigger_evict(t);
+	
+	/*
+	 * Packets are laid out oldest first from head onwards, so whatever is
+	 * in the way is always the oldest. Packets don't wrap; if there isn't
+	 * room before the end, the end is given up along with what is in it.
+	 */
+	offset = t->head;
+	if(offset+len > t->config.ringBytes)
+	{
+		while(t->count > 0 && t->slots[t->first].offset >= offset)
+			ma_trigger_evict(t);
+		offset = 0;
+	}
+	while(t->count > 0 && t->slots[t->first].offset >= offset &&
+		  t->slots[t->first].offset < offset+len)
+		ma_trigger_evict(t);
+	
+	slot = &t->slots[(t->first+t->count) % t->config.ringPackets];
+	slot->hdr = *hdr;
+	slot->offset = offset;
+	memcpy(t->arena+offset, data, len);
+	t->head = offset+len;
+	t->count++;
+}
+
+#pragma mark - Dumps
+
+static void
+ma_trigger_write(ma_trigger_t *t, const struct pcap_pkthdr *hdr,
+				 const u_char *data)
+{
+	if(ma_spool_packet(t->dump, hdr, data))
+		t->stats.dumped++;
+	else
+		t->stats.lost++;
+}
+
+/*
+ * Start a dump with everything in the ring. The spool does the writing
+ * on its own thread; closing it, which waits for that, is left to a
+ * global queue so the capture thread never waits on the disk. The dump
+ * has buffers for the whole ring and as much again as a plain spool for
+ * what follows, the ring goes in all at once.
+ */
+static void
+ma_trigger_fire(ma_trigger_t *t, ma_trigger_reason_t reason, int64_t ts)
+{
+	char path[MAXPATHLEN];
+	char stamp[32];
+	time_t secs = (time_t)(ts/MA_NSEC_PER_SEC);
+	struct tm tm;
+	NSUInteger i;
+	
+	if(t->dump)
+		return;
+	
+	localtime_r(&secs, &tm);
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+	snprintf(path, sizeof(path), "%s-%s.%09lld.pcap", t->prefix, stamp,
+			 (long long)(ts % MA_NSEC_PER_SEC));
+	
+	if(!(t->dump = ma_spool_open_with_room(path, t->config.linkType,
+										   t->config.snapLen, NULL,
+										   t->config.ringBytes+
+										   t->config.ringPackets*
+										   MA_SPOOL_RECORD_SIZE+
+										   MASpoolBuffers*MASpoolBufferSize)))
+	{
+		NSLog(@"%s(): could not open %s", __func__, path);
+		return;
+	}
+	
+	t->stats.fired++;
+	t->stats.lastReason = reason;
+	t->postUntil = ts+t->config.post;
+	
+	for(i = 0; i < t->count; i++)
+	{
+		ma_trigger_slot_t *slot = &t->slots[(t->first+i) % t->config.ringPackets];
+		
+		ma_trigger_write(t, &slot->hdr, t->arena+slot->offset);
+	}
+	
+	/* Let the other rings know. */
+	if(t->generation && reason != MA_TRIGGER_SHARED)
+		t->seen = OSAtomicIncrement64Barrier(t->generation);
+}
+
+static void
+ma_trigger_finish(ma_trigger_t *t)
+{
+	ma_spool_t *dump = t->dump;
+	
+	t->dump = NULL;
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+		if(!ma_spool_close(dump))
+			NSLog(@"%s(): trigger dump incomplete", __func__);
+	});
+}
+
+#pragma mark - Triggers
+
+static BOOL
+ma_trigger_rst_burst(ma_trigger_t *t, const struct pcap_pkthdr *hdr,
+					 const u_char *data, int64_t ts)
+{
+	int64_t oldest;
+	
+	if(!t->hasRst || !pcap_offline_filter(&t->rst, hdr, data))
+		return NO;
+	
+	/* After this one goes in, the next slot holds the oldest of the burst. */
+	t->rstTimes[t->rstNext] = ts;
+	t->rstNext = (t->rstNext+1) % t->config.rstBurst;
+	oldest = t->rstTimes[t->rstNext];
+	
+	return (oldest != 0 && ts-oldest <= MA_NSEC_PER_SEC);
+}
+
+void
+ma_trigger_packet(ma_trigger_t *t, const struct pcap_pkthdr *hdr,
+				  const u_char *data)
+{
+	int64_t ts = ma_pkthdr_ns(hdr);
+	ma_trigger_reason_t reason = MA_TRIGGER_NONE;
+	
+	ma_trigger_store(t, hdr, data, ts);
+	
+	if(t->dump)
+	{
+		if(ts <= t->postUntil)
+		{
+			ma_trigger_write(t, hdr, data);
+			return;
+		}
+		ma_trigger_finish(t);
+	}
+	
+	if(t->hasFilter && pcap_offline_filter(&t->filter, hdr, data))
+		reason = MA_TRIGGER_FILTER;
+	else if(ma_trigger_rst_burst(t, hdr, data, ts))
+		reason = MA_TRIGGER_RST_BURST;
+	else if(t->generation && *t->generation != t->seen)
+	{
+		t->seen = *t->generation;
+		reason = MA_TRIGGER_SHARED;
+	}
+	
+	if(reason != MA_TRIGGER_NONE)
+		ma_trigger_fire(t, reason, ts);
+}
+
+/*
+ * Finish a dump whose post window is over by now, in nanoseconds, even
+ * if no packet came along to do it. Call from the thread that feeds
+ * packets, between them.
+ */
+void
+ma_trigger_tick(ma_trigger_t *t, int64_t now)
+{
+	if(t->dump && now > t->postUntil)
+		ma_trigger_finish(t);
+}
+
+/*
+ * Feed the session's kernel drop counter, checked once a second. Call
+ * from the thread that feeds packets.
+ */
+void
+ma_trigger_drops(ma_trigger_t *t, uint64_t drops)
+{
+	struct timeval now;
+	uint64_t spike;
+	
+	if(t->config.dropSpike == 0)
+		return;
+	
+	gettimeofday(&now, NULL);
+	if(now.tv_sec == t->lastDropCheck)
+		return;
+	
+	spike = (t->lastDropCheck && drops > t->lastDrops ? drops-t->lastDrops : 0);
+	t->lastDrops = drops;
+	t->lastDropCheck = now.tv_sec;
+	
+	if(spike >= t->config.dropSpike && !t->dump)
+		ma_trigger_fire(t, MA_TRIGGER_DROP_SPIKE, ma_timeval_ns(&now));
+}
+
+void
+ma_trigger_stats(ma_trigger_t *t, ma_trigger_stats_t *stats)
+{
+	*stats = t->stats;
+}
+
+const char *
+ma_trigger_reason_name(ma_trigger_reason_t reason)
+{
+	switch(reason)
+	{
+		case MA_TRIGGER_FILTER:		return "filter";
+		case MA_TRIGGER_RST_BURST:	return "rst-burst";
+		case MA_TRIGGER_DROP_SPIKE:	return "drop-spike";
+		case MA_TRIGGER_SHARED:		return "other worker";
+		default:					return "none";
+	}
+}
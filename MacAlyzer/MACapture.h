@@ -33,14 +33,25 @@
 #import <Cocoa/Cocoa.h>
 #import <pcap/pcap.h>
 
+#import "MABurst.h"
+#import "MACardinality.h"
+#import "MADedup.h"
+#import "MAHierarchy.h"
+#import "MAIOGraph.h"
+#import "MAMerge.h"
+#import "MAPipeline.h"
+#import "MASpool.h"
+#import "MATCPAnalysis.h"
+#import "MATopK.h"
 #import "MAProtocols.h"
 
 
 @class MAPacket;
 @class MADocumentController;
+@class MASpillFile;
 
 
-@interface MACapture : NSDocument {
+@interface MACapture : NSDocument <MAStatisticsReporting> {
 @private
 	MADocumentController *_docController;
 	cap_device_t _deviceType;
@@ -48,19 +59,76 @@
 	
 	NSUInteger _bytesCaptured;
 	NSUInteger _packetsCaptured;
+	uint64_t _bytesEstimated;		/* wire bytes, scaled by sample weight */
+	uint64_t _packetsEstimated;
+	ma_hierarchy_t *_hierarchy;		/* packets and bytes per protocol */
+	ma_talkers_t *_talkers;			/* heavy hitters */
+	ma_cardinality_t *_cardinality;	/* distinct hosts, flows and ports */
+	ma_iograph_t *_ioGraph;			/* traffic over time */
+	ma_burst_t *_bursts;			/* microbursts */
+	ma_tcpa_t *_tcpAnalysis;		/* TCP expert tags per connection */
 	
 	NSMutableSet *_buffer;
+	dispatch_semaphore_t _bufferSlots;	/* savefile backpressure */
+	BOOL _throttled;
+	dispatch_group_t _readers;			/* savefile and merge readers */
+	volatile BOOL _stopReading;
 	NSMutableArray *_packets;
 	
 	uint16_t _dataLinkLayer;
 	pcap_t *_session;
 	int _dataLink;
 	NSUInteger _packetId;
+	int64_t _firstTimestamp;
+	
+	ma_pipeline_t *_pipeline;
+	
+	ma_merge_t *_merge;
+	NSMutableArray *_mergeSources;
+	NSMutableArray *_mergeDataLinks;	/* link type of each source */
+	BOOL _mixedDataLinks;
+	BOOL _mergeLive;
+	ma_dedup_t *_dedup;				/* copies seen on more than one source */
+	ma_dedup_mode_t _dedupMode;
+	uint64_t _duplicates;
+	
+	ma_spool_t *_spool;
+	NSString *_spoolPath;
+	BOOL _spoolTried;
+	
+	NSUInteger _memoryBudget;
+	NSUInteger _residentBytes;		/* packet bytes not spilled */
+	NSUInteger _spillCursor;		/* first packet not spilled */
+	MASpillFile *_spillFile;
+	BOOL _spilling;
+	BOOL _spillFailed;
 }
 
+- (id)initWithMergedSources:(NSArray *)sources error:(NSError **)outError;
+
 - (void)newPacket:(const u_char *)data
 	   withHeader:(const struct pcap_pkthdr *)header;
+- (void)newPacket:(const u_char *)data
+	   withHeader:(const struct pcap_pkthdr *)header
+		 dataLink:(int)dataLink;
+- (BOOL)packetsDataLink:(int *)dataLink;
+- (BOOL)writePacketsToURL:(NSURL *)absoluteURL
+				   ofType:(NSString *)typeName
+					error:(NSError **)outError;
+- (BOOL)writePcapngToURL:(NSURL *)absoluteURL error:(NSError **)outError;
+- (BOOL)mergePacket:(MAPacket *)packet;
+- (void)mergedPacket:(MAPacket *)packet;
+- (void)advanceMerge;
+- (void)flushMerge;
+- (void)stopReaders;
 - (NSInteger)updatePacketsWithSortDescriptors:(NSArray *)descriptors;
+- (NSInteger)updatePacketsWithSortDescriptors:(NSArray *)descriptors
+								  holdingBack:(uint64_t)skew;
+- (void)enforceMemoryBudget;
+- (BOOL)openSpoolWithDataLink:(int)dataLink;
+- (BOOL)spoolIsComplete;
+- (BOOL)copySpoolToPath:(NSString *)path;
+- (NSArray *)spoolURLsFrom:(int64_t)start to:(int64_t)end;
 
 @property (readonly) NSUInteger countOfBuffer;
 @property (readonly) NSEnumerator *enumeratorOfBuffer;
@@ -79,9 +147,23 @@
 @property (readonly) NSString *deviceUUID;
 @property (readonly) NSUInteger bytesCaptured;
 @property (readonly) NSUInteger packetsCaptured;
+@property (readonly) uint64_t bytesEstimated;
+@property (readonly) uint64_t packetsEstimated;
+@property (readonly) ma_hierarchy_t *hierarchy;
+@property (readonly) ma_talkers_t *talkers;
+@property (readonly) ma_cardinality_t *cardinality;
+@property (readonly) ma_iograph_t *ioGraph;
+@property (readonly) ma_burst_t *bursts;
+@property (readonly) ma_tcpa_t *tcpAnalysis;
 @property (readonly) NSMutableSet *buffer;
 @property (readonly) NSMutableArray *packets;
 @property (readonly) uint16_t dataLinkLayer;
 @property (readonly) pcap_t *session;
+@property (readonly) ma_pipeline_t *pipeline;
+@property (readonly) ma_merge_t *merge;
+@property (readonly) BOOL isLiveMerge;
+@property (readonly) uint64_t duplicates;
+@property (readonly) NSString *spoolPath;
+@property (readonly) NSUInteger residentBytes;
 
 @end
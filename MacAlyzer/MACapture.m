@@ -32,7 +32,11 @@
 
 #import "MACapture.h"
 
+#import <fcntl.h>
 #import <pcap/pcap.h>
+#import <sys/param.h>
+#import <sys/time.h>
+#import <unistd.h>
 
 #import "ConfigurationConstants.h"
 
@@ -40,7 +44,14 @@
 #import "MAWindowController.h"
 #import "PCAPController.h"
 #import "MACaptureDevice.h"
+#import "MACaptureStats.h"
 #import "MAPacket.h"
+#import "MABlockStore.h"
+#import "MAFileIO.h"
+#import "MAPcapng.h"
+#import "MAPipelineStats.h"
+#import "MASpillFile.h"
+#import "MARecord.h"
 #import "MAString.h"
 
 
@@ -54,30 +65,370 @@ ma_local_pcap_callback(u_char *obj, const struct pcap_pkthdr *hdr,
 	[(id)obj newPacket:data withHeader:hdr];
 }
 
+/* One savefile feeding a merged document. */
+typedef struct
+{
+	MACapture *doc;
+	NSUInteger source;
+	pcap_t *session;
+	int dataLink;
+	NSUInteger nextId;
+	BOOL stopped;
+} ma_merge_reader_t;
+
+
+static void
+ma_merge_emit(void *ctx, void *item)
+{
+	[(MACapture *)ctx mergedPacket:item];
+}
+
+/* A pcap or block store file has room for a single link type. */
+static NSError *
+ma_mixed_link_error(void)
+{
+	NSDictionary *userInfo =
+	[NSDictionary dictionaryWithObject:@"The packets come from links of "
+	 "different types, only pcapng can hold them in one file."
+								forKey:NSLocalizedDescriptionKey];
+	
+	return [NSError errorWithDomain:NSCocoaErrorDomain
+							   code:NSFileWriteUnknownError
+						   userInfo:userInfo];
+}
+
+/* Left in the merge when the document went away, never shown. */
+static void
+ma_merge_discard(void *ctx, void *item)
+{
+	[(MAPacket *)item release];
+}
+
+/*
+ * Savefile packets for a merged document, blocks while this file is
+ * too far ahead of the others. Stops the reader once the merge refuses
+ * packets, the document is closing.
+ */
+static void
+ma_merge_pcap_callback(u_char *obj, const struct pcap_pkthdr *hdr,
+					   const u_char *data)
+{
+	ma_merge_reader_t *reader = (ma_merge_reader_t *)obj;
+	MACapture *doc = reader->doc;
+	uint64_t startedAt = ma_pipeline_now();
+	MAPacket *packet = [[MAPacket alloc] initWithData:data
+										   withHeader:hdr
+											   withId:reader->nextId++
+											 withUUID:[doc deviceUUID]
+										 withDataLink:reader->dataLink];
+	
+	if(packet == nil)
+	{
+		ma_pipeline_drop([doc pipeline], MA_STAGE_PACKET, 1);
+		return;
+	}
+	
+	[packet setPipeline:[doc pipeline]];
+	[packet setStagedAt:ma_pipeline_now()];
+	ma_pipeline_record([doc pipeline], MA_STAGE_PACKET, startedAt,
+					   [packet stagedAt], 1, hdr->caplen);
+	
+	if(!ma_merge_push([doc merge], reader->source, [packet timestamp], packet,
+					  YES))
+	{
+		[packet release];
+		reader->stopped = YES;
+		if(reader->session)
+			pcap_breakloop(reader->session);
+	}
+}
+
 @implementation MACapture
 
 - (id)init
 {
+	NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+	NSInteger burstWindow, lineRate;
+	double fraction;
+	
 	if(!(self = [super init]))
 		return nil;
 	
 	_docController = [MADocumentController sharedDocumentController];
 	_buffer = [NSMutableSet new];
+	_bufferSlots = dispatch_semaphore_create(MAMaxBufferedPackets);
+	_readers = dispatch_group_create();
 	_packets = [NSMutableArray new];
+	_hierarchy = ma_hierarchy_create();
+	_talkers = ma_talkers_create(MATopKCapacity,
+								 (int64_t)MATopKWindow*MA_NSEC_PER_SEC,
+								 MATopKBuckets);
+	_cardinality = ma_cardinality_create(MACardinalitySources,
+										 (int64_t)MACardinalityBucket*
+										 MA_NSEC_PER_SEC,
+										 MACardinalityBuckets);
+	_ioGraph = ma_iograph_create([NSTemporaryDirectory() fileSystemRepresentation]);
+	
+	/* Bursts are measured against the line the capture came off. */
+	burstWindow = [defaults integerForKey:MABurstWindowKey];
+	if(burstWindow < 100 || burstWindow > 1000)
+		burstWindow = MABurstWindow;
+	lineRate = [defaults integerForKey:MABurstLineRateKey];
+	if(lineRate <= 0)
+		lineRate = MABurstLineRate;
+	fraction = [defaults doubleForKey:MABurstFractionKey];
+	if(fraction <= 0.0)
+		fraction = MABurstFraction;
+	_bursts = ma_burst_create((int64_t)burstWindow*1000,
+							  (uint64_t)lineRate*1000000, fraction,
+							  MABurstHistory);
+	_tcpAnalysis = ma_tcpa_create(MATCPAnalysisTableSize,
+								  (int64_t)MATCPAnalysisIdle*MA_NSEC_PER_SEC);
+	
+	_memoryBudget = (NSUInteger)[defaults integerForKey:MAMemoryBudgetKey] << 20;
+	if(_memoryBudget == 0)
+		_memoryBudget = MAMemoryBudget;
+	
+	return self;
+}
+
+/*
+ * A document that shows several live devices and/or savefiles as one
+ * timestamp ordered stream. sources holds device:// and file:// URLs.
+ */
+- (id)initWithMergedSources:(NSArray *)sources error:(NSError **)outError
+{
+	NSMutableArray *names = [NSMutableArray array];
+	NSMutableArray *keys = [NSMutableArray array];
+	NSMutableArray *sessions = [NSMutableArray array];
+	NSMutableArray *stores = [NSMutableArray array];
+	char errbuf[PCAP_ERRBUF_SIZE];
+	NSURL *mergeURL;
+	NSUInteger i;
+	
+	if(!(self = [self init]))
+		return nil;
+	
+	_deviceType = PCAP_MERGED;
+	_packetId = 1;
+	_mergeSources = [[NSMutableArray alloc] init];
+	_mergeDataLinks = [[NSMutableArray alloc] init];
+	
+	for(NSURL *url in sources)
+	{
+		pcap_t *session = NULL;
+		ma_blockstore_reader_t *store = NULL;
+		
+		if([[url scheme] isEqualToString:@"device"])
+		{
+			MACaptureDevice *device = [[[PCAPController sharedPCAPController]
+										deviceList] objectForKey:
+									   [url lastPathComponent]];
+			
+			_mergeLive = YES;
+			[_mergeSources addObject:[[url absoluteString] md5]];
+			if(device)
+				[_mergeDataLinks addObject:
+				 [NSNumber numberWithInt:[device dataLink]]];
+		}
+		
+		/* Compressed spool files. */
+		else if(ma_blockstore_is_blockstore([[url path] fileSystemRepresentation]) &&
+				(store = ma_blockstore_reader_open([[url path]
+													fileSystemRepresentation])))
+		{
+			[_mergeSources addObject:[url path]];
+			[_mergeDataLinks addObject:[NSNumber numberWithInt:
+										ma_blockstore_reader_link_type(store)]];
+		}
+		else
+		{
+			if(!(session = pcap_open_offline_with_tstamp_precision(
+							[[url path] UTF8String], PCAP_TSTAMP_PRECISION_NANO,
+							errbuf)))
+			{
+				NSDictionary *userInfo =
+				[NSDictionary dictionaryWithObject:
+				 [NSString stringWithUTF8String:errbuf]
+											forKey:NSLocalizedDescriptionKey];
+				
+				if(outError)
+					*outError = [NSError errorWithDomain:NSCocoaErrorDomain
+													code:NSFileReadUnknownError
+												userInfo:userInfo];
+				for(NSValue *opened in sessions)
+					if([opened pointerValue])
+						pcap_close([opened pointerValue]);
+				for(NSValue *opened in stores)
+					ma_blockstore_reader_close([opened pointerValue]);
+				[self release];
+				return nil;
+			}
+			
+			[_mergeSources addObject:[url path]];
+			[_mergeDataLinks addObject:[NSNumber numberWithInt:
+										pcap_datalink(session)]];
+		}
+		
+		[sessions addObject:[NSValue valueWithPointer:session]];
+		[stores addObject:[NSValue valueWithPointer:store]];
+		[names addObject:[url lastPathComponent]];
+		[keys addObject:([[url scheme] isEqualToString:@"device"] ?
+						 [url lastPathComponent] : [url path])];
+	}
+	
+	/*
+	 * Sources of different link types can only be saved as pcapng, and
+	 * are not spooled.
+	 */
+	if([_mergeDataLinks count] > 0)
+		_dataLink = [[_mergeDataLinks objectAtIndex:0] intValue];
+	for(NSNumber *dataLink in _mergeDataLinks)
+		if([dataLink intValue] != _dataLink)
+			_mixedDataLinks = YES;
+	
+	/* Only savefiles can be made to wait for the document to catch up. */
+	_throttled = !_mergeLive;
+	_merge = ma_merge_create([sources count], MAMergeMaxPending,
+							 (_mergeLive ? MAMergeMaxSkew : 0),
+							 ma_merge_emit, self);
+	
+	/* Overlapping taps see the same packets, catch them in merge order. */
+	_dedupMode = ma_dedup_mode_from_string([[NSUserDefaults standardUserDefaults]
+											stringForKey:MADedupModeKey]);
+	if(_dedupMode != MA_DEDUP_OFF)
+	{
+		NSInteger window = [[NSUserDefaults standardUserDefaults]
+							integerForKey:MADedupWindowKey];
+		
+		_dedup = ma_dedup_create(MADedupTableSize,
+								 (int64_t)(window > 0 ? window : MADedupWindow)*
+								 MA_NSEC_PER_MSEC);
+	}
+	
+	mergeURL = [NSURL URLWithString:
+				[[NSString stringWithFormat:@"merge:///%@",
+				  [names componentsJoinedByString:@"+"]]
+				 stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding]];
+	[self setFileURL:mergeURL];
+	[self setFileType:MADocumentTypeMerged];
+	_deviceUUID = [[[mergeURL absoluteString] md5] copy];
+	_pipeline = [[MAPipelineStats sharedPipelineStats]
+				 pipelineForSource:[@"merge:" stringByAppendingString:
+									[keys componentsJoinedByString:@"+"]]];
+	
+	if(_merge == NULL)
+	{
+		for(NSValue *opened in sessions)
+			if([opened pointerValue])
+				pcap_close([opened pointerValue]);
+		for(NSValue *opened in stores)
+			ma_blockstore_reader_close([opened pointerValue]);
+		[self release];
+		return nil;
+	}
+	
+	/* One reader per savefile, each source finishes on its own. */
+	for(i = 0; i < [sessions count]; i++)
+	{
+		pcap_t *session = [[sessions objectAtIndex:i] pointerValue];
+		ma_blockstore_reader_t *store = [[stores objectAtIndex:i] pointerValue];
+		
+		if(store)
+		{
+			dispatch_group_async(_readers, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+				ma_merge_reader_t reader = { self, i, NULL,
+					ma_blockstore_reader_link_type(store), 1, NO };
+				struct pcap_pkthdr hdr;
+				const u_char *data;
+				NSUInteger n;
+				
+				for(n = 0; n < ma_blockstore_reader_count(store) &&
+					!reader.stopped; n++)
+					if(ma_blockstore_reader_packet(store, n, &hdr, &data))
+						ma_merge_pcap_callback((u_char *)&reader, &hdr, data);
+				ma_blockstore_reader_close(store);
+				ma_merge_finish(_merge, i);
+				
+				dispatch_async(dispatch_get_main_queue(), ^{
+					[_docController requestFileTimerUpdate:self];
+				});
+			});
+			continue;
+		}
+		
+		if(session == NULL)
+			continue;
+		
+		dispatch_group_async(_readers, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+			ma_merge_reader_t reader = { self, i, session,
+				pcap_datalink(session), 1, NO };
+			
+			pcap_loop(session, -1, ma_merge_pcap_callback, (u_char *)&reader);
+			pcap_close(session);
+			ma_merge_finish(_merge, i);
+			
+			dispatch_async(dispatch_get_main_queue(), ^{
+				[_docController requestFileTimerUpdate:self];
+			});
+		});
+	}
 	
 	return self;
 }
 
 - (void)dealloc
 {
+	/* Nobody can be pushing now, what the merge still holds is dropped. */
+	[self stopReaders];
+	ma_merge_destroy(_merge, ma_merge_discard);
+	ma_dedup_destroy(_dedup);
+	if(_session)
+		pcap_close(_session);
+	[_mergeSources release];
+	[_mergeDataLinks release];
+	
+	/*
+	 * The spool only backs the document, saving copies what is kept out
+	 * of it; don't leave Application Support filling up behind us.
+	 */
+	ma_spool_discard(_spool);
+	[_spoolPath release];
+	/*
+	 * Readers are gone, hand back the slots still held by the buffer; a
+	 * semaphore can't be released below the value it was created with.
+	 */
+	if(_throttled)
+	{
+		NSUInteger i;
+		
+		for(i = 0; i < [_buffer count]; i++)
+			dispatch_semaphore_signal(_bufferSlots);
+	}
 	[_buffer release];
+	dispatch_release(_bufferSlots);
+	dispatch_release(_readers);
 	[_packets release];
+	[_spillFile release];
 	[_deviceUUID release];
+	ma_hierarchy_destroy(_hierarchy);
+	ma_talkers_destroy(_talkers);
+	ma_cardinality_destroy(_cardinality);
+	ma_iograph_destroy(_ioGraph);
+	ma_burst_destroy(_bursts);
+	ma_tcpa_destroy(_tcpAnalysis);
 	[super dealloc];
 }
 
 #pragma mark - NSDocument Override methods
 
+- (void)close
+{
+	/* Readers hold on to us, they have to let go for the document to. */
+	[self stopReaders];
+	[super close];
+}
+
 - (void)makeWindowControllers
 {
 	MAWindowController *winController;
@@ -112,11 +463,60 @@ ma_local_pcap_callback(u_char *obj, const struct pcap_pkthdr *hdr,
 			ofType:(NSString *)typeName
 			 error:(NSError **)outError
 {
-	if([typeName isEqualToString:MADocumentTypePCAPSavefile])
+	int64_t first;
+	int64_t last;
+	
+	if(![self writePacketsToURL:absoluteURL ofType:typeName error:outError])
+		return NO;
+	
+	/* The IO graph goes along with the capture, it is costly to rebuild. */
+	if(_ioGraph && ma_iograph_range(_ioGraph, &first, &last) &&
+	   !ma_iograph_write(_ioGraph, [[[absoluteURL path]
+									 stringByAppendingPathExtension:@"iograph"]
+									fileSystemRepresentation]))
+		NSLog(@"Could not write the IO graph for %@", [absoluteURL path]);
+	
+	return YES;
+}
+
+- (BOOL)writePacketsToURL:(NSURL *)absoluteURL
+				   ofType:(NSString *)typeName
+					error:(NSError **)outError
+{
+	/*
+	 * Everything is on disk already, just make sure and copy it over. If
+	 * the writer ever fell behind the files have gaps, and once rotation
+	 * removed or compressed one the oldest packets aren't in a savefile,
+	 * so dump from memory then.
+	 */
+	if([typeName isEqualToString:MADocumentTypePCAPSavefile] && _spool &&
+	   [self spoolIsComplete])
+	{
+		if(![self copySpoolToPath:[absoluteURL path]])
+		{
+			if(outError)
+				*outError = [NSError errorWithDomain:NSCocoaErrorDomain
+												code:NSFileWriteUnknownError
+											userInfo:nil];
+			return NO;
+		}
+		
+		return YES;
+	}
+	
+	else if([typeName isEqualToString:MADocumentTypePCAPSavefile])
 	{
 		BOOL freeSession = NO;
 		pcap_t *session = NULL;
 		pcap_dumper_t *dumper;
+		int dataLink;
+		
+		if(![self packetsDataLink:&dataLink])
+		{
+			if(outError)
+				*outError = ma_mixed_link_error();
+			return NO;
+		}
 		
 		if([[[self fileURL] scheme] isEqualToString:@"device"])
 		{
@@ -128,8 +528,9 @@ ma_local_pcap_callback(u_char *obj, const struct pcap_pkthdr *hdr,
 			if(device == nil)
 				return NO;
 			
-			if(!(session = pcap_open_dead([device dataLink],
-										  [device maxPacketSize])))
+			if(!(session = pcap_open_dead_with_tstamp_precision(
+							[device dataLink], [device maxPacketSize],
+							PCAP_TSTAMP_PRECISION_NANO)))
 			{
 				/* XXX Error handling. */
 				return NO;
@@ -137,6 +538,18 @@ ma_local_pcap_callback(u_char *obj, const struct pcap_pkthdr *hdr,
 			freeSession = YES;
 		}
 		
+		/*
+		 * Merged documents and pcapng files have no pcap session of their
+		 * own, they get one for the link type their packets share.
+		 */
+		else if(_deviceType == PCAP_MERGED || _session == NULL)
+		{
+			if(!(session = pcap_open_dead_with_tstamp_precision(dataLink, 65535,
+							PCAP_TSTAMP_PRECISION_NANO)))
+				return NO;
+			freeSession = YES;
+		}
+		
 		else if([[[self fileURL] scheme] isEqualToString:@"file"] && _session)
 		{
 			session = _session;
@@ -163,9 +576,172 @@ ma_local_pcap_callback(u_char *obj, const struct pcap_pkthdr *hdr,
 		return YES;
 	}
 	
+	else if([typeName isEqualToString:MADocumentTypePcapng])
+		return [self writePcapngToURL:absoluteURL error:outError];
+	
+	/* Saving is archiving, compress for size. */
+	else if([typeName isEqualToString:MADocumentTypeBlockStore])
+	{
+		ma_blockstore_writer_t *writer;
+		BOOL ok = YES;
+		int dataLink;
+		
+		if(![self packetsDataLink:&dataLink])
+		{
+			if(outError)
+				*outError = ma_mixed_link_error();
+			return NO;
+		}
+		
+		if(!(writer = ma_blockstore_writer_open([[absoluteURL path]
+												 fileSystemRepresentation],
+												MA_BLOCKSTORE_ARCHIVE,
+												dataLink, 65535)))
+		{
+			if(outError)
+				*outError = [NSError errorWithDomain:NSPOSIXErrorDomain
+												code:errno
+											userInfo:nil];
+			return NO;
+		}
+		
+		for(MAPacket *packet in _packets)
+			if(!(ok = ma_blockstore_writer_packet(writer, [packet header],
+												  [packet bytes])))
+				break;
+		
+		if(!ma_blockstore_writer_close(writer))
+			ok = NO;
+		
+		if(!ok && outError)
+			*outError = [NSError errorWithDomain:NSCocoaErrorDomain
+											code:NSFileWriteUnknownError
+										userInfo:nil];
+		return ok;
+	}
+	
 	return NO;
 }
 
+/*
+ * The link type all our packets share, NO if they come from links of more
+ * than one type. With no packets it is the document's own.
+ */
+- (BOOL)packetsDataLink:(int *)dataLink
+{
+	MAPacket *first = [_packets count] ? [_packets objectAtIndex:0] : nil;
+	
+	*dataLink = (first ? [first dataLink] : _dataLink);
+	for(MAPacket *packet in _packets)
+		if([packet dataLink] != *dataLink)
+			return NO;
+	
+	return YES;
+}
+
+/*
+ * Write our packets out as pcapng, with an interface block for each
+ * device and link type we have packets from and, for live devices, a
+ * statistics block with the counters as they stand now.
+ */
+- (BOOL)writePcapngToURL:(NSURL *)absoluteURL error:(NSError **)outError
+{
+	NSDictionary *deviceList = [[PCAPController sharedPCAPController] deviceList];
+	NSDictionary *captureStats = [[PCAPController sharedPCAPController]
+								  captureStats];
+	NSMutableDictionary *devices = [NSMutableDictionary dictionary];
+	NSMutableDictionary *interfaces = [NSMutableDictionary dictionary];
+	ma_pcapng_writer_t *writer;
+	struct timeval now;
+	BOOL ok = YES;
+	
+	if(!(writer = ma_pcapng_writer_open([[absoluteURL path] UTF8String],
+										[MAWindowTitle UTF8String])))
+	{
+		if(outError)
+			*outError = [NSError errorWithDomain:NSPOSIXErrorDomain
+											code:errno
+										userInfo:nil];
+		return NO;
+	}
+	
+	/* Packets only know their device by the UUID of its document. */
+	for(NSString *name in deviceList)
+	{
+		NSString *url = [NSString stringWithFormat:@"device:///dev/%@", name];
+		
+		[devices setObject:name forKey:[url md5]];
+	}
+	
+	for(MAPacket *packet in _packets)
+	{
+		NSString *key = [NSString stringWithFormat:@"%@/%d",
+						 [packet deviceUUID], [packet dataLink]];
+		NSNumber *interface = [interfaces objectForKey:key];
+		
+		if(interface == nil)
+		{
+			NSString *name = [devices objectForKey:[packet deviceUUID]];
+			NSString *description = [[deviceList objectForKey:name]
+									 deviceDescription];
+			NSInteger ifId;
+			
+			if(name == nil)
+				name = [[self fileURL] lastPathComponent];
+			
+			ifId = ma_pcapng_writer_add_interface(writer, [packet dataLink],
+												  65535, [name UTF8String],
+												  [description UTF8String]);
+			if(ifId < 0)
+			{
+				ok = NO;
+				break;
+			}
+			
+			interface = [NSNumber numberWithInteger:ifId];
+			[interfaces setObject:interface forKey:key];
+		}
+		
+		if(!ma_pcapng_writer_packet(writer, [interface unsignedIntegerValue],
+									[packet header], [packet bytes]))
+		{
+			ok = NO;
+			break;
+		}
+	}
+	
+	gettimeofday(&now, NULL);
+	for(NSString *key in interfaces)
+	{
+		NSString *uuid = [[key pathComponents] objectAtIndex:0];
+		NSString *name = [devices objectForKey:uuid];
+		MACaptureStats *stats;
+		ma_pcapng_stats_t isb;
+		
+		if(!ok || name == nil || !(stats = [captureStats objectForKey:name]))
+			continue;
+		
+		isb.received = [stats kernelReceived];
+		isb.interfaceDropped = [stats interfaceDropped];
+		isb.kernelDropped = [stats kernelDropped];
+		isb.delivered = [stats appIngested];
+		ok = ma_pcapng_writer_stats(writer,
+									[[interfaces objectForKey:key]
+									 unsignedIntegerValue],
+									ma_timeval_ns(&now), &isb);
+	}
+	
+	if(!ma_pcapng_writer_close(writer))
+		ok = NO;
+	
+	if(!ok && outError)
+		*outError = [NSError errorWithDomain:NSCocoaErrorDomain
+										code:NSFileWriteUnknownError
+									userInfo:nil];
+	
+	return ok;
+}
+
 - (BOOL)readFromURL:(NSURL *)absoluteURL
 			 ofType:(NSString *)typeName
 			  error:(NSError **)outError
@@ -174,7 +750,10 @@ ma_local_pcap_callback(u_char *obj, const struct pcap_pkthdr *hdr,
 	{
 		/* Don't need to do much since the device takes care of it. */
 		_deviceType = PCAP_DEVICE;
+		_packetId = 1;
 		_deviceUUID = [[[absoluteURL absoluteString] md5] copy];
+		_pipeline = [[MAPipelineStats sharedPipelineStats]
+					 pipelineForSource:[absoluteURL lastPathComponent]];
 		[[[MADocumentController sharedDocumentController]
 		  deviceDocuments] setObject:self forKey:_deviceUUID];
 		return YES;
@@ -183,9 +762,12 @@ ma_local_pcap_callback(u_char *obj, const struct pcap_pkthdr *hdr,
 	else if([typeName isEqualToString:MADocumentTypePCAPSavefile])
 	{
 		_deviceType = PCAP_SAVEFILE;
+		_throttled = YES;
 		char errbuf[PCAP_ERRBUF_SIZE];
 		
-		if(!(_session = pcap_open_offline([[absoluteURL path] UTF8String], errbuf)))
+		if(!(_session = pcap_open_offline_with_tstamp_precision(
+							[[absoluteURL path] UTF8String],
+							PCAP_TSTAMP_PRECISION_NANO, errbuf)))
 		{
 			/* XXX Needs detailed error checking. */
 			return NO;
@@ -194,13 +776,97 @@ ma_local_pcap_callback(u_char *obj, const struct pcap_pkthdr *hdr,
 		_packetId = 1;
 		_dataLink = pcap_datalink(_session);
 		_deviceUUID = [[[absoluteURL absoluteString] md5] copy];
-		dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+		_pipeline = [[MAPipelineStats sharedPipelineStats]
+					 pipelineForSource:[absoluteURL path]];
+		dispatch_group_async(_readers, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
 			pcap_loop(_session, -1, ma_local_pcap_callback, (voidPtr)self);
 		});
 		
 		return YES;
 	}
 	
+	else if([typeName isEqualToString:MADocumentTypePcapng])
+	{
+		ma_pcapng_reader_t *reader;
+		
+		if(!(reader = ma_pcapng_reader_open([[absoluteURL path] UTF8String])))
+		{
+			if(outError)
+				*outError = [NSError errorWithDomain:NSCocoaErrorDomain
+												code:NSFileReadCorruptFileError
+											userInfo:nil];
+			return NO;
+		}
+		
+		_deviceType = PCAP_SAVEFILE;
+		_throttled = YES;
+		_packetId = 1;
+		if(ma_pcapng_reader_interface_count(reader) > 0)
+			_dataLink = ma_pcapng_reader_interface(reader, 0)->linkType;
+		_deviceUUID = [[[absoluteURL absoluteString] md5] copy];
+		_pipeline = [[MAPipelineStats sharedPipelineStats]
+					 pipelineForSource:[absoluteURL path]];
+		
+		/* Each packet keeps the link type of the interface it came in on. */
+		dispatch_group_async(_readers, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+			ma_pcapng_packet_t packet;
+			NSUInteger i;
+			
+			for(i = 0; i < ma_pcapng_reader_count(reader) && !_stopReading; i++)
+			{
+				if(!ma_pcapng_reader_packet(reader, i, &packet))
+					continue;
+				
+				[self newPacket:packet.data
+					 withHeader:&packet.hdr
+					   dataLink:ma_pcapng_reader_interface(reader,
+														   packet.interface)->linkType];
+			}
+			
+			ma_pcapng_reader_close(reader);
+		});
+		
+		return YES;
+	}
+	
+	else if([typeName isEqualToString:MADocumentTypeBlockStore])
+	{
+		ma_blockstore_reader_t *reader;
+		
+		if(!(reader = ma_blockstore_reader_open([[absoluteURL path]
+												 fileSystemRepresentation])))
+		{
+			if(outError)
+				*outError = [NSError errorWithDomain:NSCocoaErrorDomain
+												code:NSFileReadCorruptFileError
+											userInfo:nil];
+			return NO;
+		}
+		
+		_deviceType = PCAP_SAVEFILE;
+		_throttled = YES;
+		_packetId = 1;
+		_dataLink = ma_blockstore_reader_link_type(reader);
+		_deviceUUID = [[[absoluteURL absoluteString] md5] copy];
+		_pipeline = [[MAPipelineStats sharedPipelineStats]
+					 pipelineForSource:[absoluteURL path]];
+		
+		dispatch_group_async(_readers, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+			struct pcap_pkthdr hdr;
+			const u_char *data;
+			NSUInteger i;
+			
+			for(i = 0; i < ma_blockstore_reader_count(reader) && !_stopReading;
+				i++)
+				if(ma_blockstore_reader_packet(reader, i, &hdr, &data))
+					[self newPacket:data withHeader:&hdr];
+			
+			ma_blockstore_reader_close(reader);
+		});
+		
+		return YES;
+	}
+	
 	return NO;
 }
 
@@ -229,12 +895,36 @@ ma_local_pcap_callback(u_char *obj, const struct pcap_pkthdr *hdr,
 
 - (void)addBufferObject:(MAPacket *)object
 {
+	/* Tagged before it can be shown, a marked duplicate would look resent. */
+	if(_tcpAnalysis && ![object isDuplicate])
+		[object setTcpAnalysis:ma_tcpa_packet(_tcpAnalysis, [object dataLink],
+											  [object header], [object bytes])];
+	
 	@synchronized(_buffer)
 	{
 		[_buffer addObject:object];
 	}
 	_packetsCaptured++;
 	_bytesCaptured += ((struct pcap_pkthdr *)[object header])->caplen;
+	_packetsEstimated += [object weight];
+	_bytesEstimated += (uint64_t)[object weight]*[object header]->len;
+	
+	/* Classify it now, so the statistics never need a rescan. */
+	if(_hierarchy)
+		ma_hierarchy_add_packet(_hierarchy, [object dataLink], [object bytes],
+								[object header]->caplen);
+	if(_talkers)
+		ma_talkers_packet(_talkers, [object dataLink], [object header],
+						  [object bytes], [object weight]);
+	if(_cardinality)
+		ma_cardinality_packet(_cardinality, [object dataLink], [object header],
+							  [object bytes]);
+	if(_ioGraph)
+		ma_iograph_packet(_ioGraph, [object dataLink], [object header],
+						  [object bytes], [object weight]);
+	if(_bursts)
+		ma_burst_packet(_bursts, [object dataLink], [object header],
+						[object bytes], [object weight]);
 }
 
 - (void)removeBuffer:(NSSet *)objects
@@ -285,11 +975,53 @@ ma_local_pcap_callback(u_char *obj, const struct pcap_pkthdr *hdr,
 - (void)newPacket:(const u_char *)data
 	   withHeader:(const struct pcap_pkthdr *)header
 {
-	MAPacket *packet = [[MAPacket alloc] initWithData:data
-										   withHeader:header
-											   withId:_packetId++
-											 withUUID:_deviceUUID
-										 withDataLink:_dataLink];
+	[self newPacket:data withHeader:header dataLink:_dataLink];
+}
+
+- (void)newPacket:(const u_char *)data
+	   withHeader:(const struct pcap_pkthdr *)header
+		 dataLink:(int)dataLink
+{
+	uint64_t startedAt;
+	MAPacket *packet;
+	
+	/*
+	 * A savefile can be read far faster than we can drain it, and nothing
+	 * is lost by waiting, so block the reader instead of shedding packets.
+	 */
+	if(_throttled)
+	{
+		dispatch_semaphore_wait(_bufferSlots, DISPATCH_TIME_FOREVER);
+		
+		/* Closing, pass the wakeup on to anyone else waiting. */
+		if(_stopReading)
+		{
+			dispatch_semaphore_signal(_bufferSlots);
+			if(_session)
+				pcap_breakloop(_session);
+			return;
+		}
+	}
+	
+	startedAt = ma_pipeline_now();
+	packet = [[MAPacket alloc] initWithData:data
+								 withHeader:header
+									 withId:_packetId++
+								   withUUID:_deviceUUID
+							   withDataLink:dataLink];
+	
+	if(packet == nil)
+	{
+		ma_pipeline_drop(_pipeline, MA_STAGE_PACKET, 1);
+		if(_throttled)
+			dispatch_semaphore_signal(_bufferSlots);
+		return;
+	}
+	
+	[packet setPipeline:_pipeline];
+	[packet setStagedAt:ma_pipeline_now()];
+	ma_pipeline_record(_pipeline, MA_STAGE_PACKET, startedAt,
+					   [packet stagedAt], 1, header->caplen);
 	
 	[self addBufferObject:packet];
 	[packet release];
@@ -303,10 +1035,361 @@ ma_local_pcap_callback(u_char *obj, const struct pcap_pkthdr *hdr,
 	}
 }
 
+#pragma mark - Memory budget
+
+/*
+ * Keep the bytes of at most _memoryBudget worth of packets in memory.
+ * Past that the oldest are spilled to a file, an arena at a time, until
+ * we are back under three quarters of it. The packets themselves stay
+ * in _packets and find their bytes through the file's mapping.
+ */
+- (void)enforceMemoryBudget
+{
+	NSMutableArray *batch;
+	NSUInteger target;
+	NSUInteger bytes = 0;
+	NSUInteger count = [_packets count];
+	
+	if(_spilling || _spillFailed || _residentBytes <= _memoryBudget)
+		return;
+	
+	if(_spillFile == nil &&
+	   !(_spillFile = [[MASpillFile alloc] initInDirectory:NSTemporaryDirectory()]))
+	{
+		NSLog(@"%@: no spill file, memory budget not enforced",
+			  [self displayName]);
+		_spillFailed = YES;
+		return;
+	}
+	
+	target = MIN(_residentBytes-_memoryBudget*3/4, MASpillArenaSize);
+	batch = [NSMutableArray array];
+	while(_spillCursor < count && bytes < target)
+	{
+		MAPacket *packet = [_packets objectAtIndex:_spillCursor++];
+		
+		if([packet isSpilled])
+			continue;
+		
+		[batch addObject:packet];
+		bytes += [packet length];
+	}
+	
+	if([batch count] == 0)
+		return;
+	
+	_spilling = [_spillFile spillPackets:batch completion:^(NSUInteger freed) {
+		_residentBytes -= MIN(freed, _residentBytes);
+		_spilling = NO;
+		if(freed == 0)
+			_spillFailed = YES;
+		[self enforceMemoryBudget];
+	}];
+	
+	if(!_spilling)
+		_spillFailed = YES;
+}
+
+#pragma mark - Write-behind
+
+/*
+ * Start writing this capture to a file under Application Support as it
+ * arrives, unless the user turned that off. Only tried once.
+ */
+- (BOOL)openSpoolWithDataLink:(int)dataLink
+{
+	NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+	ma_spool_rotation_t rotation;
+	NSInteger megabytes;
+	NSInteger files;
+	NSDateFormatter *formatter;
+	NSString *directory;
+	NSString *name;
+	
+	if(_spoolTried)
+		return (_spool != NULL);
+	_spoolTried = YES;
+	
+	if([defaults objectForKey:MAWriteBehindKey] &&
+	   ![defaults boolForKey:MAWriteBehindKey])
+		return NO;
+	
+	/* A pcap file has one link type, ours don't agree. */
+	if(_mixedDataLinks)
+	{
+		NSLog(@"Not spooling %@, its sources have different link types",
+			  [[self fileURL] lastPathComponent]);
+		return NO;
+	}
+	
+	/* mahelper is recording the device, we only see a sample of it. */
+	if(_deviceType == PCAP_DEVICE &&
+	   [[[[PCAPController sharedPCAPController] deviceList]
+		 objectForKey:[[self fileURL] lastPathComponent]] recordPath])
+		return NO;
+	
+	directory = [[[NSSearchPathForDirectoriesInDomains(NSApplicationSupportDirectory,
+													   NSUserDomainMask, YES)
+				   lastObject] stringByAppendingPathComponent:MAWindowTitle]
+				 stringByAppendingPathComponent:MASpoolDirectoryName];
+	[[NSFileManager defaultManager] createDirectoryAtPath:directory
+							  withIntermediateDirectories:YES
+											   attributes:nil
+													error:NULL];
+	
+	formatter = [[NSDateFormatter alloc] init];
+	[formatter setDateFormat:@"yyyyMMdd-HHmmss"];
+	name = [NSString stringWithFormat:@"%@-%@.pcap",
+			[[[self fileURL] lastPathComponent] stringByDeletingPathExtension],
+			[formatter stringFromDate:[NSDate date]]];
+	[formatter release];
+	
+	/*
+	 * tcpdump's -C, -G and -W. Write-behind is on unless turned off, so
+	 * without settings of its own a spool is a ring of MASpoolDefaultFiles
+	 * files of MASpoolDefaultMegabytes rather than growing for as long as
+	 * the capture runs.
+	 */
+	megabytes = MASpoolDefaultMegabytes;
+	if([defaults objectForKey:MASpoolRotateMegabytesKey])
+		megabytes = [defaults integerForKey:MASpoolRotateMegabytesKey];
+	files = MASpoolDefaultFiles;
+	if([defaults objectForKey:MASpoolRotateFilesKey])
+		files = [defaults integerForKey:MASpoolRotateFilesKey];
+	
+	rotation.maxBytes = (uint64_t)megabytes << 20;
+	rotation.maxDuration = (int64_t)[defaults integerForKey:
+									 MASpoolRotateSecondsKey]*MA_NSEC_PER_SEC;
+	rotation.maxFiles = (NSUInteger)files;
+	rotation.compress = [defaults boolForKey:MASpoolCompressKey];
+	
+	_spoolPath = [[directory stringByAppendingPathComponent:name] retain];
+	if(!(_spool = ma_spool_open([_spoolPath fileSystemRepresentation],
+								dataLink, 65535, &rotation)))
+		NSLog(@"Could not open %@ for writing", _spoolPath);
+	
+	return (_spool != NULL);
+}
+
+- (BOOL)spoolIsComplete
+{
+	return ma_spool_complete(_spool);
+}
+
+/*
+ * Copy the spool to path, up to where it was synced: the writer keeps
+ * going while we copy, and what it wrote after the sync may be a record
+ * cut in half. The files are joined, less the pcap header of all but
+ * the first.
+ */
+- (BOOL)copySpoolToPath:(NSString *)path
+{
+	u_char *buffer;
+	ma_spool_file_t file;
+	char source[MAXPATHLEN];
+	NSUInteger i;
+	BOOL ok;
+	int out;
+	
+	if(!ma_spool_sync(_spool))
+		return NO;
+	
+	if(!(buffer = malloc(MASpoolBufferSize)))
+		return NO;
+	if((out = open([path fileSystemRepresentation],
+				   O_WRONLY|O_CREAT|O_TRUNC, 0644)) == -1)
+	{
+		free(buffer);
+		return NO;
+	}
+	
+	ok = YES;
+	for(i = 0; ok && ma_spool_file(_spool, i, &file); i++)
+	{
+		uint64_t length = ma_spool_synced_bytes(_spool, file.sequence);
+		off_t offset = (i > 0 ? MA_SPOOL_HEADER_SIZE : 0);
+		int in;
+		
+		ma_spool_file_path(_spool, file.sequence, source, sizeof(source));
+		if((in = open(source, O_RDONLY)) == -1)
+		{
+			ok = NO;
+			break;
+		}
+		
+		while(ok && (uint64_t)offset < length)
+		{
+			size_t n = (size_t)MIN(length-offset, MASpoolBufferSize);
+			
+			ok = (ma_pread_all(in, buffer, n, offset) &&
+				  ma_write_all(out, buffer, n));
+			offset += n;
+		}
+		close(in);
+	}
+	
+	if(close(out) == -1)
+		ok = NO;
+	if(!ok)
+		unlink([path fileSystemRepresentation]);
+	free(buffer);
+	
+	return ok;
+}
+
+/*
+ * The spool files holding packets from start to end, in nanoseconds,
+ * oldest first. What has been appended so far is synced first so the
+ * file being written can be opened too.
+ */
+- (NSArray *)spoolURLsFrom:(int64_t)start to:(int64_t)end
+{
+	NSMutableArray *urls = [NSMutableArray array];
+	ma_spool_file_t file;
+	char path[MAXPATHLEN];
+	NSUInteger i;
+	
+	if(_spool == NULL)
+		return urls;
+	
+	ma_spool_sync(_spool);
+	for(i = 0; ma_spool_file(_spool, i, &file); i++)
+	{
+		if(file.packets == 0 || file.last < start || file.first > end)
+			continue;
+		
+		ma_spool_file_path(_spool, file.sequence, path, sizeof(path));
+		[urls addObject:[NSURL fileURLWithPath:
+						 [NSString stringWithUTF8String:path]]];
+	}
+	
+	return urls;
+}
+
+#pragma mark - Merging
+
+/*
+ * A live packet from one of the devices we merge, we take our own copy
+ * since the device's document numbers its packets too. Returns NO if the
+ * device isn't one of ours.
+ */
+- (BOOL)mergePacket:(MAPacket *)packet
+{
+	NSUInteger source = [_mergeSources indexOfObject:[packet deviceUUID]];
+	MAPacket *copy;
+	
+	if(source == NSNotFound || !(copy = [packet copy]))
+		return NO;
+	
+	if(!ma_merge_push(_merge, source, [copy timestamp], copy, NO))
+	{
+		[copy release];
+		return NO;
+	}
+	
+	return YES;
+}
+
+/* Called by the merge, in timestamp order, with a retained packet. */
+- (void)mergedPacket:(MAPacket *)packet
+{
+	if(_stopReading)
+	{
+		[packet release];
+		return;
+	}
+	
+	if(_dedup && ma_dedup_packet(_dedup, [packet dataLink], [packet header],
+								 [packet bytes]))
+	{
+		_duplicates++;
+		if(_dedupMode == MA_DEDUP_DROP)
+		{
+			[packet release];
+			return;
+		}
+		[packet setWeight:0];
+	}
+	
+	/* Runs with the merge locked, so a stop has to get us out of here. */
+	if(_throttled)
+	{
+		dispatch_semaphore_wait(_bufferSlots, DISPATCH_TIME_FOREVER);
+		if(_stopReading)
+		{
+			dispatch_semaphore_signal(_bufferSlots);
+			[packet release];
+			return;
+		}
+	}
+	
+	[self addBufferObject:packet];
+	[packet release];
+	
+	if(_throttled)
+	{
+		dispatch_async(dispatch_get_main_queue(), ^{
+			[_docController requestFileTimerUpdate:self];
+		});
+	}
+}
+
+/*
+ * Stop the readers feeding this document and wait for them to return.
+ * A reader blocked on the buffer is woken and passes the wakeup on, one
+ * blocked on its share of the merge is woken by the cancel; either way it
+ * sees the stop and gives up.
+ */
+- (void)stopReaders
+{
+	_stopReading = YES;
+	if(_session)
+		pcap_breakloop(_session);
+	dispatch_semaphore_signal(_bufferSlots);
+	if(_merge)
+		ma_merge_cancel(_merge);
+	dispatch_group_wait(_readers, DISPATCH_TIME_FOREVER);
+}
+
+/* Let go of anything older than the allowed skew, even from quiet devices. */
+- (void)advanceMerge
+{
+	struct timeval now;
+	
+	gettimeofday(&now, NULL);
+	ma_merge_advance(_merge, (uint64_t)ma_timeval_ns(&now));
+}
+
+- (void)flushMerge
+{
+	ma_merge_flush(_merge);
+}
+
+- (BOOL)isLiveMerge
+{
+	return (_deviceType == PCAP_MERGED && _mergeLive);
+}
+
+- (NSInteger)updatePacketsWithSortDescriptors:(NSArray *)descriptors
+{
+	return [self updatePacketsWithSortDescriptors:descriptors holdingBack:0];
+}
+
+/*
+ * Move the buffered packets into the document in descriptors order. With
+ * a skew, packets captured less than skew ns ago stay buffered, so one
+ * that a slower fanout worker delivers late still sorts in ahead of them.
+ * descriptors must order by capture time for that to hold.
+ */
 - (NSInteger)updatePacketsWithSortDescriptors:(NSArray *)descriptors
+								  holdingBack:(uint64_t)skew
 {
 	NSUInteger bufferCount;
+	NSUInteger bufferBytes = 0;
 	NSArray *newPackets;
+	MAPacket *previous = [_packets lastObject];
+	uint64_t startedAt = ma_pipeline_now();
+	BOOL recorded = NO;
 	
 	@synchronized(_buffer)
 	{
@@ -317,8 +1400,84 @@ ma_local_pcap_callback(u_char *obj, const struct pcap_pkthdr *hdr,
 		newPackets = [_buffer sortedArrayUsingDescriptors:descriptors];
 		[_buffer removeAllObjects];
 		
+		if(skew > 0)
+		{
+			struct timeval now;
+			int64_t watermark;
+			
+			gettimeofday(&now, NULL);
+			watermark = ma_timeval_ns(&now)-(int64_t)skew;
+			while(bufferCount > 0 &&
+				  [[newPackets objectAtIndex:bufferCount-1] timestamp] > watermark)
+				bufferCount--;
+			
+			if(bufferCount < [newPackets count])
+			{
+				NSRange held = NSMakeRange(bufferCount,
+										   [newPackets count]-bufferCount);
+				
+				[_buffer addObjectsFromArray:[newPackets subarrayWithRange:held]];
+				newPackets = [newPackets subarrayWithRange:
+							  NSMakeRange(0, bufferCount)];
+			}
+			if(bufferCount == 0)
+				return 0;
+		}
+	}
+	
+	/* Let a blocked savefile reader carry on. */
+	if(_throttled)
+	{
+		NSUInteger i;
+		for(i = 0; i < bufferCount; i++)
+			dispatch_semaphore_signal(_bufferSlots);
+	}
+	
+	/* mahelper is writing this device to disk, we only get a sample. */
+	if(_deviceType == PCAP_DEVICE)
+		recorded = ([[[[PCAPController sharedPCAPController] deviceList]
+					  objectForKey:[[self fileURL] lastPathComponent]]
+					 recordPath] != nil);
+	
+	for(MAPacket *packet in newPackets)
+	{
+		NSInteger length = [packet length];
+		
+		/*
+		 * Helper ids are only unique per capture worker; number packets
+		 * in the order they were sorted into instead. A sample of a
+		 * recording keeps its place in the worker's file, which is what
+		 * the helper's sequence counts.
+		 */
+		if(recorded)
+			[packet setNumber:MA_FANOUT_SEQUENCE([packet captureId])];
+		else if(_deviceType != PCAP_SAVEFILE)
+			[packet setNumber:_packetId++];
+		
+		/* Relative and delta times are plain nanosecond arithmetic. */
+		if(previous == nil)
+			_firstTimestamp = [packet timestamp];
+		[packet setRelativeTime:[packet timestamp]-_firstTimestamp];
+		[packet setDeltaTime:(previous ? [packet timeSince:previous] : 0)];
+		previous = packet;
+		
+		/* Live captures go to disk as they arrive. */
+		if(_spool || ((_deviceType == PCAP_DEVICE || _mergeLive) &&
+					  [self openSpoolWithDataLink:[packet dataLink]]))
+			ma_spool_packet(_spool, [packet header], [packet bytes]);
+		
+		ma_pipeline_record([packet pipeline], MA_STAGE_BUFFER,
+						   [packet stagedAt], startedAt, 1, length);
+		ma_pipeline_record([packet pipeline], MA_STAGE_TOTAL,
+						   [packet capturedAt], startedAt, 1, length);
+		bufferBytes += length;
 	}
 	
+	if(_spool)
+		ma_spool_commit(_spool);
+	
+	_residentBytes += bufferBytes;
+	
 	/* Using manual KVO notifications since this will be updating fast. */
 	[self willChangeValueForKey:@"packets"];
 	[_packets addObjectsFromArray:newPackets];
@@ -327,6 +1486,8 @@ ma_local_pcap_callback(u_char *obj, const struct pcap_pkthdr *hdr,
 	for(MAWindowController *winController in [self windowControllers])
 		[winController updatePacketStats];
 	
+	[self enforceMemoryBudget];
+	
 	/* Notify others that we have new packets. */
 	NSDictionary *userInfo =
 	[NSDictionary dictionaryWithObject:[NSNumber
@@ -337,18 +1498,76 @@ ma_local_pcap_callback(u_char *obj, const struct pcap_pkthdr *hdr,
 					object:self
 				  userInfo:userInfo];
 	
+	ma_pipeline_record(_pipeline, MA_STAGE_DRAIN, startedAt, ma_pipeline_now(),
+					   bufferCount, bufferBytes);
+	
 	return bufferCount;
 }
 
+#pragma mark - MAStatisticsReporting methods
+
+- (NSString *)statisticsReport
+{
+	NSMutableString *report = [NSMutableString string];
+	
+	if(_hierarchy)
+		[report appendFormat:@"PROTOCOL HIERARCHY\n\n%@",
+		 ma_hierarchy_report(_hierarchy)];
+	
+	/*
+	 * Late packets arrived behind what was already shown and are out of
+	 * order; forced ones were let out early to bound memory or skew.
+	 */
+	if(_merge)
+	{
+		ma_merge_stats_t stats;
+		
+		ma_merge_stats(_merge, &stats);
+		[report appendFormat:@"\n\nMERGE\n\n"
+		 "%-12s %12llu\n%-12s %12llu\n%-12s %12llu\n%-12s %12llu\n"
+		 "%-12s %12lu\n",
+		 "pushed", stats.pushed, "emitted", stats.emitted,
+		 "late", stats.late, "forced", stats.forced,
+		 "pending", (unsigned long)stats.pending];
+	}
+	if(_talkers)
+		[report appendFormat:@"\n\nTOP TALKERS\n\n%@",
+		 ma_talkers_report(_talkers, MATopKReportRows)];
+	if(_cardinality)
+		[report appendFormat:@"\n\nDISTINCT COUNTS\n\n%@",
+		 ma_cardinality_report(_cardinality, MACardinalityReportRows)];
+	if(_bursts)
+		[report appendFormat:@"\n\nMICROBURSTS\n\n%@",
+		 ma_burst_report(_bursts, MABurstReportRows)];
+	if(_tcpAnalysis)
+		[report appendFormat:@"\n\nTCP ANALYSIS\n\n%@",
+		 ma_tcpa_report(_tcpAnalysis, MATCPAnalysisReportRows)];
+	
+	return report;
+}
+
 #pragma mark - Accessors
 
 @synthesize deviceType				= _deviceType;
 @synthesize deviceUUID				= _deviceUUID;
 @synthesize bytesCaptured			= _bytesCaptured;
 @synthesize packetsCaptured			= _packetsCaptured;
+@synthesize bytesEstimated			= _bytesEstimated;
+@synthesize packetsEstimated		= _packetsEstimated;
+@synthesize hierarchy				= _hierarchy;
+@synthesize talkers					= _talkers;
+@synthesize cardinality				= _cardinality;
+@synthesize ioGraph					= _ioGraph;
+@synthesize bursts					= _bursts;
+@synthesize tcpAnalysis				= _tcpAnalysis;
 @synthesize buffer					= _buffer;
 @synthesize packets					= _packets;
 @synthesize dataLinkLayer			= _dataLinkLayer;
 @synthesize session					= _session;
+@synthesize pipeline				= _pipeline;
+@synthesize merge					= _merge;
+@synthesize duplicates				= _duplicates;
+@synthesize spoolPath				= _spoolPath;
+@synthesize residentBytes			= _residentBytes;
 
 @end
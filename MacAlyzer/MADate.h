@@ -36,6 +36,7 @@
 @interface NSDate (MADate)
 
 + (NSDate *)dateWithTimeVal:(struct timeval)time;
++ (NSDate *)dateWithNanoseconds:(int64_t)ns;
 - (id)initWithTimeVal:(struct timeval)time;
 
 @end
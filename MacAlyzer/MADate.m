@@ -40,6 +40,12 @@
 	return [self dateWithTimeIntervalSince1970:time.tv_sec+time.tv_usec/1000000.0];
 }
 
+/* NSDate is a double, anything below about a microsecond is lost here. */
++ (NSDate *)dateWithNanoseconds:(int64_t)ns
+{
+	return [self dateWithTimeIntervalSince1970:ns/1000000000.0];
+}
+
 - (id)initWithTimeVal:(struct timeval)time
 {
 	return [self initWithTimeIntervalSince1970:time.tv_sec+time.tv_usec/1000000.0];
@@ -37,6 +37,8 @@
 
 @class MACaptureDevice;
 @class MAPacket;
+@class MAStatisticsController;
+@class MAIOGraphController;
 
 
 @interface MADocumentController : NSDocumentController <PCAPControllerDelegate> {
@@ -46,16 +48,41 @@
 	
 	NSTimer *_fileTimer;
 	NSTimer *_deviceTimer;
+	NSTimer *_statsTimer;
 	NSInteger _timerCount;
 	
 	NSMutableSet *_documentsWithUpdates;
 	NSMutableDictionary *_deviceDocuments;
+	NSMutableArray *_mergeDocuments;
+	
+	NSMutableDictionary *_statisticsWindows;
+	NSMutableDictionary *_ioGraphWindows;
 }
 
 - (IBAction)newWindow:(id)sender;
+- (IBAction)mergeSavefiles:(id)sender;
+- (IBAction)mergeActiveDevices:(id)sender;
+- (void)openMergedDocumentWithSources:(NSArray *)sources;
+- (IBAction)openCaptureWindow:(id)sender;
+
+- (IBAction)showPipelineStatistics:(id)sender;
+- (IBAction)savePipelineStatistics:(id)sender;
+- (IBAction)resetPipelineStatistics:(id)sender;
+- (IBAction)showCaptureStatistics:(id)sender;
+- (IBAction)showTrafficStatistics:(id)sender;
+- (IBAction)showIOGraph:(id)sender;
+- (IBAction)changeQueuePolicy:(id)sender;
+- (void)showStatistics:(id<MAStatisticsReporting>)reporter
+			 withTitle:(NSString *)title;
 
 - (void)toggleCaptureDevice:(MACaptureDevice *)device;
+- (void)configureTriggerForDevice:(MACaptureDevice *)device;
+- (void)configureRecordingForDevice:(MACaptureDevice *)device;
+- (void)configureSamplingForDevice:(MACaptureDevice *)device;
+- (void)configureFlowCutForDevice:(MACaptureDevice *)device;
+- (void)configureDedupForDevice:(MACaptureDevice *)device;
 - (void)updateCaptures:(NSTimer	*)timer;
+- (void)updateCaptureStats:(NSTimer *)timer;
 - (void)requestFileTimerUpdate:(id)sender;
 
 @property (readonly) NSDictionary *imageStore;
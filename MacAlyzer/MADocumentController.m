@@ -32,6 +32,8 @@
 
 #import "MADocumentController.h"
 
+#import <sys/time.h>
+
 #import "ConfigurationConstants.h"
 
 #import "PCAPController.h"
@@ -40,12 +42,18 @@
 #import "MASavePanel.h"
 #import "MAPacket.h"
 #import "MACapture.h"
+#import "MAPipelineStats.h"
+#import "MARecord.h"
+#import "MAStatisticsController.h"
+#import "MAIOGraphController.h"
 #import "MAString.h"
 
 
 @interface MADocumentController (__PRIVATE__)
 
 - (void)windowWillClose:(NSNotification *)notification;
+- (void)installMergeMenuItems;
+- (void)installStatisticsMenu;
 
 @end
 
@@ -62,6 +70,9 @@
 	_windowStore = [NSMutableSet new];
 	_documentsWithUpdates = [NSMutableSet new];
 	_deviceDocuments = [NSMutableDictionary new];
+	_statisticsWindows = [NSMutableDictionary new];
+	_ioGraphWindows = [NSMutableDictionary new];
+	_mergeDocuments = [NSMutableArray new];
 	
 	/* XXX Need to figure this one out... */
 	//interfaceImage = [NSImage imageNamed:NSImageNameNetwork];
@@ -92,6 +103,9 @@
 	[[NSNotificationCenter defaultCenter] removeObserver:self];
 	[_windowStore release];
 	[_imageStore release];
+	[_statisticsWindows release];
+	[_ioGraphWindows release];
+	[_mergeDocuments release];
 	[super dealloc];
 }
 
@@ -106,12 +120,382 @@
 	[winController release];
 }
 
+- (IBAction)mergeSavefiles:(id)sender
+{
+	NSOpenPanel *panel = [NSOpenPanel openPanel];
+	
+	[panel setAllowsMultipleSelection:YES];
+	[panel setCanChooseDirectories:NO];
+	
+	if([self runModalOpenPanel:panel forTypes:nil] != NSFileHandlingPanelOKButton)
+		return;
+	
+	[self openMergedDocumentWithSources:[panel URLs]];
+}
+
+- (IBAction)mergeActiveDevices:(id)sender
+{
+	NSMutableArray *sources = [NSMutableArray array];
+	
+	for(MACaptureDevice *device in [[[PCAPController sharedPCAPController]
+									 deviceList] objectEnumerator])
+	{
+		if(![device isCapturing])
+			continue;
+		
+		[sources addObject:[NSURL URLWithString:
+							[NSString stringWithFormat:@"device:///dev/%@",
+							 [device deviceName]]]];
+	}
+	
+	if([sources count] == 0)
+	{
+		NSBeep();
+		return;
+	}
+	
+	[self openMergedDocumentWithSources:sources];
+}
+
+/*
+ * sources are device:// and file:// URLs, shown together in one document
+ * in timestamp order.
+ */
+- (void)openMergedDocumentWithSources:(NSArray *)sources
+{
+	NSError *error = nil;
+	MACapture *doc = [[MACapture alloc] initWithMergedSources:sources
+														error:&error];
+	
+	if(doc == nil)
+	{
+		if(error)
+			[NSApp presentError:error];
+		return;
+	}
+	
+	[self addDocument:doc];
+	[_mergeDocuments addObject:doc];
+	[doc makeWindowControllers];
+	[doc showWindows];
+	[doc release];
+}
+
+/*
+ * Open the last few minutes of the current capture from its spool
+ * files, handy once a long running capture has rotated past what is
+ * worth keeping around in memory.
+ */
+- (IBAction)openCaptureWindow:(id)sender
+{
+	MACapture *doc = [self currentDocument];
+	NSAlert *alert = [[NSAlert alloc] init];
+	NSTextField *minutes = [[NSTextField alloc] initWithFrame:
+							NSMakeRect(0, 0, 80, 22)];
+	struct timeval now;
+	int64_t end;
+	NSArray *urls;
+	
+	[alert setMessageText:MASpoolWindowTitle];
+	[alert setInformativeText:@"Minutes of capture to open:"];
+	[alert addButtonWithTitle:@"Open"];
+	[alert addButtonWithTitle:@"Cancel"];
+	[minutes setIntegerValue:MASpoolWindowMinutes];
+	[alert setAccessoryView:minutes];
+	
+	if([alert runModal] != NSAlertFirstButtonReturn ||
+	   [minutes integerValue] <= 0)
+	{
+		[minutes release];
+		[alert release];
+		return;
+	}
+	
+	gettimeofday(&now, NULL);
+	end = (int64_t)now.tv_sec*MA_NSEC_PER_SEC;
+	urls = [doc spoolURLsFrom:end-[minutes integerValue]*60*MA_NSEC_PER_SEC
+						   to:end+MA_NSEC_PER_SEC];
+	[minutes release];
+	[alert release];
+	
+	if([urls count] == 0)
+	{
+		NSBeep();
+		return;
+	}
+	
+	[self openMergedDocumentWithSources:urls];
+}
+
+/*
+ * Trigger mode is on when any of the triggers is set in the defaults,
+ * dumps go to Application Support/MacAlyzer/Triggers.
+ */
+- (void)configureTriggerForDevice:(MACaptureDevice *)device
+{
+	NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+	NSString *filter = [defaults stringForKey:MATriggerFilterKey];
+	NSInteger rstBurst = [defaults integerForKey:MATriggerRstBurstKey];
+	NSInteger dropSpike = [defaults integerForKey:MATriggerDropSpikeKey];
+	NSInteger window = [defaults integerForKey:MATriggerWindowKey];
+	NSInteger postWindow = [defaults integerForKey:MATriggerPostWindowKey];
+	NSString *directory = nil;
+	
+	if([filter length] > 0 || rstBurst > 0 || dropSpike > 0)
+	{
+		directory = [[[NSSearchPathForDirectoriesInDomains(NSApplicationSupportDirectory,
+														   NSUserDomainMask, YES)
+					   lastObject] stringByAppendingPathComponent:MAWindowTitle]
+					 stringByAppendingPathComponent:MATriggerDirectoryName];
+		[[NSFileManager defaultManager] createDirectoryAtPath:directory
+								  withIntermediateDirectories:YES
+												   attributes:nil
+														error:NULL];
+	}
+	
+	[device setTriggerDirectory:directory];
+	[device setTriggerFilter:filter];
+	[device setTriggerRstBurst:(int)rstBurst];
+	[device setTriggerDropSpike:(int)dropSpike];
+	[device setTriggerWindow:(int)(window > 0 ? window : MATriggerWindow)];
+	[device setTriggerPostWindow:(int)(postWindow > 0 ? postWindow :
+									   MATriggerPostWindow)];
+}
+
+/*
+ * In record-only mode mahelper writes the capture to Application
+ * Support/MacAlyzer/Captures itself and only sends a sample of the
+ * packets on, every MARecordSampleInterval milliseconds.
+ */
+- (void)configureRecordingForDevice:(MACaptureDevice *)device
+{
+	NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+	NSInteger interval = [defaults integerForKey:MARecordSampleIntervalKey];
+	NSDateFormatter *formatter;
+	NSString *directory;
+	NSString *name;
+	
+	if(![defaults boolForKey:MARecordOnlyKey])
+	{
+		[device setRecordPath:nil];
+		return;
+	}
+	
+	directory = [[[NSSearchPathForDirectoriesInDomains(NSApplicationSupportDirectory,
+													   NSUserDomainMask, YES)
+				   lastObject] stringByAppendingPathComponent:MAWindowTitle]
+				 stringByAppendingPathComponent:MASpoolDirectoryName];
+	[[NSFileManager defaultManager] createDirectoryAtPath:directory
+							  withIntermediateDirectories:YES
+											   attributes:nil
+													error:NULL];
+	
+	formatter = [[NSDateFormatter alloc] init];
+	[formatter setDateFormat:@"yyyyMMdd-HHmmss"];
+	name = [NSString stringWithFormat:@"%@-%@.pcap", [device deviceName],
+			[formatter stringFromDate:[NSDate date]]];
+	[formatter release];
+	
+	[device setRecordPath:[directory stringByAppendingPathComponent:name]];
+	[device setRecordSampleInterval:(int)(interval > 0 ? interval :
+										  MARecordSampleInterval)];
+}
+
+/*
+ * Sampling thins out what mahelper sends us, see MASampler.h for the
+ * modes. Record-only mode already sends just a sample and ignores it.
+ */
+- (void)configureSamplingForDevice:(MACaptureDevice *)device
+{
+	NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+	NSInteger rate = [defaults integerForKey:MASampleRateKey];
+	NSInteger reservoir = [defaults integerForKey:MASampleReservoirKey];
+	NSInteger window = [defaults integerForKey:MASampleWindowKey];
+	
+	[device setSampleMode:ma_sample_mode_from_string([defaults
+													  stringForKey:MASampleModeKey])];
+	[device setSampleRate:(int)(rate > 0 ? rate : MASampleRate)];
+	[device setSampleReservoir:(int)(reservoir > 0 ? reservoir :
+									 MASampleReservoir)];
+	[device setSampleWindow:(int)(window > 0 ? window : MASampleWindow)];
+}
+
+/*
+ * Per-flow truncation keeps the first MAFlowCutPackets packets or
+ * MAFlowCutBytes bytes of each flow whole, then headers only, or nothing
+ * with MAFlowCutDrop.
+ */
+- (void)configureFlowCutForDevice:(MACaptureDevice *)device
+{
+	NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+	
+	[device setFlowCutPackets:(int)[defaults integerForKey:MAFlowCutPacketsKey]];
+	[device setFlowCutBytes:[[defaults objectForKey:MAFlowCutBytesKey]
+							 longLongValue]];
+	[device setFlowCutDrop:[defaults boolForKey:MAFlowCutDropKey]];
+}
+
+/*
+ * Duplicates from a SPAN port are caught in mahelper, MADedupMode drops
+ * or marks them.
+ */
+- (void)configureDedupForDevice:(MACaptureDevice *)device
+{
+	NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
+	NSInteger window = [defaults integerForKey:MADedupWindowKey];
+	
+	[device setDedupMode:ma_dedup_mode_from_string([defaults
+													stringForKey:MADedupModeKey])];
+	[device setDedupWindow:(int)(window > 0 ? window : MADedupWindow)];
+}
+
+#pragma mark - Statistics
+
+- (IBAction)showPipelineStatistics:(id)sender
+{
+	[self showStatistics:[MAPipelineStats sharedPipelineStats]
+			   withTitle:MAPipelineStatisticsTitle];
+}
+
+- (IBAction)savePipelineStatistics:(id)sender
+{
+	NSSavePanel *panel = [NSSavePanel savePanel];
+	NSError *error = nil;
+	
+	[panel setAllowedFileTypes:[NSArray arrayWithObject:@"txt"]];
+	[panel setNameFieldStringValue:MAPipelineStatisticsTitle];
+	
+	if([panel runSheetModalForWindow:[NSApp mainWindow]] !=
+	   NSFileHandlingPanelOKButton)
+		return;
+	
+	if(![[MAPipelineStats sharedPipelineStats]
+		 writeReportToFile:[[panel URL] path] error:&error])
+		[NSApp presentError:error];
+}
+
+- (IBAction)resetPipelineStatistics:(id)sender
+{
+	[[MAPipelineStats sharedPipelineStats] reset];
+}
+
+- (IBAction)showCaptureStatistics:(id)sender
+{
+	[self showStatistics:[PCAPController sharedPCAPController]
+			   withTitle:MACaptureStatisticsTitle];
+}
+
+/* One window per document, the statistics belong to the capture. */
+- (IBAction)showTrafficStatistics:(id)sender
+{
+	MACapture *doc = [self currentDocument];
+	
+	if(![doc isKindOfClass:[MACapture class]])
+		return;
+	
+	[self showStatistics:doc
+			   withTitle:[NSString stringWithFormat:@"%@ — %@",
+						  MATrafficStatisticsTitle, [doc displayName]]];
+}
+
+- (IBAction)showIOGraph:(id)sender
+{
+	MACapture *doc = [self currentDocument];
+	MAIOGraphController *controller;
+	NSString *title;
+	
+	if(![doc isKindOfClass:[MACapture class]] || [doc ioGraph] == NULL)
+		return;
+	
+	title = [NSString stringWithFormat:@"%@ — %@", MAIOGraphTitle,
+			 [doc displayName]];
+	controller = [_ioGraphWindows objectForKey:title];
+	if(controller == nil || [controller capture] != doc)
+	{
+		controller = [[MAIOGraphController alloc] initWithTitle:title
+														capture:doc];
+		[_ioGraphWindows setObject:controller forKey:title];
+		[controller release];
+	}
+	
+	[controller showWindow:self];
+}
+
+/*
+ * Sender's tag is the ma_queue_policy_t to apply to every queue between
+ * the capture and the document, in the helper as well as here.
+ */
+- (IBAction)changeQueuePolicy:(id)sender
+{
+	[[PCAPController sharedPCAPController]
+	 setQueuePolicy:(ma_queue_policy_t)[sender tag]];
+}
+
+- (BOOL)validateUserInterfaceItem:(id<NSValidatedUserInterfaceItem>)item
+{
+	if([item action] == @selector(openCaptureWindow:))
+		return ([[self currentDocument] isKindOfClass:[MACapture class]] &&
+				[(MACapture *)[self currentDocument] spoolPath] != nil);
+	
+	if([item action] == @selector(showTrafficStatistics:))
+		return [[self currentDocument] isKindOfClass:[MACapture class]];
+	
+	if([item action] == @selector(showIOGraph:))
+		return ([[self currentDocument] isKindOfClass:[MACapture class]] &&
+				[(MACapture *)[self currentDocument] ioGraph] != NULL);
+	
+	if([item action] == @selector(changeQueuePolicy:))
+	{
+		ma_queue_policy_t policy =
+			[[PCAPController sharedPCAPController] queuePolicy];
+		
+		[(NSMenuItem *)item setState:([item tag] == policy) ?
+		 NSOnState : NSOffState];
+		return YES;
+	}
+	
+	return [super validateUserInterfaceItem:item];
+}
+
+- (void)showStatistics:(id<MAStatisticsReporting>)reporter
+			 withTitle:(NSString *)title
+{
+	MAStatisticsController *controller =
+		[_statisticsWindows objectForKey:title];
+	
+	if(controller == nil || [controller reporter] != reporter)
+	{
+		controller = [[MAStatisticsController alloc] initWithTitle:title
+														  reporter:reporter];
+		[_statisticsWindows setObject:controller forKey:title];
+		[controller release];
+	}
+	
+	[controller showWindow:self];
+}
+
 #pragma mark - Misc
 
 - (void)addPacket:(MAPacket *)packet
 {
-	[[_deviceDocuments objectForKey:[packet deviceUUID]]
-	 addBufferObject:packet];
+	MACapture *doc = [_deviceDocuments objectForKey:[packet deviceUUID]];
+	BOOL merged = NO;
+	
+	for(MACapture *mergeDoc in _mergeDocuments)
+	{
+		if([mergeDoc mergePacket:packet])
+			merged = YES;
+	}
+	
+	/* Nobody has the device open, the packet has nowhere to go. */
+	if(doc == nil)
+	{
+		if(!merged)
+			ma_pipeline_drop([packet pipeline], MA_STAGE_BUFFER, 1);
+		return;
+	}
+	
+	[doc addBufferObject:packet];
 }
 
 - (void)toggleCaptureDevice:(MACaptureDevice *)device
@@ -124,6 +508,13 @@
 		[device setReadDelay:200];
 		[device setMaxPacketSize:65535];
 		[device setPromiscuousMode:YES];
+		[device setFanoutWorkers:(int)[[NSUserDefaults standardUserDefaults]
+									   integerForKey:MAFanoutWorkersKey]];
+		[self configureTriggerForDevice:device];
+		[self configureRecordingForDevice:device];
+		[self configureSamplingForDevice:device];
+		[self configureFlowCutForDevice:device];
+		[self configureDedupForDevice:device];
 		
 		[device startCapture];
 	}
@@ -144,11 +535,22 @@
 									   selector:@selector(updateCaptures:)
 									   userInfo:nil
 										repeats:YES];
+		_statsTimer =
+		[NSTimer scheduledTimerWithTimeInterval:MACaptureStatsInterval
+										 target:self
+									   selector:@selector(updateCaptureStats:)
+									   userInfo:nil
+										repeats:YES];
 	}
 	else if(_timerCount == 0 && _deviceTimer)
 	{
 		[_deviceTimer invalidate];
 		_deviceTimer = nil;
+		[_statsTimer invalidate];
+		_statsTimer = nil;
+		
+		/* Pick up the final counters of the device we just stopped. */
+		[self updateCaptureStats:nil];
 		
 		/* Set a temp timer to catch any late arriving packets. */
 		[NSTimer scheduledTimerWithTimeInterval:MACaptureUpdateInterval
@@ -162,17 +564,47 @@
 - (void)updateCaptures:(NSTimer	*)timer
 {
 	NSArray *sortDescriptors;
+	uint64_t skew = 0;
+	NSArray *captureOrder =
+	[NSArray arrayWithObject:[NSSortDescriptor
+							  sortDescriptorWithKey:@"self"
+							  ascending:YES
+							  selector:@selector(compareCaptureOrder:)]];
+	
+	/*
+	 * Fanout workers deliver out of order, go by the capture time. Sorting
+	 * one drain isn't enough, a worker can hand over a packet after a
+	 * later one went out in the previous drain; hold back the last skew
+	 * worth until every worker has had the chance. Once nothing is
+	 * capturing, everything goes.
+	 */
+	if(_timerCount > 0 && [[NSUserDefaults standardUserDefaults]
+						   integerForKey:MAFanoutWorkersKey] > 1)
+		skew = MAFanoutMaxSkew;
 	
 	if([_deviceDocuments count] > 0)
 	{
-		sortDescriptors =
-		[NSArray arrayWithObject:[NSSortDescriptor
-								  sortDescriptorWithKey:@"number"
-								  ascending:YES]];
-		
 		for(MACapture *doc in [_deviceDocuments objectEnumerator])
-			[doc updatePacketsWithSortDescriptors:sortDescriptors];
+			[doc updatePacketsWithSortDescriptors:captureOrder
+									  holdingBack:skew];
 	}
+	
+	/*
+	 * Live merges wait for every device to move past a packet, or for the
+	 * skew to run out; once nothing is capturing there is no point waiting.
+	 */
+	for(MACapture *doc in _mergeDocuments)
+	{
+		if(![doc isLiveMerge])
+			continue;
+		
+		if(_timerCount > 0)
+			[doc advanceMerge];
+		else
+			[doc flushMerge];
+		[doc updatePacketsWithSortDescriptors:captureOrder];
+	}
+	
 	if([_documentsWithUpdates count] > 0)
 	{
 		sortDescriptors =
@@ -181,7 +613,12 @@
 											  ascending:YES]];
 		
 		for(MACapture *doc in _documentsWithUpdates)
-			[doc updatePacketsWithSortDescriptors:sortDescriptors];
+		{
+			if([doc deviceType] == PCAP_MERGED)
+				[doc updatePacketsWithSortDescriptors:captureOrder];
+			else
+				[doc updatePacketsWithSortDescriptors:sortDescriptors];
+		}
 		
 		[_documentsWithUpdates removeAllObjects];
 	}
@@ -194,6 +631,11 @@
 	}
 }
 
+- (void)updateCaptureStats:(NSTimer *)timer
+{
+	[[PCAPController sharedPCAPController] updateCaptureStats];
+}
+
 - (void)requestFileTimerUpdate:(id)sender
 {
 	if(sender == nil)
@@ -243,6 +685,35 @@
 	return [openPanel runSheetModalForWindow:[NSApp mainWindow]];
 }
 
+- (void)removeDocument:(NSDocument *)document
+{
+	[_mergeDocuments removeObject:document];
+	
+	/* Traffic statistics and IO graph windows keep their document alive. */
+	for(NSString *title in [_statisticsWindows allKeys])
+	{
+		MAStatisticsController *controller =
+			[_statisticsWindows objectForKey:title];
+		
+		if([controller reporter] == (id)document)
+		{
+			[controller close];
+			[_statisticsWindows removeObjectForKey:title];
+		}
+	}
+	for(NSString *title in [_ioGraphWindows allKeys])
+	{
+		MAIOGraphController *controller = [_ioGraphWindows objectForKey:title];
+		
+		if([controller capture] == (id)document)
+		{
+			[controller close];
+			[_ioGraphWindows removeObjectForKey:title];
+		}
+	}
+	[super removeDocument:document];
+}
+
 - (NSString *)typeForContentsOfURL:(NSURL *)inAbsoluteURL
 							 error:(NSError **)outError
 {
@@ -263,6 +734,12 @@
 
 #pragma mark - Application Delegate methods
 
+- (void)applicationDidFinishLaunching:(NSNotification *)notification
+{
+	[self installMergeMenuItems];
+	[self installStatisticsMenu];
+}
+
 - (BOOL)applicationShouldOpenUntitledFile:(NSApplication *)sender
 {
 	/* Don't open a new document, but create a new window. */
@@ -270,6 +747,105 @@
 	return NO;
 }
 
+#pragma mark - Private methods
+
+/*
+ * The merge and capture window items go into the File menu from
+ * MainMenu.xib, right after Open.
+ */
+- (void)installMergeMenuItems
+{
+	NSMenu *fileMenu;
+	NSInteger index;
+	
+	if(!(fileMenu = [[[NSApp mainMenu] itemWithTitle:@"File"] submenu]))
+		return;
+	
+	index = [fileMenu indexOfItemWithTarget:nil
+								  andAction:@selector(openDocument:)];
+	index = (index < 0 ? [fileMenu numberOfItems] : index+1);
+	
+	[[fileMenu insertItemWithTitle:MAMergeSavefilesTitle
+							action:@selector(mergeSavefiles:)
+					 keyEquivalent:@""
+						   atIndex:index] setTarget:self];
+	[[fileMenu insertItemWithTitle:MAMergeDevicesTitle
+							action:@selector(mergeActiveDevices:)
+					 keyEquivalent:@""
+						   atIndex:index+1] setTarget:self];
+	[[fileMenu insertItemWithTitle:MASpoolWindowTitle
+							action:@selector(openCaptureWindow:)
+					 keyEquivalent:@""
+						   atIndex:index+2] setTarget:self];
+}
+
+/*
+ * The Statistics menu is built here rather than in MainMenu.xib, it sits
+ * just before the Window menu.
+ */
+- (void)installStatisticsMenu
+{
+	NSMenu *mainMenu = [NSApp mainMenu];
+	NSMenu *menu = [[NSMenu alloc] initWithTitle:MAStatisticsMenuTitle];
+	NSMenuItem *menuItem = [[NSMenuItem alloc] initWithTitle:MAStatisticsMenuTitle
+													  action:NULL
+											   keyEquivalent:@""];
+	NSMenu *policyMenu;
+	NSString *policyTitles[MA_QUEUE_POLICY_COUNT] = {
+		[MA_QUEUE_DROP_NEWEST]	= @"Drop Newest",
+		[MA_QUEUE_DROP_OLDEST]	= @"Drop Oldest",
+		[MA_QUEUE_DEGRADE]		= @"Truncate to Headers"
+	};
+	ma_queue_policy_t policy;
+	NSInteger index;
+	
+	[[menu addItemWithTitle:MAPipelineStatisticsTitle
+					 action:@selector(showPipelineStatistics:)
+			  keyEquivalent:@""] setTarget:self];
+	[[menu addItemWithTitle:@"Save Pipeline Latency…"
+					 action:@selector(savePipelineStatistics:)
+			  keyEquivalent:@""] setTarget:self];
+	[[menu addItemWithTitle:@"Reset Pipeline Latency"
+					 action:@selector(resetPipelineStatistics:)
+			  keyEquivalent:@""] setTarget:self];
+	[menu addItem:[NSMenuItem separatorItem]];
+	[[menu addItemWithTitle:MACaptureStatisticsTitle
+					 action:@selector(showCaptureStatistics:)
+			  keyEquivalent:@""] setTarget:self];
+	[[menu addItemWithTitle:MATrafficStatisticsTitle
+					 action:@selector(showTrafficStatistics:)
+			  keyEquivalent:@""] setTarget:self];
+	[[menu addItemWithTitle:MAIOGraphTitle
+					 action:@selector(showIOGraph:)
+			  keyEquivalent:@""] setTarget:self];
+	
+	/* What to do with packets when a queue between here and pcap fills. */
+	policyMenu = [[NSMenu alloc] initWithTitle:MAQueuePolicyMenuTitle];
+	for(policy = 0; policy < MA_QUEUE_POLICY_COUNT; policy++)
+	{
+		NSMenuItem *policyItem =
+			[policyMenu addItemWithTitle:policyTitles[policy]
+								  action:@selector(changeQueuePolicy:)
+						   keyEquivalent:@""];
+		[policyItem setTarget:self];
+		[policyItem setTag:policy];
+	}
+	[[menu addItemWithTitle:MAQueuePolicyMenuTitle
+					 action:NULL
+			  keyEquivalent:@""] setSubmenu:policyMenu];
+	[policyMenu release];
+	
+	[menuItem setSubmenu:menu];
+	
+	index = [mainMenu indexOfItemWithSubmenu:[NSApp windowsMenu]];
+	if(index < 0)
+		index = [mainMenu numberOfItems];
+	[mainMenu insertItem:menuItem atIndex:index];
+	
+	[menu release];
+	[menuItem release];
+}
+
 #pragma mark - Accessors
 
 @synthesize imageStore				= _imageStore;
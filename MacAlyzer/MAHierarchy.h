@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#import <Foundation/Foundation.h>
+
+#import "pan.h"
+
+
+/*
+ * Protocol hierarchy statistics: a tree of the layers packets were
+ * dissected into (Frame, Ethernet, IPv4, TCP, ...) with the packets and
+ * bytes seen at each node. It is kept up to date as packets are added,
+ * so showing it never means going back over the packets.
+ *
+ * Any number of threads may add to the same tree at once. Counters are
+ * updated atomically and new nodes are pushed onto their parent with a
+ * compare and swap; nodes are never removed until the tree is destroyed.
+ */
+
+typedef struct ma_hierarchy_node
+{
+	const char *name;
+	int64_t packets;
+	int64_t bytes;
+	struct ma_hierarchy_node *children;
+	struct ma_hierarchy_node *next;			/* sibling */
+} ma_hierarchy_node_t;
+
+typedef struct ma_hierarchy ma_hierarchy_t;
+
+
+ma_hierarchy_t *ma_hierarchy_create(void);
+void ma_hierarchy_destroy(ma_hierarchy_t *h);
+BOOL ma_hierarchy_add(ma_hierarchy_t *h, const pan_path_t *path, uint32_t bytes);
+BOOL ma_hierarchy_add_packet(ma_hierarchy_t *h, int dataLink,
+							 const u_char *data, uint32_t caplen);
+const ma_hierarchy_node_t *ma_hierarchy_root(ma_hierarchy_t *h);
+NSString *ma_hierarchy_report(ma_hierarchy_t *h);
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#import "MAHierarchy.h"
+
+#import <libkern/OSAtomic.h>
+
+
+#define MA_HIERARCHY_ROOT		"Frame"
+#define MA_HIERARCHY_INDENT		2
+
+struct ma_hierarchy
+{
+	ma_hierarchy_node_t root;
+};
+
+
+static void
+ma_hierarchy_free(ma_hierarchy_node_t *node)
+{
+	ma_hierarchy_node_t *next;
+	
+	for(; node; node = next)
+	{
+		next = node->next;
+		ma_hierarchy_free(node->children);
+		free(node);
+	}
+}
+
+/*
+ * Finds the child of parent with this name, adding it if there is none.
+ * Two threads adding the same child race on the compare and swap, the
+ * loser looks again and finds the winner's node.
+ */
+static ma_hierarchy_node_t *
+ma_hierarchy_child(ma_hierarchy_node_t *parent, const char *name)
+{
+	ma_hierarchy_node_t *head, *node, *added = NULL;
+	
+	for(;;)
+	{
+		head = parent->children;
+		OSMemoryBarrier();
+		
+		for(node = head; node; node = node->next)
+		{
+			if(node->name == name || strcmp(node->name, name) == 0)
+			{
+				free(added);
+				return node;
+			}
+		}
+		
+		if(added == NULL && !(added = calloc(1, sizeof(*added))))
+			return NULL;
+		
+		added->name = name;
+		added->next = head;
+		if(OSAtomicCompareAndSwapPtrBarrier(head, added,
+											(void * volatile *)&parent->children))
+			return added;
+	}
+}
+
+
+ma_hierarchy_t *
+ma_hierarchy_create(void)
+{
+	ma_hierarchy_t *h;
+	
+	if(!(h = calloc(1, sizeof(*h))))
+		return NULL;
+	
+	h->root.name = MA_HIERARCHY_ROOT;
+	return h;
+}
+
+void
+ma_hierarchy_destroy(ma_hierarchy_t *h)
+{
+	if(h == NULL)
+		return;
+	
+	ma_hierarchy_free(h->root.children);
+	free(h);
+}
+
+/*
+ * Counts one packet of bytes against the root and every layer in path.
+ * Returns NO if a node couldn't be allocated; the layers above it have
+ * still been counted.
+ */
+BOOL
+ma_hierarchy_add(ma_hierarchy_t *h, const pan_path_t *path, uint32_t bytes)
+{
+	ma_hierarchy_node_t *node = &h->root;
+	int i;
+	
+	OSAtomicIncrement64(&node->packets);
+	OSAtomicAdd64(bytes, &node->bytes);
+	
+	for(i = 0; i < path->depth; i++)
+	{
+		if(!(node = ma_hierarchy_child(node, path->layer[i])))
+			return NO;
+		
+		OSAtomicIncrement64(&node->packets);
+		OSAtomicAdd64(bytes, &node->bytes);
+	}
+	
+	return YES;
+}
+
+BOOL
+ma_hierarchy_add_packet(ma_hierarchy_t *h, int dataLink, const u_char *data,
+						uint32_t caplen)
+{
+	pan_path_t path;
+	
+	pan_path(dataLink, data, caplen, &path);
+	return ma_hierarchy_add(h, &path, caplen);
+}
+
+const ma_hierarchy_node_t *
+ma_hierarchy_root(ma_hierarchy_t *h)
+{
+	return &h->root;
+}
+
+#pragma mark - Report
+
+static int
+ma_hierarchy_compare(const void *a, const void *b)
+{
+	int64_t pa = (*(const ma_hierarchy_node_t **)a)->packets;
+	int64_t pb = (*(const ma_hierarchy_node_t **)b)->packets;
+	
+	return (pa < pb) - (pa > pb);
+}
+
+static void
+ma_hierarchy_report_node(NSMutableString *report, const ma_hierarchy_node_t *node,
+						 int depth, const ma_hierarchy_node_t *root)
+{
+	const ma_hierarchy_node_t *child;
+	const ma_hierarchy_node_t **children;
+	int64_t packets = node->packets, bytes = node->bytes;
+	NSUInteger count = 0, i;
+	char name[64];
+	
+	snprintf(name, sizeof(name), "%*s%s", depth*MA_HIERARCHY_INDENT, "",
+			 node->name);
+	[report appendFormat:@"%-32s %9.1f%% %12lld %9.1f%% %14lld\n", name,
+	 (root->packets ? 100.0*packets/root->packets : 0.0), packets,
+	 (root->bytes ? 100.0*bytes/root->bytes : 0.0), bytes];
+	
+	/* Largest first, the list itself is in the order nodes were added. */
+	for(child = node->children; child; child = child->next)
+		count++;
+	if(count == 0 || !(children = malloc(count*sizeof(*children))))
+		return;
+	
+	for(i = 0, child = node->children; child && i < count; child = child->next)
+		children[i++] = child;
+	qsort(children, i, sizeof(*children), ma_hierarchy_compare);
+	
+	for(count = i, i = 0; i < count; i++)
+		ma_hierarchy_report_node(report, children[i], depth+1, root);
+	free(children);
+}
+
+NSString *
+ma_hierarchy_report(ma_hierarchy_t *h)
+{
+	NSMutableString *report = [NSMutableString string];
+	
+	[report appendFormat:@"%-32s %10s %12s %10s %14s\n", "protocol",
+	 "% packets", "packets", "% bytes", "bytes"];
+	ma_hierarchy_report_node(report, &h->root, 0, &h->root);
+	
+	return report;
+}
@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#import "MAIOGraphView.h"
+
+#import "ConfigurationConstants.h"
+#import "MARecord.h"
+
+
+@interface MAIOGraphView ()
+- (void)setStart:(int64_t)start end:(int64_t)end;
+@end
+
+
+@implementation MAIOGraphView
+
+- (id)initWithFrame:(NSRect)frame
+{
+	if(!(self = [super initWithFrame:frame]))
+		return nil;
+	
+	_followsLive = YES;
+	_labelAttributes = [NSMutableDictionary new];
+	[_labelAttributes setObject:[NSFont userFixedPitchFontOfSize:10.0]
+						 forKey:NSFontAttributeName];
+	[_labelAttributes setObject:[NSColor darkGrayColor]
+						 forKey:NSForegroundColorAttributeName];
+	
+	return self;
+}
+
+- (void)dealloc
+{
+	[_labelAttributes release];
+	[super dealloc];
+}
+
+- (void)drawRect:(NSRect)dirtyRect
+{
+	static NSColor *colors[MA_IOGRAPH_PROTOS];
+	NSString *proto[MA_IOGRAPH_PROTOS] = {
+		[MA_IOGRAPH_TCP]	= @"TCP",
+		[MA_IOGRAPH_UDP]	= @"UDP",
+		[MA_IOGRAPH_ICMP]	= @"ICMP",
+		[MA_IOGRAPH_OTHER]	= @"Other"
+	};
+	NSRect bounds = [self bounds];
+	ma_iograph_bucket_t *buckets;
+	NSString *label;
+	int64_t first, last, bucketStart, width;
+	uint64_t peak = 0;
+	NSUInteger points, n, i, j;
+	CGFloat x, y, scale, barWidth, height;
+	
+	if(colors[0] == nil)
+	{
+		colors[MA_IOGRAPH_TCP] = [[NSColor colorWithCalibratedRed:0.25 green:0.45
+															  blue:0.85 alpha:1.0] retain];
+		colors[MA_IOGRAPH_UDP] = [[NSColor colorWithCalibratedRed:0.30 green:0.70
+															  blue:0.35 alpha:1.0] retain];
+		colors[MA_IOGRAPH_ICMP] = [[NSColor colorWithCalibratedRed:0.90 green:0.60
+															   blue:0.15 alpha:1.0] retain];
+		colors[MA_IOGRAPH_OTHER] = [[NSColor grayColor] retain];
+	}
+	
+	[[NSColor whiteColor] set];
+	NSRectFill(dirtyRect);
+	
+	if(_ioGraph == NULL || !ma_iograph_range(_ioGraph, &first, &last))
+		return;
+	
+	if(_followsLive)
+	{
+		_start = first;
+		_end = last;
+	}
+	
+	/* Never more buckets than pixels, whatever the span. */
+	points = MIN((NSUInteger)NSWidth(bounds), (NSUInteger)MAIOGraphMaxPoints);
+	if(points == 0 || !(buckets = malloc(points*sizeof(*buckets))))
+		return;
+	
+	n = ma_iograph_query(_ioGraph, _start, _end, points, buckets,
+						 &bucketStart, &width);
+	if(n == 0)
+	{
+		free(buckets);
+		return;
+	}
+	
+	for(i = 0; i < n; i++)
+		peak = MAX(peak, buckets[i].bytes);
+	
+	/* Buckets are placed by time, the first may start before the view. */
+	scale = NSWidth(bounds)/MAX(_end-_start, width);
+	height = NSHeight(bounds)-16.0;
+	barWidth = width*scale;
+	for(i = 0; peak && i < n; i++)
+	{
+		x = NSMinX(bounds)+(bucketStart+(int64_t)i*width-_start)*scale;
+		y = NSMinY(bounds);
+		
+		for(j = 0; j < MA_IOGRAPH_PROTOS; j++)
+		{
+			CGFloat h = height*buckets[i].protoBytes[j]/peak;
+			
+			if(h <= 0.0)
+				continue;
+			[colors[j] set];
+			NSRectFill(NSMakeRect(x, y, MAX(barWidth, 1.0), h));
+			y += h;
+		}
+	}
+	free(buckets);
+	
+	/* Span, resolution and the busiest bucket as a rate. */
+	label = [NSString stringWithFormat:@"%.3f s in %lu × %.3f s, "
+			 "peak %.1f Mbit/s",
+			 (double)(_end-_start)/MA_NSEC_PER_SEC, (unsigned long)n,
+			 (double)width/MA_NSEC_PER_SEC,
+			 (double)peak*8*MA_NSEC_PER_SEC/width/1e6];
+	[label drawAtPoint:NSMakePoint(NSMinX(bounds)+4.0, NSMaxY(bounds)-14.0)
+		withAttributes:_labelAttributes];
+	
+	/* Colour key, from the right edge. */
+	x = NSMaxX(bounds)-4.0;
+	for(j = MA_IOGRAPH_PROTOS; j-- > 0;)
+	{
+		x -= [proto[j] sizeWithAttributes:_labelAttributes].width;
+		[proto[j] drawAtPoint:NSMakePoint(x, NSMaxY(bounds)-14.0)
+			   withAttributes:_labelAttributes];
+		x -= 12.0;
+		[colors[j] set];
+		NSRectFill(NSMakeRect(x, NSMaxY(bounds)-11.0, 8.0, 8.0));
+		x -= 8.0;
+	}
+}
+
+- (void)setStart:(int64_t)start end:(int64_t)end
+{
+	int64_t first, last;
+	int64_t minSpan = (int64_t)MAIOGraphMinSpan*MA_NSEC_PER_MSEC;
+	
+	if(_ioGraph == NULL || !ma_iograph_range(_ioGraph, &first, &last))
+		return;
+	
+	if(end-start < minSpan)
+	{
+		start = (start+end)/2-minSpan/2;
+		end = start+minSpan;
+	}
+	if(end-start >= last-first)
+	{
+		start = first;
+		end = last;
+	}
+	else if(start < first)
+	{
+		end += first-start;
+		start = first;
+	}
+	else if(end > last)
+	{
+		start -= end-last;
+		end = last;
+	}
+	
+	_start = start;
+	_end = end;
+	_followsLive = NO;
+	[self setNeedsDisplay:YES];
+}
+
+- (void)showAll:(id)sender
+{
+	_followsLive = YES;
+	[self setNeedsDisplay:YES];
+}
+
+#pragma mark - Events
+
+- (void)scrollWheel:(NSEvent *)event
+{
+	NSPoint point = [self convertPoint:[event locationInWindow] fromView:nil];
+	double fraction = point.x/NSWidth([self bounds]);
+	double scale = pow(1.1, -[event deltaY]);
+	int64_t span = _end-_start;
+	int64_t pivot = _start+(int64_t)(span*fraction);
+	
+	if([event deltaY] == 0.0)
+		return;
+	
+	span = (int64_t)(span*scale);
+	[self setStart:pivot-(int64_t)(span*fraction)
+			   end:pivot+(int64_t)(span*(1.0-fraction))];
+}
+
+- (void)magnifyWithEvent:(NSEvent *)event
+{
+	NSPoint point = [self convertPoint:[event locationInWindow] fromView:nil];
+	double fraction = point.x/NSWidth([self bounds]);
+	int64_t span = _end-_start;
+	int64_t pivot = _start+(int64_t)(span*fraction);
+	
+	span = (int64_t)(span/(1.0+[event magnification]));
+	[self setStart:pivot-(int64_t)(span*fraction)
+			   end:pivot+(int64_t)(span*(1.0-fraction))];
+}
+
+- (void)mouseDown:(NSEvent *)event
+{
+	if([event clickCount] == 2)
+		[self showAll:self];
+	
+	_dragOrigin = [self convertPoint:[event locationInWindow] fromView:nil];
+}
+
+- (void)mouseDragged:(NSEvent *)event
+{
+	NSPoint point = [self convertPoint:[event locationInWindow] fromView:nil];
+	int64_t shift = (int64_t)((_dragOrigin.x-point.x)/NSWidth([self bounds])*
+							  (_end-_start));
+	
+	_dragOrigin = point;
+	[self setStart:_start+shift end:_end+shift];
+}
+
+#pragma mark - Accessors
+
+@synthesize ioGraph				= _ioGraph;
+@synthesize followsLive			= _followsLive;
+
+@end
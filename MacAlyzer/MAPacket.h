@@ -33,16 +33,32 @@
 #import <Foundation/Foundation.h>
 #import <pcap/pcap.h>
 
+#import "MAPipeline.h"
 #import "MAProtocols.h"
+#import "MATCPAnalysis.h"
 
 
-@interface MAPacket : NSObject <MAPacketProcessor> {
+@class MASpillFile;
+
+
+@interface MAPacket : NSObject <MAPacketProcessor, NSCopying> {
 @private
 	struct pcap_pkthdr _header;
 	u_char *_bytes;
+	MASpillFile *_spillFile;		/* _bytes live here, if set */
 	NSInteger _id;
+	NSUInteger _captureId;
+	int64_t _timestamp;				/* ns since the epoch */
+	int64_t _relativeTime;			/* ns since the first packet */
+	int64_t _deltaTime;				/* ns since the previous packet */
 	NSString *_deviceUUID;
 	int _datalink;
+	uint32_t _weight;				/* packets this one stands for */
+	ma_tcpa_tags_t _tcpAnalysis;
+	
+	ma_pipeline_t *_pipeline;
+	uint64_t _capturedAt;
+	uint64_t _stagedAt;				/* entered its current stage */
 }
 
 - (id)initWithData:(const void *)bytes
@@ -56,12 +72,38 @@
 		  withUUID:(NSString *)uuid
 	  withDataLink:(int)dataLink;
 
+- (NSComparisonResult)compareCaptureOrder:(MAPacket *)packet;
+- (int64_t)timeSince:(MAPacket *)packet;
+- (void)setSpilledBytes:(const u_char *)bytes inFile:(MASpillFile *)file;
+
 @property (readonly) const struct pcap_pkthdr *header;
 @property (readonly) const u_char *bytes;
 @property (readonly) NSData *data;
 @property (readonly) NSInteger length;
-@property (readonly) NSInteger number;
+@property (readwrite) NSInteger number;
+@property (readonly) NSUInteger captureId;
 @property (readonly) NSDate *time;
+@property (readonly) int64_t timestamp;
+@property (readwrite, assign) int64_t relativeTime;
+@property (readwrite, assign) int64_t deltaTime;
 @property (readonly) NSString *deviceUUID;
+@property (readonly) int dataLink;
+@property (readonly) BOOL isSpilled;
+@property (readwrite, assign) uint32_t weight;
+@property (readonly) BOOL isDuplicate;
+
+/* TCP analysis tags, one per ma_tcpa_kind_t, for filter predicates. */
+@property (readwrite, assign) ma_tcpa_tags_t tcpAnalysis;
+@property (readonly) BOOL isRetransmission;
+@property (readonly) BOOL isFastRetransmission;
+@property (readonly) BOOL isOutOfOrder;
+@property (readonly) BOOL isLostSegment;
+@property (readonly) BOOL isDuplicateAck;
+@property (readonly) BOOL isZeroWindow;
+@property (readonly) BOOL isWindowFull;
+
+@property (readwrite, assign) ma_pipeline_t *pipeline;
+@property (readwrite, assign) uint64_t capturedAt;
+@property (readwrite, assign) uint64_t stagedAt;
 
 @end
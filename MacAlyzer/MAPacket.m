@@ -33,6 +33,8 @@
 #import "MAPacket.h"
 
 #import "MADate.h"
+#import "MARecord.h"
+#import "MASpillFile.h"
 #import "pan.h"
 
 @implementation MAPacket
@@ -71,10 +73,13 @@
 		return nil;
 	
 	_id = identification;
+	_captureId = identification;
 	_deviceUUID = [uuid retain];
 	_datalink = dataLink;
+	_weight = 1;
 	
 	memcpy(&_header, header, sizeof(_header));
+	_timestamp = ma_pkthdr_ns(header);
 	
 	if(!(_bytes = malloc(sizeof(*_bytes)*_header.caplen)))
 	{
@@ -87,13 +92,121 @@
 	return self;
 }
 
+- (id)copyWithZone:(NSZone *)zone
+{
+	MAPacket *copy = [[MAPacket allocWithZone:zone] initWithData:_bytes
+													  withHeader:&_header
+														  withId:_captureId
+														withUUID:_deviceUUID
+													withDataLink:_datalink];
+	
+	if(copy)
+	{
+		copy->_id = _id;
+		copy->_relativeTime = _relativeTime;
+		copy->_deltaTime = _deltaTime;
+		copy->_weight = _weight;
+		copy->_tcpAnalysis = _tcpAnalysis;
+		copy->_pipeline = _pipeline;
+		copy->_capturedAt = _capturedAt;
+		copy->_stagedAt = _stagedAt;
+	}
+	
+	return copy;
+}
+
 - (void)dealloc
 {
-	free(_bytes);
+	if(_spillFile)
+		[_spillFile release];
+	else
+		free(_bytes);
 	[_deviceUUID release];
 	[super dealloc];
 }
 
+#pragma mark - Ordering
+
+/*
+ * Order by capture time, ties broken by the id the capture device gave
+ * us so packets from one worker keep their order.
+ */
+- (NSComparisonResult)compareCaptureOrder:(MAPacket *)packet
+{
+	if(_timestamp != packet->_timestamp)
+		return (_timestamp < packet->_timestamp ? NSOrderedAscending : NSOrderedDescending);
+	if(_captureId != packet->_captureId)
+		return (_captureId < packet->_captureId ? NSOrderedAscending : NSOrderedDescending);
+	
+	return NSOrderedSame;
+}
+
+/* Nanoseconds between packet and us, no objects involved. */
+- (int64_t)timeSince:(MAPacket *)packet
+{
+	return _timestamp-packet->_timestamp;
+}
+
+/*
+ * Our bytes have been written to file, drop our copy and use the mapped
+ * one from now on.
+ */
+- (void)setSpilledBytes:(const u_char *)bytes inFile:(MASpillFile *)file
+{
+	if(_spillFile)
+		return;
+	
+	free(_bytes);
+	_bytes = (u_char *)bytes;
+	_spillFile = [file retain];
+}
+
+- (BOOL)isSpilled
+{
+	return (_spillFile != nil);
+}
+
+/* Marked by duplicate detection, it stands for no packets at all. */
+- (BOOL)isDuplicate
+{
+	return (_weight == 0);
+}
+
+- (BOOL)isRetransmission
+{
+	return (_tcpAnalysis & MA_TCPA_TAG(MA_TCPA_RETRANSMISSION)) != 0;
+}
+
+- (BOOL)isFastRetransmission
+{
+	return (_tcpAnalysis & MA_TCPA_TAG(MA_TCPA_FAST_RETRANSMISSION)) != 0;
+}
+
+- (BOOL)isOutOfOrder
+{
+	return (_tcpAnalysis & MA_TCPA_TAG(MA_TCPA_OUT_OF_ORDER)) != 0;
+}
+
+- (BOOL)isLostSegment
+{
+	return (_tcpAnalysis & MA_TCPA_TAG(MA_TCPA_LOST_SEGMENT)) != 0;
+}
+
+- (BOOL)isDuplicateAck
+{
+	return (_tcpAnalysis & MA_TCPA_TAG(MA_TCPA_DUP_ACK)) != 0;
+}
+
+- (BOOL)isZeroWindow
+{
+	return (_tcpAnalysis & MA_TCPA_TAG(MA_TCPA_ZERO_WINDOW)) != 0;
+}
+
+- (BOOL)isWindowFull
+{
+	return (_tcpAnalysis & MA_TCPA_TAG(MA_TCPA_WINDOW_FULL)) != 0;
+}
+
 #pragma mark - Basic packet processing
 
 - (NSString *)source
@@ -113,7 +226,17 @@
 
 - (NSString *)description
 {
-	return pan_input(PAN_INFO_STRING, _datalink, self.bytes, self.length);
+	NSString *tags;
+	NSString *info = pan_input(PAN_INFO_STRING, _datalink, self.bytes,
+							   self.length);
+	
+	if(self.isDuplicate && info)
+		return [@"[Duplicate] " stringByAppendingString:info];
+	
+	if(_tcpAnalysis && info && (tags = ma_tcpa_tags_string(_tcpAnalysis)))
+		return [NSString stringWithFormat:@"[TCP %@] %@", tags, info];
+	
+	return info;
 }
 
 #pragma mark - Accessors
@@ -135,13 +258,27 @@
 	return self.header->caplen;
 }
 
+/*
+ * For the bindings only, anything doing arithmetic on times should use
+ * timestamp/relativeTime/deltaTime instead of allocating a date.
+ */
 - (NSDate *)time
 {
-	return [NSDate dateWithTimeVal:self.header->ts];
+	return [NSDate dateWithNanoseconds:_timestamp];
 }
 
 @synthesize bytes			= _bytes;
 @synthesize number			= _id;
+@synthesize captureId		= _captureId;
+@synthesize timestamp		= _timestamp;
+@synthesize relativeTime	= _relativeTime;
+@synthesize deltaTime		= _deltaTime;
 @synthesize deviceUUID		= _deviceUUID;
+@synthesize dataLink		= _datalink;
+@synthesize weight			= _weight;
+@synthesize tcpAnalysis		= _tcpAnalysis;
+@synthesize pipeline		= _pipeline;
+@synthesize capturedAt		= _capturedAt;
+@synthesize stagedAt		= _stagedAt;
 
 @end
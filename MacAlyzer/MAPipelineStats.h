@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+
+#import "MAPipeline.h"
+#import "MAProtocols.h"
+
+
+/*
+ * Per-source (capture device or savefile) pipeline statistics for the
+ * whole app. Sources are created on first use and never freed, so the
+ * returned ma_pipeline_t pointers can be held by packets and documents.
+ * Devices are named by their interface name, savefiles by full path so
+ * two files called the same don't share statistics.
+ */
+@interface MAPipelineStats : NSObject <MAStatisticsReporting> {
+@private
+	NSMutableDictionary *_sources;
+}
+
++ (MAPipelineStats *)sharedPipelineStats;
+
+- (ma_pipeline_t *)pipelineForSource:(NSString *)name;
+- (NSArray *)sources;
+- (void)reset;
+
+- (NSDictionary *)statisticsForSource:(NSString *)name;
+- (NSString *)reportWithDistributions:(BOOL)yn;
+- (BOOL)writeReportToFile:(NSString *)path error:(NSError **)error;
+
+@end
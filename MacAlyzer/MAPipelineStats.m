@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import "MAPipelineStats.h"
+
+
+#define MAPipelineReportHeader	@"%-12s %10s %12s %8s %10s %10s %10s %10s %10s %10s %10s\n"
+#define MAPipelineReportRow		@"%-12s %10lld %12lld %8lld %10.0f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n"
+
+static MAPipelineStats *sharedPipelineStats = nil;
+
+
+@implementation MAPipelineStats
+
++ (MAPipelineStats *)sharedPipelineStats
+{
+	@synchronized(self)
+	{
+		if(sharedPipelineStats == nil)
+			sharedPipelineStats = [[self alloc] init];
+	}
+	return sharedPipelineStats;
+}
+
+- (id)init
+{
+	if(!(self = [super init]))
+		return nil;
+	
+	_sources = [NSMutableDictionary new];
+	
+	return self;
+}
+
+- (void)dealloc
+{
+	for(NSValue *value in [_sources objectEnumerator])
+		free([value pointerValue]);
+	[_sources release];
+	[super dealloc];
+}
+
+#pragma mark - Sources
+
+- (ma_pipeline_t *)pipelineForSource:(NSString *)name
+{
+	ma_pipeline_t *p;
+	
+	if(name == nil)
+		return NULL;
+	
+	@synchronized(_sources)
+	{
+		p = [[_sources objectForKey:name] pointerValue];
+		if(p == NULL)
+		{
+			if(!(p = malloc(sizeof(*p))))
+				return NULL;
+			
+			ma_pipeline_init(p);
+			[_sources setObject:[NSValue valueWithPointer:p] forKey:name];
+		}
+	}
+	
+	return p;
+}
+
+- (NSArray *)sources
+{
+	@synchronized(_sources)
+	{
+		return [[_sources allKeys]
+				sortedArrayUsingSelector:@selector(localizedCompare:)];
+	}
+}
+
+- (void)reset
+{
+	/*
+	 * Reset in place, packets and documents keep pointers to these. A
+	 * recording racing with the reset only skews the first few samples.
+	 */
+	@synchronized(_sources)
+	{
+		for(NSValue *value in [_sources objectEnumerator])
+			ma_pipeline_reset([value pointerValue]);
+	}
+}
+
+#pragma mark - Reporting
+
+- (NSDictionary *)statisticsForSource:(NSString *)name
+{
+	ma_pipeline_t *p;
+	NSMutableDictionary *stats;
+	double elapsed;
+	NSUInteger i;
+	
+	@synchronized(_sources)
+	{
+		p = [[_sources objectForKey:name] pointerValue];
+	}
+	if(p == NULL)
+		return nil;
+	
+	stats = [NSMutableDictionary dictionary];
+	elapsed = ma_pipeline_ns(ma_pipeline_now()-p->started)/(double)NSEC_PER_SEC;
+	
+	for(i = 0; i < MA_STAGE_COUNT; i++)
+	{
+		ma_stage_stats_t *s = &p->stages[i];
+		ma_histogram_t *h = &s->latency;
+		
+		NSDictionary *stage =
+		[NSDictionary dictionaryWithObjectsAndKeys:
+		 [NSNumber numberWithLongLong:s->packets], @"packets",
+		 [NSNumber numberWithLongLong:s->bytes], @"bytes",
+		 [NSNumber numberWithLongLong:s->drops], @"drops",
+		 [NSNumber numberWithDouble:(elapsed > 0 ? s->packets/elapsed : 0)],
+		 @"packetsPerSecond",
+		 [NSNumber numberWithDouble:(elapsed > 0 ? s->bytes/elapsed : 0)],
+		 @"bytesPerSecond",
+		 [NSNumber numberWithUnsignedLongLong:ma_histogram_mean(h)], @"mean",
+		 [NSNumber numberWithUnsignedLongLong:
+		  ma_histogram_percentile(h, 50.0)], @"p50",
+		 [NSNumber numberWithUnsignedLongLong:
+		  ma_histogram_percentile(h, 90.0)], @"p90",
+		 [NSNumber numberWithUnsignedLongLong:
+		  ma_histogram_percentile(h, 99.0)], @"p99",
+		 [NSNumber numberWithUnsignedLongLong:
+		  ma_histogram_percentile(h, 99.9)], @"p999",
+		 [NSNumber numberWithUnsignedLongLong:
+		  ma_histogram_percentile(h, 100.0)], @"max",
+		 nil];
+		
+		[stats setObject:stage
+				  forKey:[NSString stringWithUTF8String:ma_stage_name(i)]];
+	}
+	
+	return stats;
+}
+
+/*
+ * Plain text report, latencies in microseconds. With distributions each
+ * stage is followed by its non-empty histogram buckets so the full shape
+ * can be compared between runs.
+ */
+- (NSString *)reportWithDistributions:(BOOL)yn
+{
+	NSMutableString *report = [NSMutableString string];
+	
+	for(NSString *name in [self sources])
+	{
+		ma_pipeline_t *p = [self pipelineForSource:name];
+		double elapsed = ma_pipeline_ns(ma_pipeline_now()-p->started)/
+			(double)NSEC_PER_SEC;
+		NSUInteger i;
+		
+		[report appendFormat:@"%@ (%.1f s)\n", name, elapsed];
+		[report appendFormat:MAPipelineReportHeader, "stage", "packets",
+		 "bytes", "drops", "pkt/s", "mean us", "p50 us", "p90 us",
+		 "p99 us", "p99.9 us", "max us"];
+		
+		for(i = 0; i < MA_STAGE_COUNT; i++)
+		{
+			ma_stage_stats_t *s = &p->stages[i];
+			ma_histogram_t *h = &s->latency;
+			
+			[report appendFormat:MAPipelineReportRow, ma_stage_name(i),
+			 s->packets, s->bytes, s->drops,
+			 (elapsed > 0 ? s->packets/elapsed : 0),
+			 ma_histogram_mean(h)/1000.0,
+			 ma_histogram_percentile(h, 50.0)/1000.0,
+			 ma_histogram_percentile(h, 90.0)/1000.0,
+			 ma_histogram_percentile(h, 99.0)/1000.0,
+			 ma_histogram_percentile(h, 99.9)/1000.0,
+			 ma_histogram_percentile(h, 100.0)/1000.0];
+		}
+		
+		if(yn)
+		{
+			for(i = 0; i < MA_STAGE_COUNT; i++)
+			{
+				ma_histogram_t *h = &p->stages[i].latency;
+				int64_t seen = 0;
+				NSUInteger b;
+				
+				if(h->total == 0)
+					continue;
+				
+				[report appendFormat:@"\n%s latency distribution\n",
+				 ma_stage_name(i)];
+				[report appendFormat:@"%14s %14s %12s %10s\n",
+				 "from us", "to us", "count", "percentile"];
+				
+				for(b = 0; b < MA_HISTOGRAM_BUCKETS; b++)
+				{
+					if(h->counts[b] == 0)
+						continue;
+					
+					seen += h->counts[b];
+					[report appendFormat:@"%14.3f %14.3f %12lld %10.4f\n",
+					 ma_histogram_bucket_low(b)/1000.0,
+					 ma_histogram_bucket_high(b)/1000.0,
+					 h->counts[b], 100.0*seen/h->total];
+				}
+			}
+		}
+		
+		[report appendString:@"\n"];
+	}
+	
+	return report;
+}
+
+- (BOOL)writeReportToFile:(NSString *)path error:(NSError **)error
+{
+	return [[self reportWithDistributions:YES] writeToFile:path
+												atomically:YES
+												  encoding:NSUTF8StringEncoding
+													 error:error];
+}
+
+- (NSString *)statisticsReport
+{
+	return [self reportWithDistributions:NO];
+}
+
+@end
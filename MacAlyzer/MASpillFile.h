@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+
+
+/*
+ * On-disk segment for packet bytes a document can't keep in memory.
+ *
+ * The whole file is mapped into one address range reserved up front, so
+ * once a packet's bytes are spilled the pointer it is given stays valid
+ * for as long as the file lives; the pages are read back in when touched
+ * and can be dropped again by the kernel at any time. Packets hold on to
+ * the file they were spilled to. The file is unlinked as soon as it is
+ * created, nothing is left behind.
+ */
+@interface MASpillFile : NSObject {
+@private
+	int _fd;
+	u_char *_base;
+	size_t _reserved;
+	size_t _length;				/* handed out so far, page aligned */
+	dispatch_queue_t _queue;
+	
+	uint64_t _spilledPackets;
+	uint64_t _spilledBytes;
+}
+
+- (id)initInDirectory:(NSString *)directory;
+- (BOOL)spillPackets:(NSArray *)packets
+		  completion:(void (^)(NSUInteger bytes))completion;
+
+@property (readonly) uint64_t spilledPackets;
+@property (readonly) uint64_t spilledBytes;
+@property (readonly) size_t length;
+
+@end
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import "MASpillFile.h"
+
+#import <sys/mman.h>
+#import <sys/param.h>
+#import <unistd.h>
+
+#import "ConfigurationConstants.h"
+#import "MAPacket.h"
+
+
+@implementation MASpillFile
+
+- (id)initInDirectory:(NSString *)directory
+{
+	NSString *template;
+	char path[MAXPATHLEN];
+	void *base;
+	
+	if(!(self = [super init]))
+		return nil;
+	
+	_fd = -1;
+	template = [directory stringByAppendingPathComponent:
+				@"MacAlyzer-spill.XXXXXX"];
+	if(![template getFileSystemRepresentation:path maxLength:sizeof(path)] ||
+	   (_fd = mkstemp(path)) == -1)
+	{
+		NSLog(@"%s(): %s", __func__, strerror(errno));
+		[self release];
+		return nil;
+	}
+	unlink(path);
+	
+	/* Address space only, the file gets mapped into it piece by piece. */
+	_reserved = MASpillReserve;
+	if((base = mmap(NULL, _reserved, PROT_NONE, MAP_ANON|MAP_PRIVATE,
+					-1, 0)) == MAP_FAILED)
+	{
+		NSLog(@"%s(): %s", __func__, strerror(errno));
+		[self release];
+		return nil;
+	}
+	
+	_base = base;
+	_queue = dispatch_queue_create(MASpillQueueName, NULL);
+	
+	return self;
+}
+
+- (void)dealloc
+{
+	/* A spill in flight holds on to us, so there is none now. */
+	if(_queue)
+		dispatch_release(_queue);
+	if(_base)
+		munmap(_base, _reserved);
+	if(_fd != -1)
+		close(_fd);
+	[super dealloc];
+}
+
+/*
+ * Copy the packets' bytes into one page aligned arena and write it out
+ * on our queue. Back on the main queue each packet is pointed at its
+ * bytes in the mapping and gives up its own copy, then completion is
+ * called with how many bytes were freed. Returns NO if nothing was
+ * started.
+ */
+- (BOOL)spillPackets:(NSArray *)packets
+		  completion:(void (^)(NSUInteger bytes))completion
+{
+	size_t pageSize = getpagesize();
+	size_t total = 0;
+	size_t size;
+	size_t offset;
+	size_t pos = 0;
+	u_char *arena;
+	
+	for(MAPacket *packet in packets)
+		total += [packet length];
+	
+	size = (total+pageSize-1) & ~(pageSize-1);
+	if(total == 0 || _length+size > _reserved || !(arena = malloc(size)))
+		return NO;
+	
+	for(MAPacket *packet in packets)
+	{
+		memcpy(arena+pos, [packet bytes], [packet length]);
+		pos += [packet length];
+	}
+	
+	offset = _length;
+	_length += size;
+	
+	dispatch_async(_queue, ^{
+		BOOL ok = (pwrite(_fd, arena, size, offset) == (ssize_t)size &&
+				   mmap(_base+offset, size, PROT_READ, MAP_SHARED|MAP_FIXED,
+						_fd, offset) != MAP_FAILED);
+		
+		if(!ok)
+			NSLog(@"-[MASpillFile spillPackets:completion:]: %s",
+				  strerror(errno));
+		free(arena);
+		
+		dispatch_async(dispatch_get_main_queue(), ^{
+			const u_char *bytes = _base+offset;
+			NSUInteger freed = 0;
+			
+			if(ok)
+			{
+				for(MAPacket *packet in packets)
+				{
+					[packet setSpilledBytes:bytes inFile:self];
+					bytes += [packet length];
+					freed += [packet length];
+				}
+				
+				_spilledPackets += [packets count];
+				_spilledBytes += freed;
+			}
+			
+			completion(freed);
+		});
+	});
+	
+	return YES;
+}
+
+@synthesize spilledPackets	= _spilledPackets;
+@synthesize spilledBytes	= _spilledBytes;
+@synthesize length			= _length;
+
+@end
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import "MAStatisticsController.h"
+
+#import "ConfigurationConstants.h"
+
+
+@implementation MAStatisticsController
+
+- (id)initWithTitle:(NSString *)title
+		   reporter:(id<MAStatisticsReporting>)reporter
+{
+	NSWindow *window;
+	NSScrollView *scrollView;
+	NSRect frame = NSMakeRect(0, 0, MAStatisticsWindowWidth,
+							  MAStatisticsWindowHeight);
+	
+	window = [[NSWindow alloc] initWithContentRect:frame
+										 styleMask:(NSTitledWindowMask|
+													NSClosableWindowMask|
+													NSMiniaturizableWindowMask|
+													NSResizableWindowMask)
+										   backing:NSBackingStoreBuffered
+											 defer:YES];
+	if(!(self = [super initWithWindow:window]))
+	{
+		[window release];
+		return nil;
+	}
+	[window release];
+	
+	_reporter = [reporter retain];
+	
+	[window setTitle:title];
+	[window setDelegate:self];
+	[window setReleasedWhenClosed:NO];
+	
+	/* Reports are column aligned, so don't wrap lines. */
+	scrollView = [[NSScrollView alloc] initWithFrame:frame];
+	[scrollView setHasVerticalScroller:YES];
+	[scrollView setHasHorizontalScroller:YES];
+	[scrollView setAutoresizingMask:NSViewWidthSizable|NSViewHeightSizable];
+	
+	_textView = [[NSTextView alloc] initWithFrame:frame];
+	[_textView setEditable:NO];
+	[_textView setFont:[NSFont userFixedPitchFontOfSize:11.0]];
+	[_textView setHorizontallyResizable:YES];
+	[_textView setMaxSize:NSMakeSize(FLT_MAX, FLT_MAX)];
+	[[_textView textContainer] setWidthTracksTextView:NO];
+	[[_textView textContainer] setContainerSize:NSMakeSize(FLT_MAX, FLT_MAX)];
+	
+	[scrollView setDocumentView:_textView];
+	[window setContentView:scrollView];
+	[scrollView release];
+	
+	[window center];
+	
+	return self;
+}
+
+- (void)dealloc
+{
+	[_refreshTimer invalidate];
+	[_textView release];
+	[_reporter release];
+	[super dealloc];
+}
+
+- (void)showWindow:(id)sender
+{
+	[self refresh:self];
+	[super showWindow:sender];
+	
+	if(_refreshTimer == nil)
+	{
+		_refreshTimer =
+		[NSTimer scheduledTimerWithTimeInterval:MAStatisticsRefreshInterval
+										 target:self
+									   selector:@selector(refresh:)
+									   userInfo:nil
+										repeats:YES];
+	}
+}
+
+- (void)refresh:(id)sender
+{
+	NSString *report = [_reporter statisticsReport];
+	
+	if(report == nil)
+		report = @"";
+	
+	[_textView setString:report];
+}
+
+#pragma mark - NSWindow Delegate methods
+
+- (void)windowWillClose:(NSNotification *)notification
+{
+	/* The timer retains us, stop it so we can go away. */
+	[_refreshTimer invalidate];
+	_refreshTimer = nil;
+}
+
+#pragma mark - Accessors
+
+@synthesize reporter			= _reporter;
+
+@end
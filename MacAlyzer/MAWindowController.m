@@ -45,6 +45,7 @@
 #import "MATreeNode.h"
 #import "MACapture.h"
 #import "MACaptureDevice.h"
+#import "MACaptureStats.h"
 #import "MAPacket.h"
 
 
@@ -52,6 +53,7 @@
 
 - (void)newRecentCapture:(NSNotification *)notification;
 - (void)newPacketsDidArrive:(NSNotification *)notification;
+- (void)captureStatsDidChange:(NSNotification *)notification;
 - (void)populateSidebar;
 - (void)populateDevices;
 - (void)populateRecent;
@@ -80,6 +82,8 @@
 {
 	[[NSNotificationCenter defaultCenter]
 	 removeObserver:self name:MANewPacketNotificationKey object:nil];
+	[[NSNotificationCenter defaultCenter]
+	 removeObserver:self name:MACaptureStatsNotificationKey object:nil];
 	[_sidebarGroups release];
 	[_sidebarContents release];
 	[super dealloc];
@@ -111,6 +115,12 @@
 		 selector:@selector(newPacketsDidArrive:)
 			 name:MANewPacketNotificationKey
 		   object:nil];
+	
+	[[NSNotificationCenter defaultCenter]
+	  addObserver:self
+		 selector:@selector(captureStatsDidChange:)
+			 name:MACaptureStatsNotificationKey
+		   object:nil];
 }
 
 #pragma mark - NSWindowController Override methods
@@ -241,6 +251,12 @@
 	}
 }
 
+- (void)captureStatsDidChange:(NSNotification *)notification
+{
+	if([[self document] deviceType] == PCAP_DEVICE)
+		[self updatePacketStats];
+}
+
 #pragma mark - NSSplitView Delegates
 
 - (BOOL)splitView:(NSSplitView *)splitView
@@ -652,6 +668,42 @@ constrainMaxCoordinate:(CGFloat)proposedMax
 	else
 		temp = [[NSString alloc] initWithString:@"0 packets, 0 bytes"];
 	
+	/* Copies of the same packet seen on more than one merged source. */
+	if(capture && capture.duplicates > 0)
+	{
+		NSString *withDuplicates = [[NSString alloc] initWithFormat:
+									@"%@, %llu duplicates", temp,
+									capture.duplicates];
+		[temp release];
+		temp = withDuplicates;
+	}
+	
+	/* A sampled capture, scale back up to what crossed the wire. */
+	if(capture && capture.packetsEstimated != capture.packetsCaptured)
+	{
+		NSString *withEstimate = [[NSString alloc] initWithFormat:
+								  @"%@ (sampled from ~%llu packets, ~%1.1f MiB)",
+								  temp, capture.packetsEstimated,
+								  capture.bytesEstimated/1048576.0];
+		[temp release];
+		temp = withEstimate;
+	}
+	
+	/* Live captures also show what was lost on the way to us. */
+	if(capture && capture.deviceType == PCAP_DEVICE)
+	{
+		MACaptureStats *stats = [[_pcapController captureStats]
+								 objectForKey:[[capture fileURL]
+											   lastPathComponent]];
+		if(stats)
+		{
+			NSString *withDrops = [[NSString alloc] initWithFormat:@"%@ — %@",
+								   temp, [stats summary]];
+			[temp release];
+			temp = withDrops;
+		}
+	}
+	
 	[_statusLabel setStringValue:temp];
 	[temp release];
 }
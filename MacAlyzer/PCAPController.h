@@ -33,26 +33,11 @@
 #import <Foundation/Foundation.h>
 #import <pcap/pcap.h>
 
+#import "ConfigurationConstants.h"
+#import "MAPipeline.h"
 #import "MAProtocols.h"
-
-
-#define readall(fd,buf,size)											\
-	{																	\
-		ssize_t req_size = size;										\
-		ssize_t cur_size = 0;											\
-		ssize_t temp;													\
-		while(cur_size < req_size)										\
-		{																\
-			if((temp = read(fd, buf+cur_size, size-cur_size)) == -1)	\
-			{															\
-				switch(errno)											\
-				{														\
-					/* XXX error checking */							\
-				}														\
-			}															\
-			cur_size += temp;											\
-		}																\
-	}
+#import "MAQueue.h"
+#import "MARecord.h"
 
 
 @class SFAuthorization;
@@ -60,7 +45,18 @@
 @class MACaptureStats;
 
 
-@interface PCAPController : NSObject <PCAPControllerProtocol> {
+/* A device as announced on the FIFO, by its transport index. */
+typedef struct
+{
+	NSString *name;
+	NSString *uuid;
+	int dataLink;
+	ma_pipeline_t *pipeline;
+} ma_transport_device_t;
+
+
+@interface PCAPController : NSObject
+<PCAPControllerProtocol,MAStatisticsReporting> {
 	SidebarController *_sidebarController;
 	id _delegate;
 	SFAuthorization *_auth;
@@ -74,7 +70,17 @@
 	NSConnection *_conn;
 	BOOL _isConnected;
 	
+	ma_queue_t *_decodeQueue;
+	ma_queue_t *_deliverQueue;
+	dispatch_source_t _decodeSource;		/* drains _decodeQueue */
+	dispatch_source_t _deliverSource;		/* drains _deliverQueue on main */
+	ma_queue_policy_t _queuePolicy;
+	
+	/* Only touched from the FIFO queue. */
+	ma_transport_device_t *_transportDevices[MATransportMaxDevices];
+	
 	NSDictionary *_deviceList;
+	NSDictionary *_captureStats;
 	char _errbuf[PCAP_ERRBUF_SIZE];
 }
 
@@ -85,10 +91,19 @@
 
 - (BOOL)setupDispatchQueue;
 - (void)closeDispatchQueue;
+- (void)readFrame;
+- (void)abandonFIFO:(const char *)reason;
+- (BOOL)decodeFrame;
+- (void)deliverPackets;
+- (void)setTransportDevice:(const ma_frame_device_t *)device;
+
+- (void)updateCaptureStats;
 
 
 @property (readwrite, assign) id delegate;
 @property (readonly) BOOL isConnected;
 @property (readonly) NSDictionary *deviceList;
+@property (readonly) NSDictionary *captureStats;
+@property (readwrite) ma_queue_policy_t queuePolicy;
 
 @end
@@ -33,15 +33,109 @@
 #import "PCAPController.h"
 
 #import <SecurityFoundation/SFAuthorization.h>
+#import <errno.h>
 #import <sys/types.h>
 #import <sys/stat.h>
 
 #import "ConfigurationConstants.h"
 #import "MACaptureDevice.h"
+#import "MACaptureStats.h"
 #import "MAPacket.h"
 #import "MADate.h"
+#import "MAPipelineStats.h"
+#import "MARecord.h"
 
 
+/*
+ * Read exactly size bytes from fd, retrying when interrupted. Returns NO
+ * on end of file or any other read error.
+ */
+static BOOL
+readall(int fd, void *buf, size_t size)
+{
+	size_t cur_size = 0;
+	ssize_t temp;
+	
+	while(cur_size < size)
+	{
+		if((temp = read(fd, (char *)buf+cur_size, size-cur_size)) == -1)
+		{
+			switch(errno)
+			{
+				case EINTR:
+					continue;
+				
+				default:
+					NSLog(@"%s(): %s", __func__, strerror(errno));
+					return NO;
+			}
+		}
+		
+		/* mahelper closed its end of the FIFO. */
+		if(temp == 0)
+			return NO;
+		
+		cur_size += temp;
+	}
+	
+	return YES;
+}
+
+/* A frame read from the FIFO, waiting to be decoded. */
+typedef struct
+{
+	NSString *uuid;
+	int dataLink;
+	ma_pipeline_t *pipeline;
+	NSUInteger count;
+	NSUInteger length;
+	uint64_t readAt;
+	u_char body[];
+} ma_fifo_item_t;
+
+
+static void
+ma_fifo_item_free(ma_fifo_item_t *item)
+{
+	[item->uuid release];
+	free(item);
+}
+
+static void
+ma_decode_shed(void *obj)
+{
+	ma_fifo_item_t *item = obj;
+	
+	ma_pipeline_shed(item->pipeline, MA_STAGE_DISPATCH, item->count);
+	ma_fifo_item_free(item);
+}
+
+static void
+ma_deliver_shed(void *obj)
+{
+	MAPacket *packet = obj;
+	
+	ma_pipeline_shed([packet pipeline], MA_STAGE_MAIN_QUEUE, 1);
+	[packet release];
+}
+
+/*
+ * Push a frame's worth of packets onto the deliver queue in one lock
+ * hold. The ones it refuses count as shed, as if the queue had shed them.
+ */
+static NSUInteger
+ma_deliver_push(ma_queue_t *q, MAPacket **packets, const size_t *sizes,
+				NSUInteger count)
+{
+	NSUInteger pushed = ma_queue_push_batch(q, (void **)packets, sizes, count);
+	NSUInteger i;
+	
+	for(i = pushed; i < count; i++)
+		ma_deliver_shed(packets[i]);
+	
+	return pushed;
+}
+
 @implementation PCAPController
 
 static PCAPController *sharedController = nil;
@@ -113,13 +207,21 @@ static PCAPController *sharedController = nil;
 		NSLog(@"Oops! (%s)", __func__);
 	}
 	
+	_queuePolicy = ma_queue_policy_from_string([[NSUserDefaults standardUserDefaults]
+												stringForKey:MAQueuePolicyKey]);
+	_decodeQueue = ma_queue_create(MAAppQueueLength, MAAppQueueBytes,
+								   _queuePolicy, ma_decode_shed);
+	_deliverQueue = ma_queue_create(MAAppQueueLength, MAAppQueueBytes,
+									_queuePolicy, ma_deliver_shed);
+	
 	return self;
 }
 
 - (void)dealloc
 {
 	/* Close our file and delete it. */
-	close(_pcapPipe);
+	if(_pcapPipe != -1)
+		close(_pcapPipe);
 	unlink(_pcapPipeName);
 	
 	[_pcapProxy stopRunLoop];
@@ -127,6 +229,19 @@ static PCAPController *sharedController = nil;
 	[_conn registerName:nil];
 	[_conn release];
 	[_auth release];
+	
+	ma_queue_destroy(_decodeQueue);
+	ma_queue_destroy(_deliverQueue);
+	
+	for(NSUInteger i = 0; i < MATransportMaxDevices; i++)
+	{
+		if(_transportDevices[i] == NULL)
+			continue;
+		
+		[_transportDevices[i]->name release];
+		[_transportDevices[i]->uuid release];
+		free(_transportDevices[i]);
+	}
 	[super dealloc];
 }
 
@@ -145,7 +260,8 @@ static PCAPController *sharedController = nil;
 	
 	if(_pcapPipeName)
 	{
-		close(_pcapPipe);
+		if(_pcapPipe != -1)
+			close(_pcapPipe);
 		unlink(_pcapPipeName);
 	}
 	
@@ -207,6 +323,7 @@ static PCAPController *sharedController = nil;
 	_pcapProxy = [[NSConnection
 				   rootProxyForConnectionWithRegisteredName:key host:nil] retain];
 	[_pcapProxy setProtocolForProxy:@protocol(MAPCAPHelperProtocol)];
+	[_pcapProxy setQueuePolicy:ma_queue_policy_name(_queuePolicy)];
 	_isConnected = YES;
 	
 	/*
@@ -231,58 +348,351 @@ static PCAPController *sharedController = nil;
 	if(!_dispatchSource)
 		return NO;
 	
-	/* Process packets as they arrive and pass them off to our delegate. */
+	/*
+	 * Process packets as they arrive and pass them off to our delegate.
+	 * Both hops, FIFO -> decode and decode -> main queue, go through a
+	 * bounded queue. Pushing only pokes a data source, pokes made while
+	 * a drain is pending are merged into it, so however much the queues
+	 * shed there is never more than one drain waiting per hop.
+	 */
+	_decodeSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_DATA_ADD, 0, 0,
+										   dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0));
+	_deliverSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_DATA_ADD, 0, 0,
+											dispatch_get_main_queue());
+	if(!_decodeSource || !_deliverSource)
+		return NO;
+	
+	dispatch_source_set_event_handler(_decodeSource, ^{
+		while([self decodeFrame])
+			;
+	});
+	dispatch_source_set_event_handler(_deliverSource, ^{
+		[self deliverPackets];
+	});
 	dispatch_source_set_event_handler(_dispatchSource, ^{
-		char *data;
-		NSUInteger len;
+		[self readFrame];
+	});
+	dispatch_source_set_cancel_handler(_dispatchSource, ^{
+		close(_pcapPipe);
+		_pcapPipe = -1;
+	});
+	dispatch_resume(_decodeSource);
+	dispatch_resume(_deliverSource);
+	dispatch_resume(_dispatchSource);
+	
+	return YES;
+}
+
+/*
+ * Read one frame off the FIFO. Device frames only update the transport
+ * table, packet frames are resolved against it here, on the FIFO queue,
+ * and handed to the decode queue whole.
+ */
+- (void)readFrame
+{
+	u_char head[MA_FRAME_HEADER_SIZE];
+	ma_frame_type_t type;
+	uint32_t len;
+	ma_fifo_item_t *item;
+	ma_frame_packets_t packets;
+	ma_transport_device_t *dev;
+	
+	if(!readall(_pcapPipe, head, sizeof(head)))
+	{
+		[self abandonFIFO:"end of stream"];
+		return;
+	}
+	
+	if(!ma_frame_header(head, &type, &len) || len > MAMaxRecordSize)
+	{
+		[self abandonFIFO:"bad frame header"];
+		return;
+	}
+	
+	if(!(item = malloc(sizeof(*item)+len)))
+	{
+		[self abandonFIFO:"out of memory"];
+		return;
+	}
+	
+	if(!readall(_pcapPipe, item->body, len))
+	{
+		free(item);
+		[self abandonFIFO:"short frame"];
+		return;
+	}
+	item->readAt = ma_pipeline_now();
+	item->length = len;
+	item->uuid = nil;
+	
+	if(type == MA_FRAME_DEVICE)
+	{
+		ma_frame_device_t device;
 		
-		readall(_pcapPipe, &len, sizeof(len));
-		if(!(data = malloc(sizeof(*data)*len)))
-			return;
+		if(ma_frame_decode_device(item->body, len, &device))
+			[self setTransportDevice:&device];
+		else
+			NSLog(@"%s(): bad device frame", __func__);
+		free(item);
+		return;
+	}
+	
+	/* Newer frame types we don't understand are skipped. */
+	if(type != MA_FRAME_PACKETS)
+	{
+		free(item);
+		return;
+	}
+	
+	if(!ma_frame_decode_packets(item->body, len, &packets))
+	{
+		NSLog(@"%s(): bad packets frame", __func__);
+		free(item);
+		return;
+	}
+	
+	if(packets.device >= MATransportMaxDevices ||
+	   !(dev = _transportDevices[packets.device]))
+	{
+		NSLog(@"%s(): packets from unknown device %u", __func__,
+			  packets.device);
+		free(item);
+		return;
+	}
+	item->uuid = [dev->uuid retain];
+	item->dataLink = dev->dataLink;
+	item->pipeline = dev->pipeline;
+	item->count = packets.count;
+	
+	if(ma_queue_should_degrade(_decodeQueue))
+	{
+		NSUInteger cut;
 		
-		readall(_pcapPipe, data, sizeof(*data)*len);
+		item->length = ma_frame_truncate(item->body, len, MADegradedSnaplen,
+										 &cut);
+		if(cut > 0)
+		{
+			ma_queue_count_degraded(_decodeQueue);
+			ma_pipeline_degrade(item->pipeline, cut);
+		}
+	}
+	
+	if(!ma_queue_push(_decodeQueue, item, item->length))
+	{
+		ma_decode_shed(item);
+		return;
+	}
+	
+	dispatch_source_merge_data(_decodeSource, 1);
+}
+
+/*
+ * On the FIFO queue: a frame we couldn't read whole leaves the stream at
+ * an unknown offset, anything read after it would be garbage. Stop
+ * reading, the cancel handler closes the FIFO.
+ */
+- (void)abandonFIFO:(const char *)reason
+{
+	NSLog(@"%s(): %s, closing the FIFO", __func__, reason);
+	dispatch_source_cancel(_dispatchSource);
+}
+
+/*
+ * Turn the oldest frame on the decode queue into packets for the main
+ * queue. Returns NO once the decode queue is empty.
+ */
+- (BOOL)decodeFrame
+{
+	uint64_t startedAt = ma_pipeline_now();
+	ma_fifo_item_t *item;
+	ma_frame_packets_t packets;
+	ma_record_t rec;
+	ma_pipeline_t *pipe;
+	MAPacket *batch[MACaptureBatchLength];
+	size_t sizes[MACaptureBatchLength];
+	NSUInteger batched = 0;
+	NSUInteger pushed = 0;
+	NSUInteger seen = 0;
+	
+	if(!(item = ma_queue_pop(_decodeQueue, NO)))
+		return NO;
+	
+	if(!ma_frame_decode_packets(item->body, item->length, &packets))
+	{
+		ma_fifo_item_free(item);
+		return YES;
+	}
+	
+	pipe = item->pipeline;
+	ma_pipeline_record(pipe, MA_STAGE_FIFO, packets.enqueuedAt,
+					   item->readAt, packets.count, item->length);
+	ma_pipeline_record(pipe, MA_STAGE_DISPATCH, item->readAt,
+					   startedAt, packets.count, item->length);
+	
+	while(ma_frame_next_record(&packets, &rec))
+	{
+		MAPacket *newPacket;
 		
-		dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^{
-			char *packetData;
-			char *deviceName;
-			struct pcap_pkthdr *hdr;
-			NSUInteger packetId;
-			NSString *devName;
-			MAPacket *newPacket;
-			
-			packetId = *(NSUInteger *)data;
-			hdr = (struct pcap_pkthdr *)(data+sizeof(packetId));
-			packetData = (char *)hdr+sizeof(*hdr);
-			deviceName = packetData+hdr->caplen;
-			devName = [[NSString alloc] initWithBytes:deviceName
-											   length:len-(deviceName-data)
-											 encoding:NSUTF8StringEncoding];
+		seen++;
+		ma_pipeline_ingest(pipe);
+		ma_pipeline_record_ns(pipe, MA_STAGE_CAPTURE,
+							  ma_pipeline_capture_latency(&rec.hdr,
+														  rec.capturedAt),
+							  1, rec.hdr.caplen);
+		ma_pipeline_record(pipe, MA_STAGE_ENCODE, rec.capturedAt,
+						   packets.enqueuedAt, 1, rec.hdr.caplen);
+		
+		/* The main queue is backing up, only keep the headers. */
+		if(ma_queue_should_degrade(_deliverQueue) &&
+		   rec.hdr.caplen > MADegradedSnaplen)
+		{
+			rec.hdr.caplen = MADegradedSnaplen;
+			ma_queue_count_degraded(_deliverQueue);
+			ma_pipeline_degrade(pipe, 1);
+		}
+		
+		newPacket = [[MAPacket alloc] initWithData:rec.data
+										withHeader:&rec.hdr
+											withId:rec.packetId
+										  withUUID:item->uuid
+									  withDataLink:item->dataLink];
+		if(newPacket == nil)
+		{
+			ma_pipeline_drop(pipe, MA_STAGE_PACKET, 1);
+			continue;
+		}
+		
+		[newPacket setPipeline:pipe];
+		[newPacket setWeight:rec.weight];
+		[newPacket setCapturedAt:rec.capturedAt];
+		[newPacket setStagedAt:ma_pipeline_now()];
+		ma_pipeline_record(pipe, MA_STAGE_PACKET, startedAt,
+						   [newPacket stagedAt], 1, rec.hdr.caplen);
+		
+		batch[batched] = newPacket;
+		sizes[batched++] = rec.hdr.caplen;
+		if(batched == MACaptureBatchLength)
+		{
+			pushed += ma_deliver_push(_deliverQueue, batch, sizes, batched);
+			batched = 0;
+		}
+	}
+	if(batched > 0)
+		pushed += ma_deliver_push(_deliverQueue, batch, sizes, batched);
+	
+	/*
+	 * A record whose length runs past the frame ends it. The frame was
+	 * read whole so the FIFO stays in step, only the rest of this frame
+	 * is lost.
+	 */
+	if(seen < packets.count)
+	{
+		NSLog(@"%s(): bad record length, %lu of %lu records lost", __func__,
+			  (unsigned long)(packets.count-seen), (unsigned long)packets.count);
+		ma_pipeline_drop(pipe, MA_STAGE_FIFO, packets.count-seen);
+	}
+	ma_fifo_item_free(item);
+	
+	if(pushed > 0)
+		dispatch_source_merge_data(_deliverSource, pushed);
+	
+	return YES;
+}
+
+/*
+ * On the main queue: hand everything on the deliver queue to our delegate,
+ * a batch at a time.
+ */
+- (void)deliverPackets
+{
+	uint64_t mainAt = ma_pipeline_now();
+	void *popped[MACaptureBatchLength];
+	size_t sizes[MACaptureBatchLength];
+	NSUInteger n;
+	BOOL delivers = [_delegate respondsToSelector:@selector(addPacket:)];
+	
+	while((n = ma_queue_pop_batch(_deliverQueue, popped, sizes,
+								  MACaptureBatchLength, NO)) > 0)
+	{
+		for(NSUInteger i = 0; i < n; i++)
+		{
+			MAPacket *packet = popped[i];
 			
-			MACaptureDevice *dev = [self.deviceList objectForKey:devName];
-			newPacket = [[MAPacket alloc] initWithData:packetData
-											withHeader:hdr
-												withId:packetId
-											fromDevice:dev];
-			dispatch_async(dispatch_get_main_queue(), ^{
-				[self processPacket:newPacket];
-				[newPacket release];
-			});
+			ma_pipeline_record([packet pipeline], MA_STAGE_MAIN_QUEUE,
+							   [packet stagedAt], mainAt, 1,
+							   [packet length]);
+			[packet setStagedAt:mainAt];
 			
-			[devName release];
-			free(data);
-		});
-	});
-	dispatch_resume(_dispatchSource);
+			/*
+			 * Already on the main queue, hand the packet straight over;
+			 * going through processPacket: would add a second hop the
+			 * MAIN_QUEUE stage doesn't see.
+			 */
+			if(delivers)
+				[_delegate addPacket:packet];
+			else
+				ma_pipeline_drop([packet pipeline], MA_STAGE_BUFFER, 1);
+			[packet release];
+		}
+	}
+}
+
+/*
+ * mahelper announced a device index. The uuid and link type are looked up
+ * once here instead of asking the device proxy for them on every packet.
+ */
+- (void)setTransportDevice:(const ma_frame_device_t *)device
+{
+	NSAutoreleasePool *pool;
+	ma_transport_device_t *dev;
+	NSString *name;
 	
-	return YES;
+	if(device->index >= MATransportMaxDevices)
+	{
+		NSLog(@"%s(): device index %u out of range", __func__, device->index);
+		return;
+	}
+	
+	if(!(dev = _transportDevices[device->index]))
+	{
+		if(!(dev = calloc(1, sizeof(*dev))))
+			return;
+		_transportDevices[device->index] = dev;
+	}
+	
+	pool = [[NSAutoreleasePool alloc] init];
+	name = [[NSString alloc] initWithBytes:device->name
+									length:device->nameLen
+								  encoding:NSUTF8StringEncoding];
+	
+	[dev->name release];
+	[dev->uuid release];
+	dev->name = name;
+	dev->uuid = [[[self.deviceList objectForKey:name] uuid] copy];
+	dev->dataLink = device->dataLink;
+	dev->pipeline = [[MAPipelineStats sharedPipelineStats]
+					 pipelineForSource:name];
+	[pool drain];
 }
 
 - (void)closeDispatchQueue
 {
-	/* Stop our dispatch source and queue. */
+	/* Stop our dispatch sources and queue. */
 	dispatch_source_cancel(_dispatchSource);
 	dispatch_release(_dispatchSource);
 	dispatch_release(_dispatchQueue);
+	if(_decodeSource)
+	{
+		dispatch_source_cancel(_decodeSource);
+		dispatch_release(_decodeSource);
+		_decodeSource = NULL;
+	}
+	if(_deliverSource)
+	{
+		dispatch_source_cancel(_deliverSource);
+		dispatch_release(_deliverSource);
+		_deliverSource = NULL;
+	}
 }
 
 #pragma mark - Process Packets
@@ -290,13 +700,120 @@ static PCAPController *sharedController = nil;
 - (oneway void)processPacket:(MAPacket *)packet
 {
 	if(![_delegate respondsToSelector:@selector(addPacket:)])
+	{
+		ma_pipeline_drop([packet pipeline], MA_STAGE_BUFFER, 1);
 		return;
+	}
 	
 	dispatch_async(dispatch_get_main_queue(), ^{
 		[_delegate addPacket:packet];
 	});
 }
 
+#pragma mark - Overload Policy
+
+- (ma_queue_policy_t)queuePolicy
+{
+	return _queuePolicy;
+}
+
+- (void)setQueuePolicy:(ma_queue_policy_t)policy
+{
+	_queuePolicy = policy;
+	ma_queue_set_policy(_decodeQueue, policy);
+	ma_queue_set_policy(_deliverQueue, policy);
+	
+	[[NSUserDefaults standardUserDefaults] setObject:ma_queue_policy_name(policy)
+											  forKey:MAQueuePolicyKey];
+	
+	if(self.isConnected)
+		[_pcapProxy setQueuePolicy:ma_queue_policy_name(policy)];
+}
+
+#pragma mark - Capture Statistics
+
+/*
+ * Poll mahelper for the per-device counters and add the number of records
+ * that made it through the FIFO.
+ */
+- (void)updateCaptureStats
+{
+	NSDictionary *stats;
+	
+	if(!self.isConnected)
+		return;
+	
+	if(!(stats = [_pcapProxy captureStats]))
+		return;
+	
+	for(MACaptureStats *devStats in [stats objectEnumerator])
+	{
+		ma_pipeline_t *pipe;
+		
+		if([devStats helperEnqueued] == 0)
+			continue;
+		
+		pipe = [[MAPipelineStats sharedPipelineStats]
+				pipelineForSource:[devStats deviceName]];
+		[devStats setAppIngested:pipe->ingested];
+		[devStats setAppShed:pipe->shed];
+		[devStats setAppDegraded:pipe->degraded];
+	}
+	
+	[_captureStats release];
+	_captureStats = [stats retain];
+	
+	[[NSNotificationCenter defaultCenter]
+	 postNotificationName:MACaptureStatsNotificationKey
+				   object:self];
+}
+
+- (NSString *)statisticsReport
+{
+	NSMutableString *report = [NSMutableString string];
+	ma_queue_stats_t queueStats;
+	
+	[report appendFormat:@"overload policy: %@\n\n",
+	 ma_queue_policy_name(_queuePolicy)];
+	
+	/* Every device goes through the same two queues. */
+	[report appendFormat:@"%-12s %12s %12s %12s %12s %12s %12s\n",
+	 "queue", "enqueued", "refused", "shed", "truncated", "items", "bytes"];
+	ma_queue_stats(_decodeQueue, &queueStats);
+	[report appendFormat:@"%-12s %12llu %12llu %12llu %12llu %12lu %12lu\n",
+	 "decode", queueStats.enqueued, queueStats.refused, queueStats.shed,
+	 queueStats.degraded, (unsigned long)queueStats.count,
+	 (unsigned long)queueStats.bytes];
+	ma_queue_stats(_deliverQueue, &queueStats);
+	[report appendFormat:@"%-12s %12llu %12llu %12llu %12llu %12lu %12lu\n\n",
+	 "deliver", queueStats.enqueued, queueStats.refused, queueStats.shed,
+	 queueStats.degraded, (unsigned long)queueStats.count,
+	 (unsigned long)queueStats.bytes];
+	
+	[report appendFormat:@"%-12s %12s %12s %12s %12s %12s %12s %12s %12s %12s %12s %12s %12s %12s %12s %12s %12s\n",
+	 "device", "received", "kernel drop", "if drop", "enqueued",
+	 "helper shed", "helper trunc", "fifo drop", "ingested", "app shed",
+	 "app trunc", "triggers", "recorded", "disk drop", "sampled out",
+	 "flow cut", "duplicates"];
+	
+	for(NSString *name in [[_captureStats allKeys]
+						   sortedArrayUsingSelector:@selector(localizedCompare:)])
+	{
+		MACaptureStats *stats = [_captureStats objectForKey:name];
+		
+		[report appendFormat:@"%-12s %12llu %12llu %12llu %12llu %12llu %12llu %12llu %12llu %12llu %12llu %12llu %12llu %12llu %12llu %12llu %12llu\n",
+		 [name UTF8String], [stats kernelReceived], [stats kernelDropped],
+		 [stats interfaceDropped], [stats helperEnqueued],
+		 [stats helperShed], [stats helperDegraded],
+		 [stats transportDropped], [stats appIngested],
+		 [stats appShed], [stats appDegraded], [stats triggersFired],
+		 [stats recorded], [stats recordDropped], [stats sampledOut],
+		 [stats flowCut], [stats duplicates]];
+	}
+	
+	return report;
+}
+
 #pragma mark - Accessors
 
 - (NSDictionary *)deviceList
@@ -309,5 +826,6 @@ static PCAPController *sharedController = nil;
 
 @synthesize delegate			= _delegate;
 @synthesize isConnected			= _isConnected;
+@synthesize captureStats		= _captureStats;
 
 @end
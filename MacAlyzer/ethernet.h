@@ -38,4 +38,5 @@
 #define ETHERNET_SIZE	sizeof(struct ether_header)
 
 
+NSString *ethernet_host_string(const u_char *data);
 void ethernet_input(pbuf_t *pbuf);
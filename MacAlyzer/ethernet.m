@@ -181,7 +181,15 @@ ethernet_input(pbuf_t *pbuf)
 		case PAN_INFO_STRING:
 			ethernet_info_string(pbuf);
 			break;
+			
+		case PAN_PROTO_PATH:
+			PAN_PATH_PUSH(pbuf, "Ethernet")
+			break;
 	}
 	pan_header_t *e = ethernet_itoet(ntohs(ethernet_type_ptr(pbuf->data)));
+	
+	/* Known types we can't dissect yet still get their own node. */
+	if(pbuf->req == PAN_PROTO_PATH && e && !e->pan)
+		PAN_PATH_PUSH(pbuf, e->description)
 	PAN_NEXT(pbuf, e, ETHERNET_SIZE)
 }
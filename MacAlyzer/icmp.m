@@ -64,6 +64,10 @@ icmp_input(pbuf_t *pbuf)
 			icmp_info_string(pbuf);
 			break;
 			
+		case PAN_PROTO_PATH:
+			PAN_PATH_PUSH(pbuf, "ICMP")
+			break;
+			
 		default:
 			break;
 	}
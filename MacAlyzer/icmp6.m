@@ -63,6 +63,10 @@ icmp6_input(pbuf_t *pbuf)
 			icmp6_info_string(pbuf);
 			break;
 			
+		case PAN_PROTO_PATH:
+			PAN_PATH_PUSH(pbuf, "ICMPv6")
+			break;
+			
 		default:
 			break;
 	}
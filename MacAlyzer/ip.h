@@ -152,4 +152,5 @@
 #define	IPPROTO_MAX			256
 
 
+NSString *ip_host_string(BOOL legacy, const u_char *data);
 void ip_input(pbuf_t *pbuf);
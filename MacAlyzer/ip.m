@@ -188,6 +188,10 @@ ip_input(pbuf_t *pbuf)
 		case PAN_INFO_STRING:
 			ip_info_string(pbuf);
 			break;
+			
+		case PAN_PROTO_PATH:
+			PAN_PATH_PUSH(pbuf, ip_isLegacy(pbuf->data) ? "IPv4" : "IPv6")
+			break;
 	}
 	
 	uint8_t proto;
@@ -199,5 +203,20 @@ ip_input(pbuf_t *pbuf)
 	
 	pan_header_t *p = ip_itoet(proto);
 	uint16_t len = ip_header_len(pbuf->data);
+	ssize_t payload = pbuf->payload;
+	
+	/*
+	 * The captured length can be cut short by the snaplen or padded by
+	 * the link layer, the IP length is what was sent. Segmentation
+	 * offload leaves it at zero, then the captured length has to do.
+	 */
+	if(ip_isLegacy(pbuf->data))
+		pbuf->payload = MAX((ssize_t)ntohs(((struct ip *)pbuf->data)->ip_len)-len, 0);
+	else
+		pbuf->payload = ntohs(((struct ip6_hdr *)pbuf->data)->ip6_plen);
+	
+	if(pbuf->req == PAN_PROTO_PATH && p && !p->pan)
+		PAN_PATH_PUSH(pbuf, p->name+sizeof("IPPROTO_")-1)
 	PAN_NEXT(pbuf, p, len)
+	pbuf->payload = payload;
 }
@@ -97,6 +97,9 @@ null_input(pbuf_t *pbuf)
 		case PAN_INFO_STRING:
 			null_info_string(pbuf);
 			break;
+		case PAN_PROTO_PATH:
+			PAN_PATH_PUSH(pbuf, "Loopback")
+			break;
 			
 		default:
 			break;
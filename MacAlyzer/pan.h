@@ -54,18 +54,39 @@ typedef enum
 	PAN_SRC_STRING,
 	PAN_DST_STRING,
 	PAN_PROTO_STRING,
-	PAN_INFO_STRING
+	PAN_INFO_STRING,
+	PAN_PROTO_PATH
 } pan_req_t;
 
+/*
+ * The layers a packet was dissected into, outermost first. Names are
+ * string constants owned by the dissectors.
+ */
+#define PAN_PATH_MAX		8
+
+typedef struct
+{
+	const char *layer[PAN_PATH_MAX];
+	int depth;
+} pan_path_t;
+
 typedef struct
 {
 	int dlt;
 	ssize_t len;
+	ssize_t payload;	/* bytes the network layer says follow it, 0 if unknown */
 	pan_req_t req;
 	id obj;
 	const u_char *data;
+	pan_path_t *path;
 } pbuf_t;
 
+#define PAN_PATH_PUSH(p, name)										\
+	{																\
+		if((p)->path && (p)->path->depth < PAN_PATH_MAX)			\
+			(p)->path->layer[(p)->path->depth++] = (name);			\
+	}																\
+
 #define p_dat(p)	(p->dat+p->pos)
 
 typedef void (*pan_t)(pbuf_t *);
@@ -85,3 +106,4 @@ static const char *pan_itos(int type);
 static pan_t pan_itop(int type);
 
 id pan_input(pan_req_t req, int dlt, const u_char *buf, size_t len);
+int pan_path(int dlt, const u_char *buf, size_t len, pan_path_t *path);
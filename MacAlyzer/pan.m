@@ -218,3 +218,36 @@ pan_input(pan_req_t req, int dlt, const u_char *buf, size_t len)
 	
 	return p_buf.obj;
 }
+
+/*
+ * Walks the dissectors for the layers of a packet, without building any
+ * strings. A link type with no dissector is still named, from dlt_types.
+ */
+int
+pan_path(int dlt, const u_char *buf, size_t len, pan_path_t *path)
+{
+	pbuf_t p_buf = {0};
+	int i;
+	
+	p_buf.dlt = dlt;
+	p_buf.len = len;
+	p_buf.req = PAN_PROTO_PATH;
+	p_buf.obj = nil;
+	p_buf.data = buf;
+	p_buf.path = path;
+	path->depth = 0;
+	
+	for(i = 0; dlt_types[i].name; i++)
+	{
+		if(dlt_types[i].type != dlt)
+			continue;
+		
+		if(dlt_types[i].pan)
+			(*dlt_types[i].pan)(&p_buf);
+		else
+			PAN_PATH_PUSH(&p_buf, dlt_types[i].description)
+		break;
+	}
+	
+	return path->depth;
+}
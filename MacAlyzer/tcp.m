@@ -107,7 +107,10 @@ tcp_info_string(pbuf_t *pbuf)
 	
 #undef FLAGS_APPEND
 	
-	[str appendFormat:@"] "];
+	[str appendFormat:@"] Seq=%u Ack=%u Win=%hu Len=%zd",
+	 ntohl(hdr->th_seq), ntohl(hdr->th_ack), ntohs(hdr->th_win),
+	 MAX((pbuf->payload > 0 ? pbuf->payload : pbuf->len)-
+		 (ssize_t)hdr->th_off*4, 0)];
 	
 	pbuf->obj = str;
 }
@@ -133,5 +136,9 @@ tcp_input(pbuf_t *pbuf)
 		case PAN_INFO_STRING:
 			tcp_info_string(pbuf);
 			break;
+			
+		case PAN_PROTO_PATH:
+			PAN_PATH_PUSH(pbuf, "TCP")
+			break;
 	}
 }
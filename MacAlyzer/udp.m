@@ -95,5 +95,9 @@ udp_input(pbuf_t *pbuf)
 		case PAN_INFO_STRING:
 			udp_info_string(pbuf);
 			break;
+			
+		case PAN_PROTO_PATH:
+			PAN_PATH_PUSH(pbuf, "UDP")
+			break;
 	}
 }
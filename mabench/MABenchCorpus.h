@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+#import <pcap/pcap.h>
+
+
+/* A single packet in a benchmark corpus, with its layer offsets resolved. */
+typedef struct
+{
+	struct pcap_pkthdr hdr;
+	u_char *data;
+	int dlt;
+	ssize_t linkOffset;			/* -1 if not present */
+	ssize_t networkOffset;		/* -1 if not present */
+	ssize_t transportOffset;	/* -1 if not present */
+	BOOL networkLegacy;			/* IPv4 (YES) or IPv6 (NO) */
+	uint8_t transportProto;
+} ma_bench_packet_t;
+
+typedef struct
+{
+	char name[128];
+	NSUInteger count;
+	NSUInteger bytes;
+	ma_bench_packet_t *packets;
+} ma_bench_corpus_t;
+
+
+ma_bench_corpus_t *ma_corpus_synthetic_mixed(void);
+ma_bench_corpus_t *ma_corpus_synthetic_bulk(void);
+ma_bench_corpus_t *ma_corpus_load(const char *path);
+void ma_corpus_free(ma_bench_corpus_t *corpus);
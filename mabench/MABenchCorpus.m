@@ -0,0 +1,422 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import "MABenchCorpus.h"
+
+#import <arpa/inet.h>
+#import <netinet/in.h>
+#import <sys/socket.h>
+
+
+#define CORPUS_MIXED_COUNT		1024
+#define CORPUS_BULK_COUNT		256
+#define CORPUS_BULK_SIZE		1514
+
+#define ETHER_HDR_LEN			14
+#define NULL_HDR_LEN			4
+#define IP4_HDR_LEN				20
+#define IP6_HDR_LEN				40
+#define TCP_HDR_LEN				20
+#define UDP_HDR_LEN				8
+#define ICMP_HDR_LEN			8
+
+#define ETHERTYPE_IPV4_		0x0800
+#define ETHERTYPE_IPV6_		0x86dd
+#define ETHERTYPE_ARP_		0x0806
+
+
+/*
+ * The synthetic corpora must be identical from run to run, so we use our
+ * own generator rather than random().
+ */
+static uint32_t
+corpus_next(uint32_t *state)
+{
+	*state = *state*1103515245+12345;
+	return *state >> 8;
+}
+
+static ma_bench_corpus_t *
+corpus_alloc(const char *name, NSUInteger count)
+{
+	ma_bench_corpus_t *corpus;
+	
+	if(!(corpus = calloc(1, sizeof(*corpus))))
+		return NULL;
+	
+	if(!(corpus->packets = calloc(count, sizeof(*corpus->packets))))
+	{
+		free(corpus);
+		return NULL;
+	}
+	
+	strlcpy(corpus->name, name, sizeof(corpus->name));
+	return corpus;
+}
+
+/*
+ * Work out the offsets of each layer so the per-protocol benchmarks can
+ * start dissecting at the right place.
+ */
+static void
+corpus_resolve(ma_bench_packet_t *p)
+{
+	const u_char *d = p->data;
+	ssize_t caplen = p->hdr.caplen;
+	ssize_t off = -1;
+	
+	p->linkOffset = -1;
+	p->networkOffset = -1;
+	p->transportOffset = -1;
+	
+	if(p->dlt == DLT_EN10MB && caplen >= ETHER_HDR_LEN)
+	{
+		uint16_t type = (d[12] << 8)|d[13];
+		
+		p->linkOffset = 0;
+		if(type == ETHERTYPE_IPV4_ || type == ETHERTYPE_IPV6_)
+			off = ETHER_HDR_LEN;
+	}
+	else if(p->dlt == DLT_NULL && caplen >= NULL_HDR_LEN)
+	{
+		p->linkOffset = 0;
+		off = NULL_HDR_LEN;
+	}
+	
+	if(off < 0 || off >= caplen)
+		return;
+	
+	if((d[off] >> 4) == 4 && caplen-off >= IP4_HDR_LEN)
+	{
+		p->networkOffset = off;
+		p->networkLegacy = YES;
+		p->transportProto = d[off+9];
+		off += (d[off] & 0x0f)*4;
+	}
+	else if((d[off] >> 4) == 6 && caplen-off >= IP6_HDR_LEN)
+	{
+		p->networkOffset = off;
+		p->networkLegacy = NO;
+		p->transportProto = d[off+6];
+		off += IP6_HDR_LEN;
+	}
+	else
+		return;
+	
+	if(off < caplen)
+		p->transportOffset = off;
+}
+
+static void
+put16(u_char *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v & 0xff;
+}
+
+static void
+put32(u_char *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = (v >> 16) & 0xff;
+	p[2] = (v >> 8) & 0xff;
+	p[3] = v & 0xff;
+}
+
+static size_t
+build_link(u_char *buf, int dlt, BOOL legacy, uint32_t *state)
+{
+	if(dlt == DLT_NULL)
+	{
+		uint32_t family = (legacy ? AF_INET : AF_INET6);
+		memcpy(buf, &family, sizeof(family));
+		return NULL_HDR_LEN;
+	}
+	
+	uint32_t r = corpus_next(state);
+	u_char dst[6] = { 0x00, 0x1c, 0x42, r & 0xff, (r >> 8) & 0xff, 0x01 };
+	u_char src[6] = { 0x00, 0x25, 0x00, (r >> 16) & 0xff, r & 0xff, 0x02 };
+	
+	memcpy(buf, dst, sizeof(dst));
+	memcpy(buf+6, src, sizeof(src));
+	put16(buf+12, (legacy ? ETHERTYPE_IPV4_ : ETHERTYPE_IPV6_));
+	return ETHER_HDR_LEN;
+}
+
+static size_t
+build_network(u_char *buf, BOOL legacy, uint8_t proto, size_t payload,
+			  uint32_t *state)
+{
+	uint32_t r = corpus_next(state);
+	
+	if(legacy)
+	{
+		buf[0] = 0x45;
+		put16(buf+2, IP4_HDR_LEN+payload);
+		put16(buf+4, r & 0xffff);
+		buf[8] = 64;
+		buf[9] = proto;
+		put32(buf+12, 0x0a000000|(r & 0xffff));
+		put32(buf+16, 0xc0a80000|((r >> 8) & 0xffff));
+		return IP4_HDR_LEN;
+	}
+	
+	buf[0] = 0x60;
+	put16(buf+4, payload);
+	buf[6] = proto;
+	buf[7] = 64;
+	put32(buf+8, 0x20010db8);
+	put32(buf+20, r);
+	put32(buf+24, 0x20010db8);
+	put32(buf+36, r ^ 0xffff);
+	return IP6_HDR_LEN;
+}
+
+static size_t
+build_transport(u_char *buf, uint8_t proto, size_t payload, uint32_t *state)
+{
+	uint32_t r = corpus_next(state);
+	
+	switch(proto)
+	{
+		case IPPROTO_TCP:
+			put16(buf, 1024+(r % 60000));
+			put16(buf+2, (r & 1) ? 80 : 443);
+			put32(buf+4, r);
+			put32(buf+8, r*7);
+			buf[12] = (TCP_HDR_LEN/4) << 4;
+			buf[13] = (payload ? 0x18 : ((r & 2) ? 0x02 : 0x12));
+			put16(buf+14, 65535);
+			return TCP_HDR_LEN;
+			
+		case IPPROTO_UDP:
+			put16(buf, 1024+(r % 60000));
+			put16(buf+2, 53);
+			put16(buf+4, UDP_HDR_LEN+payload);
+			return UDP_HDR_LEN;
+			
+		case IPPROTO_ICMP:
+		case IPPROTO_ICMPV6:
+			buf[0] = (proto == IPPROTO_ICMP ? 8 : 128);
+			put16(buf+4, r & 0xffff);
+			return ICMP_HDR_LEN;
+	}
+	
+	return 0;
+}
+
+static BOOL
+build_packet(ma_bench_packet_t *p, int dlt, BOOL legacy, uint8_t proto,
+			 size_t payload, uint32_t *state)
+{
+	size_t len;
+	size_t max = ETHER_HDR_LEN+IP6_HDR_LEN+TCP_HDR_LEN+payload;
+	
+	if(!(p->data = calloc(1, max)))
+		return NO;
+	
+	len = build_link(p->data, dlt, legacy, state);
+	len += build_network(p->data+len, legacy, proto,
+						 (proto == IPPROTO_TCP ? TCP_HDR_LEN :
+						  (proto == IPPROTO_UDP ? UDP_HDR_LEN : ICMP_HDR_LEN))+
+						 payload, state);
+	len += build_transport(p->data+len, proto, payload, state);
+	
+	/* Fill the payload with something that looks vaguely like text. */
+	for(size_t i = 0; i < payload; i++)
+		p->data[len+i] = 0x20+((i+*state) % 0x5f);
+	len += payload;
+	
+	p->dlt = dlt;
+	p->hdr.caplen = (bpf_u_int32)len;
+	p->hdr.len = (bpf_u_int32)len;
+	p->hdr.ts.tv_sec = 1300000000+(*state % 86400);
+	p->hdr.ts.tv_usec = *state % 1000000000;
+	
+	corpus_resolve(p);
+	return YES;
+}
+
+
+/*
+ * A mix of small control traffic, DNS, ICMP and some bulk TCP over
+ * Ethernet and BSD loopback, both address families.
+ */
+ma_bench_corpus_t *
+ma_corpus_synthetic_mixed(void)
+{
+	static const struct
+	{
+		int dlt;
+		BOOL legacy;
+		uint8_t proto;
+		size_t payload;
+	} shapes[] = {
+		{ DLT_EN10MB, YES, IPPROTO_TCP, 0 },
+		{ DLT_EN10MB, YES, IPPROTO_TCP, 1460 },
+		{ DLT_EN10MB, YES, IPPROTO_TCP, 512 },
+		{ DLT_EN10MB, YES, IPPROTO_UDP, 40 },
+		{ DLT_EN10MB, YES, IPPROTO_ICMP, 56 },
+		{ DLT_EN10MB, NO, IPPROTO_TCP, 0 },
+		{ DLT_EN10MB, NO, IPPROTO_TCP, 1440 },
+		{ DLT_EN10MB, NO, IPPROTO_UDP, 96 },
+		{ DLT_EN10MB, NO, IPPROTO_ICMPV6, 24 },
+		{ DLT_NULL, YES, IPPROTO_UDP, 64 },
+		{ DLT_NULL, NO, IPPROTO_TCP, 200 },
+	};
+	ma_bench_corpus_t *corpus;
+	uint32_t state = 0x4d41;
+	NSUInteger i;
+	
+	if(!(corpus = corpus_alloc("synthetic.mixed", CORPUS_MIXED_COUNT)))
+		return NULL;
+	
+	for(i = 0; i < CORPUS_MIXED_COUNT; i++)
+	{
+		size_t s = corpus_next(&state) % (sizeof(shapes)/sizeof(*shapes));
+		
+		if(!build_packet(&corpus->packets[i], shapes[s].dlt, shapes[s].legacy,
+						 shapes[s].proto, shapes[s].payload, &state))
+			break;
+		
+		corpus->count++;
+		corpus->bytes += corpus->packets[i].hdr.caplen;
+	}
+	
+	return corpus;
+}
+
+/*
+ * Full sized Ethernet/IPv4/TCP frames, the worst case for the formatters.
+ */
+ma_bench_corpus_t *
+ma_corpus_synthetic_bulk(void)
+{
+	ma_bench_corpus_t *corpus;
+	uint32_t state = 0x4242;
+	size_t payload = CORPUS_BULK_SIZE-ETHER_HDR_LEN-IP4_HDR_LEN-TCP_HDR_LEN;
+	NSUInteger i;
+	
+	if(!(corpus = corpus_alloc("synthetic.bulk", CORPUS_BULK_COUNT)))
+		return NULL;
+	
+	for(i = 0; i < CORPUS_BULK_COUNT; i++)
+	{
+		if(!build_packet(&corpus->packets[i], DLT_EN10MB, YES, IPPROTO_TCP,
+						 payload, &state))
+			break;
+		
+		corpus->count++;
+		corpus->bytes += corpus->packets[i].hdr.caplen;
+	}
+	
+	return corpus;
+}
+
+/*
+ * Load a recorded savefile into memory.
+ */
+ma_bench_corpus_t *
+ma_corpus_load(const char *path)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+	char name[128];
+	struct pcap_pkthdr *hdr;
+	const u_char *data;
+	ma_bench_corpus_t *corpus;
+	NSUInteger capacity = 1024;
+	const char *base;
+	pcap_t *session;
+	int dlt;
+	
+	if(!(session = pcap_open_offline(path, errbuf)))
+	{
+		fprintf(stderr, "mabench: %s\n", errbuf);
+		return NULL;
+	}
+	
+	base = strrchr(path, '/');
+	snprintf(name, sizeof(name), "recorded.%s", (base ? base+1 : path));
+	
+	dlt = pcap_datalink(session);
+	if(!(corpus = corpus_alloc(name, capacity)))
+	{
+		pcap_close(session);
+		return NULL;
+	}
+	
+	while(pcap_next_ex(session, &hdr, &data) == 1)
+	{
+		ma_bench_packet_t *p;
+		
+		if(corpus->count == capacity)
+		{
+			ma_bench_packet_t *temp;
+			
+			capacity *= 2;
+			if(!(temp = realloc(corpus->packets, capacity*sizeof(*temp))))
+				break;
+			corpus->packets = temp;
+		}
+		
+		p = &corpus->packets[corpus->count];
+		memset(p, 0, sizeof(*p));
+		if(!(p->data = malloc(hdr->caplen)))
+			break;
+		
+		memcpy(p->data, data, hdr->caplen);
+		memcpy(&p->hdr, hdr, sizeof(p->hdr));
+		p->dlt = dlt;
+		corpus_resolve(p);
+		
+		corpus->count++;
+		corpus->bytes += hdr->caplen;
+	}
+	
+	pcap_close(session);
+	return corpus;
+}
+
+void
+ma_corpus_free(ma_bench_corpus_t *corpus)
+{
+	NSUInteger i;
+	
+	if(!corpus)
+		return;
+	
+	for(i = 0; i < corpus->count; i++)
+		free(corpus->packets[i].data);
+	
+	free(corpus->packets);
+	free(corpus);
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+
+#import "MABenchCorpus.h"
+
+
+#define MA_BENCH_SCHEMA_VERSION		1
+#define MA_BENCH_DEFAULT_ITERATIONS	50
+
+
+typedef BOOL (^ma_bench_filter_t)(const ma_bench_packet_t *packet);
+typedef void (^ma_bench_block_t)(const ma_bench_packet_t *packet);
+typedef BOOL (^ma_bench_reset_t)(void);
+
+typedef struct
+{
+	char name[128];
+	char corpus[128];
+	NSUInteger packets;			/* Packets per iteration. */
+	NSUInteger bytes;			/* Bytes per iteration. */
+	NSUInteger iterations;
+	double nsPerPacket;			/* Median over all iterations. */
+	double nsPerPacketMin;
+	double allocsPerPacket;
+	double bytesPerSec;
+} ma_bench_result_t;
+
+
+void ma_bench_init(void);
+BOOL ma_bench_run(const char *name, const ma_bench_corpus_t *corpus,
+				  NSUInteger iterations, ma_bench_filter_t filter,
+				  ma_bench_reset_t reset, ma_bench_block_t block,
+				  ma_bench_result_t *result);
+void ma_bench_write_json(FILE *out, ma_bench_corpus_t **corpora,
+						 NSUInteger corpusCount,
+						 const ma_bench_result_t *results,
+						 NSUInteger resultCount);
@@ -0,0 +1,292 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import "MABenchmark.h"
+
+#import <mach/mach.h>
+#import <mach/mach_time.h>
+#import <malloc/malloc.h>
+
+
+static mach_timebase_info_data_t bench_timebase;
+static volatile int64_t bench_allocs;
+
+static void *(*bench_zone_malloc)(malloc_zone_t *, size_t);
+static void *(*bench_zone_calloc)(malloc_zone_t *, size_t, size_t);
+static void *(*bench_zone_valloc)(malloc_zone_t *, size_t);
+static void *(*bench_zone_realloc)(malloc_zone_t *, void *, size_t);
+
+
+/*
+ * Allocation counting. We hook the default malloc zone rather than
+ * interposing malloc(3) so Objective-C allocations are counted as well.
+ */
+static void *
+bench_malloc(malloc_zone_t *zone, size_t size)
+{
+	__sync_fetch_and_add(&bench_allocs, 1);
+	return bench_zone_malloc(zone, size);
+}
+
+static void *
+bench_calloc(malloc_zone_t *zone, size_t count, size_t size)
+{
+	__sync_fetch_and_add(&bench_allocs, 1);
+	return bench_zone_calloc(zone, count, size);
+}
+
+static void *
+bench_valloc(malloc_zone_t *zone, size_t size)
+{
+	__sync_fetch_and_add(&bench_allocs, 1);
+	return bench_zone_valloc(zone, size);
+}
+
+static void *
+bench_realloc(malloc_zone_t *zone, void *ptr, size_t size)
+{
+	__sync_fetch_and_add(&bench_allocs, 1);
+	return bench_zone_realloc(zone, ptr, size);
+}
+
+static void
+bench_hook_zone(malloc_zone_t *zone)
+{
+	vm_address_t start = trunc_page((vm_address_t)zone);
+	vm_size_t size = round_page((vm_address_t)zone+sizeof(*zone))-start;
+	
+	/* The zone structure is read-only on newer systems. */
+	if(vm_protect(mach_task_self(), start, size, 0,
+				  VM_PROT_READ|VM_PROT_WRITE) != KERN_SUCCESS)
+	{
+		fprintf(stderr, "mabench: allocation counting unavailable\n");
+		return;
+	}
+	
+	bench_zone_malloc = zone->malloc;
+	bench_zone_calloc = zone->calloc;
+	bench_zone_valloc = zone->valloc;
+	bench_zone_realloc = zone->realloc;
+	
+	zone->malloc = bench_malloc;
+	zone->calloc = bench_calloc;
+	zone->valloc = bench_valloc;
+	zone->realloc = bench_realloc;
+	
+	vm_protect(mach_task_self(), start, size, 0, VM_PROT_READ);
+}
+
+static uint64_t
+bench_now(void)
+{
+	return mach_absolute_time()*bench_timebase.numer/bench_timebase.denom;
+}
+
+static int
+bench_compare(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	
+	return (x > y)-(x < y);
+}
+
+static void
+bench_json_string(FILE *out, const char *str)
+{
+	fputc('"', out);
+	for(; *str; str++)
+	{
+		if(*str == '"' || *str == '\\')
+			fputc('\\', out);
+		
+		if((u_char)*str < 0x20)
+			fprintf(out, "\\u%04x", *str);
+		else
+			fputc(*str, out);
+	}
+	fputc('"', out);
+}
+
+
+void
+ma_bench_init(void)
+{
+	mach_timebase_info(&bench_timebase);
+	bench_hook_zone(malloc_default_zone());
+}
+
+/*
+ * Run block over every packet in the corpus accepted by filter, iterations
+ * times (plus one untimed warm up pass). Stateful blocks pass reset, which
+ * is called untimed before every pass to start their state over, so each
+ * pass sees the corpus as new. Returns NO if no packets matched or reset
+ * failed.
+ */
+BOOL
+ma_bench_run(const char *name, const ma_bench_corpus_t *corpus,
+			 NSUInteger iterations, ma_bench_filter_t filter,
+			 ma_bench_reset_t reset, ma_bench_block_t block,
+			 ma_bench_result_t *result)
+{
+	NSAutoreleasePool *pool;
+	const ma_bench_packet_t **packets;
+	double *samples;
+	NSUInteger count = 0;
+	NSUInteger bytes = 0;
+	NSUInteger i, j;
+	int64_t allocs;
+	
+	if(iterations == 0 ||
+	   !(packets = malloc(sizeof(*packets)*corpus->count)))
+		return NO;
+	
+	/* Build the list of packets up front so filtering isn't timed. */
+	for(i = 0; i < corpus->count; i++)
+	{
+		if(filter && !filter(&corpus->packets[i]))
+			continue;
+		
+		packets[count++] = &corpus->packets[i];
+		bytes += corpus->packets[i].hdr.caplen;
+	}
+	
+	if(count == 0 || !(samples = malloc(sizeof(*samples)*iterations)))
+	{
+		free(packets);
+		return NO;
+	}
+	
+	/* Warm up caches and any lazily initialized state. */
+	if(reset && !reset())
+	{
+		free(samples);
+		free(packets);
+		return NO;
+	}
+	pool = [[NSAutoreleasePool alloc] init];
+	for(j = 0; j < count; j++)
+		block(packets[j]);
+	[pool drain];
+	
+	allocs = 0;
+	for(i = 0; i < iterations; i++)
+	{
+		uint64_t start;
+		int64_t before;
+		
+		if(reset && !reset())
+		{
+			free(samples);
+			free(packets);
+			return NO;
+		}
+		
+		before = bench_allocs;
+		start = bench_now();
+		
+		pool = [[NSAutoreleasePool alloc] init];
+		for(j = 0; j < count; j++)
+			block(packets[j]);
+		[pool drain];
+		
+		samples[i] = (double)(bench_now()-start)/count;
+		allocs += bench_allocs-before;
+	}
+	
+	qsort(samples, iterations, sizeof(*samples), bench_compare);
+	
+	memset(result, 0, sizeof(*result));
+	strlcpy(result->name, name, sizeof(result->name));
+	strlcpy(result->corpus, corpus->name, sizeof(result->corpus));
+	result->packets = count;
+	result->bytes = bytes;
+	result->iterations = iterations;
+	result->nsPerPacket = samples[iterations/2];
+	result->nsPerPacketMin = samples[0];
+	result->allocsPerPacket = (double)allocs/(count*iterations);
+	if(result->nsPerPacket > 0)
+	{
+		result->bytesPerSec = bytes/
+			(result->nsPerPacket*count/NSEC_PER_SEC);
+	}
+	
+	free(samples);
+	free(packets);
+	return YES;
+}
+
+/*
+ * Write the results as JSON. Keys and ordering never change between runs
+ * so two outputs can be compared directly.
+ */
+void
+ma_bench_write_json(FILE *out, ma_bench_corpus_t **corpora,
+					NSUInteger corpusCount, const ma_bench_result_t *results,
+					NSUInteger resultCount)
+{
+	NSUInteger i;
+	
+	fprintf(out, "{\n\t\"schema\": %d,\n\t\"corpora\": [", 
+			MA_BENCH_SCHEMA_VERSION);
+	for(i = 0; i < corpusCount; i++)
+	{
+		fprintf(out, "%s\n\t\t{ \"name\": ", (i ? "," : ""));
+		bench_json_string(out, corpora[i]->name);
+		fprintf(out, ", \"packets\": %lu, \"bytes\": %lu }",
+				(unsigned long)corpora[i]->count,
+				(unsigned long)corpora[i]->bytes);
+	}
+	
+	fprintf(out, "\n\t],\n\t\"results\": [");
+	for(i = 0; i < resultCount; i++)
+	{
+		const ma_bench_result_t *r = &results[i];
+		
+		fprintf(out, "%s\n\t\t{\n\t\t\t\"name\": ", (i ? "," : ""));
+		bench_json_string(out, r->name);
+		fprintf(out, ",\n\t\t\t\"corpus\": ");
+		bench_json_string(out, r->corpus);
+		fprintf(out, ",\n"
+				"\t\t\t\"packets\": %lu,\n"
+				"\t\t\t\"iterations\": %lu,\n"
+				"\t\t\t\"ns_per_packet\": %.2f,\n"
+				"\t\t\t\"ns_per_packet_min\": %.2f,\n"
+				"\t\t\t\"allocs_per_packet\": %.2f,\n"
+				"\t\t\t\"bytes_per_sec\": %.0f\n"
+				"\t\t}",
+				(unsigned long)r->packets, (unsigned long)r->iterations,
+				r->nsPerPacket, r->nsPerPacketMin, r->allocsPerPacket,
+				r->bytesPerSec);
+	}
+	fprintf(out, "\n\t]\n}\n");
+}
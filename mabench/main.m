@@ -0,0 +1,836 @@
+/*
+ * Copyright (c) 2012 Joshua Piccari, All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. All advertising materials mentioning features or use of this software
+ *    must display the following acknowledgement:
+ *
+ *	This product includes software developed by Joshua Piccari
+ *
+ * 4. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED
+ * AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#import <Foundation/Foundation.h>
+#import <fcntl.h>
+#import <getopt.h>
+#import <netinet/in.h>
+#import <sys/param.h>
+#import <sys/stat.h>
+
+#import "ConfigurationConstants.h"
+#import "MABenchCorpus.h"
+#import "MABenchmark.h"
+#import "MABurst.h"
+#import "MACardinality.h"
+#import "MAData.h"
+#import "MARecord.h"
+#import "MASpool.h"
+#import "MATCPAnalysis.h"
+#import "MATopK.h"
+#import "pan.h"
+#import "ethernet.h"
+#import "icmp.h"
+#import "icmp6.h"
+#import "ip.h"
+#import "null.h"
+#import "tcp.h"
+#import "udp.h"
+
+
+#define BENCH_HEX_ROW_SIZE		16		/* Bytes per row in the hex view. */
+
+typedef enum
+{
+	BENCH_LAYER_LINK,
+	BENCH_LAYER_NETWORK,
+	BENCH_LAYER_TRANSPORT
+} bench_layer_t;
+
+static const struct
+{
+	pan_req_t req;
+	const char *name;
+} bench_requests[] = {
+	{ PAN_SRC_STRING, "src" },
+	{ PAN_DST_STRING, "dst" },
+	{ PAN_PROTO_STRING, "proto" },
+	{ PAN_INFO_STRING, "info" },
+};
+
+static const struct
+{
+	const char *name;
+	pan_t pan;
+	bench_layer_t layer;
+	int dlt;			/* Link layer only. */
+	int proto;			/* Transport layer only. */
+} bench_dissectors[] = {
+	{ "ethernet_input", &ethernet_input, BENCH_LAYER_LINK, DLT_EN10MB, 0 },
+	{ "null_input", &null_input, BENCH_LAYER_LINK, DLT_NULL, 0 },
+	{ "ip_input", &ip_input, BENCH_LAYER_NETWORK, 0, 0 },
+	{ "tcp_input", &tcp_input, BENCH_LAYER_TRANSPORT, 0, IPPROTO_TCP },
+	{ "udp_input", &udp_input, BENCH_LAYER_TRANSPORT, 0, IPPROTO_UDP },
+	{ "icmp_input", &icmp_input, BENCH_LAYER_TRANSPORT, 0, IPPROTO_ICMP },
+	{ "icmp6_input", &icmp6_input, BENCH_LAYER_TRANSPORT, 0, IPPROTO_ICMPV6 },
+};
+
+#define nitems(x)	(sizeof(x)/sizeof(*(x)))
+
+
+static ma_bench_result_t *results;
+static NSUInteger resultCount;
+static NSUInteger resultCapacity;
+static const char *benchMatch;
+static NSUInteger benchIterations = MA_BENCH_DEFAULT_ITERATIONS;
+
+
+static void
+bench_reset(const char *name, const ma_bench_corpus_t *corpus,
+			ma_bench_filter_t filter, ma_bench_reset_t reset,
+			ma_bench_block_t block)
+{
+	if(benchMatch && !strstr(name, benchMatch))
+		return;
+	
+	if(resultCount == resultCapacity)
+	{
+		ma_bench_result_t *temp;
+		
+		resultCapacity = (resultCapacity ? resultCapacity*2 : 64);
+		if(!(temp = realloc(results, resultCapacity*sizeof(*temp))))
+			return;
+		results = temp;
+	}
+	
+	if(ma_bench_run(name, corpus, benchIterations, filter, reset, block,
+					&results[resultCount]))
+		resultCount++;
+}
+
+static void
+bench(const char *name, const ma_bench_corpus_t *corpus,
+	  ma_bench_filter_t filter, ma_bench_block_t block)
+{
+	bench_reset(name, corpus, filter, nil, block);
+}
+
+static ssize_t
+layer_offset(const ma_bench_packet_t *p, bench_layer_t layer)
+{
+	switch(layer)
+	{
+		case BENCH_LAYER_LINK:
+			return p->linkOffset;
+		case BENCH_LAYER_NETWORK:
+			return p->networkOffset;
+		case BENCH_LAYER_TRANSPORT:
+			return p->transportOffset;
+	}
+	return -1;
+}
+
+static void
+bench_dissection(const ma_bench_corpus_t *corpus)
+{
+	char name[128];
+	NSUInteger i, j;
+	
+	/* Full dissection, starting at the data link type. */
+	for(i = 0; i < nitems(bench_requests); i++)
+	{
+		pan_req_t req = bench_requests[i].req;
+		
+		snprintf(name, sizeof(name), "pan_input.%s", bench_requests[i].name);
+		bench(name, corpus, nil, ^(const ma_bench_packet_t *p) {
+			pan_input(req, p->dlt, p->data, p->hdr.caplen);
+		});
+	}
+	
+	/*
+	 * Each dissector on its own, starting at its own layer. Times include
+	 * any dissectors further up the stack that it hands off to.
+	 */
+	for(i = 0; i < nitems(bench_dissectors); i++)
+	{
+		pan_t pan = bench_dissectors[i].pan;
+		bench_layer_t layer = bench_dissectors[i].layer;
+		int dlt = bench_dissectors[i].dlt;
+		int proto = bench_dissectors[i].proto;
+		
+		ma_bench_filter_t filter = ^BOOL(const ma_bench_packet_t *p) {
+			if(layer_offset(p, layer) < 0)
+				return NO;
+			if(layer == BENCH_LAYER_LINK)
+				return p->dlt == dlt;
+			if(layer == BENCH_LAYER_TRANSPORT)
+				return p->transportProto == proto;
+			return YES;
+		};
+		
+		for(j = 0; j < nitems(bench_requests); j++)
+		{
+			pan_req_t req = bench_requests[j].req;
+			
+			snprintf(name, sizeof(name), "%s.%s", bench_dissectors[i].name,
+					 bench_requests[j].name);
+			bench(name, corpus, filter, ^(const ma_bench_packet_t *p) {
+				ssize_t off = layer_offset(p, layer);
+				pbuf_t pbuf = {0};
+				
+				pbuf.dlt = p->dlt;
+				pbuf.len = p->hdr.caplen-off;
+				pbuf.req = req;
+				pbuf.data = p->data+off;
+				pan(&pbuf);
+			});
+		}
+	}
+}
+
+static void
+bench_formatters(const ma_bench_corpus_t *corpus)
+{
+	bench("ethernet_host_string", corpus,
+		  ^BOOL(const ma_bench_packet_t *p) {
+			  return p->dlt == DLT_EN10MB && p->linkOffset >= 0;
+		  },
+		  ^(const ma_bench_packet_t *p) {
+			  ethernet_host_string(p->data+p->linkOffset);
+		  });
+	
+	bench("ip_host_string", corpus,
+		  ^BOOL(const ma_bench_packet_t *p) {
+			  return p->networkOffset >= 0;
+		  },
+		  ^(const ma_bench_packet_t *p) {
+			  /* Source address of either header. */
+			  size_t off = (p->networkLegacy ? 12 : 8);
+			  ip_host_string(p->networkLegacy,
+							 p->data+p->networkOffset+off);
+		  });
+	
+	/* Formatted a row at a time, the same as MAHexView. */
+	bench("MAstringFromHexBytes", corpus, nil,
+		  ^(const ma_bench_packet_t *p) {
+			  NSData *data = [NSData dataWithBytesNoCopy:p->data
+												  length:p->hdr.caplen
+											freeWhenDone:NO];
+			  NSUInteger pos;
+			  
+			  for(pos = 0; pos < p->hdr.caplen; pos += BENCH_HEX_ROW_SIZE)
+			  {
+				  NSRange range = NSMakeRange(pos,
+											  MIN(BENCH_HEX_ROW_SIZE,
+												  p->hdr.caplen-pos));
+				  [[data subdataWithRange:range] MAstringFromHexBytes];
+			  }
+		  });
+	
+	bench("MAstringFromRawASCII", corpus, nil,
+		  ^(const ma_bench_packet_t *p) {
+			  NSData *data = [NSData dataWithBytesNoCopy:p->data
+												  length:p->hdr.caplen
+											freeWhenDone:NO];
+			  NSUInteger pos;
+			  
+			  for(pos = 0; pos < p->hdr.caplen; pos += BENCH_HEX_ROW_SIZE)
+			  {
+				  NSRange range = NSMakeRange(pos,
+											  MIN(BENCH_HEX_ROW_SIZE,
+												  p->hdr.caplen-pos));
+				  [[data subdataWithRange:range] MAstringFromRawASCII];
+			  }
+		  });
+}
+
+static void
+bench_framing(const ma_bench_corpus_t *corpus)
+{
+	__block ma_frame_t frame;
+	ma_frame_packets_t *cursors;
+	u_char **frames;
+	NSUInteger frameCount = 0;
+	NSUInteger i, j;
+	
+	if(!(frames = calloc(corpus->count, sizeof(*frames))))
+		return;
+	
+	if(!(cursors = calloc(corpus->count, sizeof(*cursors))))
+	{
+		free(frames);
+		return;
+	}
+	
+	/*
+	 * Pre-encode the corpus in capture sized batches for the decode
+	 * benchmark, keeping a cursor at every record.
+	 */
+	memset(&frame, 0, sizeof(frame));
+	for(i = 0; i < corpus->count; i += MACaptureBatchLength)
+	{
+		NSUInteger n = MIN(corpus->count-i, MACaptureBatchLength);
+		ma_frame_packets_t packets;
+		ma_record_t rec;
+		size_t len;
+		
+		for(j = 0; j < n; j++)
+		{
+			const ma_bench_packet_t *p = &corpus->packets[i+j];
+			
+			if(!ma_frame_add_packet(&frame, 0, i+j, 0, 1, &p->hdr, p->data))
+				break;
+		}
+		
+		if(j < n || !(frames[frameCount] = ma_frame_finish(&frame, &len)))
+			break;
+		
+		ma_frame_decode_packets(frames[frameCount]+MA_FRAME_HEADER_SIZE,
+								len-MA_FRAME_HEADER_SIZE, &packets);
+		frameCount++;
+		
+		for(j = 0; j < n; j++)
+		{
+			cursors[i+j] = packets;
+			ma_frame_next_record(&packets, &rec);
+		}
+	}
+	
+	if(i >= corpus->count)
+	{
+		bench("ma_frame_add_packet", corpus, nil,
+			  ^(const ma_bench_packet_t *p) {
+				  size_t len;
+				  
+				  ma_frame_add_packet(&frame, 0, 1, 0, 1, &p->hdr, p->data);
+				  if(frame.count == MACaptureBatchLength)
+					  free(ma_frame_finish(&frame, &len));
+			  });
+		
+		bench("ma_frame_next_record", corpus, nil,
+			  ^(const ma_bench_packet_t *p) {
+				  ma_frame_packets_t packets = cursors[p-corpus->packets];
+				  ma_record_t decoded;
+				  
+				  ma_frame_next_record(&packets, &decoded);
+			  });
+	}
+	
+	ma_frame_discard(&frame);
+	for(i = 0; i < frameCount; i++)
+		free(frames[i]);
+	free(frames);
+	free(cursors);
+}
+
+static ma_cardinality_t *
+new_cardinality(void)
+{
+	return ma_cardinality_create(MACardinalitySources,
+								 (int64_t)MACardinalityBucket*MA_NSEC_PER_SEC,
+								 MACardinalityBuckets);
+}
+
+static ma_burst_t *
+new_bursts(void)
+{
+	return ma_burst_create((int64_t)MABurstWindow*1000,
+						   (uint64_t)MABurstLineRate*1000000, MABurstFraction,
+						   MABurstHistory);
+}
+
+/*
+ * These keep state by time: played again, the corpus would go back in
+ * time and land in windows, flows and bursts already seen. Each pass
+ * starts over with a fresh one.
+ */
+static void
+bench_statistics(const ma_bench_corpus_t *corpus)
+{
+	__block ma_talkers_t *talkers = NULL;
+	__block ma_cardinality_t *cardinality = NULL;
+	__block ma_burst_t *bursts = NULL;
+	__block ma_tcpa_t *tcpAnalysis = NULL;
+	
+	bench_reset("ma_talkers_packet", corpus, nil,
+				^{
+					ma_talkers_destroy(talkers);
+					talkers = ma_talkers_create(MATopKCapacity,
+												(int64_t)MATopKWindow*
+												MA_NSEC_PER_SEC,
+												MATopKBuckets);
+					return (BOOL)(talkers != NULL);
+				},
+				^(const ma_bench_packet_t *p) {
+					ma_talkers_packet(talkers, p->dlt, &p->hdr, p->data, 1);
+				});
+	ma_talkers_destroy(talkers);
+	
+	bench_reset("ma_cardinality_packet", corpus, nil,
+				^{
+					ma_cardinality_destroy(cardinality);
+					cardinality = new_cardinality();
+					return (BOOL)(cardinality != NULL);
+				},
+				^(const ma_bench_packet_t *p) {
+					ma_cardinality_packet(cardinality, p->dlt, &p->hdr,
+										  p->data);
+				});
+	ma_cardinality_destroy(cardinality);
+	
+	bench_reset("ma_burst_packet", corpus, nil,
+				^{
+					ma_burst_destroy(bursts);
+					bursts = new_bursts();
+					return (BOOL)(bursts != NULL);
+				},
+				^(const ma_bench_packet_t *p) {
+					ma_burst_packet(bursts, p->dlt, &p->hdr, p->data, 1);
+				});
+	ma_burst_destroy(bursts);
+	
+	bench_reset("ma_tcpa_packet", corpus, nil,
+				^{
+					ma_tcpa_destroy(tcpAnalysis);
+					tcpAnalysis = ma_tcpa_create(MATCPAnalysisTableSize,
+												 (int64_t)MATCPAnalysisIdle*
+												 MA_NSEC_PER_SEC);
+					return (BOOL)(tcpAnalysis != NULL);
+				},
+				^(const ma_bench_packet_t *p) {
+					ma_tcpa_packet(tcpAnalysis, p->dlt, &p->hdr, p->data);
+				});
+	ma_tcpa_destroy(tcpAnalysis);
+}
+
+/*
+ * Distinct counts for each savefile, then for all of them together. Each
+ * file is sketched on its own worker and the sketches merged after.
+ */
+static BOOL
+report_cardinality(FILE *out, ma_bench_corpus_t **corpora, NSUInteger count)
+{
+	ma_cardinality_t **sketches;
+	ma_cardinality_t *all;
+	NSUInteger i;
+	BOOL ok = YES;
+	
+	if(!(sketches = calloc(count, sizeof(*sketches))))
+		return NO;
+	
+	dispatch_apply(count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t n) {
+		const ma_bench_corpus_t *corpus = corpora[n];
+		NSUInteger j;
+		
+		if(!(sketches[n] = new_cardinality()))
+			return;
+		
+		for(j = 0; j < corpus->count; j++)
+			ma_cardinality_packet(sketches[n], corpus->packets[j].dlt,
+								  &corpus->packets[j].hdr,
+								  corpus->packets[j].data);
+	});
+	
+	if(!(all = new_cardinality()))
+		ok = NO;
+	
+	for(i = 0; i < count; i++)
+	{
+		if(sketches[i] == NULL)
+		{
+			ok = NO;
+			continue;
+		}
+		
+		fprintf(out, "%s\n\n%s\n", corpora[i]->name,
+				[ma_cardinality_report(sketches[i], MACardinalityReportRows)
+				 UTF8String]);
+		if(all && !ma_cardinality_merge(all, sketches[i]))
+			ok = NO;
+		ma_cardinality_destroy(sketches[i]);
+	}
+	
+	if(all && count > 1)
+		fprintf(out, "all savefiles\n\n%s\n",
+				[ma_cardinality_report(all, MACardinalityReportRows)
+				 UTF8String]);
+	
+	ma_cardinality_destroy(all);
+	free(sketches);
+	
+	return ok;
+}
+
+/*
+ * Microbursts in each savefile, then for all of them. As with distinct
+ * counts, each file gets its own detector on its own worker.
+ */
+static BOOL
+report_bursts(FILE *out, ma_bench_corpus_t **corpora, NSUInteger count)
+{
+	ma_burst_t **detectors;
+	ma_burst_t *all;
+	NSUInteger i;
+	BOOL ok = YES;
+	
+	if(!(detectors = calloc(count, sizeof(*detectors))))
+		return NO;
+	
+	dispatch_apply(count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t n) {
+		const ma_bench_corpus_t *corpus = corpora[n];
+		NSUInteger j;
+		
+		if(!(detectors[n] = new_bursts()))
+			return;
+		
+		for(j = 0; j < corpus->count; j++)
+			ma_burst_packet(detectors[n], corpus->packets[j].dlt,
+							&corpus->packets[j].hdr, corpus->packets[j].data,
+							1);
+		ma_burst_finish(detectors[n]);
+	});
+	
+	if(!(all = new_bursts()))
+		ok = NO;
+	
+	for(i = 0; i < count; i++)
+	{
+		if(detectors[i] == NULL)
+		{
+			ok = NO;
+			continue;
+		}
+		
+		fprintf(out, "%s\n\n%s\n", corpora[i]->name,
+				[ma_burst_report(detectors[i], MABurstReportRows) UTF8String]);
+		if(all && !ma_burst_merge(all, detectors[i]))
+			ok = NO;
+		ma_burst_destroy(detectors[i]);
+	}
+	
+	if(all && count > 1)
+		fprintf(out, "all savefiles\n\n%s\n",
+				[ma_burst_report(all, MABurstReportRows) UTF8String]);
+	
+	ma_burst_destroy(all);
+	free(detectors);
+	
+	return ok;
+}
+
+#pragma mark - Checks
+
+#define CHECK(cond)													\
+	if(!(cond))														\
+	{																\
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,		\
+				__LINE__, #cond);									\
+		ok = NO;													\
+	}
+
+/* Spool a packet of caplen bytes, every one of them seq's low byte. */
+static BOOL
+check_spool_add(ma_spool_t *s, u_char *data, bpf_u_int32 caplen,
+				NSUInteger seq)
+{
+	struct pcap_pkthdr hdr;
+	
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.ts.tv_sec = (time_t)seq;
+	hdr.caplen = hdr.len = caplen;
+	memset(data, (int)(seq & 0xff), caplen);
+	
+	return ma_spool_packet(s, &hdr, data);
+}
+
+/*
+ * Fill a spool to the last byte it may take while its writer is stuck on
+ * the first buffer. The spool writes to a FIFO nobody reads until the end,
+ * so nothing is written out from under the test. A record that would fill
+ * the last free buffer must be dropped, bufferCount-1 buffers is as many
+ * as may be pending. Then read the FIFO and check every record came
+ * through intact.
+ */
+static BOOL
+check_spool_full(void)
+{
+	const size_t capacity = (size_t)MASpoolBuffers*MASpoolBufferSize;
+	const size_t headerSize = 24;
+	char dir[] = "/tmp/mabench.XXXXXX";
+	char path[MAXPATHLEN];
+	__block u_char *file;
+	__block size_t fileSize = 0;
+	dispatch_group_t reader;
+	uint32_t *caplens;
+	NSUInteger count = 0;
+	size_t used = headerSize;
+	bpf_u_int32 caplen;
+	ma_spool_stats_t stats;
+	ma_spool_t *s;
+	u_char *data;
+	size_t off;
+	NSUInteger i;
+	BOOL ok = YES;
+	int fd;
+	
+	if(!mkdtemp(dir))
+		return NO;
+	snprintf(path, sizeof(path), "%s/full.pcap", dir);
+	
+	if(mkfifo(path, S_IRUSR|S_IWUSR) == -1 ||
+	   (fd = open(path, O_RDONLY|O_NONBLOCK)) == -1)
+	{
+		rmdir(dir);
+		return NO;
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+	
+	data = malloc(65535);
+	file = malloc(capacity);
+	caplens = malloc(capacity/MA_SPOOL_RECORD_SIZE*sizeof(*caplens));
+	if(!data || !file || !caplens ||
+	   !(s = ma_spool_open(path, DLT_EN10MB, 65535, NULL)))
+	{
+		free(data);
+		free(file);
+		free(caplens);
+		close(fd);
+		unlink(path);
+		rmdir(dir);
+		return NO;
+	}
+	
+	/* Whole packets, then one to leave exactly 1000 bytes of room. */
+	while(capacity-used-1000 >= 2*MA_SPOOL_RECORD_SIZE+65535)
+	{
+		CHECK(check_spool_add(s, data, 65535, count));
+		caplens[count++] = 65535;
+		used += MA_SPOOL_RECORD_SIZE+65535;
+	}
+	caplen = (bpf_u_int32)(capacity-used-1000-MA_SPOOL_RECORD_SIZE);
+	CHECK(check_spool_add(s, data, caplen, count));
+	caplens[count++] = caplen;
+	used += MA_SPOOL_RECORD_SIZE+caplen;
+	CHECK(capacity-used == 1000);
+	
+	/* Exactly the rest: would leave every buffer pending. */
+	CHECK(!check_spool_add(s, data, 1000-MA_SPOOL_RECORD_SIZE, count));
+	
+	/* One byte less fits, after that nothing does. */
+	caplen = 1000-MA_SPOOL_RECORD_SIZE-1;
+	CHECK(check_spool_add(s, data, caplen, count));
+	caplens[count++] = caplen;
+	used += MA_SPOOL_RECORD_SIZE+caplen;
+	CHECK(!check_spool_add(s, data, 0, count));
+	
+	ma_spool_stats(s, &stats);
+	CHECK(stats.packets == count);
+	CHECK(stats.dropped == 2);
+	
+	/* Let the writer go and take everything it writes. */
+	reader = dispatch_group_create();
+	dispatch_group_async(reader, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+		ssize_t n;
+		
+		while(fileSize < capacity &&
+			  (n = read(fd, file+fileSize, capacity-fileSize)) > 0)
+			fileSize += n;
+	});
+	/* fsync() fails on a FIFO, what was written is checked below instead. */
+	ma_spool_close(s);
+	dispatch_group_wait(reader, DISPATCH_TIME_FOREVER);
+	dispatch_release(reader);
+	
+	CHECK(fileSize == used);
+	for(i = 0, off = headerSize; ok && i < count; i++)
+	{
+		uint32_t record[4];
+		size_t j;
+		
+		/* sec, nsec, caplen and len, in host order like the header. */
+		memcpy(record, file+off, sizeof(record));
+		CHECK(record[0] == i && record[2] == caplens[i]);
+		off += MA_SPOOL_RECORD_SIZE;
+		for(j = 0; ok && j < caplens[i]; j++)
+			CHECK(file[off+j] == (i & 0xff));
+		off += caplens[i];
+	}
+	
+	free(data);
+	free(file);
+	free(caplens);
+	close(fd);
+	unlink(path);
+	rmdir(dir);
+	
+	return ok;
+}
+
+#undef CHECK
+
+static BOOL
+run_checks(void)
+{
+	BOOL ok = YES;
+	
+	if(!check_spool_full())
+	{
+		fprintf(stderr, "mabench: check_spool_full failed\n");
+		ok = NO;
+	}
+	
+	return ok;
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+			"usage: mabench [-n iterations] [-b match] [-o file] "
+			"[-r savefile ...]\n"
+			"       mabench -c [-o file] -r savefile ...\n"
+			"       mabench -m [-o file] -r savefile ...\n"
+			"       mabench -t\n");
+	exit(EXIT_FAILURE);
+}
+
+
+int
+main(int argc, char **argv)
+{
+	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
+	ma_bench_corpus_t *corpora[64];
+	NSUInteger corpusCount = 0;
+	const char *outPath = NULL;
+	FILE *out = stdout;
+	BOOL cardinality = NO;
+	BOOL bursts = NO;
+	BOOL checks = NO;
+	NSUInteger i;
+	int ch;
+	
+	corpora[corpusCount++] = ma_corpus_synthetic_mixed();
+	corpora[corpusCount++] = ma_corpus_synthetic_bulk();
+	
+	while((ch = getopt(argc, argv, "b:cmn:o:r:t")) != -1)
+	{
+		switch(ch)
+		{
+			case 'b':
+				benchMatch = optarg;
+				break;
+				
+			case 'c':
+				cardinality = YES;
+				break;
+				
+			case 'm':
+				bursts = YES;
+				break;
+				
+			case 'n':
+				benchIterations = strtoul(optarg, NULL, 10);
+				break;
+				
+			case 'o':
+				outPath = optarg;
+				break;
+				
+			case 'r':
+				if(corpusCount == nitems(corpora))
+					usage();
+				if(!(corpora[corpusCount] = ma_corpus_load(optarg)))
+					return EXIT_FAILURE;
+				corpusCount++;
+				break;
+				
+			case 't':
+				checks = YES;
+				break;
+				
+			default:
+				usage();
+		}
+	}
+	
+	if(checks)
+	{
+		BOOL ok = run_checks();
+		
+		for(i = 0; i < corpusCount; i++)
+			ma_corpus_free(corpora[i]);
+		[pool drain];
+		
+		return (ok ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	
+	if(!corpora[0] || !corpora[1] || benchIterations == 0)
+		return EXIT_FAILURE;
+	
+	/* Reports are only for the savefiles, not the synthetic corpora. */
+	if((cardinality || bursts) && corpusCount == 2)
+		usage();
+	if(cardinality && bursts)
+		usage();
+	
+	if(!cardinality && !bursts)
+	{
+		ma_bench_init();
+		
+		for(i = 0; i < corpusCount; i++)
+		{
+			bench_dissection(corpora[i]);
+			bench_formatters(corpora[i]);
+			bench_framing(corpora[i]);
+			bench_statistics(corpora[i]);
+		}
+	}
+	
+	if(outPath && !(out = fopen(outPath, "w")))
+	{
+		perror(outPath);
+		return EXIT_FAILURE;
+	}
+	
+	if(cardinality)
+	{
+		if(!report_cardinality(out, corpora+2, corpusCount-2))
+			fprintf(stderr, "mabench: some distinct counts are missing\n");
+	}
+	else if(bursts)
+	{
+		if(!report_bursts(out, corpora+2, corpusCount-2))
+			fprintf(stderr, "mabench: some microbursts are missing\n");
+	}
+	else
+		ma_bench_write_json(out, corpora, corpusCount, results, resultCount);
+	
+	if(out != stdout)
+		fclose(out);
+	
+	for(i = 0; i < corpusCount; i++)
+		ma_corpus_free(corpora[i]);
+	free(results);
+	[pool drain];
+	
+	return EXIT_SUCCESS;
+}
@@ -33,10 +33,9 @@
 #import <Foundation/Foundation.h>
 #import <pcap/pcap.h>
 
+#import "MACaptureDevice.h"
 #import "MAProtocols.h"
-
-
-@class MACaptureDevice;
+#import "MAQueue.h"
 
 
 @interface MAPCAPHelper : NSObject <MAPCAPHelperProtocol> {
@@ -47,13 +46,21 @@
 	NSMutableDictionary *_captureDevices;
 	char *_pipeName;
 	int _pipeDescriptor;
+	ma_queue_t *_writeQueue;
+	dispatch_group_t _writer;
 }
 
 - (void)connectionDied:(NSNotification *)notification;
-- (void)processPacket:(NSUInteger)packetId
+- (void)startWriter;
+- (BOOL)announceDevice:(MACaptureDevice *)device;
+- (BOOL)processPacket:(NSUInteger)packetId
 			 withData:(const u_char *)data
 		   withHeader:(const struct pcap_pkthdr *)hdr
+			   weight:(uint32_t)weight
+			  toBatch:(ma_capture_batch_t *)batch
 			forDevice:(MACaptureDevice *)device;
+- (NSUInteger)flushBatch:(ma_capture_batch_t *)batch
+			   forDevice:(MACaptureDevice *)device;
 
 @property (readwrite, retain) NSMutableDictionary *captureDevices;
 @property (readwrite, retain) NSString *controllerKey;
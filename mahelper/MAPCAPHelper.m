@@ -34,11 +34,100 @@
 
 #import <CoreFoundation/CFRunLoop.h>
 #import <errno.h>
+#import <libkern/OSAtomic.h>
+#import <sys/uio.h>
 
 #import "ConfigurationConstants.h"
 #import "MACaptureDevice.h"
+#import "MAPipeline.h"
+#import "MARecord.h"
 
 
+/* A frame waiting in the write queue. */
+typedef struct
+{
+	MACaptureDevice *device;
+	NSUInteger count;			/* packets in the frame */
+	size_t length;
+	u_char *frame;
+} ma_helper_item_t;
+
+
+static void
+ma_helper_item_free(ma_helper_item_t *item)
+{
+	free(item->frame);
+	free(item);
+}
+
+/*
+ * A frame that never reached the FIFO. Losing a device frame, the only
+ * kind without packets, means the application doesn't know the device's
+ * index, so it has to be announced again before its next batch.
+ */
+static void
+ma_helper_item_lost(ma_helper_item_t *item)
+{
+	if(item->count == 0)
+		[item->device setTransportAnnounced:NO];
+}
+
+/*
+ * Frames shed by the write queue are counted against their device. Runs
+ * on the pushing thread after the queue is unlocked.
+ */
+static void
+ma_helper_shed(void *obj)
+{
+	ma_helper_item_t *item = obj;
+	
+	OSAtomicAdd64(item->count, &[item->device counters]->shed);
+	ma_helper_item_lost(item);
+	ma_helper_item_free(item);
+}
+
+/*
+ * Write all of iov to fd in as few writev() calls as possible, retrying
+ * when interrupted. Returns NO if the FIFO is closed or broken. iov is
+ * consumed in the process.
+ */
+static BOOL
+writevall(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t written;
+	
+	while(iovcnt > 0)
+	{
+		if((written = writev(fd, iov, iovcnt)) == -1)
+		{
+			switch(errno)
+			{
+				case EINTR:
+					continue;
+				
+				default:
+					return NO;
+			}
+		}
+		
+		/* Skip what was written, a partial vector is adjusted in place. */
+		while(iovcnt > 0 && (size_t)written >= iov->iov_len)
+		{
+			written -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		
+		if(iovcnt > 0)
+		{
+			iov->iov_base = (char *)iov->iov_base+written;
+			iov->iov_len -= written;
+		}
+	}
+	
+	return YES;
+}
+
 @implementation MAPCAPHelper
 
 - (id)init
@@ -50,12 +139,20 @@
 	srandomdev();
 	_pcapHelperKey = [[NSString alloc] initWithFormat:@"%@<%02lx%02lx>",
 					  MAPCAPHelperKey, random()%255, random()%255];
+	_writeQueue = ma_queue_create(MAHelperQueueLength, MAHelperQueueBytes,
+								  MA_QUEUE_DROP_NEWEST, ma_helper_shed);
+	_writer = dispatch_group_create();
 	
 	return self;
 }
 
 - (void)dealloc
 {
+	/* Let the writer finish what it holds before freeing the queue. */
+	ma_queue_close(_writeQueue);
+	dispatch_group_wait(_writer, DISPATCH_TIME_FOREVER);
+	dispatch_release(_writer);
+	ma_queue_destroy(_writeQueue);
 	if(_pipeName)
 		close(_pipeDescriptor);
 	[_pcapHelperKey release];
@@ -74,6 +171,7 @@
 	
 	/* Open our pipe for writing. */
 	_pipeDescriptor = open(self.pipeName, O_WRONLY);
+	[self startWriter];
 	
 	/* Notify the main app that we are ready. */
 	_pcapController = [NSConnection
@@ -98,14 +196,55 @@
 
 - (void)stopRunLoop
 {
+	ma_queue_close(_writeQueue);
 	CFRunLoopStop(CFRunLoopGetCurrent());
 }
 
+/*
+ * Capture callbacks only queue records, this is the one place that writes
+ * to the FIFO. A slow reader backs up the queue instead of pcap_dispatch.
+ * Whatever has piled up is written with a single writev().
+ */
+- (void)startWriter
+{
+	dispatch_group_async(_writer, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^{
+		ma_helper_item_t *items[MAHelperWriteBatch];
+		struct iovec iov[MAHelperWriteBatch];
+		NSUInteger count;
+		NSUInteger i;
+		
+		while((count = ma_queue_pop_batch(_writeQueue, (void **)items, NULL,
+										  MAHelperWriteBatch, YES)) > 0)
+		{
+			for(i = 0; i < count; i++)
+			{
+				iov[i].iov_base = items[i]->frame;
+				iov[i].iov_len = items[i]->length;
+			}
+			
+			/* We can't tell where a failed write stopped, count them all. */
+			if(!writevall(_pipeDescriptor, iov, (int)count))
+			{
+				for(i = 0; i < count; i++)
+				{
+					OSAtomicAdd64(items[i]->count,
+								  &[items[i]->device counters]->transportDropped);
+					ma_helper_item_lost(items[i]);
+				}
+			}
+			
+			for(i = 0; i < count; i++)
+				ma_helper_item_free(items[i]);
+		}
+	});
+}
+
 #pragma mark - Misc
 
 - (void)connectionDied:(NSNotification *)notification
 {
 	/* We should unlink our FIFO since the main program probably crashed. */
+	ma_queue_close(_writeQueue);
 	close(_pipeDescriptor);
 	unlink(self.pipeName);
 	self.pipeName = NULL;
@@ -137,6 +276,7 @@
 										flags:curdev->flags];
 		
 		[dev setDelegate:self];
+		[dev setTransportIndex:(uint16_t)[_captureDevices count]];
 		[_captureDevices setObject:dev forKey:[dev deviceName]];
 		[dev release];
 	}
@@ -147,27 +287,120 @@
 	return _captureDevices;
 }
 
-- (void)processPacket:(NSUInteger)packetId
+/*
+ * Give device its index on the FIFO ahead of its packets. Returns NO if
+ * the write queue refused it, the next batch tries again.
+ */
+- (BOOL)announceDevice:(MACaptureDevice *)device
+{
+	const char *name = [[device deviceName] UTF8String];
+	size_t len = strlen(name);
+	ma_helper_item_t *item;
+	
+	if(!(item = malloc(sizeof(*item))))
+		return NO;
+	
+	item->device = device;
+	item->count = 0;
+	item->length = ma_frame_device_size(len);
+	if(!(item->frame = malloc(item->length)))
+	{
+		free(item);
+		return NO;
+	}
+	ma_frame_encode_device(item->frame, item->length, [device transportIndex],
+						   [device dataLink], name, len);
+	
+	if(!ma_queue_push(_writeQueue, item, item->length))
+	{
+		ma_helper_item_free(item);
+		return NO;
+	}
+	
+	[device setTransportAnnounced:YES];
+	return YES;
+}
+
+/*
+ * Called from the capture thread for every packet, inside an autorelease
+ * pool that covers the whole capture buffer. The packet only goes into
+ * the batch's frame here; flushBatch:forDevice: hands the frame to the
+ * write queue.
+ */
+- (BOOL)processPacket:(NSUInteger)packetId
 			 withData:(const u_char *)data
 		   withHeader:(const struct pcap_pkthdr *)hdr
+			   weight:(uint32_t)weight
+			  toBatch:(ma_capture_batch_t *)batch
 			forDevice:(MACaptureDevice *)device
 {
-	NSAutoreleasePool *pool = [[NSAutoreleasePool alloc] init];
-	NSMutableData *theData = [[NSMutableData alloc] init];
-	NSString *deviceName = [device deviceName];
-	const char *dev_name = [deviceName UTF8String];
-	NSUInteger len = [deviceName length];
-	NSUInteger totalLen = sizeof(packetId)+sizeof(*hdr)+hdr->caplen+len;
-	
-	[theData appendBytes:&totalLen length:sizeof(totalLen)];
-	[theData appendBytes:&packetId length:sizeof(packetId)];
-	[theData appendBytes:hdr length:sizeof(*hdr)];
-	[theData appendBytes:data length:hdr->caplen];
-	[theData appendBytes:dev_name length:len];
-	
-	write(_pipeDescriptor, [theData bytes], [theData length]);
-	[theData release];
-	[pool drain];
+	uint64_t capturedAt = ma_pipeline_now();
+	struct pcap_pkthdr header = *hdr;
+	
+	/* Under pressure keep only the headers, the wire length stays intact. */
+	if(ma_queue_should_degrade(_writeQueue) &&
+	   header.caplen > MADegradedSnaplen)
+	{
+		header.caplen = MADegradedSnaplen;
+		ma_queue_count_degraded(_writeQueue);
+		OSAtomicIncrement64(&[device counters]->degraded);
+	}
+	
+	if(!ma_frame_add_packet(&batch->frame, [device transportIndex], packetId,
+							capturedAt, weight, &header, data))
+		return NO;
+	
+	batch->count++;
+	return YES;
+}
+
+/*
+ * Push the batch's frame onto the write queue, announcing the device
+ * first if that hasn't happened yet. Returns the number of packets
+ * queued, all or none.
+ */
+- (NSUInteger)flushBatch:(ma_capture_batch_t *)batch
+			   forDevice:(MACaptureDevice *)device
+{
+	ma_helper_item_t *item;
+	NSUInteger count = batch->frame.count;
+	
+	if(count == 0)
+		return 0;
+	
+	if((![device transportAnnounced] && ![self announceDevice:device]) ||
+	   !(item = malloc(sizeof(*item))))
+	{
+		ma_frame_discard(&batch->frame);
+		return 0;
+	}
+	
+	item->device = device;
+	item->count = count;
+	item->frame = ma_frame_finish(&batch->frame, &item->length);
+	
+	if(!ma_queue_push(_writeQueue, item, item->length))
+	{
+		ma_helper_item_free(item);
+		return 0;
+	}
+	
+	return count;
+}
+
+- (NSDictionary *)captureStats
+{
+	NSMutableDictionary *stats = [NSMutableDictionary dictionary];
+	
+	for(MACaptureDevice *dev in [_captureDevices objectEnumerator])
+		[stats setObject:[dev captureStats] forKey:[dev deviceName]];
+	
+	return stats;
+}
+
+- (oneway void)setQueuePolicy:(NSString *)policy
+{
+	ma_queue_set_policy(_writeQueue, ma_queue_policy_from_string(policy));
 }
 
 #pragma mark - Accessors
@@ -32,7 +32,10 @@
 
 #import "MAPCAPHelper.h"
 
+#import <signal.h>
+
 #import "ConfigurationConstants.h"
+#import "MAFileIO.h"
 
 
 int
@@ -46,6 +49,15 @@ main(int argc, const char **argv)
 	NSConnection *conn = [NSConnection new];
 	NSString *controllerKey = [[NSString alloc] initWithUTF8String:argv[1]];
 	
+	/* A closed FIFO should fail the write() and count as a drop. */
+	signal(SIGPIPE, SIG_IGN);
+	
+	/*
+	 * Recordings and trigger dumps go to the user's Application Support.
+	 * We only run as root, our real ids are still the user's.
+	 */
+	ma_file_set_owner(getuid(), getgid());
+	
 	[pcap setPipeName:(char *)argv[2]];
 	[pcap setControllerKey:controllerKey];
 	